@@ -16,21 +16,73 @@ layout(std140, binding = 0) buffer buf
    Pixel imageData[];
 };
 
+/*
+Progressive (coarse-to-fine) dispatch renders the voxels at
+gl_GlobalInvocationID * stride, skipping the ones an earlier, coarser
+pass (skipStride) already rendered.  A full dispatch is stride 1, skipStride 0.
+*/
+layout(push_constant) uniform Progressive {
+  uint stride;
+  uint skipStride;
+} progressive;
+
+/*
+With BRICK_SIZE set (specialization constant 0) the shader is launched by
+vudo::BrickMap::dispatch() over the active bricks only, and activeBricks
+maps each run of (BRICK_SIZE/WORKGROUP_SIZE)^3 workgroups, counted row by
+row over gl_WorkGroupID.y, to its brick.  Entries past the end of the last
+row are NO_BRICK.  A dense dispatch (BRICK_SIZE 0) never reads activeBricks.
+*/
+layout(constant_id = 0) const uint BRICK_SIZE = 0;
+
+const uint NO_BRICK = 0xffffffffu;
+
+layout(std430, binding = 1) readonly buffer ActiveBricks
+{
+   uint activeBricks[];
+};
+
+uvec3 brickedVoxel() {
+  const uint groupsPerAxis = BRICK_SIZE / WORKGROUP_SIZE;
+  const uint groupsPerBrick = groupsPerAxis * groupsPerAxis * groupsPerAxis;
+  const uvec3 brickGrid = (uvec3(WIDTH, HEIGHT, DEPTH) + BRICK_SIZE - 1) / BRICK_SIZE;
+  uint workgroup = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  uint brick = activeBricks[workgroup / groupsPerBrick];
+  if(brick == NO_BRICK) {
+    return uvec3(WIDTH, HEIGHT, DEPTH); // outside, so main() returns
+  }
+  uint group = workgroup % groupsPerBrick;
+  uvec3 brickCoordinate = uvec3(brick % brickGrid.x,
+                                (brick / brickGrid.x) % brickGrid.y,
+                                brick / (brickGrid.x * brickGrid.y));
+  uvec3 groupCoordinate = uvec3(group % groupsPerAxis,
+                                (group / groupsPerAxis) % groupsPerAxis,
+                                group / (groupsPerAxis * groupsPerAxis));
+  return brickCoordinate * BRICK_SIZE + groupCoordinate * WORKGROUP_SIZE + gl_LocalInvocationID;
+}
+
 void main() {
 
+  uvec3 voxel = BRICK_SIZE == 0 ? gl_GlobalInvocationID * progressive.stride : brickedVoxel();
+
   /*
   In order to fit the work into workgroups, some unnecessary threads are launched.
   We terminate those threads here.
   */
-  if(gl_GlobalInvocationID.x >= WIDTH
-      || gl_GlobalInvocationID.y >= HEIGHT
-      || gl_GlobalInvocationID.z >= DEPTH) {
+  if(voxel.x >= WIDTH
+      || voxel.y >= HEIGHT
+      || voxel.z >= DEPTH) {
+    return;
+  }
+
+  if(progressive.skipStride != 0
+      && all(equal(voxel % progressive.skipStride, uvec3(0)))) {
     return;
   }
 
-  float x = float(gl_GlobalInvocationID.x) / float(WIDTH);
-  float y = float(gl_GlobalInvocationID.y) / float(HEIGHT);
-  float zoom = 2. * float(1 + gl_GlobalInvocationID.z) / float(DEPTH);
+  float x = float(voxel.x) / float(WIDTH);
+  float y = float(voxel.y) / float(HEIGHT);
+  float zoom = 2. * float(1 + voxel.z) / float(DEPTH);
 
   // What follows is code for rendering the mandelbrot set.
   vec2 uv = zoom * vec2(x,y);
@@ -48,8 +100,8 @@ void main() {
   }
 
   // store the rendered mandelbrot set into a storage buffer:
-  uint offset = HEIGHT * WIDTH * gl_GlobalInvocationID.z
-                       + WIDTH * gl_GlobalInvocationID.y
-                               + gl_GlobalInvocationID.x;
+  uint offset = HEIGHT * WIDTH * voxel.z
+                       + WIDTH * voxel.y
+                               + voxel.x;
   imageData[offset].value = vec4(iterationCount);
 }
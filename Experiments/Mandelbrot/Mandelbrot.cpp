@@ -2,7 +2,7 @@
  * Vudo
  * Do things using Vulkan.
  *
- * TODO: make a vudo.h to factor out the common stuff
+ * Instance, device and queue setup come from VudoLib/vudo.h
  */
 
 #include <vulkan/vulkan.h>
@@ -13,337 +13,19 @@
 #include <stdexcept>
 #include <cmath>
 
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoProgressive.h"
+
 // put code in namespace after static global includes
 namespace %%_NAMESPACE_TAG_%% {
 
-  /*
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-*/
-const bool enableValidationLayers = true;
-/*
-#endif
-*/
-
-// Used for validating return values of Vulkan API calls.
-// TODO: what to use instead of the assert - need to bail out
-// of methods, not overall app.  Probably best to keep an
-// error state in the Vudo class.
-// TODO: passing async messages back to the calling code
-#ifndef VK_CHECK_RESULT
-#define VK_CHECK_RESULT(f)                     \
-{                                              \
-    VkResult res = (f);                        \
-    if (res != VK_SUCCESS)                     \
-    {                                          \
-        fprintf(stderr, "Fatal : VkResult is %d in %s at line %d\n", res,  __FILE__, __LINE__); \
-        assert(res == VK_SUCCESS);             \
-    }                                          \
-}
-#endif
-
 /*
 The application launches a compute shader that renders the Mandelbrot set,
 by rendering it into a storage buffer.
 The storage buffer is then read from the GPU, and saved as .png.
 */
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-    VkDebugReportFlagsEXT                       flags,
-    VkDebugReportObjectTypeEXT                  objectType,
-    uint64_t                                    object,
-    size_t                                      location,
-    int32_t                                     messageCode,
-    const char*                                 pLayerPrefix,
-    const char*                                 pMessage,
-    void*                                       pUserData) {
-
-    printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
-
-    return VK_FALSE;
-}
-
-class DeviceQueue {
-    protected:
-
-        VkInstance instance;
-
-        VkDebugReportCallbackEXT debugReportCallback;
-
-        std::vector<const char *> enabledLayers;
-        std::vector<const char *> enabledExtensions;
-
-        VkPhysicalDevice physicalDevice;
-        VkDevice device;
-        VkQueue queue; // a queue supporting compute operations
-
-    public:
-        DeviceQueue() {
-            findValidationLayer();
-            loadExtensions();
-            createInstance();
-            findDeviceQueue();
-        }
-
-        ~DeviceQueue() {
-        }
-    VkPhysicalDevice getPhysicalDevice() {return this->physicalDevice;};
-    void findValidationLayer();
-    void loadExtensions();
-    void createInstance();
-    uint32_t getComputeQueueFamilyIndex();
-    void findDeviceQueue();
-};
-
-class ComputePipeline {
-    protected:
-        DeviceQueue *deviceQueue;
-
-    public:
-        ComputePipeline() {
-        }
-
-        ~ComputePipeline() {
-        }
-};
-
-class ComputeBuffer {
-    protected:
-        DeviceQueue *deviceQueue;
-
-    public:
-        ComputeBuffer() {
-        }
-
-        ~ComputeBuffer() {
-        }
-
-    // Allocate buffer and memory, accessor to read/write as buffer
-    // images vs arrays
-    // PixelToPatient, transform
-    // workgroup size?
-
-    uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
-};
-
-class ComputeAlgorithm {
-    protected:
-        DeviceQueue *deviceQueue;
-
-    public:
-        ComputeAlgorithm() {
-        }
-
-        ~ComputeAlgorithm() {
-        }
-
-    // Set layouts, uniforms, (varying?), shader
-    // - descriptorSet, descriptorPool, descriptorSet
-    // arbitrary number of read-write buffers
-    // workgroup size?
-    // pipeline here or queue?
-    // commandPool, commandBuffer?
-
-};
-
-void DeviceQueue::findValidationLayer() {
-    /*
-    By enabling validation layers, Vulkan will emit warnings if the API
-    is used incorrectly
-
-    enable the layer VK_LAYER_LUNARG_standard_validation,
-    which is basically a collection of several useful validation layers
-    */
-
-    /* get all supported layers with vkEnumerateInstanceLayerProperties */
-    uint32_t layerCount;
-    vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-    std::vector<VkLayerProperties> layerProperties(layerCount);
-    vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-    /* check if VK_LAYER_LUNARG_standard_validation is among the supported layers */
-    bool foundLayer = false;
-    for (VkLayerProperties prop : layerProperties) {
-        if (strcmp("VK_LAYER_LUNARG_standard_validation", prop.layerName) == 0) {
-            foundLayer = true;
-            break;
-        }
-    }
-
-    if (!foundLayer) {
-        throw std::runtime_error("Layer VK_LAYER_LUNARG_standard_validation not supported\n");
-    }
-    this->enabledLayers.push_back("VK_LAYER_LUNARG_standard_validation");
-}
-
-void DeviceQueue::loadExtensions() {
-    /*
-    enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-    in order to be able to print the warnings emitted by the validation layer
-
-    we just check if the extension is among the supported extensions
-    */
-    uint32_t extensionCount;
-    vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-    vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, extensionProperties.data());
-
-    bool foundExtension = false;
-    for (VkExtensionProperties prop : extensionProperties) {
-        if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) == 0) {
-            foundExtension = true;
-            break;
-        }
-    }
-
-    if (!foundExtension) {
-        throw std::runtime_error("Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-    }
-    this->enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-}
-
-void DeviceQueue::createInstance() {
-    /*
-    fill applicationInfo - this is actually not that important
-    The only real important field is apiVersion
-    */
-    VkApplicationInfo applicationInfo = {};
-    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.pApplicationName = "Cpp Vulkan Experiments";
-    applicationInfo.applicationVersion = 0;
-    applicationInfo.pEngineName = "cppengine";
-    applicationInfo.engineVersion = 0;
-    applicationInfo.apiVersion = VK_API_VERSION_1_0;;
-
-    VkInstanceCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    createInfo.flags = 0;
-    createInfo.pApplicationInfo = &applicationInfo;
-
-    // pass desired layers and extensions to vulkan
-    createInfo.enabledLayerCount = enabledLayers.size();
-    createInfo.ppEnabledLayerNames = enabledLayers.data();
-    createInfo.enabledExtensionCount = enabledExtensions.size();
-    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
-
-    /* create the instance.  */
-    VK_CHECK_RESULT(vkCreateInstance(
-        &createInfo,
-        NULL,
-        &instance));
-
-    /*
-    Register a callback function for the extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME
-    so that warnings emitted from the validation layer are actually printed.
-    */
-    if (enableValidationLayers) {
-        VkDebugReportCallbackCreateInfoEXT createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-        createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT |
-                           VK_DEBUG_REPORT_WARNING_BIT_EXT |
-                           VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-        createInfo.pfnCallback = &debugReportCallbackFn;
-
-        // We have to explicitly load this function.
-        auto vkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-        if (vkCreateDebugReportCallbackEXT == nullptr) {
-        throw std::runtime_error("Could not load vkCreateDebugReportCallbackEXT");
-        }
-
-        // Create and register callback.
-        VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(instance, &createInfo, NULL, &debugReportCallback));
-    }
-}
-
-// Returns the index of a queue family that supports compute operations.
-uint32_t DeviceQueue::getComputeQueueFamilyIndex() {
-    uint32_t queueFamilyCount;
-
-    vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &queueFamilyCount, NULL);
-
-    // Retrieve all queue families.
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
-
-    // Now find a family that supports compute.
-    uint32_t queueFamilyIndex = 0;
-    for (; queueFamilyIndex < queueFamilies.size(); ++queueFamilyIndex) {
-        VkQueueFamilyProperties props = queueFamilies[queueFamilyIndex];
-
-        if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-            // found a queue with compute
-            break;
-        }
-    }
-
-    if (queueFamilyIndex == queueFamilies.size()) {
-        throw std::runtime_error("could not find a queue family that supports operations");
-    }
-
-    return queueFamilyIndex;
-}
-
-void DeviceQueue::findDeviceQueue() {
-
-    // list all physical devices on the system
-    uint32_t deviceCount;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-    if (deviceCount == 0) {
-        throw std::runtime_error("could not find a device with vulkan support");
-    }
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-    // choose a device that can be used for our purposes
-    for (VkPhysicalDevice device : devices) {
-        if (true) { // TODO: no feature checks, so just accept
-            this->physicalDevice = device;
-            break;
-        }
-    }
-
-    // create the logical device in this function
-    // - when creating the device, we also specify what queues it has
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    uint32_t queueFamilyIndex = getComputeQueueFamilyIndex(); // find queue family with compute capability
-    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-    queueCreateInfo.queueCount = 1; // create one queue in this family
-    float queuePriorities = 1.0;  // we only have one queue, so this is not that imporant.
-    queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-    // create the logical device
-    // - specify any desired device features
-    VkDeviceCreateInfo deviceCreateInfo = {};
-
-    VkPhysicalDeviceFeatures deviceFeatures = {};
-    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.enabledLayerCount = enabledLayers.size();  // need to specify validation layers
-    deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo; // we also specify the queues
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-    VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &(this->device)));
-
-    // Get a handle to the only member of the queue family.
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &(this->queue));
-}
-
-// find memory type with desired properties.
-uint32_t ComputeBuffer::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-
-    vkGetPhysicalDeviceMemoryProperties(this->deviceQueue->getPhysicalDevice(), &memoryProperties);
-    for (uint32_t memoryType = 0; memoryType < memoryProperties.memoryTypeCount; ++memoryType) {
-        if ((memoryTypeBits & (1 << memoryType)) &&
-            ((memoryProperties.memoryTypes[memoryType].propertyFlags & properties) == properties))
-            return memoryType;
-    }
-    return -1;
-}
-
-
 class MandelbrotVudo {
 public:
 
@@ -351,6 +33,7 @@ public:
     struct Pixel {
         float r, g, b, a;
     };
+    // a compiled .spv to map, or empty to use the shader embedded at build time
     std::string shaderSPIRVPath = "";
 
     void* mappedMemory = nullptr;
@@ -361,11 +44,15 @@ public:
     const int WORKGROUP_SIZE = 8; // Workgroup size in compute shader.
 
     /*
-    In order to use Vulkan, you must create an instance.
+    Validation and debug messages are off unless asked for here before run().
+    */
+    vudo::DeviceQueueOptions options;
+
+    /*
+    The DeviceQueue owns the instance, the logical device and its compute queue.
     */
-    VkInstance instance;
+    vudo::DeviceQueue *deviceQueue = nullptr;
 
-    VkDebugReportCallbackEXT debugReportCallback;
     /*
     The physical device is some device on the system that supports usage of Vulkan.
     Often, it is simply a graphics card that supports Vulkan.
@@ -416,8 +103,6 @@ public:
 
     uint32_t bufferSize; // size of `buffer` in bytes.
 
-    std::vector<const char *> enabledLayers;
-
     /*
     In order to execute commands on a device(GPU), the commands must be submitted
     to a queue. The commands are stored in a command buffer, and this command buffer
@@ -445,9 +130,7 @@ public:
         bufferSize = sizeof(Pixel) * WIDTH * HEIGHT * DEPTH;
 
         // Initialize vulkan:
-        createInstance();
-        findPhysicalDevice();
-        createDevice();
+        createDeviceQueue();
         createBuffer();
         createDescriptorSetLayout();
         createDescriptorSet();
@@ -464,273 +147,22 @@ public:
         return this->mappedMemory;
     }
 
-    static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-        VkDebugReportFlagsEXT                       flags,
-        VkDebugReportObjectTypeEXT                  objectType,
-        uint64_t                                    object,
-        size_t                                      location,
-        int32_t                                     messageCode,
-        const char*                                 pLayerPrefix,
-        const char*                                 pMessage,
-        void*                                       pUserData) {
-
-        printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
-
-        return VK_FALSE;
-     }
-
-    void createInstance() {
-        std::vector<const char *> enabledExtensions;
-
-        /*
-        By enabling validation layers, Vulkan will emit warnings if the API
-        is used incorrectly. We shall enable the layer VK_LAYER_LUNARG_standard_validation,
-        which is basically a collection of several useful validation layers.
-        */
-        if (enableValidationLayers) {
-            /*
-            We get all supported layers with vkEnumerateInstanceLayerProperties.
-            */
-            uint32_t layerCount;
-            vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-
-            std::vector<VkLayerProperties> layerProperties(layerCount);
-            vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-            /*
-            And then we simply check if VK_LAYER_LUNARG_standard_validation is among the supported layers.
-            */
-            bool foundLayer = false;
-            for (VkLayerProperties prop : layerProperties) {
-
-                if (strcmp("VK_LAYER_LUNARG_standard_validation", prop.layerName) == 0) {
-                    foundLayer = true;
-                    break;
-                }
-
-            }
-
-            if (!foundLayer) {
-                throw std::runtime_error("Layer VK_LAYER_LUNARG_standard_validation not supported\n");
-            }
-            enabledLayers.push_back("VK_LAYER_LUNARG_standard_validation"); // Alright, we can use this layer.
-
-            /*
-            We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-            in order to be able to print the warnings emitted by the validation layer.
-
-            So again, we just check if the extension is among the supported extensions.
-            */
-
-            uint32_t extensionCount;
-
-            vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-            std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-            vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, extensionProperties.data());
-
-            bool foundExtension = false;
-            for (VkExtensionProperties prop : extensionProperties) {
-                if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) == 0) {
-                    foundExtension = true;
-                    break;
-                }
-
-            }
-
-            if (!foundExtension) {
-                throw std::runtime_error("Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-            }
-            enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-        }
-
-        /*
-        Next, we actually create the instance.
-
-        */
-
-        /*
-        Contains application info. This is actually not that important.
-        The only real important field is apiVersion.
-        */
-        VkApplicationInfo applicationInfo = {};
-        applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        applicationInfo.pApplicationName = "Hello world app";
-        applicationInfo.applicationVersion = 0;
-        applicationInfo.pEngineName = "awesomeengine";
-        applicationInfo.engineVersion = 0;
-        applicationInfo.apiVersion = VK_API_VERSION_1_0;;
-
-        VkInstanceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.flags = 0;
-        createInfo.pApplicationInfo = &applicationInfo;
-
-        // Give our desired layers and extensions to vulkan.
-        createInfo.enabledLayerCount = enabledLayers.size();
-        createInfo.ppEnabledLayerNames = enabledLayers.data();
-        createInfo.enabledExtensionCount = enabledExtensions.size();
-        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
-
-        /*
-        Actually create the instance.
-        Having created the instance, we can actually start using vulkan.
-        */
-        VK_CHECK_RESULT(vkCreateInstance(
-            &createInfo,
-            NULL,
-            &instance));
-
-        /*
-        Register a callback function for the extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the validation
-        layer are actually printed.
-        */
-        if (enableValidationLayers) {
-            VkDebugReportCallbackCreateInfoEXT createInfo = {};
-            createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-            createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-            createInfo.pfnCallback = &debugReportCallbackFn;
-
-            // We have to explicitly load this function.
-            auto vkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-            if (vkCreateDebugReportCallbackEXT == nullptr) {
-                throw std::runtime_error("Could not load vkCreateDebugReportCallbackEXT");
-            }
-
-            // Create and register callback.
-            VK_CHECK_RESULT(vkCreateDebugReportCallbackEXT(instance, &createInfo, NULL, &debugReportCallback));
-        }
-
-    }
-
-    void findPhysicalDevice() {
-        /*
-        In this function, we find a physical device that can be used with Vulkan.
-        */
-
-        /*
-        So, first we will list all physical devices on the system with vkEnumeratePhysicalDevices .
-        */
-        uint32_t deviceCount;
-        vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-        if (deviceCount == 0) {
-            throw std::runtime_error("could not find a device with vulkan support");
-        }
-
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-        /*
-        Next, we choose a device that can be used for our purposes.
-
-        With VkPhysicalDeviceFeatures(), we can retrieve a fine-grained list of physical features supported by the device.
-        However, in this demo, we are simply launching a simple compute shader, and there are no
-        special physical features demanded for this task.
-
-        With VkPhysicalDeviceProperties(), we can obtain a list of physical device properties. Most importantly,
-        we obtain a list of physical device limitations. For this application, we launch a compute shader,
-        and the maximum size of the workgroups and total number of compute shader invocations is limited by the physical device,
-        and we should ensure that the limitations named maxComputeWorkGroupCount, maxComputeWorkGroupInvocations and
-        maxComputeWorkGroupSize are not exceeded by our application.  Moreover, we are using a storage buffer in the compute shader,
-        and we should ensure that it is not larger than the device can handle, by checking the limitation maxStorageBufferRange.
-
-        However, in our application, the workgroup size and total number of shader invocations is relatively small, and the storage buffer is
-        not that large, and thus a vast majority of devices will be able to handle it. This can be verified by looking at some devices at_
-        http://vulkan.gpuinfo.org/
-
-        Therefore, to keep things simple and clean, we will not perform any such checks here, and just pick the first physical
-        device in the list. But in a real and serious application, those limitations should certainly be taken into account.
-
-        */
-        for (VkPhysicalDevice device : devices) {
-            if (true) { // As above stated, we do no feature checks, so just accept.
-                physicalDevice = device;
-                break;
-            }
-        }
-    }
-
-    // Returns the index of a queue family that supports compute operations.
-    uint32_t getComputeQueueFamilyIndex() {
-        uint32_t queueFamilyCount;
-
-        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
-
-        // Retrieve all queue families.
-        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
-
-        // Now find a family that supports compute.
-        uint32_t i = 0;
-        for (; i < queueFamilies.size(); ++i) {
-            VkQueueFamilyProperties props = queueFamilies[i];
-
-            if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-                // found a queue with compute. We're done!
-                break;
-            }
-        }
-
-        if (i == queueFamilies.size()) {
-            throw std::runtime_error("could not find a queue family that supports operations");
-        }
-
-        return i;
-    }
-
-    void createDevice() {
-        /*
-        We create the logical device in this function.
-        */
-
+    void createDeviceQueue() {
         /*
-        When creating the device, we also specify what queues it has.
+        The instance, physical device, logical device and compute queue
+        are set up by vudo::DeviceQueue according to the options.
+        We keep copies of the handles we use most.
         */
-        VkDeviceQueueCreateInfo queueCreateInfo = {};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueFamilyIndex = getComputeQueueFamilyIndex(); // find queue family with compute capability.
-        queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-        queueCreateInfo.queueCount = 1; // create one queue in this family. We don't need more.
-        float queuePriorities = 1.0;  // we only have one queue, so this is not that imporant.
-        queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-        /*
-        Now we create the logical device. The logical device allows us to interact with the physical
-        device.
-        */
-        VkDeviceCreateInfo deviceCreateInfo = {};
-
-        // Specify any desired device features here. We do not need any for this application, though.
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-
-        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceCreateInfo.enabledLayerCount = enabledLayers.size();  // need to specify validation layers here as well.
-        deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
-        deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo; // when creating the logical device, we also specify what queues it has.
-        deviceCreateInfo.queueCreateInfoCount = 1;
-        deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-
-        VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device)); // create logical device.
-
-        // Get a handle to the only member of the queue family.
-        vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+        deviceQueue = new vudo::DeviceQueue(options);
+        physicalDevice = deviceQueue->getPhysicalDevice();
+        device = deviceQueue->getDevice();
+        queue = deviceQueue->getQueue();
+        queueFamilyIndex = deviceQueue->getQueueFamilyIndex();
     }
 
     // find memory type with desired properties.
     uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-
-        /*
-        How does this search work?
-        See the documentation of VkPhysicalDeviceMemoryProperties for a detailed description.
-        */
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-            if ((memoryTypeBits & (1 << i)) &&
-                ((memoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
-                return i;
-        }
-        return -1;
+        return deviceQueue->findMemoryType(memoryTypeBits, properties);
     }
 
     void createBuffer() {
@@ -745,7 +177,7 @@ public:
         bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; // buffer is used as a storage buffer.
         bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE; // buffer is exclusive to a single queue family at a time.
 
-        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, NULL, &buffer)); // create buffer.
+        vkcheck(vkCreateBuffer(device, &bufferCreateInfo, NULL, &buffer)); // create buffer.
 
         /*
         But the buffer doesn't allocate memory for itself, so we must do that manually.
@@ -777,10 +209,10 @@ public:
             memoryRequirements.memoryTypeBits,
             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-        VK_CHECK_RESULT(vkAllocateMemory(device, &allocateInfo, NULL, &bufferMemory)); // allocate memory on device.
+        vkcheck(vkAllocateMemory(device, &allocateInfo, NULL, &bufferMemory)); // allocate memory on device.
 
         // Now associate that allocated memory with the buffer. With that, the buffer is backed by actual memory.
-        VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, bufferMemory, 0));
+        vkcheck(vkBindBufferMemory(device, buffer, bufferMemory, 0));
     }
 
     void createDescriptorSetLayout() {
@@ -796,21 +228,24 @@ public:
 
           layout(std140, binding = 0) buffer buf
 
-        in the compute shader.
+        in the compute shader.  Binding 1 is the active brick list of a
+        bricked dispatch, which the dense dispatch here does not read.
         */
-        VkDescriptorSetLayoutBinding descriptorSetLayoutBinding = {};
-        descriptorSetLayoutBinding.binding = 0; // binding = 0
-        descriptorSetLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorSetLayoutBinding.descriptorCount = 1;
-        descriptorSetLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2] = {};
+        for (uint32_t binding = 0; binding < 2; ++binding) {
+            descriptorSetLayoutBindings[binding].binding = binding;
+            descriptorSetLayoutBindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorSetLayoutBindings[binding].descriptorCount = 1;
+            descriptorSetLayoutBindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
 
         VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
         descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        descriptorSetLayoutCreateInfo.bindingCount = 1; // only a single binding in this descriptor set layout.
-        descriptorSetLayoutCreateInfo.pBindings = &descriptorSetLayoutBinding;
+        descriptorSetLayoutCreateInfo.bindingCount = 2;
+        descriptorSetLayoutCreateInfo.pBindings = descriptorSetLayoutBindings;
 
         // Create the descriptor set layout.
-        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
+        vkcheck(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, NULL, &descriptorSetLayout));
     }
 
     void createDescriptorSet() {
@@ -820,11 +255,11 @@ public:
         */
 
         /*
-        Our descriptor pool can only allocate a single storage buffer.
+        Our descriptor pool can only allocate the two storage buffers.
         */
         VkDescriptorPoolSize descriptorPoolSize = {};
         descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorPoolSize.descriptorCount = 1;
+        descriptorPoolSize.descriptorCount = 2;
 
         VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
         descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -833,7 +268,7 @@ public:
         descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
 
         // create descriptor pool.
-        VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, NULL, &descriptorPool));
+        vkcheck(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, NULL, &descriptorPool));
 
         /*
         With the pool allocated, we can now allocate the descriptor set.
@@ -845,7 +280,7 @@ public:
         descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
 
         // allocate descriptor set.
-        VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet));
+        vkcheck(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet));
 
         /*
         Next, we need to connect our actual storage buffer with the descrptor.
@@ -858,46 +293,19 @@ public:
         descriptorBufferInfo.offset = 0;
         descriptorBufferInfo.range = this->bufferSize;
 
-        VkWriteDescriptorSet writeDescriptorSet = {};
-        writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        writeDescriptorSet.dstSet = descriptorSet; // write to this descriptor set.
-        writeDescriptorSet.dstBinding = 0; // write to the first, and only binding.
-        writeDescriptorSet.descriptorCount = 1; // update a single descriptor.
-        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
-        writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
-
-        // perform the update of the descriptor set.
-        vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
-    }
-
-    // Read file into array of bytes, and cast to uint32_t*, then return.
-    // The data has been padded, so that it fits into an array uint32_t.
-    uint32_t* readFile(uint32_t& length, const char* filename) {
-
-        FILE* fp = fopen(filename, "rb");
-        if (fp == NULL) {
-            printf("Could not find or open file: %s\n", filename);
+        VkWriteDescriptorSet writeDescriptorSets[2] = {};
+        for (uint32_t binding = 0; binding < 2; ++binding) {
+            writeDescriptorSets[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSets[binding].dstSet = descriptorSet; // write to this descriptor set.
+            writeDescriptorSets[binding].dstBinding = binding;
+            writeDescriptorSets[binding].descriptorCount = 1; // update a single descriptor.
+            writeDescriptorSets[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; // storage buffer.
+            // the unused brick list binding just needs a valid buffer
+            writeDescriptorSets[binding].pBufferInfo = &descriptorBufferInfo;
         }
 
-        // get file size.
-        fseek(fp, 0, SEEK_END);
-        long filesize = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-
-        long filesizepadded = long(ceil(filesize / 4.0)) * 4;
-
-        // read file contents.
-        char *str = new char[filesizepadded];
-        fread(str, filesize, sizeof(char), fp);
-        fclose(fp);
-
-        // data padding.
-        for (int i = filesize; i < filesizepadded; i++) {
-            str[i] = 0;
-        }
-
-        length = filesizepadded;
-        return (uint32_t *)str;
+        // perform the update of the descriptor set.
+        vkUpdateDescriptorSets(device, 2, writeDescriptorSets, 0, NULL);
     }
 
     void createComputePipeline() {
@@ -908,17 +316,11 @@ public:
         /*
         Create a shader module. A shader module basically just encapsulates some shader code.
         */
-        uint32_t filelength;
-        // the code in comp.spv was created by running the command:
+        // the code is either embedded at build time by CMake/vudoEmbedSPIRV.cmake
+        // or was created by running the command:
         // glslangValidator.exe -V shader.comp
-        uint32_t* code = readFile(filelength, shaderSPIRVPath.c_str());
-        VkShaderModuleCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.pCode = code;
-        createInfo.codeSize = filelength;
-
-        VK_CHECK_RESULT(vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModule));
-        delete[] code;
+        // it is validated before it gets to vkCreateShaderModule
+        computeShaderModule = vudo::createShaderModule(device, "Mandelbrot", shaderSPIRVPath);
 
         /*
         Now let us actually create the compute pipeline.
@@ -935,13 +337,21 @@ public:
 
         /*
         The pipeline layout allows the pipeline to access descriptor sets.
-        So we just specify the descriptor set layout we created earlier.
+        So we just specify the descriptor set layout we created earlier,
+        and the push constants used for progressive rendering.
         */
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(vudo::ProgressivePushConstants);
+
         VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
         pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipelineLayoutCreateInfo.setLayoutCount = 1;
         pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
-        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        vkcheck(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
 
         VkComputePipelineCreateInfo pipelineCreateInfo = {};
         pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -951,7 +361,7 @@ public:
         /*
         Now, we finally create the compute pipeline.
         */
-        VK_CHECK_RESULT(vkCreateComputePipelines(
+        vkcheck(vkCreateComputePipelines(
             device, VK_NULL_HANDLE,
             1, &pipelineCreateInfo,
             NULL, &pipeline));
@@ -969,7 +379,7 @@ public:
         // the queue family of this command pool. All command buffers allocated from this command pool,
         // must be submitted to queues of this family ONLY.
         commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-        VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &commandPool));
+        vkcheck(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &commandPool));
 
         /*
         Now allocate a command buffer from the command pool.
@@ -982,7 +392,7 @@ public:
         // submitted to a queue. To keep things simple, we use a primary command buffer.
         commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
         commandBufferAllocateInfo.commandBufferCount = 1; // allocate a single command buffer.
-        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer)); // allocate command buffer.
+        vkcheck(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer)); // allocate command buffer.
 
         /*
         Now we shall start recording commands into the newly allocated command buffer.
@@ -990,7 +400,7 @@ public:
         VkCommandBufferBeginInfo beginInfo = {};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // the buffer is only submitted and used once in this application.
-        VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo)); // start recording commands.
+        vkcheck(vkBeginCommandBuffer(commandBuffer, &beginInfo)); // start recording commands.
 
         /*
         We need to bind a pipeline, AND a descriptor set before we dispatch.
@@ -1000,6 +410,11 @@ public:
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
+        // render every voxel in one go (see vudo::ProgressiveDispatch for coarse-to-fine)
+        vudo::ProgressivePushConstants fullResolution = {1, 0};
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(fullResolution), &fullResolution);
+
         /*
         Calling vkCmdDispatch basically starts the compute pipeline, and executes the compute shader.
         The number of workgroups is specified in the arguments.
@@ -1010,7 +425,7 @@ public:
                       (uint32_t)ceil(HEIGHT / float(WORKGROUP_SIZE)),
                       (uint32_t)ceil(DEPTH / float(WORKGROUP_SIZE)));
 
-        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer)); // end recording commands.
+        vkcheck(vkEndCommandBuffer(commandBuffer)); // end recording commands.
     }
 
     void runCommandBuffer() {
@@ -1030,12 +445,12 @@ public:
         VkFenceCreateInfo fenceCreateInfo = {};
         fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
         fenceCreateInfo.flags = 0;
-        VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
+        vkcheck(vkCreateFence(device, &fenceCreateInfo, NULL, &fence));
 
         /*
         We submit the command buffer on the queue, at the same time giving a fence.
         */
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+        vkcheck(vkQueueSubmit(queue, 1, &submitInfo, fence));
         /*
         The command will not have finished executing until the fence is signalled.
         So we wait here.
@@ -1044,7 +459,7 @@ public:
         Hence, we use a fence here.
         */
         std::cerr << "waiting for fence...\n";
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
+        vkcheck(vkWaitForFences(device, 1, &fence, VK_TRUE, 100000000000));
         std::cerr << "done waiting for fence\n";
 
         vkDestroyFence(device, fence, NULL);
@@ -1055,15 +470,6 @@ public:
         Clean up all Vulkan Resources.
         */
 
-        if (enableValidationLayers) {
-            // destroy callback.
-            auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-            if (func == nullptr) {
-                throw std::runtime_error("Could not load vkDestroyDebugReportCallbackEXT");
-            }
-            func(instance, debugReportCallback, NULL);
-        }
-
         vkFreeMemory(device, bufferMemory, NULL);
         vkDestroyBuffer(device, buffer, NULL);
         vkDestroyShaderModule(device, computeShaderModule, NULL);
@@ -1072,8 +478,10 @@ public:
         vkDestroyPipelineLayout(device, pipelineLayout, NULL);
         vkDestroyPipeline(device, pipeline, NULL);
         vkDestroyCommandPool(device, commandPool, NULL);
-        vkDestroyDevice(device, NULL);
-        vkDestroyInstance(instance, NULL);
+
+        // destroys the device, the debug messenger and the instance
+        delete deviceQueue;
+        deviceQueue = nullptr;
     }
 };
 
@@ -16,21 +16,38 @@ layout(std140, binding = 0) buffer buf
    Pixel imageData[];
 };
 
+/*
+Progressive (coarse-to-fine) dispatch renders the voxels at
+gl_GlobalInvocationID * stride, skipping the ones an earlier, coarser
+pass (skipStride) already rendered.  A full dispatch is stride 1, skipStride 0.
+*/
+layout(push_constant) uniform Progressive {
+  uint stride;
+  uint skipStride;
+} progressive;
+
 void main() {
 
+  uvec3 voxel = gl_GlobalInvocationID * progressive.stride;
+
   /*
   In order to fit the work into workgroups, some unnecessary threads are launched.
   We terminate those threads here.
   */
-  if(gl_GlobalInvocationID.x >= WIDTH
-      || gl_GlobalInvocationID.y >= HEIGHT
-      || gl_GlobalInvocationID.z >= DEPTH) {
+  if(voxel.x >= WIDTH
+      || voxel.y >= HEIGHT
+      || voxel.z >= DEPTH) {
+    return;
+  }
+
+  if(progressive.skipStride != 0
+      && all(equal(voxel % progressive.skipStride, uvec3(0)))) {
     return;
   }
 
-  float x = float(gl_GlobalInvocationID.x) / float(WIDTH);
-  float y = float(gl_GlobalInvocationID.y) / float(HEIGHT);
-  float zoom = 2. * float(1 + gl_GlobalInvocationID.z) / float(DEPTH);
+  float x = float(voxel.x) / float(WIDTH);
+  float y = float(voxel.y) / float(HEIGHT);
+  float zoom = 2. * float(1 + voxel.z) / float(DEPTH);
 
   // render the mandelbrot set
   vec2 uv = zoom * vec2(x,y);
@@ -48,8 +65,8 @@ void main() {
   }
 
   // store the rendered mandelbrot set into a storage buffer:
-  uint offset = HEIGHT * WIDTH * gl_GlobalInvocationID.z
-                       + WIDTH * gl_GlobalInvocationID.y
-                               + gl_GlobalInvocationID.x;
+  uint offset = HEIGHT * WIDTH * voxel.z
+                       + WIDTH * voxel.y
+                               + voxel.x;
   imageData[offset].value = exp(vec4(iterationCount));
 }
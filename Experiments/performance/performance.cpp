@@ -2,7 +2,7 @@
  * Vudo
  * Do things using Vulkan.
  *
- * TODO: make a vudo.h to factor out the common stuff
+ * Instance, device and queue setup come from VudoLib/vudo.h
  */
 
 #include <vulkan/vulkan.h>
@@ -13,35 +13,20 @@
 #include <stdexcept>
 #include <cmath>
 
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoProgressive.h"
+
 // put code in namespace after static global includes
 namespace %%_NAMESPACE_TAG_%% {
 
-const bool enableValidationLayers = true;
-
-// Used for validating return values of Vulkan API calls.
-// TODO: what to use instead of the assert - need to bail out
-// of methods, not overall app.  Probably best to keep an
-// error state in the Vudo class.
-// TODO: passing async messages back to the calling code
-#ifndef vkcheck
-#define vkcheck(f)                     \
-{                                              \
-    VkResult res = (f);                        \
-    if (res != VK_SUCCESS)                     \
-    {                                          \
-        fprintf(stderr, \
-          "Fatal : VkResult is %d in %s at line %d\n", res,  __FILE__, __LINE__); \
-        assert(res == VK_SUCCESS);             \
-    }                                          \
-}
-#endif
-
 class PerformanceVudo {
 public:
 
     struct Pixel {
         float r, g, b, a;
     };
+    // a compiled .spv to map, or empty to use the shader embedded at build time
     std::string shaderSPIRVPath = "";
 
     void* mappedMemory = nullptr;
@@ -51,9 +36,10 @@ public:
     const int DEPTH = 512;
     const int WORKGROUP_SIZE = 8; // Workgroup size in compute shader.
 
-    VkDebugReportCallbackEXT debugReportCallback;
+    // validation and debug messages are off unless asked for before run()
+    vudo::DeviceQueueOptions options;
+    vudo::DeviceQueue *deviceQueue = nullptr;
 
-    VkInstance instance;
     VkPhysicalDevice physicalDevice;
     VkDevice device;
 
@@ -84,8 +70,6 @@ public:
     VkDeviceMemory bufferMemory;
     uint32_t bufferSize; // size of `buffer` in bytes.
 
-    std::vector<const char *> enabledLayers;
-
     /*
     In order to execute commands on a device(GPU), the commands must be submitted
     to a queue. The commands are stored in a command buffer, and this command buffer
@@ -110,9 +94,7 @@ public:
         bufferSize = sizeof(Pixel) * WIDTH * HEIGHT * DEPTH;
 
         // Initialize vulkan:
-        createInstance();
-        findPhysicalDevice();
-        createDevice();
+        createDeviceQueue();
         createBuffer();
         createDescriptorSetLayout();
         createDescriptorSet();
@@ -129,213 +111,17 @@ public:
         return this->mappedMemory;
     }
 
-    static VKAPI_ATTR VkBool32 VKAPI_CALL debugReportCallbackFn(
-        VkDebugReportFlagsEXT                       flags,
-        VkDebugReportObjectTypeEXT                  objectType,
-        uint64_t                                    object,
-        size_t                                      location,
-        int32_t                                     messageCode,
-        const char*                                 pLayerPrefix,
-        const char*                                 pMessage,
-        void*                                       pUserData) {
-
-        printf("Debug Report: %s: %s\n", pLayerPrefix, pMessage);
-
-        return VK_FALSE;
-     }
-
-    void createInstance() {
-        std::vector<const char *> enabledExtensions;
-
-        /*
-        By enabling validation layers, Vulkan will emit warnings if the API
-        is used incorrectly. We shall enable the layer VK_LAYER_LUNARG_standard_validation,
-        which is basically a collection of several useful validation layers.
-        */
-        if (enableValidationLayers) {
-            uint32_t layerCount;
-            vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-            std::vector<VkLayerProperties> layerProperties(layerCount);
-            vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
-
-            /* And then we simply check for VK_LAYER_LUNARG_standard_validation */
-            bool foundLayer = false;
-            for (VkLayerProperties prop : layerProperties) {
-                if (strcmp("VK_LAYER_LUNARG_standard_validation", prop.layerName) == 0) {
-                    foundLayer = true;
-                    break;
-                }
-            }
-
-            if (!foundLayer) {
-                throw std::runtime_error("Layer VK_LAYER_LUNARG_standard_validation not supported\n");
-            }
-            enabledLayers.push_back("VK_LAYER_LUNARG_standard_validation");
-
-            /*
-            We need to enable an extension named VK_EXT_DEBUG_REPORT_EXTENSION_NAME,
-            in order to be able to print the warnings emitted by the validation layer.
-
-            So again, we just check if the extension is among the supported extensions.
-            */
-
-            uint32_t extensionCount;
-
-            vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
-            std::vector<VkExtensionProperties> extensionProperties(extensionCount);
-            vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, 
-              extensionProperties.data());
-
-            bool foundExtension = false;
-            for (VkExtensionProperties prop : extensionProperties) {
-                if (strcmp(VK_EXT_DEBUG_REPORT_EXTENSION_NAME, prop.extensionName) == 0) {
-                    foundExtension = true;
-                    break;
-                }
-            }
-
-            if (!foundExtension) {
-                throw std::runtime_error("Extension VK_EXT_DEBUG_REPORT_EXTENSION_NAME not supported\n");
-            }
-            enabledExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-        }
-
-        /* Next, we actually create the instance.*/
-
-        /*
-        Contains application info. This is actually not that important.
-        The only real important field is apiVersion.
-        */
-        VkApplicationInfo applicationInfo = {};
-        applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        applicationInfo.pApplicationName = "Hello world app";
-        applicationInfo.applicationVersion = 0;
-        applicationInfo.pEngineName = "awesomeengine";
-        applicationInfo.engineVersion = 0;
-        applicationInfo.apiVersion = VK_API_VERSION_1_0;;
-
-        VkInstanceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.flags = 0;
-        createInfo.pApplicationInfo = &applicationInfo;
-
-        // Give our desired layers and extensions to vulkan.
-        createInfo.enabledLayerCount = enabledLayers.size();
-        createInfo.ppEnabledLayerNames = enabledLayers.data();
-        createInfo.enabledExtensionCount = enabledExtensions.size();
-        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
-
-        /*
-        Actually create the instance.
-        Having created the instance, we can actually start using vulkan.
-        */
-        vkcheck(vkCreateInstance(
-            &createInfo,
-            NULL,
-            &instance));
-
-        /*
-        Register a callback function for the extension 
-        VK_EXT_DEBUG_REPORT_EXTENSION_NAME, so that warnings emitted from the validation
-        layer are actually printed.
-        */
-        if (enableValidationLayers) {
-            VkDebugReportCallbackCreateInfoEXT createInfo = {};
-            createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-            createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT;
-            createInfo.pfnCallback = &debugReportCallbackFn;
-
-            // We have to explicitly load this function.
-            auto vkCreateDebugReportCallbackEXT = 
-              (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, 
-                  "vkCreateDebugReportCallbackEXT");
-            if (vkCreateDebugReportCallbackEXT == nullptr) {
-                throw std::runtime_error("Could not load vkCreateDebugReportCallbackEXT");
-            }
-
-            // Create and register callback.
-            vkcheck(vkCreateDebugReportCallbackEXT(instance,
-                &createInfo, NULL, &debugReportCallback));
-        }
-    }
-
-    void findPhysicalDevice() {
-        uint32_t deviceCount;
-        vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
-        if (deviceCount == 0) {
-            throw std::runtime_error("could not find a device with vulkan support");
-        }
-
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-
-        for (VkPhysicalDevice device : devices) {
-            if (true) { // accept any device
-                physicalDevice = device;
-                break;
-            }
-        }
-    }
-
-    uint32_t getComputeQueueFamilyIndex() {
-        uint32_t queueFamilyCount;
-
-        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, NULL);
-
-        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, 
-          &queueFamilyCount, queueFamilies.data());
-
-        uint32_t i = 0;
-        for (; i < queueFamilies.size(); ++i) {
-            VkQueueFamilyProperties props = queueFamilies[i];
-
-            if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
-                break; // found a queue with compute. We're done!
-            }
-        }
-
-        if (i == queueFamilies.size()) {
-            throw std::runtime_error("could not find a queue family that supports operations");
-        }
-
-        return i;
-    }
-
-    void createDevice() {
-        VkDeviceQueueCreateInfo queueCreateInfo = {};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueFamilyIndex = getComputeQueueFamilyIndex();
-        queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-        queueCreateInfo.queueCount = 1;
-        float queuePriorities = 1.0;
-        queueCreateInfo.pQueuePriorities = &queuePriorities;
-
-        VkDeviceCreateInfo deviceCreateInfo = {};
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceCreateInfo.enabledLayerCount = enabledLayers.size();
-        deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
-        deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-        deviceCreateInfo.queueCreateInfoCount = 1;
-        deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-
-        vkcheck(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device));
-
-        // Get a handle to the only member of the queue family.
-        vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    void createDeviceQueue() {
+        deviceQueue = new vudo::DeviceQueue(options);
+        physicalDevice = deviceQueue->getPhysicalDevice();
+        device = deviceQueue->getDevice();
+        queue = deviceQueue->getQueue();
+        queueFamilyIndex = deviceQueue->getQueueFamilyIndex();
     }
 
     // find memory type with desired properties.
     uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
-            if ((memoryTypeBits & (1 << i)) &&
-                ((memoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
-                return i;
-        }
-        return -1;
+        return deviceQueue->findMemoryType(memoryTypeBits, properties);
     }
 
     void createBuffer() {
@@ -415,41 +201,8 @@ public:
         vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, NULL);
     }
 
-    // Read file into array of bytes, and cast to uint32_t*, then return.
-    // The data has been padded, so that it fits into an array uint32_t.
-    // Used to read spirv files.
-    uint32_t* readFile(uint32_t& length, const char* filename) {
-        FILE* fp = fopen(filename, "rb");
-        if (fp == NULL) {
-            printf("Could not find or open file: %s\n", filename);
-        }
-        // get file size.
-        fseek(fp, 0, SEEK_END);
-        long filesize = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-        long filesizepadded = long(ceil(filesize / 4.0)) * 4;
-        // read file contents.
-        char *str = new char[filesizepadded];
-        fread(str, filesize, sizeof(char), fp);
-        fclose(fp);
-        // data padding.
-        for (int i = filesize; i < filesizepadded; i++) {
-            str[i] = 0;
-        }
-        length = filesizepadded;
-        return (uint32_t *)str;
-    }
-
     void createComputePipeline() {
-        uint32_t filelength;
-        uint32_t* code = readFile(filelength, shaderSPIRVPath.c_str());
-        VkShaderModuleCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.pCode = code;
-        createInfo.codeSize = filelength;
-
-        vkcheck(vkCreateShaderModule(device, &createInfo, NULL, &computeShaderModule));
-        delete[] code;
+        computeShaderModule = vudo::createShaderModule(device, "performance", shaderSPIRVPath);
 
         VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
         shaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -461,10 +214,17 @@ public:
         The pipeline layout allows the pipeline to access descriptor sets.
         So we just specify the descriptor set layout we created earlier.
         */
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(vudo::ProgressivePushConstants);
+
         VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
         pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipelineLayoutCreateInfo.setLayoutCount = 1;
         pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
         vkcheck(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout));
 
         VkComputePipelineCreateInfo pipelineCreateInfo = {};
@@ -502,6 +262,10 @@ public:
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
           pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
+        vudo::ProgressivePushConstants fullResolution = {1, 0};
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(fullResolution), &fullResolution);
+
         vkCmdDispatch(commandBuffer,
                       (uint32_t)ceil(WIDTH / float(WORKGROUP_SIZE)),
                       (uint32_t)ceil(HEIGHT / float(WORKGROUP_SIZE)),
@@ -532,16 +296,6 @@ public:
     }
 
     void cleanup() {
-        if (enableValidationLayers) {
-            // destroy callback.
-            auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(
-              instance, "vkDestroyDebugReportCallbackEXT");
-            if (func == nullptr) {
-                throw std::runtime_error("Could not load vkDestroyDebugReportCallbackEXT");
-            }
-            func(instance, debugReportCallback, NULL);
-        }
-
         vkFreeMemory(device, bufferMemory, NULL);
         vkDestroyBuffer(device, buffer, NULL);
         vkDestroyShaderModule(device, computeShaderModule, NULL);
@@ -550,8 +304,8 @@ public:
         vkDestroyPipelineLayout(device, pipelineLayout, NULL);
         vkDestroyPipeline(device, pipeline, NULL);
         vkDestroyCommandPool(device, commandPool, NULL);
-        vkDestroyDevice(device, NULL);
-        vkDestroyInstance(instance, NULL);
+        delete deviceQueue; // device, debug messenger and instance
+        deviceQueue = nullptr;
     }
 };
 }
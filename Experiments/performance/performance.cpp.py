@@ -28,6 +28,7 @@ import timeit
 
 # project specific imports
 import cppyy
+import sys
 
 print("setting up...")
 # vulkan SDK
@@ -53,6 +54,7 @@ else:
 cppSourcePath = sourceDir+"/performance.cpp"
 shaderSourcePath = sourceDir+"/performance.comp.glsl"
 shaderSPIRVPath = sourceDir+"/performance.spv"
+vudoLibDir = sourceDir+"/../../Vudo/VudoLib"
 
 ## shader compilation
 print("compiling glsl...")
@@ -65,6 +67,7 @@ performanceCppSource = open(cppSourcePath).read()
 namepaceTag = "cppyy_"+str(time.time()).replace(".", "_")
 performanceCppSource = performanceCppSource.replace("%%_NAMESPACE_TAG_%%", namepaceTag) 
 cppyy.add_include_path(vulkanSDKIncludeDir)
+cppyy.add_include_path(vudoLibDir)
 cppyy.add_library_path(vulkanSDKLibDir)
 cppyy.load_library(vulkanSharedLibrary)
 cppyy.cppdef(performanceCppSource)
@@ -77,11 +80,18 @@ namespace = eval("cppyy.gbl." + namepaceTag)
 print("instance...")
 vudo = namespace.performanceVudo()
 vudo.shaderSPIRVPath = shaderSPIRVPath
+# validation is off by default, set VUDO_VALIDATION=1 to turn it on
+vudo.options.enableValidation = os.environ.get("VUDO_VALIDATION") == "1"
+vudo.options.enableDebugMessenger = vudo.options.enableValidation
 # TODO: put this in a thread 
 print("run...")
 time = timeit.timeit(vudo.run, number=1)
 print(f"Time for vudo.run is: {time}")
 
+sys.path.append(vudoLibDir+"/..")
+from VudoLib.Vudo import drainDiagnostics
+drainDiagnostics(vudo.deviceQueue)
+
 # get the rendered image as a numpy array
 print("data access...")
 imageView = vudo.renderedImage()
@@ -0,0 +1,310 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * VudoCLI: headless batch processing of NRRD and NIfTI-1 volumes,
+ * streamed slab by slab through Vudo kernels (see vudoSlabPipeline.h).
+ *
+ *   VudoCLI gaussian=1.5,threshold=100 --type uint8 ct.nrrd mask.nrrd
+ */
+
+#include <vulkan/vulkan.h>
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "vudo.h"
+#include "vudoMappedVolume.h"
+#include "vudoSPIRV.h"
+#include "vudoSlabPipeline.h"
+#include "vudoVolumeFile.h"
+
+namespace {
+
+const char *usage =
+"Usage: VudoCLI [options] <pipeline> <input> <output>\n"
+"\n"
+"Streams a raw NRRD (.nrrd, .nhdr) or NIfTI-1 (.nii, .hdr) volume through\n"
+"Vudo kernels a slab of slices at a time and writes the result as it goes.\n"
+"\n"
+"pipeline is a comma separated list of stages, applied in order:\n"
+"  threshold=T        voxels >= T become value * scale + shift, the others --outside\n"
+"  gaussian=S         Gaussian smoothing, sigma S or Sx:Sy:Sz in voxels\n"
+"  box=R              box mean of radius R or Rx:Ry:Rz in voxels\n"
+"  gradient           gradient magnitude, using the voxel spacing\n"
+"\n"
+"options:\n"
+"  --outside V        value of the voxels below a threshold (0)\n"
+"  --scale S          scale of the voxels that pass a threshold (1)\n"
+"  --shift B          shift of the voxels that pass a threshold (0)\n"
+"  --type T           output type of a final threshold: uint8, int8, uint16,\n"
+"                     int16, uint32, int32 or float (the input's type)\n"
+"  --slab-mb N        input megabytes per slab (64)\n"
+"  --mmap             memory map the input and page it in ahead on a thread,\n"
+"                     for inputs larger than memory (uncompressed files only)\n"
+"  --raw WxHxD:TYPE[:OFFSET[:big]]\n"
+"                     the input is a headerless raw file (implies --mmap)\n"
+"  --prefetch-mb N    megabytes paged in ahead with --mmap (256)\n"
+"  --spirv DIR        load <name>.spv from DIR instead of the embedded shaders\n"
+"  --validation       enable the Vulkan validation layer\n"
+"  --quiet            no throughput report\n";
+
+// a malformed command line, reported with the usage
+class ArgumentError : public std::runtime_error {
+    public:
+        explicit ArgumentError(const std::string &message) : std::runtime_error(message) {}
+};
+
+// the whole of text as a number, with std::stof and friends' exceptions reported as an ArgumentError
+template <typename Convert>
+auto parseNumber(const std::string &text, Convert convert) -> decltype(convert(text, nullptr)) {
+    size_t end = 0;
+    try {
+        auto number = convert(text, &end);
+        if (end == text.size()) {
+            return number;
+        }
+    }
+    catch (const std::invalid_argument &) {}
+    catch (const std::out_of_range &) {}
+    throw ArgumentError("expected a number, not \"" + text + "\"");
+}
+
+float parseFloat(const std::string &text) {
+    return parseNumber(text, [](const std::string &digits, size_t *end) {return std::stof(digits, end);});
+}
+
+double parseDouble(const std::string &text) {
+    return parseNumber(text, [](const std::string &digits, size_t *end) {return std::stod(digits, end);});
+}
+
+uint64_t parseUnsigned(const std::string &text) {
+    return parseNumber(text, [](const std::string &digits, size_t *end) {return uint64_t(std::stoull(digits, end));});
+}
+
+const char *scalarTypeNames[] = {"uint8", "int8", "uint16", "int16", "uint32", "int32", "float"};
+
+vudo::ScalarType parseScalarType(const std::string &name) {
+    for (uint32_t scalarType = vudo::UInt8; scalarType <= vudo::Float32; ++scalarType) {
+        if (name == scalarTypeNames[scalarType]) {
+            return vudo::ScalarType(scalarType);
+        }
+    }
+    if (name == "float32") {
+        return vudo::Float32;
+    }
+    throw ArgumentError("unknown scalar type " + name);
+}
+
+// "1.5" or "1:1:2", as x, y and z
+void parseTriple(const std::string &text, float values[3]) {
+    std::vector<float> parsed;
+    std::istringstream fields(text);
+    std::string field;
+    while (std::getline(fields, field, ':')) {
+        parsed.push_back(parseFloat(field));
+    }
+    if (parsed.size() != 1 && parsed.size() != 3) {
+        throw ArgumentError("expected one or three values in " + text);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        values[axis] = parsed[parsed.size() == 1 ? 0 : axis];
+    }
+}
+
+struct Options {
+    std::string pipeline, input, output;
+    float outside = 0.f, scale = 1.f, shift = 0.f;
+    std::string type;
+    double slabMegabytes = 64.;
+    bool mmap = false;
+    std::string raw;
+    double prefetchMegabytes = 256.;
+    std::string spirvDirectory;
+    bool validation = false;
+    bool quiet = false;
+};
+
+Options parseArguments(int argc, char *argv[]) {
+    Options options;
+    std::vector<std::string> positional;
+    for (int index = 1; index < argc; ++index) {
+        std::string argument = argv[index];
+        auto value = [&]() {
+            if (index + 1 >= argc) {
+                throw ArgumentError(argument + " needs a value");
+            }
+            return std::string(argv[++index]);
+        };
+        if (argument == "--outside") {
+            options.outside = parseFloat(value());
+        } else if (argument == "--scale") {
+            options.scale = parseFloat(value());
+        } else if (argument == "--shift") {
+            options.shift = parseFloat(value());
+        } else if (argument == "--type") {
+            options.type = value();
+        } else if (argument == "--slab-mb") {
+            options.slabMegabytes = parseDouble(value());
+        } else if (argument == "--mmap") {
+            options.mmap = true;
+        } else if (argument == "--raw") {
+            options.raw = value();
+            options.mmap = true;
+        } else if (argument == "--prefetch-mb") {
+            options.prefetchMegabytes = parseDouble(value());
+        } else if (argument == "--spirv") {
+            options.spirvDirectory = value();
+        } else if (argument == "--validation") {
+            options.validation = true;
+        } else if (argument == "--quiet") {
+            options.quiet = true;
+        } else if (argument == "-h" || argument == "--help") {
+            printf("%s", usage);
+            exit(EXIT_SUCCESS);
+        } else if (argument.compare(0, 2, "--") == 0) {
+            throw ArgumentError("unknown option " + argument);
+        } else {
+            positional.push_back(argument);
+        }
+    }
+    if (positional.size() != 3) {
+        throw ArgumentError("expected a pipeline, an input and an output");
+    }
+    options.pipeline = positional[0];
+    options.input = positional[1];
+    options.output = positional[2];
+    return options;
+}
+
+void addStages(vudo::SlabPipeline &pipeline, const Options &options, vudo::ScalarType inputType) {
+    std::istringstream stages(options.pipeline);
+    std::string stage;
+    std::vector<std::string> names;
+    while (std::getline(stages, stage, ',')) {
+        names.push_back(stage);
+    }
+    for (size_t index = 0; index < names.size(); ++index) {
+        std::string name = names[index], argument;
+        size_t equals = name.find('=');
+        if (equals != std::string::npos) {
+            argument = name.substr(equals + 1);
+            name = name.substr(0, equals);
+        }
+        float values[3];
+        if (name == "threshold") {
+            bool last = index + 1 == names.size();
+            vudo::ScalarType outputType = vudo::Float32;
+            if (last) {
+                outputType = options.type.empty() ? inputType : parseScalarType(options.type);
+            }
+            pipeline.addThreshold(parseFloat(argument), options.outside, options.scale, options.shift, outputType);
+        } else if (name == "gaussian") {
+            parseTriple(argument, values);
+            pipeline.addGaussian(values[0], values[1], values[2]);
+        } else if (name == "box") {
+            parseTriple(argument, values);
+            pipeline.addBox(uint32_t(values[0]), uint32_t(values[1]), uint32_t(values[2]));
+        } else if (name == "gradient") {
+            pipeline.addGradientMagnitude();
+        } else {
+            throw ArgumentError("unknown pipeline stage " + name);
+        }
+    }
+    if (!options.type.empty() && (names.empty() || names.back().compare(0, 9, "threshold") != 0)) {
+        throw ArgumentError("--type only applies to a pipeline ending in a threshold");
+    }
+}
+
+// WxHxD:TYPE[:OFFSET[:big]]
+vudo::VolumeFileInfo parseRaw(const std::string &path, const std::string &description) {
+    std::vector<std::string> fields;
+    std::istringstream parts(description);
+    std::string field;
+    while (std::getline(parts, field, ':')) {
+        fields.push_back(field);
+    }
+    uint32_t dimensions[3];
+    if (fields.size() < 2 || fields.size() > 4 ||
+        sscanf(fields[0].c_str(), "%ux%ux%u", &dimensions[0], &dimensions[1], &dimensions[2]) != 3) {
+        throw ArgumentError("--raw expects WxHxD:TYPE[:OFFSET[:big]], not " + description);
+    }
+    uint64_t offset = fields.size() > 2 ? parseUnsigned(fields[2]) : 0;
+    bool bigEndian = fields.size() > 3 && fields[3] == "big";
+    return vudo::rawVolumeInfo(path, dimensions[0], dimensions[1], dimensions[2],
+                               parseScalarType(fields[1]), offset, bigEndian);
+}
+
+int run(const Options &options) {
+    vudo::DeviceQueueOptions deviceOptions;
+    deviceOptions.enableValidation = options.validation;
+    deviceOptions.enableDebugMessenger = options.validation;
+    vudo::DeviceQueue deviceQueue(deviceOptions);
+
+    std::unique_ptr<vudo::VolumeSource> source;
+    vudo::MappedVolume *mapped = nullptr;
+    uint64_t prefetchBytes = uint64_t(options.prefetchMegabytes * 1e6);
+    if (!options.raw.empty()) {
+        source.reset(mapped = new vudo::MappedVolume(parseRaw(options.input, options.raw), prefetchBytes));
+    } else if (options.mmap) {
+        source.reset(mapped = new vudo::MappedVolume(options.input, prefetchBytes));
+    } else {
+        source.reset(new vudo::VolumeFileReader(options.input));
+    }
+    vudo::VolumeFileInfo info = source->getInfo();
+    vudo::SlabPipeline pipeline(&deviceQueue);
+    if (!options.spirvDirectory.empty()) {
+        for (const char *name : {"threshold", "stencil", "layout"}) {
+            pipeline.setShaderPath(name, options.spirvDirectory + "/" + name + ".spv");
+        }
+    }
+    addStages(pipeline, options, info.scalarType);
+
+    vudo::VolumeFileInfo outputInfo = info;
+    outputInfo.scalarType = pipeline.getOutputType(info.scalarType);
+    vudo::VolumeFileWriter writer(options.output, outputInfo);
+    uint64_t slabSlices = uint64_t(options.slabMegabytes * 1e6 / double(info.getSliceBytes()));
+    slabSlices = std::max<uint64_t>(1, std::min<uint64_t>(slabSlices, info.dimensions[2]));
+    pipeline.run(source.get(), &writer, uint32_t(slabSlices));
+    writer.close();
+
+    if (!options.quiet) {
+        printf("%s: %u x %u x %u %s, %.1f MB\n", options.input.c_str(),
+               info.dimensions[0], info.dimensions[1], info.dimensions[2],
+               scalarTypeNames[info.scalarType], info.getVolumeBytes() / 1e6);
+        printf("%u slabs of up to %u slices, %u halo slices\n",
+               pipeline.getSlabCount(), uint32_t(slabSlices), pipeline.getHalo());
+        printf("read %.3f s, compute %.3f s, write %.3f s, total %.3f s\n",
+               pipeline.getReadSeconds(), pipeline.getComputeSeconds(),
+               pipeline.getWriteSeconds(), pipeline.getTotalSeconds());
+        double total = pipeline.getTotalSeconds();
+        printf("throughput %.1f MB/s end to end, %.1f MB/s read plus written\n", pipeline.getThroughput(),
+               total > 0. ? (pipeline.getBytesRead() + pipeline.getBytesWritten()) / total / 1e6 : 0.);
+        if (mapped != nullptr) {
+            printf("mapped input: %.1f MB paged in ahead, at most %.1f MB held, %u of %u slices read before prefetch\n",
+                   mapped->getPrefetchedBytes() / 1e6, mapped->getMaxWindowBytes() / 1e6,
+                   mapped->getStalledSlices(), info.dimensions[2]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char *argv[]) {
+    try {
+        return run(parseArguments(argc, argv));
+    }
+    catch (const ArgumentError& e) {
+        fprintf(stderr, "VudoCLI: %s\n\n%s", e.what(), usage);
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception& e) {
+        fprintf(stderr, "VudoCLI: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
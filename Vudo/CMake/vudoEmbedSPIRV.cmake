@@ -0,0 +1,184 @@
+#-----------------------------------------------------------------------------
+# Compile .comp.glsl shaders at build time and embed the SPIR-V as
+# constexpr uint32_t arrays in a generated header.
+#
+#   vudo_embed_spirv(
+#     TARGET VudoShaders
+#     HEADER ${output_dir}/vudoShaders.h
+#     SHADERS a.comp.glsl b.comp.glsl
+#     INCLUDES common.glsl
+#     VARIANTS Shaders/variants.txt
+#     )
+#
+# Each shader is registered in vudo::embeddedShaderTable under its
+# file name without the .comp.glsl suffix.  The shaders are recompiled
+# when any of the INCLUDES (GL_GOOGLE_include_directive files) change.
+#
+# VARIANTS lists kernel templates next to it (see variants.txt), each
+# compiled once per scalar type and option flag combination and
+# registered under its variant name, e.g. histogram_int16_masked.
+#
+# The same file is run in script mode (cmake -P) to write the header.
+#-----------------------------------------------------------------------------
+
+if(CMAKE_SCRIPT_MODE_FILE)
+
+  # script mode: -DHEADER=... -DSPIRV_FILES=a.spv;b.spv
+  set(_content "// Generated by vudoEmbedSPIRV.cmake from the .comp.glsl shaders, do not edit.\n")
+  string(APPEND _content "#ifndef __vudoShaders_h\n#define __vudoShaders_h\n\n")
+  string(APPEND _content "#include <stdint.h>\n#include <stddef.h>\n\n")
+  string(APPEND _content "namespace vudo {\nnamespace shaders {\n\n")
+  set(_table "")
+  set(_count 0)
+  foreach(_spirv IN LISTS SPIRV_FILES)
+    get_filename_component(_name ${_spirv} NAME_WE)
+    file(READ ${_spirv} _hex HEX)
+    string(LENGTH "${_hex}" _length)
+    math(EXPR _remainder "${_length} % 8")
+    if(NOT _remainder EQUAL 0 OR _length EQUAL 0)
+      message(FATAL_ERROR "${_spirv} is not a whole number of SPIR-V words")
+    endif()
+    # SPIR-V words are little endian
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])"
+      "0x\\4\\3\\2\\1u, " _words "${_hex}")
+    set(_word "0x[0-9a-f]+u, ")
+    string(REGEX REPLACE "(${_word}${_word}${_word}${_word}${_word}${_word}${_word}${_word})"
+      "\\1\n    " _words "${_words}")
+    string(REPLACE ", \n" ",\n" _words "${_words}")
+    string(REGEX REPLACE "[ \n]+$" "" _words "${_words}")
+    string(APPEND _content "constexpr uint32_t ${_name}[] = {\n    ${_words}\n};\n\n")
+    string(APPEND _table "    {\"${_name}\", shaders::${_name}, sizeof(shaders::${_name}) / sizeof(uint32_t)},\n")
+    math(EXPR _count "${_count} + 1")
+  endforeach()
+  string(APPEND _content "} // end of namespace shaders\n\n")
+  string(APPEND _content "static const EmbeddedShader embeddedShaderTable[] = {\n${_table}};\n")
+  string(APPEND _content "static const size_t embeddedShaderCount = ${_count};\n\n")
+  string(APPEND _content "} // end of namespace vudo\n\n#endif\n")
+  file(WRITE ${HEADER} "${_content}")
+  return()
+
+endif()
+
+set(_vudo_embed_spirv_script ${CMAKE_CURRENT_LIST_FILE})
+
+function(vudo_embed_spirv)
+  set(options)
+  set(oneValueArgs TARGET HEADER VARIANTS)
+  set(multiValueArgs SHADERS INCLUDES)
+  cmake_parse_arguments(_VUDO "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+  # the one find_package(Vulkan) located (CMake 3.21 and later), if any
+  if(Vulkan_GLSLANG_VALIDATOR_EXECUTABLE AND NOT GLSLANG_VALIDATOR_EXECUTABLE)
+    set(GLSLANG_VALIDATOR_EXECUTABLE ${Vulkan_GLSLANG_VALIDATOR_EXECUTABLE} CACHE FILEPATH "glslangValidator")
+  endif()
+  find_program(GLSLANG_VALIDATOR_EXECUTABLE glslangValidator
+    HINTS $ENV{VULKAN_SDK}/bin $ENV{VULKAN_SDK}/Bin
+    )
+  if(NOT GLSLANG_VALIDATOR_EXECUTABLE)
+    message(STATUS "glslangValidator not found - shaders will be compiled at run time")
+    return()
+  endif()
+
+  get_filename_component(_header_dir ${_VUDO_HEADER} DIRECTORY)
+  set(_spirv_dir ${CMAKE_CURRENT_BINARY_DIR}/SPIRV)
+  file(MAKE_DIRECTORY ${_spirv_dir})
+
+  set(_includes)
+  foreach(_include IN LISTS _VUDO_INCLUDES)
+    get_filename_component(_include_path ${_include} ABSOLUTE)
+    list(APPEND _includes ${_include_path})
+  endforeach()
+
+  set(_spirv_files)
+  foreach(_shader IN LISTS _VUDO_SHADERS)
+    get_filename_component(_shader_path ${_shader} ABSOLUTE)
+    get_filename_component(_name ${_shader} NAME)
+    string(REGEX REPLACE "\\.comp\\.glsl$" "" _name ${_name})
+    set(_spirv ${_spirv_dir}/${_name}.spv)
+    add_custom_command(
+      OUTPUT ${_spirv}
+      COMMAND ${GLSLANG_VALIDATOR_EXECUTABLE} -S comp -V ${_shader_path} -o ${_spirv}
+      DEPENDS ${_shader_path} ${_includes}
+      COMMENT "Compiling ${_name} to SPIR-V"
+      VERBATIM
+      )
+    list(APPEND _spirv_files ${_spirv})
+  endforeach()
+
+  if(_VUDO_VARIANTS)
+    get_filename_component(_variants_path ${_VUDO_VARIANTS} ABSOLUTE)
+    get_filename_component(_variants_dir ${_variants_path} DIRECTORY)
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${_variants_path})
+    file(STRINGS ${_variants_path} _variant_lines REGEX "^[^#]")
+    foreach(_line IN LISTS _variant_lines)
+      string(STRIP "${_line}" _line)
+      string(REGEX REPLACE "[ \t]+" ";" _fields "${_line}")
+      list(LENGTH _fields _field_count)
+      if(_field_count LESS 2)
+        continue()
+      endif()
+      list(GET _fields 0 _kernel)
+      list(GET _fields 1 _types)
+      string(REPLACE "," ";" _types "${_types}")
+      set(_flags)
+      if(_field_count GREATER 2)
+        list(GET _fields 2 _flags)
+        string(REPLACE "," ";" _flags "${_flags}")
+      endif()
+      # every combination of the flags, in their listed order
+      set(_combinations "-")
+      foreach(_flag IN LISTS _flags)
+        set(_more)
+        foreach(_combination IN LISTS _combinations)
+          list(APPEND _more "${_combination}+${_flag}")
+        endforeach()
+        list(APPEND _combinations ${_more})
+      endforeach()
+      set(_template ${_variants_dir}/${_kernel}.comp.glsl)
+      foreach(_type IN LISTS _types)
+        if(_type STREQUAL "uint8")
+          set(_type_defines -DVOXEL_TYPE=uint8_t -DVOXEL_BITS=8)
+        elseif(_type STREQUAL "int16")
+          set(_type_defines -DVOXEL_TYPE=int16_t -DVOXEL_BITS=16)
+        elseif(_type STREQUAL "uint16")
+          set(_type_defines -DVOXEL_TYPE=uint16_t -DVOXEL_BITS=16)
+        elseif(_type STREQUAL "float32")
+          set(_type_defines -DVOXEL_TYPE=float -DVOXEL_BITS=32)
+        else()
+          message(FATAL_ERROR "${_variants_path}: ${_kernel} has unknown scalar type ${_type}")
+        endif()
+        foreach(_combination IN LISTS _combinations)
+          string(REPLACE "+" ";" _combination_flags "${_combination}")
+          list(REMOVE_ITEM _combination_flags "-")
+          set(_name ${_kernel}_${_type})
+          set(_defines ${_type_defines})
+          foreach(_flag IN LISTS _combination_flags)
+            string(TOLOWER ${_flag} _lower_flag)
+            string(APPEND _name "_${_lower_flag}")
+            list(APPEND _defines -D${_flag}=1)
+          endforeach()
+          set(_spirv ${_spirv_dir}/${_name}.spv)
+          add_custom_command(
+            OUTPUT ${_spirv}
+            COMMAND ${GLSLANG_VALIDATOR_EXECUTABLE} -S comp -V ${_defines} ${_template} -o ${_spirv}
+            DEPENDS ${_template} ${_variants_path} ${_includes}
+            COMMENT "Compiling variant ${_name} to SPIR-V"
+            VERBATIM
+            )
+          list(APPEND _spirv_files ${_spirv})
+        endforeach()
+      endforeach()
+    endforeach()
+  endif()
+
+  add_custom_command(
+    OUTPUT ${_VUDO_HEADER}
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${_header_dir}
+    COMMAND ${CMAKE_COMMAND} -DHEADER=${_VUDO_HEADER} "-DSPIRV_FILES=${_spirv_files}"
+      -P ${_vudo_embed_spirv_script}
+    DEPENDS ${_spirv_files} ${_vudo_embed_spirv_script}
+    COMMENT "Embedding SPIR-V in ${_VUDO_HEADER}"
+    VERBATIM
+    )
+  add_custom_target(${_VUDO_TARGET} ALL DEPENDS ${_VUDO_HEADER})
+endfunction()
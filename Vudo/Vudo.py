@@ -44,6 +44,7 @@ class VudoWidget(ScriptedLoadableModuleWidget):
 
   def setup(self):
     ScriptedLoadableModuleWidget.setup(self)
+    self.logic = None
 
     # Instantiate and connect widgets ...
 
@@ -126,9 +127,11 @@ class VudoWidget(ScriptedLoadableModuleWidget):
     if not self.confirmInstall():
       slicer.util.errorDisplay("Could not install the needed components")
       return
-    logic = VudoLogic()
+    # one logic for the widget, so its result cache serves repeated applies
+    if self.logic is None:
+      self.logic = VudoLogic()
     imageThreshold = self.imageThresholdSliderWidget.value
-    logic.run(self.inputSelector.currentNode(), self.outputSelector.currentNode(), imageThreshold)
+    self.logic.run(self.inputSelector.currentNode(), self.outputSelector.currentNode(), imageThreshold)
 
   def confirmInstall(self):
     try:
@@ -157,27 +160,743 @@ class VudoLogic(ScriptedLoadableModuleLogic):
   """
 
   def __init__(self):
-    import VudoLib, VudoLib.Vudo
+    import VudoLib, VudoLib.Vudo, VudoLib.ResultCache
     self.VudoModule = importlib.reload(VudoLib.Vudo)
+    self.resultCache = VudoLib.ResultCache.ResultCache()
+    self.vudo = None
+    self.thresholdFilter = None
+    self.thresholdFilterSize = 0
+    self.thresholdBatch = None
+    self.stencilFilter = None
+    self.resampler = None
+    self.morphologyFilter = None
+    self.dirtyBricks = None
+    self.registrationMetrics = None
+    self.variants = None
+    self.arrays = None
+    self.histogram = None
+    self.histogramKey = None
+
+  def getVudo(self):
+    if self.vudo is None:
+      import cppyy
+      self.vudo = self.VudoModule.Vudo()
+      cppyy.include("vudoThreshold.h")
+      cppyy.include("vudoBatch.h")
+      cppyy.include("vudoStream.h")
+      cppyy.include("vudoStencil.h")
+      cppyy.include("vudoResample.h")
+      cppyy.include("vudoRayCast.h")
+      cppyy.include("vudoConnectedComponents.h")
+      cppyy.include("vudoMorphology.h")
+      cppyy.include("vudoMarchingCubes.h")
+      cppyy.include("vudoRegistration.h")
+      cppyy.include("vudoHistogram.h")
+    return self.vudo
+
+  def getVariants(self):
+    """The VudoLib.Variants generator holding the dispatch tables of the kernel templates"""
+    if self.variants is None:
+      import VudoLib.Variants
+      self.variants = VudoLib.Variants.Variants(self.getVudo())
+    return self.variants
+
+  def getArrays(self):
+    """The VudoLib.Arrays factory of lazy, fused VudoArrays"""
+    if self.arrays is None:
+      import VudoLib.Arrays
+      self.arrays = VudoLib.Arrays.Arrays(self.getVudo())
+    return self.arrays
+
+  def thresholdArray(self, inputArray, imageThreshold, outputArray=None, scale=1., shift=0., outsideValue=0.):
+    """Threshold, rescale and cast inputArray into outputArray on the GPU.
+    Voxels at or above imageThreshold become value*scale+shift, the rest outsideValue.
+    The output defaults to a new array of the input type.  Volumes too big for the
+    memory budget go through the filter in runs of voxels.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    if outputArray is None:
+      outputArray = numpy.empty(inputArray.shape, inputArray.dtype)
+    inputType = self.VudoModule.scalarType(inputArray.dtype)
+    outputType = self.VudoModule.scalarType(outputArray.dtype)
 
+    # the filter (pipeline and buffers) is reused while the types and size stay the same
+    thresholdFilter = self.thresholdFilter
+    if (thresholdFilter is None or thresholdFilter.getInputType() != inputType
+        or thresholdFilter.getOutputType() != outputType or self.thresholdFilterSize != inputArray.size):
+      self.thresholdFilter = None # free the old buffers before allocating new ones
+      chunk = vudo.chunkLength(inputArray.size, inputArray.itemsize + outputArray.itemsize)
+      if chunk < inputArray.size:
+        logging.info(f"threshold of {inputArray.size} voxels in runs of {chunk} to fit the memory budget")
+      thresholdFilter = cppyy.gbl.vudo.ThresholdFilter(vudo.getDeviceQueue(), inputType, outputType,
+                                                       chunk, vudo.libraryShaderPath("threshold"))
+      self.thresholdFilter = thresholdFilter
+      self.thresholdFilterSize = inputArray.size
 
-  def run(self, inputVolume, outputVolume, imageThreshold, enableScreenshots=0):
+    thresholdFilter.setThreshold(imageThreshold)
+    thresholdFilter.setRescale(scale, shift)
+    thresholdFilter.setOutsideValue(outsideValue)
+    inputVoxels = numpy.ascontiguousarray(inputArray).reshape(-1)
+    outputVoxels = outputArray.reshape(-1)
+    chunk = thresholdFilter.getVoxelCount()
+    for first in range(0, inputVoxels.size, chunk):
+      count = min(chunk, inputVoxels.size - first)
+      # the voxels past count in the last run are stale and ignored
+      self.VudoModule.bufferArray(thresholdFilter.getInput(), inputVoxels.dtype, count)[:] = inputVoxels[first:first+count]
+      thresholdFilter.run()
+      outputVoxels[first:first+count] = self.VudoModule.bufferArray(thresholdFilter.getOutput(), outputVoxels.dtype, count)
+    return outputArray
+
+  def run(self, inputVolume, outputVolume, imageThreshold, enableScreenshots=0,
+          scale=1., shift=0., outputScalarType=None):
     """
     Run the actual algorithm
     """
     logging.info('Processing started')
 
-    vudo = self.VudoModule.Vudo()
-    TODO = """
-    vodo.compileGLSL(self, shaderSourcePath, shaderSPIRVPath)
+    inputArray = slicer.util.arrayFromVolume(inputVolume)
+    outputDType = numpy.dtype(outputScalarType or inputArray.dtype)
+    # the same kernel, parameters and input content give the same voxels
+    resultKey = ("threshold", self.getVudo().shaderDigest("threshold"), inputArray.dtype.str, outputDType.str,
+                 float(imageThreshold), float(scale), float(shift), self.resultCache.volumeKey(inputVolume))
+    cachedOutput = self.resultCache.get(resultKey)
+    if outputVolume != inputVolume or outputDType != inputArray.dtype:
+      # allocate the output image in the requested type, the GPU result is copied straight into it
+      import vtk.util.numpy_support
+      imageData = vtk.vtkImageData()
+      imageData.SetDimensions(inputVolume.GetImageData().GetDimensions())
+      imageData.AllocateScalars(vtk.util.numpy_support.get_vtk_array_type(outputDType), 1)
+      ijkToRAS = vtk.vtkMatrix4x4()
+      inputVolume.GetIJKToRASMatrix(ijkToRAS)
+      if outputVolume == inputVolume:
+        inputArray = inputArray.copy()
+      outputVolume.SetIJKToRASMatrix(ijkToRAS)
+      outputVolume.SetAndObserveImageData(imageData)
+    outputArray = slicer.util.arrayFromVolume(outputVolume)
 
-    vodo.compileAndImportCPP(self, cppSource)
-    """
+    if cachedOutput is not None:
+      outputArray[:] = cachedOutput
+      logging.info('Result served from the cache: ' + self.resultCache.report())
+    else:
+      self.thresholdArray(inputArray, imageThreshold, outputArray, scale, shift)
+      self.resultCache.put(resultKey, outputArray.copy())
+    slicer.util.arrayFromVolumeModified(outputVolume)
+    self.getVudo().drainDiagnostics(self.getVudo().getDeviceQueue())
 
     logging.info('Processing completed')
 
     return True
 
+  def thresholdArrays(self, inputArrays, imageThreshold, outputDType=None, scale=1., shift=0., outsideValue=0.):
+    """thresholdArray for a list of arrays of one type, e.g. the frames of a sequence,
+    in a single submission.  Returns a list of new arrays of outputDType (default the input type).
+    """
+    import cppyy
+    vudo = self.getVudo()
+    if len(inputArrays) == 0:
+      return []
+    inputDType = inputArrays[0].dtype
+    outputDType = numpy.dtype(outputDType or inputDType)
+    inputType = self.VudoModule.scalarType(inputDType)
+    outputType = self.VudoModule.scalarType(outputDType)
+    voxelCount = sum([inputArray.size for inputArray in inputArrays])
+
+    # the batch (pipeline, arenas and descriptor sets) is reused while it is big enough
+    thresholdBatch = self.thresholdBatch
+    if (thresholdBatch is None or thresholdBatch.getInputType() != inputType
+        or thresholdBatch.getOutputType() != outputType or thresholdBatch.getMaxVolumes() < len(inputArrays)
+        or self.thresholdBatchCapacity < voxelCount):
+      self.thresholdBatch = None # free the old arenas before allocating new ones
+      thresholdBatch = cppyy.gbl.vudo.ThresholdBatch(vudo.getDeviceQueue(), inputType, outputType,
+                                                     len(inputArrays), voxelCount, vudo.libraryShaderPath("threshold"))
+      self.thresholdBatch = thresholdBatch
+      self.thresholdBatchCapacity = voxelCount
+
+    thresholdBatch.clearVolumes()
+    inputBytes = self.VudoModule.bufferArray(thresholdBatch.getInput(), numpy.uint8,
+                                             thresholdBatch.getInput().getSize())
+    for inputArray in inputArrays:
+      volume = thresholdBatch.addVolume(inputArray.size)
+      offset = thresholdBatch.getInputOffset(volume)
+      inputBytes[offset:offset+inputArray.nbytes] = numpy.ascontiguousarray(inputArray).reshape(-1).view(numpy.uint8)
+    thresholdBatch.setThreshold(imageThreshold)
+    thresholdBatch.setRescale(scale, shift)
+    thresholdBatch.setOutsideValue(outsideValue)
+    thresholdBatch.run()
+    outputBytes = self.VudoModule.bufferArray(thresholdBatch.getOutput(), numpy.uint8,
+                                              thresholdBatch.getOutput().getSize())
+    outputArrays = []
+    for volume, inputArray in enumerate(inputArrays):
+      offset = thresholdBatch.getOutputOffset(volume)
+      outputArray = numpy.empty(inputArray.shape, outputDType)
+      outputArray.reshape(-1).view(numpy.uint8)[:] = outputBytes[offset:offset+outputArray.nbytes]
+      outputArrays.append(outputArray)
+    return outputArrays
+
+  def thresholdFrames(self, frames, imageThreshold, outputDType=None, scale=1., shift=0., outsideValue=0., slots=3):
+    """Generator of thresholdArray results for an iterable of same-shape frames, e.g. the
+    data nodes of a sequence, with the upload of the next frame, the threshold of this one
+    and the download of the previous one overlapped (see vudo::FrameStream).
+    """
+    import collections
+    import cppyy
+    vudo = self.getVudo()
+    deviceQueue = vudo.getDeviceQueue()
+    stream = None
+    pending = collections.deque()
+    try:
+      for frame in frames:
+        if stream is None:
+          shape, inputDType = frame.shape, frame.dtype
+          outputDType = numpy.dtype(outputDType or inputDType)
+          inputType = self.VudoModule.scalarType(inputDType)
+          outputType = self.VudoModule.scalarType(outputDType)
+          specialization = cppyy.gbl.std.vector["uint32_t"]([inputType, outputType])
+          pipeline = cppyy.gbl.vudo.ComputePipeline(deviceQueue,
+            cppyy.gbl.vudo.createShaderModule(deviceQueue.getDevice(), "threshold", vudo.libraryShaderPath("threshold")),
+            2, cppyy.sizeof(cppyy.gbl.vudo.ThresholdPushConstants), specialization, slots)
+          outputPerWord = 4 // outputDType.itemsize
+          stream = cppyy.gbl.vudo.FrameStream(deviceQueue, pipeline,
+                                              cppyy.gbl.vudo.ThresholdFilter.wordBytes(inputType, frame.size),
+                                              cppyy.gbl.vudo.ThresholdFilter.wordBytes(outputType, frame.size),
+                                              (frame.size + outputPerWord - 1) // outputPerWord, 64, slots)
+          pushConstants = cppyy.gbl.vudo.ThresholdPushConstants()
+          pushConstants.threshold, pushConstants.outsideValue = imageThreshold, outsideValue
+          pushConstants.scale, pushConstants.shift = scale, shift
+          pushConstants.voxelCount = frame.size
+        if frame.shape != shape or frame.dtype != inputDType:
+          raise ValueError("all frames of a stream need the same shape and type")
+        # the output of the oldest frame is read before its slot is used again
+        if len(pending) == slots:
+          yield self._streamedFrame(stream, pending.popleft(), shape, outputDType)
+        number = stream.acquire()
+        inputBytes = numpy.ascontiguousarray(frame).reshape(-1).view(numpy.uint8)
+        self.VudoModule.bufferArray(stream.getInputStaging(number), numpy.uint8, inputBytes.size)[:] = inputBytes
+        stream.submit(number, pushConstants)
+        pending.append(number)
+      while pending:
+        yield self._streamedFrame(stream, pending.popleft(), shape, outputDType)
+    finally:
+      # the pipeline must not go away while frames are in flight
+      if stream is not None:
+        stream.finish()
+
+  def _streamedFrame(self, stream, number, shape, outputDType):
+    stream.wait(number)
+    outputArray = numpy.empty(shape, outputDType)
+    outputArray.reshape(-1).view(numpy.uint8)[:] = self.VudoModule.bufferArray(
+      stream.getOutputStaging(number), numpy.uint8, outputArray.nbytes)
+    return outputArray
+
+  def stencilArray(self, inputArray, operation, boundary="clamp", constantValue=0., tileSize=None,
+                   reducedPrecision=False, layout="linear"):
+    """Run operation(stencilFilter) on a float32 copy of inputArray and return the result.
+    boundary is "clamp", "mirror" or "constant" (constantValue outside the volume).
+    layout is how the volume is stored on the device while filtering, "linear",
+    "bricked" (8^3 bricks) or "morton" (Z-order in 32^3 tiles).
+    With reducedPrecision, on a device with 8/16-bit storage and float16 arithmetic,
+    int16 and uint8 arrays are read as they are, anything else as float16, and the
+    result is float16.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    shape = inputArray.shape
+    if reducedPrecision and not vudo.getDeviceQueue().hasReducedPrecision():
+      logging.info("no 8/16-bit storage or float16 arithmetic on the device, filtering in float32")
+      reducedPrecision = False
+    dtype = numpy.dtype(numpy.float32)
+    if reducedPrecision:
+      dtype = inputArray.dtype if inputArray.dtype in (numpy.int16, numpy.uint8) else numpy.dtype(numpy.float16)
+    inputTypes = {numpy.dtype(numpy.float32): cppyy.gbl.vudo.Float32,
+                  numpy.dtype(numpy.float16): cppyy.gbl.vudo.Float16,
+                  numpy.dtype(numpy.int16): cppyy.gbl.vudo.Int16,
+                  numpy.dtype(numpy.uint8): cppyy.gbl.vudo.UInt8}
+    layouts = {"linear": cppyy.gbl.vudo.LinearLayout,
+               "bricked": cppyy.gbl.vudo.BrickedLayout,
+               "morton": cppyy.gbl.vudo.MortonLayout}
+    if (self.stencilFilter is None or self.stencilShape != shape
+        or self.stencilFilter.getInputType() != inputTypes[dtype] or self.stencilFilter.getLayout() != layouts[layout]):
+      self.stencilFilter = None # free the old buffers before allocating new ones
+      self.stencilFilter = cppyy.gbl.vudo.StencilFilter(vudo.getDeviceQueue(), shape[2], shape[1], shape[0],
+                                                        vudo.libraryShaderPath("stencil16" if reducedPrecision else "stencil"),
+                                                        inputTypes[dtype], layouts[layout],
+                                                        "" if layout == "linear" else vudo.libraryShaderPath("layout"))
+      self.stencilShape = shape
+    stencilFilter = self.stencilFilter
+    boundaryModes = {"clamp": cppyy.gbl.vudo.ClampBoundary,
+                     "mirror": cppyy.gbl.vudo.MirrorBoundary,
+                     "constant": cppyy.gbl.vudo.ConstantBoundary}
+    stencilFilter.setBoundary(boundaryModes[boundary], constantValue)
+    if tileSize:
+      stencilFilter.setTileSize(*tileSize)
+    self.VudoModule.bufferArray(stencilFilter.getInput(), dtype, inputArray.size)[:] = inputArray.reshape(-1)
+    operation(stencilFilter)
+    outputDType = numpy.float16 if reducedPrecision else numpy.float32
+    return self.VudoModule.bufferArray(stencilFilter.getOutput(), outputDType, inputArray.size).reshape(shape).copy()
+
+  def gaussianArray(self, inputArray, sigma, boundary="clamp", constantValue=0., reducedPrecision=False,
+                    layout="linear"):
+    """Gaussian smoothing with sigma in voxels, either one value or (k,j,i)"""
+    sigmaK, sigmaJ, sigmaI = numpy.broadcast_to(sigma, (3,))
+    return self.stencilArray(inputArray, lambda stencilFilter: stencilFilter.gaussian(sigmaI, sigmaJ, sigmaK),
+                             boundary, constantValue, reducedPrecision=reducedPrecision, layout=layout)
+
+  def boxArray(self, inputArray, radius, boundary="clamp", constantValue=0., reducedPrecision=False,
+               layout="linear"):
+    """Mean over (2*radius+1) voxels along each axis, radius either one value or (k,j,i)"""
+    radiusK, radiusJ, radiusI = [int(r) for r in numpy.broadcast_to(radius, (3,))]
+    return self.stencilArray(inputArray, lambda stencilFilter: stencilFilter.box(radiusI, radiusJ, radiusK),
+                             boundary, constantValue, reducedPrecision=reducedPrecision, layout=layout)
+
+  def gradientMagnitudeArray(self, inputArray, spacing=(1.,1.,1.), boundary="clamp", constantValue=0.,
+                             reducedPrecision=False, layout="linear"):
+    """Central difference gradient magnitude, spacing is (k,j,i)"""
+    def gradientMagnitude(stencilFilter):
+      stencilFilter.setSpacing(spacing[2], spacing[1], spacing[0])
+      stencilFilter.gradientMagnitude()
+    return self.stencilArray(inputArray, gradientMagnitude, boundary, constantValue,
+                             reducedPrecision=reducedPrecision, layout=layout)
+
+  def slabPipeline(self):
+    """A vudo::SlabPipeline, the engine of the headless VudoCLI, with this session's shaders.
+    Add stages, then run(VolumeFileReader, VolumeFileWriter, slabSlices) streams a NRRD or
+    NIfTI file through them a slab at a time.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    cppyy.include("vudoSlabPipeline.h")
+    slabPipeline = cppyy.gbl.vudo.SlabPipeline(vudo.getDeviceQueue())
+    for name in ("threshold", "stencil", "layout"):
+      slabPipeline.setShaderPath(name, vudo.libraryShaderPath(name))
+    return slabPipeline
+
+  def mappedVolume(self, path, shape=None, dtype=None, offset=0, bigEndian=False, prefetchBytes=256<<20):
+    """A vudo::MappedVolume of an uncompressed NRRD or NIfTI file, or of a headerless raw file
+    of shape (k,j,i) and dtype with its voxels from offset.  It is a source for slabPipeline()
+    runs of volumes larger than memory, and mappedRegionArray reads parts of it.
+    """
+    import cppyy
+    self.getVudo()
+    cppyy.include("vudoMappedVolume.h")
+    if shape is None:
+      return cppyy.gbl.vudo.MappedVolume(path, prefetchBytes)
+    info = cppyy.gbl.vudo.rawVolumeInfo(path, shape[2], shape[1], shape[0],
+                                        self.VudoModule.scalarType(numpy.dtype(dtype)), offset, bigEndian)
+    return cppyy.gbl.vudo.MappedVolume(info, prefetchBytes)
+
+  def mappedRegionArray(self, mappedVolume, start, shape):
+    """The voxels of mappedVolume from start (k,j,i) in a new array of shape (k,j,i)"""
+    import cppyy
+    info = mappedVolume.getInfo()
+    regionArray = numpy.empty(shape, self.VudoModule.scalarDType(info.scalarType))
+    origin = numpy.array(start[::-1], dtype=numpy.uint32)
+    size = numpy.array(shape[::-1], dtype=numpy.uint32)
+    mappedVolume.readRegion(origin, size, regionArray)
+    return regionArray
+
+  def resampleSlabs(self, inputArray, slabs, interpolation="linear", backgroundValue=0., upload=True):
+    """Resample inputArray into each of slabs, a list of (outputToInput, outputShape), in one submission.
+    outputToInput is a 4x4 output IJK to input IJK matrix and outputShape is (k,j,i).
+    interpolation is "nearest", "linear" or "sinc".  With upload=False the input of the
+    previous call is reused, e.g. to refresh slice views of an unchanged volume.
+    When the output does not fit the memory budget the slabs are resampled a few
+    output slices at a time, in several submissions.
+    Returns a list of float32 arrays.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    outputCapacity = sum([int(numpy.prod(shape)) for _, shape in slabs])
+    shape = inputArray.shape
+    if (self.resampler is None or self.resamplerShape != shape or self.resamplerRequested < outputCapacity):
+      upload = True
+      self.resampler = None # free the old buffers before allocating new ones
+      capacity = vudo.chunkLength(outputCapacity, 4, reserve=4*inputArray.size)
+      if capacity < outputCapacity:
+        logging.info(f"resampling {outputCapacity} voxels {capacity} at a time to fit the memory budget")
+      self.resampler = cppyy.gbl.vudo.Resampler(vudo.getDeviceQueue(), shape[2], shape[1], shape[0],
+                                                capacity, vudo.libraryShaderPath("resample"))
+      self.resamplerShape = shape
+      self.resamplerRequested = outputCapacity
+    resampler = self.resampler
+    if upload:
+      self.VudoModule.bufferArray(resampler.getInput(), numpy.float32, inputArray.size)[:] = inputArray.reshape(-1)
+    interpolations = {"nearest": cppyy.gbl.vudo.NearestInterpolation,
+                      "linear": cppyy.gbl.vudo.LinearInterpolation,
+                      "sinc": cppyy.gbl.vudo.WindowedSincInterpolation}
+    resampler.setInterpolation(interpolations[interpolation])
+    resampler.setBackgroundValue(backgroundValue)
+
+    # (slab, first slice, slice count) pieces, packed into runs that fit the output buffer
+    capacity = int(resampler.getOutputCapacity())
+    runs = [[]]
+    used = 0
+    for index, (_, outputShape) in enumerate(slabs):
+      sliceSize = int(outputShape[1]) * int(outputShape[2])
+      if sliceSize > capacity:
+        raise MemoryError(f"one {outputShape[2]}x{outputShape[1]} output slice does not fit the memory budget")
+      for first in range(0, outputShape[0], capacity // sliceSize):
+        count = min(capacity // sliceSize, outputShape[0] - first)
+        if used + count * sliceSize > capacity:
+          runs.append([])
+          used = 0
+        runs[-1].append((index, first, count))
+        used += count * sliceSize
+
+    outputs = [numpy.empty(outputShape, numpy.float32) for _, outputShape in slabs]
+    for run in runs:
+      resampler.clearSlabs()
+      offsets = []
+      for index, first, count in run:
+        outputToInput, outputShape = slabs[index]
+        firstSlice = numpy.identity(4)
+        firstSlice[2,3] = first
+        matrix = numpy.ascontiguousarray(numpy.asarray(outputToInput) @ firstSlice, dtype=numpy.float32).reshape(-1)
+        offsets.append(resampler.addSlab(matrix, outputShape[2], outputShape[1], count))
+      resampler.run()
+      output = self.VudoModule.bufferArray(resampler.getOutput(), numpy.float32, capacity)
+      for offset, (index, first, count) in zip(offsets, run):
+        pieceShape = (count,) + tuple(slabs[index][1][1:])
+        outputs[index][first:first+count] = output[offset:offset+int(numpy.prod(pieceShape))].reshape(pieceShape)
+    return outputs
+
+  def resampleArray(self, inputArray, outputToInput, outputShape, interpolation="linear", backgroundValue=0.):
+    return self.resampleSlabs(inputArray, [(outputToInput, outputShape)], interpolation, backgroundValue)[0]
+
+  def resampleVolume(self, inputVolume, referenceVolume, outputVolume, interpolation="linear", backgroundValue=0.):
+    """Resample inputVolume, with its (linear) parent transform hardened, onto the
+    geometry of referenceVolume and store the result in outputVolume.
+    """
+    ijkToRAS = vtk.vtkMatrix4x4()
+    referenceVolume.GetIJKToRASMatrix(ijkToRAS)
+    outputToRAS = slicer.util.arrayFromVTKMatrix(ijkToRAS)
+    rasToIJK = vtk.vtkMatrix4x4()
+    inputVolume.GetRASToIJKMatrix(rasToIJK)
+    inputToWorld = numpy.eye(4)
+    transformNode = inputVolume.GetParentTransformNode()
+    if transformNode:
+      if not transformNode.IsTransformToWorldLinear():
+        raise ValueError("only linear transforms can be resampled on the GPU")
+      transformToWorld = vtk.vtkMatrix4x4()
+      transformNode.GetMatrixTransformToWorld(transformToWorld)
+      inputToWorld = slicer.util.arrayFromVTKMatrix(transformToWorld)
+    outputToInput = slicer.util.arrayFromVTKMatrix(rasToIJK) @ numpy.linalg.inv(inputToWorld) @ outputToRAS
+    outputShape = slicer.util.arrayFromVolume(referenceVolume).shape
+    result = self.resampleArray(slicer.util.arrayFromVolume(inputVolume), outputToInput, outputShape,
+                                interpolation, backgroundValue)
+    slicer.util.updateVolumeFromArray(outputVolume, result)
+    outputVolume.SetIJKToRASMatrix(ijkToRAS)
+    return outputVolume
+
+  def registrationCosts(self, fixedArray, movingArray, fixedToMoving, metric="mattes",
+                        sampleStride=1, bins=32, upload=True):
+    """Cost (lower is better) of each of the K candidate transforms in fixedToMoving, a (K,4,4)
+    array of fixed IJK to moving IJK matrices, in one submission.  metric is "meansquares",
+    "correlation" (negative NCC) or "mattes" (negative mutual information).  Every
+    sampleStride-th fixed voxel along each axis is a sample.  With upload=False the volumes
+    of the previous call are reused, e.g. across the iterations of an optimizer.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    fixedToMoving = numpy.asarray(fixedToMoving, dtype=numpy.float32).reshape(-1,4,4)
+    candidateCount = len(fixedToMoving)
+    key = (fixedArray.shape, movingArray.shape, bins)
+    if (self.registrationMetrics is None or self.registrationMetricsKey != key
+        or self.registrationMetrics.getMaxCandidates() < candidateCount):
+      upload = True
+      self.registrationMetrics = None # free the old buffers before allocating new ones
+      self.registrationMetrics = cppyy.gbl.vudo.RegistrationMetrics(vudo.getDeviceQueue(),
+                                   fixedArray.shape[2], fixedArray.shape[1], fixedArray.shape[0],
+                                   movingArray.shape[2], movingArray.shape[1], movingArray.shape[0],
+                                   candidateCount, bins, vudo.libraryShaderPath("registration"))
+      self.registrationMetricsKey = key
+    metrics = self.registrationMetrics
+    if upload:
+      self.VudoModule.bufferArray(metrics.getFixed(), numpy.float32, fixedArray.size)[:] = fixedArray.reshape(-1)
+      self.VudoModule.bufferArray(metrics.getMoving(), numpy.float32, movingArray.size)[:] = movingArray.reshape(-1)
+      metrics.setFixedRange(float(fixedArray.min()), float(fixedArray.max()))
+      metrics.setMovingRange(float(movingArray.min()), float(movingArray.max()))
+    registrationMetrics = {"meansquares": cppyy.gbl.vudo.MeanSquaresMetric,
+                           "correlation": cppyy.gbl.vudo.CorrelationMetric,
+                           "mattes": cppyy.gbl.vudo.MattesMutualInformationMetric}
+    metrics.setMetric(registrationMetrics[metric])
+    metrics.setSampleStride(sampleStride)
+    self.VudoModule.bufferArray(metrics.getCandidates(), numpy.float32, 16 * candidateCount)[:] = fixedToMoving.reshape(-1)
+    metrics.run(candidateCount)
+    return self.VudoModule.bufferArray(metrics.getResults(), numpy.float32, candidateCount).copy()
+
+  def histogramArray(self, inputArray, bins=256, valueRange=None, segments=None, segmentMask=0xffffffff):
+    """Histogram of a numpy array or vtkDataArray counted on the GPU by the histogram variant of its
+    VTK scalar type, reading uint8, int16, uint16 and float32 voxels as stored (other types, and 8/16 bit
+    types on devices without 8/16-bit storage, are converted to float32 first).  valueRange defaults to
+    the minimum and maximum of the array.  With a packSegments array as segments only voxels with a bit
+    of segmentMask set are counted.  Returns the counts and bin edges, as numpy.histogram does.
+    """
+    import cppyy
+    import vtk
+    from vtk.util import numpy_support
+    vudo = self.getVudo()
+    variants = self.getVariants()
+    if isinstance(inputArray, vtk.vtkDataArray):
+      vtkScalarType = inputArray.GetDataType()
+      inputArray = numpy_support.vtk_to_numpy(inputArray)
+    else:
+      vtkScalarType = numpy_support.get_vtk_array_type(inputArray.dtype)
+    if (vtkScalarType not in variants.scalarTypes("histogram")
+        or not cppyy.gbl.vudo.KernelVariants.isSupported(vudo.getDeviceQueue(), vtkScalarType)):
+      vtkScalarType = vtk.VTK_FLOAT
+      inputArray = inputArray.astype(numpy.float32)
+    voxels = numpy.ascontiguousarray(inputArray).reshape(-1)
+    if valueRange is None:
+      valueRange = (float(voxels.min()), float(voxels.max())) if voxels.size else (0., 1.)
+    if valueRange[1] <= valueRange[0]:
+      valueRange = (valueRange[0], valueRange[0] + 1.)
+    options = variants.optionBits("histogram", "MASKED") if segments is not None else 0
+
+    # the variant is picked from the table by type; the histogram is reused while nothing changes
+    key = (vtkScalarType, voxels.size, bins, options)
+    if self.histogram is None or self.histogramKey != key:
+      self.histogram = None # free the old buffers before allocating new ones
+      self.histogram = cppyy.gbl.vudo.VolumeHistogram(vudo.getDeviceQueue(), variants.kernelVariants("histogram"),
+                                                      vtkScalarType, voxels.size, bins, options)
+      self.histogramKey = key
+    histogram = self.histogram
+    histogram.setRange(valueRange[0], valueRange[1])
+    histogram.setSegmentMask(segmentMask)
+    inputBytes = voxels.view(numpy.uint8)
+    self.VudoModule.bufferArray(histogram.getInput(), numpy.uint8, inputBytes.size)[:] = inputBytes
+    if segments is not None:
+      self.VudoModule.bufferArray(histogram.getSegments(), numpy.uint32, voxels.size)[:] = segments.reshape(-1)
+    histogram.run()
+    counts = self.VudoModule.bufferArray(histogram.getBins(), numpy.uint32, bins).astype(numpy.int64)
+    return counts, numpy.linspace(valueRange[0], valueRange[1], bins + 1)
+
+  def connectedComponentsArray(self, labelArray, connectivity=26, maxComponents=65536):
+    """Label the islands of each nonzero value of labelArray on the GPU.
+    Returns the uint32 component labels (0 is background) and the voxel count of each
+    label (index 0 unused), or None for the counts if there are more than maxComponents.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    depth, height, width = labelArray.shape
+    components = cppyy.gbl.vudo.ConnectedComponents(vudo.getDeviceQueue(), self.VudoModule.scalarType(labelArray.dtype),
+                                                    width, height, depth, connectivity, maxComponents,
+                                                    vudo.libraryShaderPath("connectedComponents"))
+    inputBytes = numpy.ascontiguousarray(labelArray).reshape(-1).view(numpy.uint8)
+    self.VudoModule.bufferArray(components.getInput(), numpy.uint8, inputBytes.size)[:] = inputBytes
+    components.run()
+    componentCount = components.getComponentCount()
+    labels = self.VudoModule.bufferArray(components.getLabels(), numpy.uint32, labelArray.size)
+    labels = labels.reshape(labelArray.shape).copy()
+    counts = None
+    if componentCount <= maxComponents:
+      counts = self.VudoModule.bufferArray(components.getCounts(), numpy.uint32, componentCount + 1).copy()
+      counts[0] = 0
+    return labels, counts
+
+  def removeIslands(self, labelArray, minimumSize, connectivity=26):
+    """Zero the islands of labelArray smaller than minimumSize voxels"""
+    labels, counts = self.connectedComponentsArray(labelArray, connectivity, maxComponents=labelArray.size)
+    return numpy.where(counts[labels] >= minimumSize, labelArray, 0).astype(labelArray.dtype)
+
+  def morphologyArray(self, packedArray, operation, radius, element="ball", segmentMask=0xffffffff,
+                      incremental=False, dirtyExtent=None):
+    """Erode, dilate, open or close all segments of a packSegments uint32 array in one pass.
+    radius is in voxels, either one value or (k,j,i), and element is "ball" or "box".
+    Only the segments (bits) in segmentMask change.
+    With incremental, repeating the previous operation after an edit only recomputes the
+    bricks around it (vudo::DirtyBricks).  The edit is found by comparing with the previous
+    array on the GPU, or given as dirtyExtent (i0, i1, j0, j1, k0, k1), inclusive like a
+    vtkImageData extent, in which case only that part of packedArray is uploaded.
+    """
+    import cppyy
+    vudo = self.getVudo()
+    shape = packedArray.shape
+    if self.morphologyFilter is None or self.morphologyShape != shape:
+      self.morphologyFilter = None # free the old buffers before allocating new ones
+      self.dirtyBricks = None
+      self.morphologyFilter = cppyy.gbl.vudo.MorphologyFilter(vudo.getDeviceQueue(), shape[2], shape[1], shape[0],
+                                                              vudo.libraryShaderPath("morphology"))
+      self.morphologyShape = shape
+      dirtyExtent = None # nothing uploaded yet
+    morphologyFilter = self.morphologyFilter
+    if incremental and self.dirtyBricks is None:
+      self.dirtyBricks = cppyy.gbl.vudo.DirtyBricks(vudo.getDeviceQueue(), shape[2], shape[1], shape[0], 4, 16,
+                                                    vudo.libraryShaderPath("brickDiff"),
+                                                    vudo.libraryShaderPath("brickGrow"),
+                                                    vudo.libraryShaderPath("brickCompact"))
+      morphologyFilter.setDirtyBricks(self.dirtyBricks)
+      dirtyExtent = None # the first tracked run is a full one
+    elif not incremental and self.dirtyBricks is not None:
+      morphologyFilter.setDirtyBricks(cppyy.nullptr)
+      self.dirtyBricks = None
+    if incremental:
+      morphologyFilter.setDiffInput(dirtyExtent is None)
+      if dirtyExtent is not None:
+        self.dirtyBricks.markExtent(*[int(index) for index in dirtyExtent])
+    elements = {"ball": cppyy.gbl.vudo.BallElement, "box": cppyy.gbl.vudo.BoxElement}
+    morphologyFilter.setStructuringElement(elements[element])
+    morphologyFilter.setSegmentMask(segmentMask)
+    radiusK, radiusJ, radiusI = [int(r) for r in numpy.broadcast_to(radius, (3,))]
+    inputVoxels = self.VudoModule.bufferArray(morphologyFilter.getInput(), numpy.uint32, packedArray.size)
+    if dirtyExtent is not None:
+      i0, i1, j0, j1, k0, k1 = dirtyExtent
+      edited = (slice(k0, k1 + 1), slice(j0, j1 + 1), slice(i0, i1 + 1))
+      inputVoxels.reshape(shape)[edited] = packedArray[edited]
+    else:
+      inputVoxels[:] = packedArray.reshape(-1)
+    getattr(morphologyFilter, operation)(radiusI, radiusJ, radiusK)
+    return self.VudoModule.bufferArray(morphologyFilter.getOutput(), numpy.uint32, packedArray.size).reshape(shape).copy()
+
+  def surfaceArrays(self, inputArray, isovalue=None, label=None):
+    """Marching cubes surface of inputArray, at isovalue or around the voxels equal to label.
+    Returns IJK points (n,3), unit normals (n,3) and triangle point indices (m,3).
+    """
+    import cppyy
+    vudo = self.getVudo()
+    depth, height, width = inputArray.shape
+    marchingCubes = cppyy.gbl.vudo.MarchingCubes(vudo.getDeviceQueue(), self.VudoModule.scalarType(inputArray.dtype),
+                                                 width, height, depth, 0,
+                                                 vudo.libraryShaderPath("marchingCubes"),
+                                                 vudo.libraryShaderPath("scan"))
+    if label is not None:
+      marchingCubes.setLabel(int(label))
+    else:
+      marchingCubes.setIsovalue(0.5 if isovalue is None else float(isovalue))
+    inputBytes = numpy.ascontiguousarray(inputArray).reshape(-1).view(numpy.uint8)
+    self.VudoModule.bufferArray(marchingCubes.getInput(), numpy.uint8, inputBytes.size)[:] = inputBytes
+    marchingCubes.run()
+    pointCount = marchingCubes.getPointCount()
+    triangleCount = marchingCubes.getTriangleCount()
+    points = self.VudoModule.bufferArray(marchingCubes.getPoints(), numpy.float32, 3 * pointCount)
+    normals = self.VudoModule.bufferArray(marchingCubes.getNormals(), numpy.float32, 3 * pointCount)
+    triangles = self.VudoModule.bufferArray(marchingCubes.getIndices(), numpy.uint32, 3 * triangleCount)
+    return points.reshape(-1,3).copy(), normals.reshape(-1,3).copy(), triangles.reshape(-1,3).copy()
+
+  def surfacePolyData(self, volumeNode, isovalue=None, label=None):
+    """Marching cubes surface of volumeNode as a vtkPolyData in RAS with point normals"""
+    from vtk.util import numpy_support
+    points, normals, triangles = self.surfaceArrays(slicer.util.arrayFromVolume(volumeNode), isovalue, label)
+    ijkToRAS = vtk.vtkMatrix4x4()
+    volumeNode.GetIJKToRASMatrix(ijkToRAS)
+    if ijkToRAS.Determinant() < 0:
+      # a mirroring IJK to RAS turns the triangles inside out, the normals are transformed correctly
+      triangles = numpy.ascontiguousarray(triangles[:,::-1])
+    polyData = vtk.vtkPolyData()
+    polyData.SetPoints(vtk.vtkPoints())
+    polyData.GetPoints().SetData(numpy_support.numpy_to_vtk(points, deep=True))
+    normalArray = numpy_support.numpy_to_vtk(normals, deep=True)
+    normalArray.SetName("Normals")
+    polyData.GetPointData().SetNormals(normalArray)
+    cells = vtk.vtkCellArray()
+    cells.SetData(3, numpy_support.numpy_to_vtkIdTypeArray(triangles.reshape(-1).astype(numpy.int64), deep=True))
+    polyData.SetPolys(cells)
+
+    transform = vtk.vtkTransform()
+    transform.SetMatrix(ijkToRAS)
+    transformFilter = vtk.vtkTransformPolyDataFilter()
+    transformFilter.SetTransform(transform)
+    transformFilter.SetInputData(polyData)
+    transformFilter.Update()
+    return transformFilter.GetOutput()
+
+  def rayCastImage(self, rayCaster):
+    """Render with a vudo::RayCaster and return the image as an (rows, columns, RGBA) uint8 array"""
+    rayCaster.render()
+    width, height = rayCaster.getImageWidth(), rayCaster.getImageHeight()
+    pixels = self.VudoModule.bufferArray(rayCaster.getImage(), numpy.uint8, 4 * width * height)
+    return pixels.reshape((height, width, 4)).copy()
+
+  def benchmarkGaussian(self, inputArray, sigma, repeat=3):
+    """Best of repeat seconds and effective bandwidth for vudo and vtkImageGaussianSmooth.
+    The bandwidth counts one float32 read of the input and one write of the output,
+    so it shows how close each path gets to a single streaming pass.
+    The results are checked to agree away from the boundary (the two treat it differently).
+    """
+    import vtk.util.numpy_support
+    floatArray = numpy.ascontiguousarray(inputArray, dtype=numpy.float32)
+    streamedBytes = 2 * floatArray.nbytes
+    results = {}
+
+    gpuOutput = self.gaussianArray(floatArray, sigma) # pipeline creation and allocation
+    seconds = min(timeit.repeat(lambda: self.gaussianArray(floatArray, sigma), number=1, repeat=repeat))
+    results["vudo"] = (seconds, streamedBytes / seconds / 1e9)
+
+    imageData = vtk.vtkImageData()
+    imageData.SetDimensions(floatArray.shape[::-1])
+    imageData.GetPointData().SetScalars(vtk.util.numpy_support.numpy_to_vtk(floatArray.reshape(-1), deep=False))
+    smooth = vtk.vtkImageGaussianSmooth()
+    smooth.SetInputData(imageData)
+    smooth.SetDimensionality(3)
+    smooth.SetStandardDeviations(sigma, sigma, sigma)
+    smooth.SetRadiusFactors(3, 3, 3)
+    def vtkSmooth():
+      smooth.Modified()
+      smooth.Update()
+    seconds = min(timeit.repeat(vtkSmooth, number=1, repeat=repeat))
+    results["vtk"] = (seconds, streamedBytes / seconds / 1e9)
+    vtkOutput = vtk.util.numpy_support.vtk_to_numpy(smooth.GetOutput().GetPointData().GetScalars())
+    vtkOutput = vtkOutput.reshape(floatArray.shape)
+
+    radius = int(numpy.ceil(3 * sigma))
+    interior = (slice(radius, -radius),) * 3
+    tolerance = 1e-3 * max(1., float(numpy.abs(floatArray).max()))
+    if not numpy.allclose(gpuOutput[interior], vtkOutput[interior], atol=tolerance):
+      raise RuntimeError("vudo and vtk Gaussians disagree")
+    return results
+
+  def benchmarkLayouts(self, inputArray, sigma, tileSize=None, repeat=3):
+    """Best of repeat seconds of the Gaussian in each device storage layout, swizzling
+    in and out included.  The bricked and Morton layouts keep z neighbours close, which
+    shows in the z pass of a large volume.
+    """
+    floatArray = numpy.ascontiguousarray(inputArray, dtype=numpy.float32)
+    results = {}
+    for layout in ("linear", "bricked", "morton"):
+      def gaussian():
+        self.stencilArray(floatArray, lambda stencilFilter: stencilFilter.gaussian(sigma, sigma, sigma),
+                          tileSize=tileSize, layout=layout)
+      gaussian() # pipeline creation and allocation
+      results[layout] = min(timeit.repeat(gaussian, number=1, repeat=repeat))
+    return results
+
+  def benchmarkThreshold(self, inputArray, imageThreshold, repeat=5):
+    """Best of repeat seconds for thresholding inputArray with vudo, numpy and vtkImageThreshold.
+    imageThreshold should be a whole number: vtkImageThreshold casts it to the input type.
+    The three results are checked to be identical.
+    """
+    import vtk.util.numpy_support
+    gpuOutput = numpy.empty_like(inputArray)
+    self.thresholdArray(inputArray, imageThreshold, gpuOutput) # pipeline creation and allocation
+    timings = {}
+    timings["vudo"] = min(timeit.repeat(lambda: self.thresholdArray(inputArray, imageThreshold, gpuOutput),
+                                        number=1, repeat=repeat))
+
+    numpyOutput = numpy.empty_like(inputArray)
+    def numpyThreshold():
+      numpy.multiply(inputArray, inputArray >= imageThreshold, out=numpyOutput)
+    timings["numpy"] = min(timeit.repeat(numpyThreshold, number=1, repeat=repeat))
+
+    imageData = vtk.vtkImageData()
+    imageData.SetDimensions(inputArray.shape[::-1])
+    scalars = vtk.util.numpy_support.numpy_to_vtk(numpy.ascontiguousarray(inputArray).reshape(-1), deep=False)
+    imageData.GetPointData().SetScalars(scalars)
+    threshold = vtk.vtkImageThreshold()
+    threshold.SetInputData(imageData)
+    threshold.ThresholdByUpper(imageThreshold)
+    threshold.ReplaceInOff()
+    threshold.ReplaceOutOn()
+    threshold.SetOutValue(0)
+    def vtkThreshold():
+      threshold.Modified()
+      threshold.Update()
+    timings["vtk"] = min(timeit.repeat(vtkThreshold, number=1, repeat=repeat))
+    vtkOutput = vtk.util.numpy_support.vtk_to_numpy(threshold.GetOutput().GetPointData().GetScalars())
+
+    if not numpy.array_equal(gpuOutput, numpyOutput) or not numpy.array_equal(gpuOutput.reshape(-1), vtkOutput):
+      raise RuntimeError("vudo, numpy and vtk thresholds disagree")
+    return timings
+
 
 class VudoTest(ScriptedLoadableModuleTest):
   """
@@ -195,8 +914,1122 @@ class VudoTest(ScriptedLoadableModuleTest):
     """Run as few or as many tests as needed here.
     """
     self.setUp()
+    self.test_DiagnosticRing()
+    self.test_SPIRVValidation()
+    self.test_ProgressiveMandelbrot()
+    self.test_BrickROI()
+    self.test_Threshold()
+    self.test_ResultCache()
+    self.test_ThresholdBatch()
+    self.test_FrameStream()
+    self.test_HostMemoryBuffer()
+    self.test_MemoryBudget()
+    self.test_Stencil()
+    self.test_ReducedPrecisionStencil()
+    self.test_KernelVariants()
+    self.test_VudoArray()
+    self.test_VolumeLayout()
+    self.test_SlabPipeline()
+    self.test_MappedVolume()
+    self.test_Resample()
+    self.test_RayCast()
+    self.test_ConnectedComponents()
+    self.test_Morphology()
+    self.test_IncrementalMorphology()
+    self.test_MarchingCubes()
+    self.test_Primitives()
+    self.test_RegistrationMetrics()
     self.test_VolumeFilter()
 
+  def test_DiagnosticRing(self):
+    """ Messages pushed into the ring come out in order through logging,
+    and overflow is counted rather than blocking.
+    """
+    import cppyy
+    logic = VudoLogic()
+    logic.VudoModule.Vudo()
+    ring = cppyy.gbl.vudo.DiagnosticRing()
+    self.assertTrue(ring.push(0x100, 0x2, 7, "first", "first message"))
+    self.assertTrue(ring.push(0x1000, 0x2, 8, "second", "second message"))
+    message = cppyy.gbl.vudo.DiagnosticMessage()
+    self.assertTrue(ring.pop(message))
+    self.assertEqual(message.messageIdNumber, 7)
+    self.assertTrue(ring.pop(message))
+    self.assertEqual(message.messageIdNumber, 8)
+    self.assertFalse(ring.pop(message))
+    for index in range(ring.capacity + 10):
+      ring.push(0x10, 0x1, index, "fill", "fill")
+    self.assertEqual(ring.droppedCount(), 10)
+
+  def test_SPIRVValidation(self):
+    """ The mapped .spv validates, and damaged copies are rejected
+    before they could reach vkCreateShaderModule.
+    """
+    import cppyy
+    import tempfile
+    logic = VudoLogic()
+    vudoInstance = logic.VudoModule.Vudo()
+    sourceDir = os.path.split(slicer.modules.vudo.path)[0] + "/../Experiments/performance"
+    # compiled for the test, the source tree holds no SPIR-V
+    shaderPath = os.path.join(tempfile.mkdtemp(prefix="vudo"), "performance.spv")
+    self.assertTrue(vudoInstance.compileGLSL(sourceDir+"/performance.comp.glsl", shaderPath))
+    code = cppyy.gbl.vudo.ShaderCode()
+    code.mapFile(shaderPath)
+    words = numpy.frombuffer(code.getWords(), dtype=numpy.uint32, count=code.getWordCount()).copy()
+    error = cppyy.gbl.std.string()
+    self.assertTrue(cppyy.gbl.vudo.validateSPIRV(words, len(words), error))
+    self.assertFalse(cppyy.gbl.vudo.validateSPIRV(words, 4, error))
+    words[5] &= 0xffff # first instruction claims zero words
+    self.assertFalse(cppyy.gbl.vudo.validateSPIRV(words, len(words), error))
+    words[0] = 0x03022307
+    self.assertFalse(cppyy.gbl.vudo.validateSPIRV(words, len(words), error))
+    with self.assertRaises(Exception):
+      code.mapFile(sourceDir+"/does-not-exist.spv")
+
+  def test_ProgressiveMandelbrot(self):
+    """ The first pass fills the coarsest lattice, and later passes
+    refine around it without changing the voxels already published.
+    """
+    import cppyy
+    import VudoLib.Progressive
+    logic = VudoLogic()
+    vudoInstance = logic.VudoModule.Vudo()
+    shaderPath = ""
+    if not vudoInstance.hasEmbeddedShader("Mandelbrot"):
+      sourceDir = os.path.split(slicer.modules.vudo.path)[0] + "/../Experiments/Mandelbrot"
+      shaderPath = sourceDir+"/Mandelbrot.spv"
+      vudoInstance.compileGLSL(sourceDir+"/Mandelbrot.comp.glsl", shaderPath)
+    progressive = VudoLib.Progressive.ProgressiveVolume(vudoInstance, "Mandelbrot", (512,512,512), shaderPath=shaderPath)
+    # new device memory is not zeroed, and the checks below read voxels no pass has written yet
+    sequence = cppyy.gbl.vudo.CommandSequence(vudoInstance.getDeviceQueue())
+    sequence.begin()
+    sequence.fillBuffer(progressive.buffer, 0)
+    sequence.barrier()
+    sequence.submitAndWait()
+    dispatch = progressive.dispatch
+    self.assertEqual(dispatch.getPassCount(), 4)
+    self.assertTrue(dispatch.submitNextPass())
+    dispatch.waitForPass()
+    self.assertEqual(dispatch.getCompletedStride(), 8)
+    coarse = progressive.array(8).copy()
+    self.assertGreater(coarse.max(), 0)
+    self.assertEqual(progressive.array(1)[1::8,1::8,1::8].max(), 0)
+    dispatch.runToCompletion()
+    self.assertTrue(dispatch.isFinished())
+    self.assertTrue(numpy.array_equal(progressive.array(8), coarse))
+    self.assertGreater(progressive.array(1)[1::8,1::8,1::8].max(), 0)
+    vudoInstance.drainDiagnostics(vudoInstance.getDeviceQueue())
+
+  def test_BrickROI(self):
+    """ A bricked dispatch restricted to a region of interest launches
+    workgroups only for the bricks it overlaps and renders nothing outside it.
+    """
+    import cppyy
+    import VudoLib.Progressive
+    logic = VudoLogic()
+    vudoInstance = logic.VudoModule.Vudo()
+    deviceQueue = vudoInstance.getDeviceQueue()
+    shaderPath = ""
+    if not vudoInstance.hasEmbeddedShader("Mandelbrot"):
+      sourceDir = os.path.split(slicer.modules.vudo.path)[0] + "/../Experiments/Mandelbrot"
+      shaderPath = sourceDir+"/Mandelbrot.spv"
+      vudoInstance.compileGLSL(sourceDir+"/Mandelbrot.comp.glsl", shaderPath)
+
+    brickMap = cppyy.gbl.vudo.BrickMap(deviceQueue, 512, 512, 512, 16,
+                                       vudoInstance.libraryShaderPath("brickOccupancy"),
+                                       vudoInstance.libraryShaderPath("brickCompact"))
+    brickMap.setROI(100, 100, 100, 200, 200, 200)
+    image = cppyy.gbl.vudo.ComputeBuffer(deviceQueue, 16 * 512**3)
+    shaderModule = cppyy.gbl.vudo.createShaderModule(deviceQueue.getDevice(), "Mandelbrot", shaderPath)
+    specialization = cppyy.gbl.std.vector["uint32_t"]([brickMap.getBrickSize()])
+    pipeline = cppyy.gbl.vudo.ComputePipeline(deviceQueue, shaderModule, 2,
+                                              cppyy.sizeof(cppyy.gbl.vudo.ProgressivePushConstants), specialization)
+    pipeline.bindBuffer(0, image)
+    pipeline.bindBuffer(1, brickMap.getActiveBricks())
+    pushConstants = cppyy.gbl.vudo.ProgressivePushConstants()
+    pushConstants.stride, pushConstants.skipStride = 1, 0
+
+    sequence = cppyy.gbl.vudo.CommandSequence(deviceQueue)
+    sequence.begin()
+    sequence.fillBuffer(image, 0)
+    brickMap.record(sequence, 8)
+    brickMap.dispatch(sequence, pipeline, pushConstants)
+    sequence.barrier()
+    sequence.submitAndWait()
+    vudoInstance.drainDiagnostics(deviceQueue)
+
+    # bricks 96..207 on each axis, i.e. 7 per axis
+    self.assertEqual(brickMap.getActiveBrickCount(), 7**3)
+    logging.info(f"Bricked dispatch skipped {100*brickMap.getSkippedFraction():.1f}% of {brickMap.getBrickCount()} bricks")
+    rendered = logic.VudoModule.bufferArray(image).reshape((512,512,512,4))[:,:,:,0]
+    self.assertEqual(rendered[:96].max(), 0)
+    self.assertEqual(rendered[208:].max(), 0)
+    self.assertGreater(rendered[96:208,96:208,96:208].max(), 0)
+
+    # all 32768 bricks with 512 workgroups each: the dispatch is split into rows of whole bricks
+    brickMap.clearROI()
+    sequence.begin()
+    brickMap.record(sequence, 2)
+    sequence.submitAndWait()
+    arguments = logic.VudoModule.bufferArray(brickMap.getIndirectArguments(), numpy.uint32, 4)
+    groupCountX, groupCountY, groupCountZ, activeBrickCount = [int(argument) for argument in arguments]
+    self.assertEqual(activeBrickCount, 32768)
+    self.assertLessEqual(groupCountX, cppyy.gbl.vudo.maxWorkGroupCountX(deviceQueue))
+    self.assertLessEqual(groupCountY, 65535)
+    self.assertEqual(groupCountX % 512, 0)
+    self.assertGreaterEqual(groupCountX * groupCountY, 32768 * 512)
+    activeBricks = logic.VudoModule.bufferArray(brickMap.getActiveBricks(), numpy.uint32, groupCountX // 512 * groupCountY)
+    self.assertTrue(numpy.array_equal(numpy.sort(activeBricks[:32768]), numpy.arange(32768)))
+    self.assertTrue((activeBricks[32768:] == 0xffffffff).all())
+
+  def test_Threshold(self):
+    """ The fused threshold/rescale/cast kernel matches numpy, and the
+    plain threshold matches numpy and vtkImageThreshold; timings are logged.
+    """
+    import SampleData
+    volumeNode = SampleData.downloadSample("MRHead")
+    logic = VudoLogic()
+
+    outputVolume = slicer.mrmlScene.AddNewNodeByClass("vtkMRMLScalarVolumeNode")
+    logic.run(volumeNode, outputVolume, 100, scale=0.5, shift=10, outputScalarType=numpy.uint8)
+    inputArray = slicer.util.arrayFromVolume(volumeNode)
+    rescaled = inputArray.astype(numpy.float32) * numpy.float32(0.5) + numpy.float32(10)
+    expected = numpy.clip(numpy.round(numpy.where(inputArray >= 100, rescaled, 0)), 0, 255).astype(numpy.uint8)
+    outputArray = slicer.util.arrayFromVolume(outputVolume)
+    self.assertEqual(outputArray.dtype, numpy.uint8)
+    self.assertTrue(numpy.array_equal(outputArray, expected))
+
+    synthetic = (numpy.arange(512**3, dtype=numpy.int64) % 4001 - 1000).astype(numpy.int16).reshape((512,512,512))
+    for name, array in (("MRHead", inputArray), ("synthetic 512^3", synthetic)):
+      timings = logic.benchmarkThreshold(array, 100)
+      logging.info(f"threshold {name} {array.dtype} {array.shape}: " +
+                   ", ".join([f"{path} {seconds*1000:.1f} ms" for path, seconds in timings.items()]))
+
+  def test_ResultCache(self):
+    """ Repeated applies with the same volume and threshold are served from the
+    result cache, editing the input misses it, and the byte budget evicts the
+    least recently used results.
+    """
+    import VudoLib.ResultCache
+    logic = VudoLogic()
+    cache = logic.resultCache
+    volume = numpy.random.default_rng(47).integers(0, 1000, (64,128,128), dtype=numpy.int16)
+    volumeNode = slicer.util.addVolumeFromArray(volume, name="ResultCacheInput")
+    outputVolume = slicer.mrmlScene.AddNewNodeByClass("vtkMRMLScalarVolumeNode")
+
+    seconds = {}
+    for threshold in (300, 600, 300, 600):
+      start = time.time()
+      logic.run(volumeNode, outputVolume, threshold)
+      seconds.setdefault(threshold, []).append(time.time() - start)
+      self.assertTrue(numpy.array_equal(slicer.util.arrayFromVolume(outputVolume), numpy.where(volume >= threshold, volume, 0)))
+    self.assertEqual((cache.hits, cache.misses), (2, 2))
+    logging.info(f"apply: first {seconds[300][0]*1000:.1f} ms, repeated {seconds[300][1]*1000:.1f} ms; {cache.report()}")
+
+    # an edit advances the modified time, so the same threshold runs again
+    slicer.util.arrayFromVolume(volumeNode)[0] = 999
+    slicer.util.arrayFromVolumeModified(volumeNode)
+    logic.run(volumeNode, outputVolume, 300)
+    self.assertEqual(cache.misses, 3)
+    self.assertTrue(numpy.all(slicer.util.arrayFromVolume(outputVolume)[0] == 999))
+
+    # least recently used first, and cached arrays are read-only
+    small = VudoLib.ResultCache.ResultCache(byteBudget=3000)
+    for index in range(3):
+      small.put(index, numpy.full(250, index, numpy.int32))
+    self.assertTrue(0 not in small and 1 in small and 2 in small)
+    small.get(1)
+    small.put(3, numpy.zeros(250, numpy.int32))
+    self.assertTrue(2 not in small and 1 in small)
+    self.assertFalse(small.get(1).flags.writeable)
+    small.put(4, numpy.zeros(1000, numpy.int32)) # more than the whole budget
+    self.assertTrue(4 not in small and 1 in small)
+    self.assertEqual(small.arrayKey(volume), small.arrayKey(volume.copy()))
+    edited = volume.copy()
+    edited[10,10,10] += 1
+    self.assertNotEqual(small.arrayKey(volume), small.arrayKey(edited))
+
+  def test_ThresholdBatch(self):
+    """ A batch of differently sized volumes matches thresholdArray volume by
+    volume, and many volumes per submission beat one submission each.
+    """
+    logic = VudoLogic()
+    random = numpy.random.default_rng(39)
+    inputArrays = [random.integers(-100, 100, shape, dtype=numpy.int16)
+                   for shape in random.integers(1, 24, (50,3))]
+    outputArrays = logic.thresholdArrays(inputArrays, 10, numpy.uint8, scale=0.5, shift=3, outsideValue=1)
+    for inputArray, outputArray in zip(inputArrays, outputArrays):
+      self.assertEqual(outputArray.dtype, numpy.uint8)
+      expected = logic.thresholdArray(inputArray, 10, numpy.empty(inputArray.shape, numpy.uint8),
+                                      scale=0.5, shift=3, outsideValue=1)
+      self.assertTrue(numpy.array_equal(outputArray, expected))
+
+    frames = [random.integers(0, 1000, (32,64,64), dtype=numpy.uint16) for _ in range(256)]
+    for batchSize in (1, 16, 256):
+      startTime = time.time()
+      for first in range(0, len(frames), batchSize):
+        logic.thresholdArrays(frames[first:first+batchSize], 500)
+      elapsed = time.time() - startTime
+      logging.info(f"batches of {batchSize}: {len(frames)/elapsed:.0f} volumes/s")
+
+  def test_FrameStream(self):
+    """ Streamed frames come back in order and equal to thresholdArray, with
+    upload, compute and download overlapped when timeline semaphores exist.
+    """
+    logic = VudoLogic()
+    deviceQueue = logic.getVudo().getDeviceQueue()
+    logging.info(f"timeline semaphores: {deviceQueue.hasTimelineSemaphores()}, "
+                 f"dedicated transfer queue: {deviceQueue.hasDedicatedTransferQueue()}")
+    random = numpy.random.default_rng(40)
+    frames = [random.integers(0, 1000, (24,32,40), dtype=numpy.uint16) for _ in range(7)]
+    streamed = list(logic.thresholdFrames(frames, 500, numpy.float32, scale=2., outsideValue=-1))
+    self.assertEqual(len(streamed), len(frames))
+    for frame, output in zip(frames, streamed):
+      expected = logic.thresholdArray(frame, 500, numpy.empty(frame.shape, numpy.float32), scale=2., outsideValue=-1)
+      self.assertTrue(numpy.array_equal(output, expected))
+
+    frames = [random.integers(0, 1000, (128,256,256), dtype=numpy.uint16) for _ in range(24)]
+    logic.thresholdArray(frames[0], 500) # creates the filter outside the timing
+    startTime = time.time()
+    expected = [logic.thresholdArray(frame, 500) for frame in frames]
+    serialSeconds = time.time() - startTime
+    startTime = time.time()
+    streamed = list(logic.thresholdFrames(frames, 500))
+    streamedSeconds = time.time() - startTime
+    logging.info(f"threshold of 128x256x256 frames: {len(frames)/serialSeconds:.1f} frames/s one at a time, "
+                 f"{len(frames)/streamedSeconds:.1f} streamed")
+    self.assertEqual(len(streamed), len(frames))
+    for number, (output, reference) in enumerate(zip(streamed, expected)):
+      self.assertTrue(numpy.array_equal(output, reference), f"frame {number}")
+    if deviceQueue.hasTimelineSemaphores():
+      # upload, compute and download of different frames overlap
+      self.assertLess(streamedSeconds, serialSeconds)
+
+  def test_HostMemoryBuffer(self):
+    """ Imported and staged host memory reach the device unchanged, from numpy
+    and from a vtkDataArray, and importing beats the staging copy.
+    """
+    import cppyy
+    import vtk.util.numpy_support
+    logic = VudoLogic()
+    vudo = logic.getVudo()
+    deviceQueue = vudo.getDeviceQueue()
+    logging.info(f"external memory host: {deviceQueue.hasExternalMemoryHost()}, "
+                 f"alignment {deviceQueue.getHostPointerAlignment()}")
+
+    def deviceBytes(hostBuffer):
+      readback = cppyy.gbl.vudo.ComputeBuffer(deviceQueue, hostBuffer.getSize())
+      commandSequence = cppyy.gbl.vudo.CommandSequence(deviceQueue)
+      commandSequence.begin()
+      commandSequence.copyBuffer(hostBuffer, readback)
+      commandSequence.barrier()
+      commandSequence.submitAndWait()
+      return logic.VudoModule.bufferArray(readback, numpy.uint8).copy()
+
+    random = numpy.random.default_rng(41)
+    alignment = max(int(deviceQueue.getHostPointerAlignment()), 4096)
+    aligned = logic.VudoModule.alignedEmpty((64,128,128), numpy.float32, alignment)
+    aligned[:] = random.random(aligned.shape, dtype=numpy.float32)
+    hostBuffer = vudo.hostMemoryBuffer(aligned)
+    self.assertEqual(hostBuffer.isImported(), bool(deviceQueue.hasExternalMemoryHost()))
+    self.assertTrue(numpy.array_equal(deviceBytes(hostBuffer), aligned.reshape(-1).view(numpy.uint8)))
+
+    # off the alignment, and in many small chunks
+    unaligned = aligned.reshape(-1)[1:]
+    pointer = cppyy.ll.cast["void*"](unaligned.ctypes.data)
+    hostBuffer = cppyy.gbl.vudo.HostMemoryBuffer(deviceQueue, pointer, unaligned.nbytes, True, 1<<16)
+    self.assertFalse(hostBuffer.isImported())
+    self.assertTrue(numpy.array_equal(deviceBytes(hostBuffer), unaligned.view(numpy.uint8)))
+
+    dataArray = vtk.util.numpy_support.numpy_to_vtk(random.integers(0, 1000, 100003).astype(numpy.int16))
+    hostBuffer = vudo.hostMemoryBuffer(dataArray)
+    self.assertTrue(numpy.array_equal(deviceBytes(hostBuffer),
+                                      vtk.util.numpy_support.vtk_to_numpy(dataArray).view(numpy.uint8)))
+    hostBuffer = None
+
+    volume = logic.VudoModule.alignedEmpty((256,512,512), numpy.uint16, alignment)
+    volume[:] = 7
+    for allowImport in (False, True):
+      startTime = time.time()
+      hostBuffer = vudo.hostMemoryBuffer(volume, allowImport)
+      elapsed = time.time() - startTime
+      path = "imported" if hostBuffer.isImported() else "staged"
+      logging.info(f"{volume.nbytes >> 20} MiB {path} in {elapsed*1000:.1f} ms")
+      hostBuffer = None
+
+  def test_MemoryBudget(self):
+    """ Buffers are counted against their heap, an allocation over the budget
+    raises OutOfMemoryError, and filters split work that does not fit.
+    """
+    import cppyy
+    logic = VudoLogic()
+    vudo = logic.getVudo()
+    deviceQueue = vudo.getDeviceQueue()
+    logging.info(f"memory budget extension: {deviceQueue.hasMemoryBudget()}")
+    for heap in vudo.memoryReport():
+      logging.info(", ".join([f"{key} {value}" for key, value in heap.items()]))
+
+    hostVisible = cppyy.gbl.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | cppyy.gbl.VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    heap = deviceQueue.getMemoryHeapIndex(hostVisible)
+    allocated = deviceQueue.getAllocatedBytes(heap)
+    deviceQueue.resetPeakAllocatedBytes()
+    buffer = cppyy.gbl.vudo.ComputeBuffer(deviceQueue, 1<<20)
+    self.assertEqual(deviceQueue.getAllocatedBytes(heap), allocated + buffer.getAllocationSize())
+    self.assertGreaterEqual(buffer.getAllocationSize(), 1<<20)
+    buffer = None
+    self.assertEqual(deviceQueue.getAllocatedBytes(heap), allocated)
+    self.assertGreaterEqual(deviceQueue.getPeakAllocatedBytes(heap), allocated + (1<<20))
+
+    with self.assertRaises(cppyy.gbl.vudo.OutOfMemoryError):
+      cppyy.gbl.vudo.ComputeBuffer(deviceQueue, deviceQueue.getHeapHeadroom(heap) + (1<<20))
+
+    # pretend the budget is small
+    vudo.chunkLength = lambda count, *args, **kwargs: min(count, 1000)
+    random = numpy.random.default_rng(42)
+    volume = random.integers(0, 1000, (13,17,19), dtype=numpy.uint16)
+    thresholded = logic.thresholdArray(volume, 500, numpy.empty(volume.shape, numpy.float32), outsideValue=-1)
+    self.assertTrue(numpy.array_equal(thresholded, numpy.where(volume >= 500, volume, -1).astype(numpy.float32)))
+    floats = random.random((12,16,20), dtype=numpy.float32)
+    shift = numpy.eye(4)
+    shift[2,3] = 1
+    slabs = [(numpy.eye(4), floats.shape), (shift, (11,16,20))]
+    tiled = logic.resampleSlabs(floats, slabs, "nearest")
+    self.assertTrue(numpy.array_equal(tiled[0], floats))
+    self.assertTrue(numpy.array_equal(tiled[1], floats[1:]))
+
+  def test_Stencil(self):
+    """ Boundary modes, box and gradient stencils on known volumes, a box too
+    wide for shared memory, and the Gaussian against vtkImageGaussianSmooth
+    with bandwidth logged.
+    """
+    logic = VudoLogic()
+    constant = numpy.full((20,24,28), 5., dtype=numpy.float32)
+    for boundary in ("clamp", "mirror"):
+      self.assertTrue(numpy.allclose(logic.boxArray(constant, 2, boundary), 5.))
+    padded = logic.boxArray(constant, 1, "constant", 0.)
+    self.assertAlmostEqual(float(padded[10,12,0]), 5. * 2/3, places=5)
+    self.assertAlmostEqual(float(padded[10,12,14]), 5., places=5)
+
+    ramp = numpy.fromfunction(lambda k, j, i: 3. * i, (20,24,28), dtype=numpy.float32)
+    gradient = logic.gradientMagnitudeArray(ramp, spacing=(1.,1.,1.5))
+    self.assertTrue(numpy.allclose(gradient[:,:,1:-1], 2.))
+    self.assertTrue(numpy.allclose(logic.gradientMagnitudeArray(ramp, boundary="mirror")[:,:,0], 0.))
+
+    # a radius whose tile and halo (408x8x8 floats) no device has the shared memory for
+    radius = 200
+    noise = numpy.random.default_rng(31).random((6,8,40), dtype=numpy.float32)
+    padded = numpy.pad(noise, ((0,0),(0,0),(radius,radius)), mode="edge").astype(numpy.float64)
+    sums = numpy.concatenate((numpy.zeros((6,8,1)), numpy.cumsum(padded, axis=2)), axis=2)
+    reference = (sums[:,:,2*radius+1:] - sums[:,:,:-2*radius-1]) / (2*radius+1)
+    self.assertTrue(numpy.allclose(logic.boxArray(noise, (0,0,radius)), reference, atol=1e-5))
+
+    import SampleData
+    volumeNode = SampleData.downloadSample("MRHead")
+    for name, array in (("MRHead", slicer.util.arrayFromVolume(volumeNode)),
+                        ("synthetic 256^3", numpy.random.default_rng(0).random((256,256,256), dtype=numpy.float32))):
+      results = logic.benchmarkGaussian(array, 2.)
+      logging.info(f"gaussian sigma 2 {name}: " +
+                   ", ".join([f"{path} {seconds*1000:.1f} ms ({bandwidth:.2f} GB/s)" for path, (seconds, bandwidth) in results.items()]))
+
+  def test_ReducedPrecisionStencil(self):
+    """ int16 CT and uint8 labelmaps filtered on 8/16-bit storage agree with
+    the float32 path to float16 precision; both are timed.
+    """
+    logic = VudoLogic()
+    deviceQueue = logic.getVudo().getDeviceQueue()
+    logging.info(f"16-bit storage {deviceQueue.hasStorageBuffer16Bit()}, 8-bit storage {deviceQueue.hasStorageBuffer8Bit()}, "
+                 f"float16 {deviceQueue.hasShaderFloat16()}, int8 {deviceQueue.hasShaderInt8()}, int16 {deviceQueue.hasShaderInt16()}")
+    if not deviceQueue.hasReducedPrecision():
+      logging.info("no reduced precision on this device, skipping")
+      return
+
+    random = numpy.random.default_rng(43)
+    ct = random.integers(-1024, 3071, (40,48,56), dtype=numpy.int16)
+    reduced = logic.gaussianArray(ct, 1.5, reducedPrecision=True)
+    self.assertEqual(reduced.dtype, numpy.float16)
+    # float16 keeps 11 significant bits
+    self.assertTrue(numpy.allclose(reduced, logic.gaussianArray(ct, 1.5), rtol=2e-3, atol=2.))
+    gradient = logic.gradientMagnitudeArray(ct, reducedPrecision=True)
+    self.assertTrue(numpy.allclose(gradient, logic.gradientMagnitudeArray(ct), rtol=2e-3, atol=2.))
+
+    labels = random.integers(0, 5, (40,48,56), dtype=numpy.uint8)
+    reduced = logic.boxArray(labels, 1, "mirror", reducedPrecision=True)
+    self.assertTrue(numpy.allclose(reduced, logic.boxArray(labels, 1, "mirror"), rtol=1e-3, atol=1e-2))
+
+    volume = random.integers(-1024, 3071, (256,256,256), dtype=numpy.int16)
+    for reducedPrecision in (False, True):
+      logic.gaussianArray(volume, 2., reducedPrecision=reducedPrecision) # pipeline creation and allocation
+      seconds = min(timeit.repeat(lambda: logic.gaussianArray(volume, 2., reducedPrecision=reducedPrecision),
+                                  number=1, repeat=3))
+      logging.info(f"gaussian sigma 2 int16 256^3 {'reduced precision' if reducedPrecision else 'float32'}: {seconds*1000:.1f} ms")
+
+  def test_KernelVariants(self):
+    """ Every histogram variant in variants.txt is embedded or generated and
+    registered, and the histogram of each VTK scalar type, with and without a
+    segment mask, matches numpy.
+    """
+    import cppyy
+    import vtk
+    from vtk.util import numpy_support
+    logic = VudoLogic()
+    vudo = logic.getVudo()
+    variants = logic.getVariants()
+    histograms = variants.kernelVariants("histogram")
+    names = variants.variantNames("histogram")
+    self.assertEqual(len(names), 8)
+    self.assertTrue("histogram_int16_masked" in names)
+    masked = variants.optionBits("histogram", "MASKED")
+    for vtkScalarType in variants.scalarTypes("histogram"):
+      for options in (0, masked):
+        self.assertTrue(histograms.hasVariant(vtkScalarType, options))
+    self.assertFalse(histograms.hasVariant(vtk.VTK_DOUBLE, 0))
+    logging.info(f"histogram variants: {', '.join(names)}; "
+                 f"{histograms.getRegisteredCount()} generated at run time, the rest embedded")
+
+    random = numpy.random.default_rng(45)
+    shape = (30,40,50)
+    arrays = [
+      random.integers(0, 256, shape, dtype=numpy.uint8),
+      random.integers(-1024, 3072, shape, dtype=numpy.int16),
+      random.integers(0, 4096, shape, dtype=numpy.uint16),
+      # quarters, exact in float32 so the GPU and numpy bin them alike
+      (random.integers(-4096, 12288, shape) / 4.).astype(numpy.float32),
+    ]
+    segments = random.integers(0, 4, shape, dtype=numpy.uint32)
+    for array in arrays:
+      # power of two bin widths, so the float bin of every integer value is exact
+      valueRange = (0., 256.) if array.dtype == numpy.uint8 else (-1024., 3072.)
+      counts, edges = logic.histogramArray(array, 256, valueRange)
+      expected, expectedEdges = numpy.histogram(array, 256, valueRange)
+      self.assertTrue(numpy.array_equal(counts, expected))
+      self.assertTrue(numpy.allclose(edges, expectedEdges))
+      counts, edges = logic.histogramArray(array, 256, valueRange, segments, 0b10)
+      expected, expectedEdges = numpy.histogram(array[(segments & 0b10) != 0], 256, valueRange)
+      self.assertTrue(numpy.array_equal(counts, expected))
+
+    # a vtkDataArray picks its variant by its own scalar type
+    dataArray = numpy_support.numpy_to_vtk(arrays[1].reshape(-1), deep=True)
+    self.assertEqual(dataArray.GetDataType(), vtk.VTK_SHORT)
+    counts, edges = logic.histogramArray(dataArray, 64, (-1024., 3072.))
+    self.assertTrue(numpy.array_equal(counts, numpy.histogram(arrays[1], 64, (-1024., 3072.))[0]))
+
+  def test_VudoArray(self):
+    """ Fused VudoArray expressions match numpy, shared subexpressions and
+    new scalar values reuse one compiled kernel, and results go to volumes.
+    """
+    logic = VudoLogic()
+    arrays = logic.getArrays()
+    random = numpy.random.default_rng(46)
+    shape = (30,40,50)
+    ct = random.integers(-1024, 3072, shape, dtype=numpy.int16)
+    other = random.normal(0., 100., shape).astype(numpy.float32)
+    a = arrays.array(ct)
+    b = arrays.array(other)
+
+    fused = (a*2 + b > 500.).numpy()
+    self.assertEqual(fused.dtype, numpy.bool_)
+    self.assertTrue(numpy.array_equal(fused, ct.astype(numpy.float32)*2 + other > 500.))
+
+    kernelCount = len(arrays.kernels)
+    for threshold in (0., 250., 1000.):
+      fused = (a*2 + b > threshold).numpy()
+      self.assertTrue(numpy.array_equal(fused, ct.astype(numpy.float32)*2 + other > threshold))
+    self.assertEqual(len(arrays.kernels), kernelCount)
+
+    scaled = a.astype(numpy.float32) / 4096.
+    expression = arrays.where((scaled > 0.1) & (scaled < 0.5), scaled * scaled, -scaled).clip(-0.2, 0.2)
+    expected = ct.astype(numpy.float32) / 4096.
+    expected = numpy.clip(numpy.where((expected > 0.1) & (expected < 0.5), expected * expected, -expected), -0.2, 0.2)
+    self.assertTrue(numpy.allclose(expression.numpy(), expected, atol=1e-6))
+
+    # narrow outputs are packed, integer casts truncate like numpy
+    labels = ((a + 1024) // 512).astype(numpy.uint8)
+    self.assertTrue(numpy.array_equal(labels.numpy(), ((ct.astype(numpy.int32) + 1024) // 512).astype(numpy.uint8)))
+    # an evaluated array is an input to later expressions
+    self.assertTrue(numpy.array_equal((labels == 3).numpy(), ((ct.astype(numpy.int32) + 1024) // 512) == 3))
+
+    volumeNode = slicer.util.addVolumeFromArray(ct, name="VudoArrayInput")
+    volumeNode.SetSpacing(0.5, 0.75, 2.)
+    mask = (arrays.fromVolume(volumeNode) > 100).toVolume(name="VudoArrayMask")
+    self.assertEqual(mask.GetSpacing(), (0.5, 0.75, 2.))
+    self.assertTrue(numpy.array_equal(slicer.util.arrayFromVolume(mask), (ct > 100).astype(numpy.uint8)))
+
+    volume = random.integers(-1024, 3072, (256,256,256), dtype=numpy.int16)
+    bigA, bigB = arrays.array(volume), arrays.array(volume.astype(numpy.float32))
+    (bigA*2 + bigB > 500.).numpy() # compilation and upload
+    fusedSeconds = min(timeit.repeat(lambda: (bigA*2 + bigB > 500.).numpy(), number=1, repeat=3))
+    floatVolume = volume.astype(numpy.float32)
+    numpySeconds = min(timeit.repeat(lambda: volume*2 + floatVolume > 500., number=1, repeat=3))
+    logging.info(f"(a*2+b > t) on 256^3: fused {fusedSeconds*1000:.1f} ms, numpy {numpySeconds*1000:.1f} ms")
+
+  def test_VolumeLayout(self):
+    """ Stencils give the same result in every storage layout, on a volume that
+    is not a whole number of bricks or tiles, and the layouts are timed.
+    """
+    logic = VudoLogic()
+    volume = numpy.random.default_rng(44).random((37,45,70), dtype=numpy.float32)
+    for layout in ("bricked", "morton"):
+      self.assertTrue(numpy.array_equal(logic.boxArray(volume, 0, layout=layout), volume))
+      self.assertTrue(numpy.allclose(logic.gaussianArray(volume, 1.5, "mirror", layout=layout),
+                                     logic.gaussianArray(volume, 1.5, "mirror"), atol=1e-6))
+      self.assertTrue(numpy.allclose(logic.gradientMagnitudeArray(volume, layout=layout),
+                                     logic.gradientMagnitudeArray(volume), atol=1e-6))
+
+    large = numpy.random.default_rng(0).random((256,256,256), dtype=numpy.float32)
+    for tileSize in ((8,8,8), (32,4,2)):
+      results = logic.benchmarkLayouts(large, 2., tileSize)
+      logging.info(f"gaussian sigma 2 256^3 tile {tileSize}: " +
+                   ", ".join([f"{layout} {seconds*1000:.1f} ms" for layout, seconds in results.items()]))
+
+  def test_SlabPipeline(self):
+    """ NRRD and NIfTI files streamed slab by slab through stencils and a
+    threshold, as VudoCLI does, match filtering the whole array, and the
+    results keep the input geometry.
+    """
+    import cppyy
+    import tempfile
+    logic = VudoLogic()
+    random = numpy.random.default_rng(49)
+    ct = random.integers(-1024, 3071, (40,48,56), dtype=numpy.int16)
+    volumeNode = slicer.util.addVolumeFromArray(ct, name="SlabPipelineInput")
+    volumeNode.SetSpacing(0.8, 0.9, 2.5)
+    volumeNode.SetOrigin(-10., 20., 35.)
+    volumeNode.SetIJKToRASDirections([[0.,1.,0.], [-1.,0.,0.], [0.,0.,1.]])
+
+    with tempfile.TemporaryDirectory() as directory:
+      for extension in ("nrrd", "nii"):
+        inputPath = os.path.join(directory, f"input.{extension}")
+        self.assertTrue(slicer.util.saveNode(volumeNode, inputPath, {"useCompression": 0}))
+        for stages, expected, dtype in (
+            ("threshold", numpy.clip(numpy.where(ct >= 500, ct, -1024), 0, 255).astype(numpy.uint8), numpy.uint8),
+            ("gaussian,gradient", logic.gradientMagnitudeArray(logic.gaussianArray(ct, 1.5), spacing=(2.5,0.9,0.8)), numpy.float32)):
+          slabPipeline = logic.slabPipeline()
+          if stages == "threshold":
+            slabPipeline.addThreshold(500., -1024., 1., 0., logic.VudoModule.scalarType(numpy.dtype(dtype)))
+          else:
+            slabPipeline.addGaussian(1.5, 1.5, 1.5)
+            slabPipeline.addGradientMagnitude()
+          reader = cppyy.gbl.vudo.VolumeFileReader(inputPath)
+          outputInfo = cppyy.gbl.vudo.VolumeFileInfo(reader.getInfo())
+          outputInfo.scalarType = slabPipeline.getOutputType(outputInfo.scalarType)
+          outputPath = os.path.join(directory, f"output.{extension}")
+          writer = cppyy.gbl.vudo.VolumeFileWriter(outputPath, outputInfo)
+          # 7 slices a slab leaves a short last slab
+          slabPipeline.run(reader, writer, 7)
+          writer.close()
+          self.assertEqual(slabPipeline.getSlabCount(), 6)
+          logging.info(f"{stages} {extension}: {slabPipeline.getThroughput():.1f} MB/s end to end")
+          del reader, writer
+
+          outputNode = slicer.util.loadVolume(outputPath)
+          result = slicer.util.arrayFromVolume(outputNode)
+          self.assertEqual(result.dtype, numpy.dtype(dtype))
+          self.assertTrue(numpy.allclose(result, expected, rtol=1e-5, atol=1e-3))
+          inputMatrix, outputMatrix = vtk.vtkMatrix4x4(), vtk.vtkMatrix4x4()
+          volumeNode.GetIJKToRASMatrix(inputMatrix)
+          outputNode.GetIJKToRASMatrix(outputMatrix)
+          for row in range(3):
+            for column in range(4):
+              self.assertAlmostEqual(inputMatrix.GetElement(row, column), outputMatrix.GetElement(row, column), places=4)
+          slicer.mrmlScene.RemoveNode(outputNode)
+
+  def test_MappedVolume(self):
+    """ A memory mapped raw file, big endian and after a header, reads the same
+    regions as numpy and streams through a slab pipeline like the file reader,
+    holding only about the prefetch window of the mapping's pages.
+    """
+    import cppyy
+    import re
+    import resource
+    import tempfile
+    logic = VudoLogic()
+    random = numpy.random.default_rng(50)
+
+    def mappedResidentBytes(path):
+      """The pages of the mappings of path the process holds (Rss in /proc/self/smaps), None without it"""
+      if not os.path.exists("/proc/self/smaps"):
+        return None
+      path = os.path.realpath(path)
+      residentBytes, inMapping = 0, False
+      with open("/proc/self/smaps") as smaps:
+        for line in smaps:
+          if re.match(r"^[0-9a-f]+-[0-9a-f]+ ", line):
+            inMapping = line.split(maxsplit=5)[-1].strip() == path
+          elif inMapping and line.startswith("Rss:"):
+            residentBytes += int(line.split()[1]) * 1024
+      return residentBytes
+    volume = random.integers(0, 4096, (96,64,80), dtype=numpy.uint16)
+
+    with tempfile.TemporaryDirectory() as directory:
+      rawPath = os.path.join(directory, "volume.raw")
+      with open(rawPath, "wb") as rawFile:
+        rawFile.write(bytes(100))
+        rawFile.write(volume.astype(">u2").tobytes())
+      sliceBytes = 64 * 80 * 2
+      mappedVolume = logic.mappedVolume(rawPath, volume.shape, numpy.uint16, offset=100, bigEndian=True,
+                                        prefetchBytes=8 * sliceBytes)
+      for start, shape in (((0,0,0), volume.shape), ((90,10,5), (6,20,70)), ((3,63,79), (1,1,1))):
+        region = logic.mappedRegionArray(mappedVolume, start, shape)
+        k, j, i = start
+        self.assertTrue(numpy.array_equal(region, volume[k:k+shape[0], j:j+shape[1], i:i+shape[2]]))
+
+      nrrdPath = os.path.join(directory, "volume.nrrd")
+      volumeNode = slicer.util.addVolumeFromArray(volume, name="MappedVolumeInput")
+      self.assertTrue(slicer.util.saveNode(volumeNode, nrrdPath, {"useCompression": 0}))
+      slicer.mrmlScene.RemoveNode(volumeNode)
+      results = []
+      for mapped in (False, True):
+        source = logic.mappedVolume(nrrdPath, prefetchBytes=8 * sliceBytes) if mapped else cppyy.gbl.vudo.VolumeFileReader(nrrdPath)
+        slabPipeline = logic.slabPipeline()
+        slabPipeline.addBox(1, 1, 1)
+        outputInfo = cppyy.gbl.vudo.VolumeFileInfo(source.getInfo())
+        outputInfo.scalarType = slabPipeline.getOutputType(outputInfo.scalarType)
+        outputPath = os.path.join(directory, f"box{int(mapped)}.nrrd")
+        writer = cppyy.gbl.vudo.VolumeFileWriter(outputPath, outputInfo)
+        slabPipeline.run(source, writer, 4)
+        writer.close()
+        del writer
+        if mapped:
+          self.assertGreater(source.getReleasedBytes(), 0)
+          logging.info(f"mapped box: {slabPipeline.getThroughput():.1f} MB/s, {source.getStalledSlices()} of 96 slices read before prefetch, "
+                       f"window at most {source.getMaxWindowBytes()} bytes")
+          residentBytes = mappedResidentBytes(nrrdPath)
+          if residentBytes is None:
+            logging.info("no /proc/self/smaps, resident pages of the mapping not checked")
+          else:
+            # the window ahead plus a slab and its halo, the pages rounding them out and
+            # the 64 KB the kernel may map around a fault; the whole volume is 96 slices
+            self.assertLessEqual(residentBytes, (8 + 4 + 2) * sliceBytes + 2 * resource.getpagesize() + (64 << 10))
+        del source
+        outputNode = slicer.util.loadVolume(outputPath)
+        results.append(slicer.util.arrayFromVolume(outputNode).copy())
+        slicer.mrmlScene.RemoveNode(outputNode)
+      self.assertTrue(numpy.array_equal(results[0], results[1]))
+      self.assertTrue(numpy.allclose(results[1], logic.boxArray(volume, 1), rtol=1e-5, atol=1e-3))
+
+  def test_Resample(self):
+    """ Identity and integer shifts reproduce the input for every interpolation,
+    a slab deeper than the z dispatch limit is complete, and three orthogonal slices resampled in one submission match the array.
+    """
+    logic = VudoLogic()
+    volume = numpy.random.default_rng(1).random((12,16,20), dtype=numpy.float32)
+    for interpolation in ("nearest", "linear", "sinc"):
+      resampled = logic.resampleArray(volume, numpy.eye(4), volume.shape, interpolation)
+      self.assertTrue(numpy.allclose(resampled, volume, atol=1e-4))
+    shift = numpy.eye(4)
+    shift[0,3] = 2 # output i reads input i+2
+    shifted = logic.resampleArray(volume, shift, volume.shape, "nearest", backgroundValue=-1.)
+    self.assertTrue(numpy.array_equal(shifted[:,:,:-2], volume[:,:,2:]))
+    self.assertTrue(numpy.all(shifted[:,:,-1] == -1.))
+
+    # deeper than the 65535 workgroups a dispatch is guaranteed along z
+    stretch = numpy.eye(4)
+    stretch[2,2] = 2.**-13 # output k reads input k/8192, exactly in float
+    column = logic.resampleArray(volume, stretch, (70000,1,1), "nearest")
+    nearest = numpy.floor(numpy.arange(70000) / 8192. + 0.5).astype(int)
+    self.assertTrue(numpy.array_equal(column[:,0,0], volume[nearest,0,0]))
+
+    import SampleData
+    mrHead = slicer.util.arrayFromVolume(SampleData.downloadSample("MRHead"))
+    depth, height, width = mrHead.shape
+    axial = numpy.eye(4)
+    axial[2,3] = depth // 2
+    coronal = numpy.array([[1,0,0,0], [0,0,0,height//2], [0,1,0,0], [0,0,0,1]], dtype=float)
+    sagittal = numpy.array([[0,0,0,width//2], [1,0,0,0], [0,1,0,0], [0,0,0,1]], dtype=float)
+    slabs = [(axial, (1,height,width)), (coronal, (1,depth,width)), (sagittal, (1,depth,height))]
+    slices = logic.resampleSlabs(mrHead, slabs, "nearest")
+    self.assertTrue(numpy.array_equal(slices[0][0], mrHead[depth//2]))
+    self.assertTrue(numpy.array_equal(slices[1][0], mrHead[:,height//2,:]))
+    self.assertTrue(numpy.array_equal(slices[2][0], mrHead[:,:,width//2]))
+    seconds = min(timeit.repeat(lambda: logic.resampleSlabs(mrHead, slabs, "linear", upload=False), number=1, repeat=10))
+    logging.info(f"three slice views resampled in {seconds*1000:.2f} ms ({1/seconds:.0f} refreshes per second)")
+
+  def test_RayCast(self):
+    """ Check a ray through a known block against a CPU composite, check that
+    empty space skipping keeps a voxel on a brick face, then ray cast
+    the Mandelbrot volume where it was generated and compare the time with
+    reading the whole volume back for display.
+    """
+    import cppyy
+    import VudoLib.Progressive
+    logic = VudoLogic()
+    vudoInstance = logic.getVudo()
+    deviceQueue = vudoInstance.getDeviceQueue()
+    shaderPath = ""
+    if not vudoInstance.hasEmbeddedShader("Mandelbrot"):
+      sourceDir = os.path.split(slicer.modules.vudo.path)[0] + "/../Experiments/Mandelbrot"
+      shaderPath = sourceDir+"/Mandelbrot.spv"
+      vudoInstance.compileGLSL(sourceDir+"/Mandelbrot.comp.glsl", shaderPath)
+    # the central ray through a block of ones, composited front to back on the CPU as the shader does:
+    # samples every half voxel from where the ray enters the volume box, values 0, 0.5 and 1 (at the
+    # block faces and inside) picking table entries 0, 1 and 2, opacities per unit length
+    blockVolume = cppyy.gbl.vudo.ComputeBuffer(deviceQueue, 4 * 32**3)
+    block = logic.VudoModule.bufferArray(blockVolume).reshape((32,32,32))
+    block[:] = 0.
+    block[8:24,8:24,8:24] = 1.
+    blockTable = numpy.array([[0., 0., 0., 0.], [0., 1., 0., 0.2], [1., 0.5, 0.25, 0.1]], dtype=numpy.float32)
+    rayCaster = cppyy.gbl.vudo.RayCaster(deviceQueue, blockVolume, 32, 32, 32, 1, 9, 9,
+                                         vudoInstance.libraryShaderPath("raycast"))
+    rayCaster.setTransferFunction(blockTable.reshape(-1), 3, 0., 1.)
+    rayCaster.setCamera(15.5, 15.5, -100., 15.5, 15.5, 15.5, 0., -1., 0., 30.)
+    image = logic.rayCastImage(rayCaster)
+    color, stepSize = numpy.zeros(4), 0.5
+    for z in numpy.arange(-0.5, 31.5, stepSize):
+      base = int(numpy.floor(z))
+      fraction = z - base
+      value = (1 - fraction) * block[min(max(base, 0), 31), 15, 15] + fraction * block[min(max(base + 1, 0), 31), 15, 15]
+      red, green, blue, opacity = blockTable[int(value * 2 + 0.5)]
+      alpha = 1 - (1 - opacity) ** stepSize
+      color[:3] += (1 - color[3]) * alpha * numpy.array([red, green, blue])
+      color[3] += (1 - color[3]) * alpha
+      if color[3] >= 0.99:
+        break
+    self.assertGreater(color[3], 0.5)
+    self.assertTrue(numpy.allclose(image[4,4], numpy.round(color * 255), atol=2), f"{image[4,4]} != {color * 255}")
+
+    # one bright voxel just inside brick (0,0,1), next to the empty bricks the central ray runs between:
+    # skipping over empty bricks must not lose the samples that read it
+    block[:] = 0.
+    block[16,15,15] = 1.
+    brightTable = numpy.array([[0., 0., 0., 0.], [1., 1., 1., 1.]], dtype=numpy.float32)
+    rayCaster.setTransferFunction(brightTable.reshape(-1), 2, 0., 1./16)
+    unskipped = logic.rayCastImage(rayCaster).copy()
+    self.assertGreater(unskipped[4,4,3], 0)
+    blockBricks = cppyy.gbl.vudo.BrickMap(deviceQueue, 32, 32, 32, 16,
+                                          vudoInstance.libraryShaderPath("brickOccupancy"),
+                                          vudoInstance.libraryShaderPath("brickCompact"))
+    rayCaster.setEmptySpaceSkipping(blockBricks, 0.)
+    skipped = logic.rayCastImage(rayCaster)
+    self.assertTrue(numpy.allclose(skipped, unskipped, atol=1), f"{skipped[4,4]} != {unskipped[4,4]}")
+    del rayCaster, blockBricks
+
+    progressive = VudoLib.Progressive.ProgressiveVolume(vudoInstance, "Mandelbrot", (512,512,512), shaderPath=shaderPath)
+    progressive.dispatch.runToCompletion()
+
+    # iteration counts 0..128: transparent up to 8, then blue to white with rising opacity
+    entries = 256
+    ramp = numpy.linspace(0., 1., entries, dtype=numpy.float32)
+    table = numpy.stack([ramp, ramp, numpy.ones(entries, dtype=numpy.float32), 0.05 * ramp], axis=1)
+    table[:entries//16, 3] = 0.
+    brickMap = cppyy.gbl.vudo.BrickMap(deviceQueue, 512, 512, 512, 16,
+                                       vudoInstance.libraryShaderPath("brickOccupancy"),
+                                       vudoInstance.libraryShaderPath("brickCompact"))
+
+    timings = {}
+    for size in (512, 1024):
+      rayCaster = cppyy.gbl.vudo.RayCaster(deviceQueue, progressive.buffer, 512, 512, 512, 4, size, size,
+                                           vudoInstance.libraryShaderPath("raycast"))
+      rayCaster.setTransferFunction(table.reshape(-1), entries, 0., 128.)
+      rayCaster.setEmptySpaceSkipping(brickMap, 8.)
+      image = logic.rayCastImage(rayCaster)
+      self.assertEqual(image.shape, (size, size, 4))
+      self.assertGreater(image[:,:,3].max(), 0)
+      timings[f"ray cast {size}^2"] = min(timeit.repeat(lambda: logic.rayCastImage(rayCaster), number=1, repeat=5))
+      del rayCaster
+    timings["full readback"] = min(timeit.repeat(lambda: progressive.array(1).copy(), number=1, repeat=2))
+    logging.info("Mandelbrot display: " + ", ".join([f"{path} {seconds*1000:.1f} ms" for path, seconds in timings.items()]))
+    vudoInstance.drainDiagnostics(deviceQueue)
+
+  def test_ConnectedComponents(self):
+    """ Islands that only touch along edges or corners merge with 18 or 26
+    connectivity, different labels never merge, and the counts are right.
+    """
+    import collections, itertools
+    logic = VudoLogic()
+    labelArray = numpy.zeros((10,10,10), dtype=numpy.uint8)
+    labelArray[1:3,1:3,1:3] = 1 # 8 voxel cube
+    labelArray[0,0,0] = 1       # touches the cube at a corner only
+    labelArray[3,2,2] = 1       # touches the cube at a face
+    labelArray[3,3,3] = 1       # touches (3,2,2) at an edge, the cube at a corner
+    labelArray[3,1,3] = 1       # touches (3,2,2) at an edge
+    labelArray[6:9,6:9,6:9] = 2 # 27 voxel cube of another label
+    labelArray[5,5,5] = 1       # corner neighbour of the other label
+
+    def floodFill(connectivity):
+      """Component of each voxel and component sizes, by breadth first search"""
+      offsets = [offset for offset in itertools.product((-1, 0, 1), repeat=3)
+                 if 0 < sum(map(abs, offset)) <= {6: 1, 18: 2, 26: 3}[connectivity]]
+      components = numpy.zeros(labelArray.shape, dtype=numpy.int32)
+      sizes = []
+      for seed in zip(*numpy.nonzero(labelArray)):
+        if components[seed]:
+          continue
+        sizes.append(0)
+        components[seed] = len(sizes)
+        queue = collections.deque([seed])
+        while queue:
+          voxel = queue.popleft()
+          sizes[-1] += 1
+          for offset in offsets:
+            neighbour = tuple(numpy.add(voxel, offset))
+            if (all(0 <= index < extent for index, extent in zip(neighbour, labelArray.shape))
+                and labelArray[neighbour] == labelArray[voxel] and not components[neighbour]):
+              components[neighbour] = len(sizes)
+              queue.append(neighbour)
+      return components, sizes
+
+    expected = {6: [1, 1, 1, 1, 9, 27], 18: [1, 1, 11, 27], 26: [1, 12, 27]}
+    for connectivity, sizes in expected.items():
+      components, floodSizes = floodFill(connectivity)
+      self.assertEqual(sorted(floodSizes), sizes)
+      labels, counts = logic.connectedComponentsArray(labelArray, connectivity)
+      self.assertEqual(sorted(counts[1:].tolist()), sizes)
+      self.assertTrue(numpy.array_equal(labels > 0, labelArray > 0))
+      # the same partition: each flood fill component has one label, and no label spans two
+      pairs = numpy.unique(numpy.stack([components[labelArray > 0], labels[labelArray > 0]]), axis=1)
+      self.assertEqual(pairs.shape[1], len(sizes))
+      self.assertEqual(len(numpy.unique(pairs[0])), len(sizes))
+      self.assertEqual(len(numpy.unique(pairs[1])), len(sizes))
+    self.assertEqual(int(logic.removeIslands(labelArray, 2, 26).sum()), 12 + 2 * 27)
+
+    import SampleData
+    mrHead = slicer.util.arrayFromVolume(SampleData.downloadSample("MRHead"))
+    mask = (mrHead > 50).astype(numpy.uint8)
+    startTime = time.time()
+    labels, counts = logic.connectedComponentsArray(mask, 6, maxComponents=mask.size)
+    logging.info(f"{len(counts)-1} components in MRHead > 50 labelled in {time.time()-startTime:.3f} s")
+    self.assertEqual(int(counts.sum()), int(mask.sum()))
+
+  def test_Morphology(self):
+    """ Packed morphology of several segments matches a numpy reference
+    and leaves the segments outside the mask alone.
+    """
+    logic = VudoLogic()
+    VudoModule = logic.VudoModule
+    random = numpy.random.default_rng(35)
+    masks = [random.random((12,20,24)) > threshold for threshold in (0.3, 0.6, 0.9)]
+    masks.append(numpy.zeros((12,20,24), dtype=bool))
+    masks[3][6,10,12] = True
+    packed = VudoModule.packSegments(masks)
+
+    def reference(bits, dilate, offsets):
+      radius = numpy.abs(numpy.array(offsets)).max(axis=0)
+      padded = numpy.pad(bits, [(r, r) for r in radius], mode="edge")
+      result = numpy.zeros_like(bits) if dilate else numpy.full_like(bits, 0xffffffff)
+      for k, j, i in offsets:
+        shifted = padded[radius[0]+k:radius[0]+k+bits.shape[0],
+                         radius[1]+j:radius[1]+j+bits.shape[1],
+                         radius[2]+i:radius[2]+i+bits.shape[2]]
+        result = result | shifted if dilate else result & shifted
+      return result
+
+    radius = (1, 2, 2)
+    ball = [(k, j, i) for k in range(-1, 2) for j in range(-2, 3) for i in range(-2, 3)
+            if (k/radius[0])**2 + (j/radius[1])**2 + (i/radius[2])**2 <= 1]
+    box = [(k, j, i) for k in range(-1, 2) for j in range(-2, 3) for i in range(-2, 3)]
+    for element, offsets in (("ball", ball), ("box", box)):
+      eroded = reference(packed, False, offsets)
+      dilated = reference(packed, True, offsets)
+      self.assertTrue(numpy.array_equal(logic.morphologyArray(packed, "erode", radius, element), eroded))
+      self.assertTrue(numpy.array_equal(logic.morphologyArray(packed, "dilate", radius, element), dilated))
+      self.assertTrue(numpy.array_equal(logic.morphologyArray(packed, "open", radius, element),
+                                        reference(eroded, True, offsets)))
+      self.assertTrue(numpy.array_equal(logic.morphologyArray(packed, "close", radius, element),
+                                        reference(dilated, False, offsets)))
+
+    # only segment 3, a single voxel, grows into the ball
+    grown = logic.morphologyArray(packed, "dilate", radius, "ball", segmentMask=1 << 3)
+    self.assertEqual(int(VudoModule.unpackSegment(grown, 3).sum()), len(ball))
+    self.assertTrue(numpy.array_equal(grown & 0x7, packed & 0x7))
+
+    # an 8^3 tile with a halo of 12 needs 128 KiB, more than any device's shared memory
+    radius = (12, 12, 12)
+    ball = [(k, j, i) for k in range(-12, 13) for j in range(-12, 13) for i in range(-12, 13)
+            if (k/radius[0])**2 + (j/radius[1])**2 + (i/radius[2])**2 <= 1]
+    self.assertTrue(numpy.array_equal(logic.morphologyArray(packed, "dilate", radius, "ball"),
+                                      reference(packed, True, ball)))
+
+  def test_IncrementalMorphology(self):
+    """ After a local edit, incremental morphology recomputes only the bricks
+    around it, found from the edited extent or by a GPU diff, and matches a
+    full recomputation; both are timed.
+    """
+    logic = VudoLogic()
+    fullLogic = VudoLogic()
+    random = numpy.random.default_rng(48)
+    shape = (128,128,128)
+    packed = logic.VudoModule.packSegments([random.random(shape) > threshold for threshold in (0.8, 0.95)])
+
+    for operation, radius in (("dilate", 2), ("open", (1,2,2))):
+      logic.morphologyArray(packed, operation, radius, incremental=True)
+      self.assertFalse(logic.morphologyFilter.wasIncremental())
+
+      # a painted block, given by its extent (i0, i1, j0, j1, k0, k1)
+      edited = packed.copy()
+      edited[60:64, 40:45, 50:53] ^= 0b11
+      result = logic.morphologyArray(edited, operation, radius, incremental=True, dirtyExtent=(50,52,40,44,60,63))
+      self.assertTrue(logic.morphologyFilter.wasIncremental())
+      self.assertTrue(numpy.array_equal(result, fullLogic.morphologyArray(edited, operation, radius)))
+      dirtyBricks = logic.dirtyBricks
+      self.assertLess(dirtyBricks.getActiveBrickCount(), 0.1 * dirtyBricks.getBrickCount())
+
+      # an erased stroke found by comparing with the previous upload on the GPU
+      edited[5:7, 80:100, 10:12] = 0
+      result = logic.morphologyArray(edited, operation, radius, incremental=True)
+      self.assertTrue(logic.morphologyFilter.wasIncremental())
+      self.assertTrue(numpy.array_equal(result, fullLogic.morphologyArray(edited, operation, radius)))
+      logging.info(f"incremental {operation}: {dirtyBricks.getActiveBrickCount()} of {dirtyBricks.getBrickCount()} bricks recomputed")
+      packed = edited
+
+    # a box along three axes is three passes and runs in full
+    logic.morphologyArray(packed, "dilate", 1, "box", incremental=True)
+    logic.morphologyArray(packed, "dilate", 1, "box", incremental=True)
+    self.assertFalse(logic.morphologyFilter.wasIncremental())
+
+    logic.morphologyArray(packed, "dilate", 2, incremental=True)
+    def edit():
+      packed[60:64, 40:45, 50:53] ^= 0b1
+      return logic.morphologyArray(packed, "dilate", 2, incremental=True, dirtyExtent=(50,52,40,44,60,63))
+    incrementalSeconds = min(timeit.repeat(edit, number=1, repeat=3))
+    fullSeconds = min(timeit.repeat(lambda: fullLogic.morphologyArray(packed, "dilate", 2), number=1, repeat=3))
+    logging.info(f"dilate 128^3 after a small edit: incremental {incrementalSeconds*1000:.1f} ms, full {fullSeconds*1000:.1f} ms")
+
+  def test_MarchingCubes(self):
+    """ The surface of a ball labelmap is closed, consistently wound with
+    outward normals and encloses about the ball's volume.
+    """
+    logic = VudoLogic()
+    k, j, i = numpy.indices((40,48,56))
+    center = numpy.array((20., 24., 28.))
+    labelArray = numpy.zeros((40,48,56), dtype=numpy.uint8)
+    labelArray[(k-20)**2 + (j-24)**2 + (i-28)**2 <= 15**2] = 3
+    labelArray[2:6,2:6,2:6] = 5 # another label, not part of the surface
+
+    points, normals, triangles = logic.surfaceArrays(labelArray, label=3)
+    self.assertGreater(len(triangles), 0)
+    self.assertTrue(numpy.all(triangles < len(points)))
+
+    # welded and closed: every directed edge once, and its reverse once
+    edges = numpy.concatenate([triangles[:,[0,1]], triangles[:,[1,2]], triangles[:,[2,0]]])
+    edgeKeys = edges[:,0].astype(numpy.int64) * len(points) + edges[:,1]
+    reverseKeys = edges[:,1].astype(numpy.int64) * len(points) + edges[:,0]
+    self.assertEqual(len(numpy.unique(edgeKeys)), len(edgeKeys))
+    self.assertTrue(numpy.all(numpy.isin(reverseKeys, edgeKeys)))
+
+    # outward normals and winding, and the enclosed volume (points are i,j,k)
+    radial = points - center[::-1]
+    self.assertGreater(numpy.mean(numpy.sum(normals * radial, axis=1) > 0), 0.99)
+    p0, p1, p2 = points[triangles[:,0]], points[triangles[:,1]], points[triangles[:,2]]
+    volume = numpy.sum(numpy.cross(p0 - center[::-1], p1 - center[::-1]) * (p2 - center[::-1])) / 6
+    ballVolume = 4. / 3. * numpy.pi * 15**3
+    self.assertLess(abs(volume - ballVolume) / ballVolume, 0.1)
+
+    # in RAS the winding still agrees with the normals, also when IJK to RAS mirrors
+    from vtk.util import numpy_support
+    volumeNode = slicer.util.addVolumeFromArray(labelArray)
+    for directions in ([[-1.,0.,0.], [0.,-1.,0.], [0.,0.,1.]], [[-1.,0.,0.], [0.,1.,0.], [0.,0.,1.]]):
+      volumeNode.SetIJKToRASDirections(directions)
+      surface = logic.surfacePolyData(volumeNode, label=3)
+      rasPoints = numpy_support.vtk_to_numpy(surface.GetPoints().GetData())
+      rasNormals = numpy_support.vtk_to_numpy(surface.GetPointData().GetNormals())
+      rasTriangles = numpy_support.vtk_to_numpy(surface.GetPolys().GetData()).reshape(-1,4)[:,1:]
+      p0, p1, p2 = rasPoints[rasTriangles[:,0]], rasPoints[rasTriangles[:,1]], rasPoints[rasTriangles[:,2]]
+      faceNormals = numpy.cross(p1 - p0, p2 - p0)
+      self.assertGreater(numpy.mean(numpy.sum(faceNormals * rasNormals[rasTriangles[:,0]], axis=1) > 0), 0.99)
+      rasCenter = rasPoints.mean(axis=0)
+      volume = numpy.sum(numpy.cross(p0 - rasCenter, p1 - rasCenter) * (p2 - rasCenter)) / 6
+      self.assertLess(abs(volume - ballVolume) / ballVolume, 0.1)
+    slicer.mrmlScene.RemoveNode(volumeNode)
+
+    import SampleData
+    mrHead = SampleData.downloadSample("MRHead")
+    startTime = time.time()
+    surface = logic.surfacePolyData(mrHead, isovalue=50)
+    logging.info(f"MRHead isosurface of {surface.GetNumberOfPolys()} triangles in {time.time()-startTime:.3f} s")
+    self.assertGreater(surface.GetNumberOfPolys(), 0)
+
+  def test_Primitives(self):
+    """ Scan, compaction and radix sort match numpy, including scans
+    with more than one level of blocks.
+    """
+    import cppyy
+    import VudoLib.Primitives
+    logic = VudoLogic()
+    primitives = VudoLib.Primitives.Primitives(logic.getVudo())
+    random = numpy.random.default_rng(37)
+
+    for size in (1, 1000, 1025, 3000017):
+      array = random.integers(0, 100, size, dtype=numpy.uint32)
+      expected = numpy.concatenate(([0], numpy.cumsum(array, dtype=numpy.uint32)[:-1]))
+      for algorithm in ("lookback", "reduce"):
+        self.assertTrue(numpy.array_equal(primitives.scanArray(array, algorithm), expected))
+
+    values = random.integers(0, 1<<32, 100003, dtype=numpy.uint32)
+    flags = random.integers(0, 3, values.size, dtype=numpy.uint32)
+    self.assertTrue(numpy.array_equal(primitives.compactArray(values, flags), values[flags != 0]))
+    self.assertTrue(numpy.array_equal(primitives.compactArray(flags=flags), numpy.flatnonzero(flags)))
+    self.assertTrue(numpy.array_equal(primitives.compactArray(flags), flags[flags != 0]))
+
+    for keyBits, size in ((32, 100003), (12, 5000)):
+      keys = random.integers(0, 1<<keyBits, size, dtype=numpy.uint32)
+      indices = numpy.arange(size, dtype=numpy.uint32)
+      sortedKeys, sortedIndices = primitives.sortArray(keys, indices, keyBits)
+      order = numpy.argsort(keys, kind="stable")
+      self.assertTrue(numpy.array_equal(sortedKeys, keys[order]))
+      self.assertTrue(numpy.array_equal(sortedIndices, order))
+    self.assertTrue(numpy.array_equal(primitives.sortArray(keys), numpy.sort(keys)))
+    properties = cppyy.gbl.VkPhysicalDeviceProperties()
+    cppyy.gbl.vkGetPhysicalDeviceProperties(primitives.deviceQueue.getPhysicalDevice(), properties)
+    workgroupSize = primitives.radixSort(16).getWorkgroupSize()
+    self.assertLessEqual(cppyy.gbl.vudo.RadixSort.getSharedMemorySize(workgroupSize),
+                         properties.limits.maxComputeSharedMemorySize)
+
+    for name, throughputs in primitives.benchmark(sizes=(1<<20, 1<<24), repeat=2).items():
+      for size, elementsPerSecond in throughputs.items():
+        logging.info(f"{name} of {size} elements: {elementsPerSecond/1e9:.2f} G elements/s")
+
+  def test_RegistrationMetrics(self):
+    """ A grid of candidate translations around the true one: every metric
+    is lowest at the truth, and mean squares matches numpy.
+    """
+    logic = VudoLogic()
+    shape = numpy.array((40,44,48))
+    shift = numpy.array((2,-3,1)) # k,j,i
+    def blobs(k, j, i):
+      return (100 * numpy.exp(-((k-18)**2 + (j-20)**2 + (i-26)**2) / 60.)
+              + 60 * numpy.exp(-((k-24)**2 + (j-26)**2 + (i-18)**2) / 30.)).astype(numpy.float32)
+    fixedArray = blobs(*numpy.indices(shape))
+    # moving(x + shift) == fixed(x)
+    movingArray = blobs(*(numpy.indices(shape) - shift.reshape(3,1,1,1)))
+
+    offsets = numpy.stack(numpy.meshgrid(*[numpy.arange(-2,3)]*3, indexing="ij"), axis=-1).reshape(-1,3)
+    translations = shift + offsets
+    candidates = numpy.tile(numpy.eye(4), (len(translations),1,1))
+    candidates[:,:3,3] = translations[:,::-1] # matrices act on i,j,k
+    truth = numpy.flatnonzero(numpy.all(offsets == 0, axis=1))[0]
+
+    for metric, moving in (("meansquares", movingArray), ("correlation", 3 * movingArray + 20),
+                           ("mattes", 255 - movingArray)):
+      costs = logic.registrationCosts(fixedArray, moving, candidates, metric)
+      self.assertEqual(int(numpy.argmin(costs)), truth, metric)
+
+    # the default bins fit the 16 KB of shared memory every device has, the most bins may not
+    import cppyy
+    sharedMemorySize = cppyy.gbl.vudo.RegistrationMetrics.getSharedMemorySize
+    self.assertLessEqual(sharedMemorySize(32), 16384)
+    self.assertGreater(sharedMemorySize(64), 16384)
+
+    costs = logic.registrationCosts(fixedArray, movingArray, candidates, "meansquares")
+    for candidate in (truth, 0, len(translations) - 1):
+      t = translations[candidate]
+      fixedSlices = tuple(slice(max(0, -d), min(n, n - d)) for d, n in zip(t, shape))
+      movingSlices = tuple(slice(max(0, d), min(n, n + d)) for d, n in zip(t, shape))
+      reference = numpy.mean((fixedArray[fixedSlices] - movingArray[movingSlices])**2)
+      self.assertAlmostEqual(costs[candidate], reference, delta=1e-3 * max(reference, 1.))
+
+    import SampleData
+    mrHead = slicer.util.arrayFromVolume(SampleData.downloadSample("MRHead")).astype(numpy.float32)
+    angles = numpy.radians(numpy.linspace(-10, 10, 1000))
+    center = numpy.array(mrHead.shape[::-1]) / 2.
+    rotations = numpy.tile(numpy.eye(4), (len(angles),1,1))
+    rotations[:,0,0] = rotations[:,1,1] = numpy.cos(angles)
+    rotations[:,0,1], rotations[:,1,0] = -numpy.sin(angles), numpy.sin(angles)
+    rotations[:,:3,3] = center - numpy.einsum("kij,j->ki", rotations[:,:3,:3], center)
+    startTime = time.time()
+    costs = logic.registrationCosts(mrHead, mrHead, rotations, "mattes", sampleStride=4)
+    logging.info(f"Mattes MI of {len(angles)} MRHead rotations in {time.time()-startTime:.3f} s")
+    self.assertLess(abs(numpy.degrees(angles[numpy.argmin(costs)])), 0.5)
+
   def test_VolumeFilter(self):
     """
     """
@@ -219,13 +2052,16 @@ class VudoTest(ScriptedLoadableModuleTest):
     self.delayDisplay("Compiling cpp", 50)
     performanceModule = vudoInstance.compileAndImportCPP(cppSourcePath)
     performanceVudo = performanceModule.PerformanceVudo()
-    self.delayDisplay("Compiling glsl", 50)
-    vudoInstance.compileGLSL(shaderSourcePath, shaderSPIRVPath)
-    performanceVudo.shaderSPIRVPath = shaderSPIRVPath
+    if not vudoInstance.hasEmbeddedShader("performance"):
+      self.delayDisplay("Compiling glsl", 50)
+      vudoInstance.compileGLSL(shaderSourcePath, shaderSPIRVPath)
+      performanceVudo.shaderSPIRVPath = shaderSPIRVPath
+    performanceVudo.options = vudoInstance.deviceQueueOptions()
     # TODO: put this in a thread 
     print("run...")
     time = timeit.timeit(performanceVudo.run, number=1)
     print(f"Time for performanceVudo.run is: {time}")
+    vudoInstance.drainDiagnostics(performanceVudo.deviceQueue)
 
     # get the rendered image as a numpy array
     print("data access...")
@@ -0,0 +1,416 @@
+import cppyy
+import numbers
+import numpy
+
+from VudoLib.Vudo import bufferArray
+
+# dtypes kept on the device; others are converted on upload (float64 to float32, int64 to int32)
+_deviceDTypes = [numpy.dtype(dtype) for dtype in
+                 (numpy.bool_, numpy.uint8, numpy.int8, numpy.uint16, numpy.int16,
+                  numpy.uint32, numpy.int32, numpy.float32)]
+
+def deviceDType(dtype):
+  """The dtype an array of dtype has on the device"""
+  dtype = numpy.dtype(dtype)
+  if dtype in _deviceDTypes:
+    return dtype
+  if dtype.kind == "f":
+    return numpy.dtype(numpy.float32)
+  if dtype.kind in "iu" and dtype.itemsize == 8:
+    return numpy.dtype(numpy.int32 if dtype.kind == "i" else numpy.uint32)
+  raise ValueError(f"{dtype} arrays are not supported on the GPU")
+
+def _storageDType(dtype):
+  return numpy.dtype(numpy.uint8) if dtype == numpy.bool_ else dtype
+
+# GLSL reading voxel of a uint word buffer as a float, per device dtype
+_loads = {
+  numpy.dtype(numpy.float32): "uintBitsToFloat({buffer}[voxel])",
+  numpy.dtype(numpy.int32): "float(int({buffer}[voxel]))",
+  numpy.dtype(numpy.uint32): "float({buffer}[voxel])",
+  numpy.dtype(numpy.bool_): "float(bitfieldExtract({buffer}[voxel >> 2], int(8 * (voxel & 3)), 8))",
+  numpy.dtype(numpy.uint8): "float(bitfieldExtract({buffer}[voxel >> 2], int(8 * (voxel & 3)), 8))",
+  numpy.dtype(numpy.int8): "float(bitfieldExtract(int({buffer}[voxel >> 2]), int(8 * (voxel & 3)), 8))",
+  numpy.dtype(numpy.uint16): "float(bitfieldExtract({buffer}[voxel >> 1], int(16 * (voxel & 1)), 16))",
+  numpy.dtype(numpy.int16): "float(bitfieldExtract(int({buffer}[voxel >> 1]), int(16 * (voxel & 1)), 16))",
+}
+
+# GLSL turning a float value into the low bits of an output word, per device dtype
+_stores = {
+  numpy.dtype(numpy.float32): "floatBitsToUint(value)",
+  numpy.dtype(numpy.int32): "uint(int(value))",
+  numpy.dtype(numpy.uint32): "uint(value)",
+  numpy.dtype(numpy.bool_): "uint(value != 0.0)",
+  numpy.dtype(numpy.uint8): "uint(int(value)) & 0xffu",
+  numpy.dtype(numpy.int8): "uint(int(value)) & 0xffu",
+  numpy.dtype(numpy.uint16): "uint(int(value)) & 0xffffu",
+  numpy.dtype(numpy.int16): "uint(int(value)) & 0xffffu",
+}
+
+_binaryOperations = {
+  "add": "{0} + {1}",
+  "subtract": "{0} - {1}",
+  "multiply": "{0} * {1}",
+  "divide": "{0} / {1}",
+  "floorDivide": "floor({0} / {1})",
+  "mod": "mod({0}, {1})",
+  "power": "pow({0}, {1})",
+  "minimum": "min({0}, {1})",
+  "maximum": "max({0}, {1})",
+}
+
+_comparisons = {
+  "less": "float({0} < {1})",
+  "lessEqual": "float({0} <= {1})",
+  "greater": "float({0} > {1})",
+  "greaterEqual": "float({0} >= {1})",
+  "equal": "float({0} == {1})",
+  "notEqual": "float({0} != {1})",
+}
+
+# logical on bools, bitwise on integers
+_bitwise = {
+  "and": ("float({0} != 0.0 && {1} != 0.0)", "float(int({0}) & int({1}))"),
+  "or": ("float({0} != 0.0 || {1} != 0.0)", "float(int({0}) | int({1}))"),
+  "xor": ("float(({0} != 0.0) != ({1} != 0.0))", "float(int({0}) ^ int({1}))"),
+}
+
+_unaryOperations = {
+  "negative": "-{0}",
+  "absolute": "abs({0})",
+  "sqrt": "sqrt({0})",
+  "exp": "exp({0})",
+  "log": "log({0})",
+}
+
+def _resultType(operands):
+  """numpy's result type of the array operands; Python scalars do not widen it, except that
+  a float scalar makes an integer expression float"""
+  dtypes = [operand.dtype for operand in operands if isinstance(operand, VudoArray)]
+  floatScalar = any(isinstance(operand, numbers.Real) and not isinstance(operand, numbers.Integral)
+                    for operand in operands if not isinstance(operand, VudoArray))
+  if not dtypes:
+    dtypes = [numpy.float32 if floatScalar else numpy.int32]
+  dtype = numpy.result_type(*dtypes)
+  if dtype.kind in "biu" and floatScalar:
+    dtype = numpy.float32
+  return deviceDType(dtype)
+
+class VudoArray(object):
+  """A lazy array on the GPU.
+
+  Arithmetic, comparisons, bitwise/logical operators, astype, clip and
+  Arrays.where build an expression graph instead of computing.  numpy()
+  or toVolume() fuses the whole graph into one generated compute shader,
+  so (a*2+b > t) reads a and b once and writes one output, instead of
+  four passes with three temporaries.  Operands of one expression have
+  the same shape, or are Python/numpy scalars.
+
+  Values are computed in float32 like the other filters, so integers
+  above 2^24 lose precision and integer overflow does not wrap mid
+  expression.  After evaluation the array keeps its result on the device
+  and later expressions read it from there.
+  """
+
+  __array_priority__ = 100 # numpy scalars on the left defer to our operators
+  __hash__ = None
+
+  def __init__(self, arrays, shape, dtype, operation=None, operands=(), template=None):
+    self.arrays = arrays
+    self.shape = tuple(shape)
+    self.dtype = numpy.dtype(dtype)
+    self.operation = operation
+    self.operands = tuple(operands)
+    self.template = template
+    self.data = None # host values of an input not uploaded yet
+    self.buffer = None # device values once uploaded or evaluated
+    self.volumeNode = None # geometry reference for toVolume
+
+  @property
+  def size(self):
+    return int(numpy.prod(self.shape))
+
+  @property
+  def ndim(self):
+    return len(self.shape)
+
+  def isEvaluated(self):
+    return self.buffer is not None or self.data is not None
+
+  def __repr__(self):
+    state = "evaluated" if self.isEvaluated() else f"lazy {self.operation}"
+    return f"VudoArray(shape={self.shape}, dtype={self.dtype}, {state})"
+
+  def __bool__(self):
+    raise ValueError("The truth value of a VudoArray is ambiguous, compare the numpy() values")
+
+  def _expression(self, operation, template, operands, dtype):
+    for operand in operands:
+      if isinstance(operand, VudoArray):
+        if operand.shape != self.shape:
+          raise ValueError(f"VudoArray shapes {self.shape} and {operand.shape} differ")
+      elif not isinstance(operand, numbers.Real):
+        return NotImplemented
+    return VudoArray(self.arrays, self.shape, dtype, operation, operands, template)
+
+  def _binary(self, operation, other, reflected=False):
+    operands = (other, self) if reflected else (self, other)
+    if operation in _comparisons:
+      return self._expression(operation, _comparisons[operation], operands, numpy.bool_)
+    if operation in _bitwise:
+      dtype = _resultType(operands)
+      if dtype.kind == "f":
+        raise TypeError(f"{operation} is not defined for {dtype}")
+      logical, bitwise = _bitwise[operation]
+      return self._expression(operation, logical if dtype == numpy.bool_ else bitwise, operands, dtype)
+    dtype = numpy.dtype(numpy.float32) if operation == "divide" else _resultType(operands)
+    return self._expression(operation, _binaryOperations[operation], operands, dtype)
+
+  def __add__(self, other): return self._binary("add", other)
+  def __radd__(self, other): return self._binary("add", other, True)
+  def __sub__(self, other): return self._binary("subtract", other)
+  def __rsub__(self, other): return self._binary("subtract", other, True)
+  def __mul__(self, other): return self._binary("multiply", other)
+  def __rmul__(self, other): return self._binary("multiply", other, True)
+  def __truediv__(self, other): return self._binary("divide", other)
+  def __rtruediv__(self, other): return self._binary("divide", other, True)
+  def __floordiv__(self, other): return self._binary("floorDivide", other)
+  def __rfloordiv__(self, other): return self._binary("floorDivide", other, True)
+  def __mod__(self, other): return self._binary("mod", other)
+  def __rmod__(self, other): return self._binary("mod", other, True)
+  def __pow__(self, other): return self._binary("power", other)
+  def __rpow__(self, other): return self._binary("power", other, True)
+  def __lt__(self, other): return self._binary("less", other)
+  def __le__(self, other): return self._binary("lessEqual", other)
+  def __gt__(self, other): return self._binary("greater", other)
+  def __ge__(self, other): return self._binary("greaterEqual", other)
+  def __eq__(self, other): return self._binary("equal", other)
+  def __ne__(self, other): return self._binary("notEqual", other)
+  def __and__(self, other): return self._binary("and", other)
+  def __rand__(self, other): return self._binary("and", other, True)
+  def __or__(self, other): return self._binary("or", other)
+  def __ror__(self, other): return self._binary("or", other, True)
+  def __xor__(self, other): return self._binary("xor", other)
+  def __rxor__(self, other): return self._binary("xor", other, True)
+
+  def _unary(self, operation, dtype=None):
+    return self._expression(operation, _unaryOperations[operation], (self,), dtype or self.dtype)
+
+  def __neg__(self): return self._unary("negative")
+  def __pos__(self): return self
+  def __abs__(self): return self._unary("absolute")
+  def sqrt(self): return self._unary("sqrt", numpy.float32)
+  def exp(self): return self._unary("exp", numpy.float32)
+  def log(self): return self._unary("log", numpy.float32)
+
+  def __invert__(self):
+    if self.dtype == numpy.bool_:
+      return self._expression("not", "float({0} == 0.0)", (self,), self.dtype)
+    if self.dtype.kind == "f":
+      raise TypeError(f"~ is not defined for {self.dtype}")
+    return self._expression("invert", "float(~int({0}))", (self,), self.dtype)
+
+  def astype(self, dtype):
+    """Cast like numpy: floats truncate toward zero into integer types, nonzero becomes True"""
+    dtype = deviceDType(dtype)
+    if dtype == numpy.bool_:
+      template = "float({0} != 0.0)"
+    elif dtype.kind in "iu" and self.dtype.kind == "f":
+      template = "trunc({0})"
+    else:
+      template = "{0}"
+    return self._expression("astype", template, (self,), dtype)
+
+  def clip(self, minimum, maximum):
+    return self.arrays.minimum(self.arrays.maximum(self, minimum), maximum)
+
+  def numpy(self):
+    """Evaluate (once) and return the values as a new numpy array"""
+    self.arrays.evaluate(self)
+    if self.buffer is None:
+      return self.data.reshape(self.shape).copy()
+    values = bufferArray(self.buffer, _storageDType(self.dtype), self.size)
+    return values.view(self.dtype).reshape(self.shape).copy()
+
+  def toVolume(self, volumeNode=None, name="VudoArray"):
+    """Evaluate into a scalar volume node, by default a new one, with the geometry of the
+    volume the inputs came from (Arrays.fromVolume).  Booleans are stored as uint8."""
+    import slicer
+    values = self.numpy()
+    if values.dtype == numpy.bool_:
+      values = values.view(numpy.uint8)
+    if volumeNode is None:
+      volumeNode = slicer.mrmlScene.AddNewNodeByClass("vtkMRMLScalarVolumeNode", name)
+    referenceNode = self.referenceVolume()
+    if referenceNode is not None:
+      volumeNode.CopyOrientation(referenceNode)
+    slicer.util.updateVolumeFromArray(volumeNode, values)
+    return volumeNode
+
+  def referenceVolume(self):
+    """The first volume node among the inputs of the expression, or None"""
+    pending, seen = [self], set()
+    while pending:
+      array = pending.pop()
+      if id(array) in seen:
+        continue
+      seen.add(id(array))
+      if array.volumeNode is not None:
+        return array.volumeNode
+      pending.extend(operand for operand in array.operands if isinstance(operand, VudoArray))
+    return None
+
+class Arrays(object):
+  """Makes VudoArrays and evaluates them with fused kernels (vudoFused.h).
+
+    arrays = Arrays(vudo)
+    a = arrays.fromVolume(ctNode)
+    b = arrays.array(otherVoxels)
+    mask = arrays.where((a*2 + b > threshold) & (a < 3000), 1, 0).astype(numpy.uint8)
+    mask.toVolume(name="mask")
+
+  The generated source depends only on the structure and dtypes of the
+  expression: scalars are passed in a buffer, so changing threshold
+  reuses the compiled kernel.
+  """
+
+  def __init__(self, vudo):
+    cppyy.include("vudoFused.h")
+    self.vudo = vudo
+    self.deviceQueue = vudo.getDeviceQueue()
+    self.kernels = {}
+
+  def array(self, data):
+    """A VudoArray holding a copy of data, uploaded on first use"""
+    data = numpy.asarray(data)
+    array = VudoArray(self, data.shape, deviceDType(data.dtype))
+    array.data = numpy.array(data, dtype=array.dtype, order="C")
+    return array
+
+  def fromVolume(self, volumeNode):
+    """A VudoArray of a scalar volume node's voxels, (k,j,i) like slicer.util.arrayFromVolume"""
+    import slicer
+    array = self.array(slicer.util.arrayFromVolume(volumeNode))
+    array.volumeNode = volumeNode
+    return array
+
+  def where(self, condition, x, y):
+    """x where condition is nonzero, y elsewhere"""
+    operands = (condition, x, y)
+    array = next(operand for operand in operands if isinstance(operand, VudoArray))
+    return array._expression("where", "({0} != 0.0 ? {1} : {2})", operands, _resultType((x, y)))
+
+  def minimum(self, x, y):
+    array = x if isinstance(x, VudoArray) else y
+    return array._expression("minimum", _binaryOperations["minimum"], (x, y), _resultType((x, y)))
+
+  def maximum(self, x, y):
+    array = x if isinstance(x, VudoArray) else y
+    return array._expression("maximum", _binaryOperations["maximum"], (x, y), _resultType((x, y)))
+
+  def upload(self, array):
+    if array.buffer is None:
+      storage = array.data.view(_storageDType(array.dtype)).reshape(-1)
+      wordBytes = (storage.nbytes + 3) & ~3
+      array.buffer = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, max(wordBytes, 4))
+      bufferArray(array.buffer, numpy.uint8, storage.nbytes)[:] = storage.view(numpy.uint8)
+      array.data = None
+    return array.buffer
+
+  def generate(self, array):
+    """The GLSL of array's expression, its input arrays (in binding order) and scalar values"""
+    inputs, scalars, lines, names = [], [], [], {}
+
+    def visit(operand):
+      if not isinstance(operand, VudoArray):
+        scalars.append(float(operand))
+        return f"scalars[{len(scalars) - 1}]"
+      if id(operand) in names: # shared subexpressions are computed once
+        return names[id(operand)]
+      if operand.isEvaluated():
+        inputs.append(operand)
+        expression = _loads[operand.dtype].format(buffer=f"input{len(inputs) - 1}")
+      else:
+        expression = operand.template.format(*[visit(child) for child in operand.operands])
+      name = f"v{len(names)}"
+      names[id(operand)] = name
+      lines.append(f"  float {name} = {expression};")
+      return name
+
+    result = visit(array)
+    voxelsPerWord = 4 // _storageDType(array.dtype).itemsize
+    inputBlocks = "".join(f"layout(std430, binding = {2 + index}) readonly buffer Input{index} {{\n"
+                          f"  uint input{index}[];\n}};\n\n" for index in range(len(inputs)))
+    bits = 32 // voxelsPerWord
+    source = f"""#version 450
+
+/* Generated by VudoLib/Arrays.py from a VudoArray expression of {array.dtype} result */
+
+layout (local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer Scalars {{
+  float scalars[];
+}};
+
+layout(std430, binding = 1) writeonly buffer Output {{
+  uint outputWords[];
+}};
+
+{inputBlocks}layout(push_constant) uniform Parameters {{
+  uint voxelCount;
+}} parameters;
+
+float evaluate(uint voxel)
+{{
+{chr(10).join(lines)}
+  return {result};
+}}
+
+uint store(float value)
+{{
+  return {_stores[array.dtype]};
+}}
+
+void main()
+{{
+  uint word = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * 64 + gl_GlobalInvocationID.x;
+  uint first = word * {voxelsPerWord};
+  if (first >= parameters.voxelCount) {{
+    return;
+  }}
+  uint packed = 0;
+  for (uint index = 0; index < {voxelsPerWord} && first + index < parameters.voxelCount; ++index) {{
+    packed |= store(evaluate(first + index)) << ({bits} * index);
+  }}
+  outputWords[word] = packed;
+}}
+"""
+    return source, inputs, scalars
+
+  def evaluate(self, array):
+    """Run array's expression as one fused kernel, unless it already has values"""
+    if array.isEvaluated():
+      return
+    source, inputs, scalars = self.generate(array)
+    voxelsPerWord = 4 // _storageDType(array.dtype).itemsize
+    kernel = self.kernels.get(source)
+    if kernel is None:
+      kernel = cppyy.gbl.vudo.FusedKernel(self.deviceQueue, len(inputs), voxelsPerWord,
+                                          self.vudo.generatedShaderPath("fused", source))
+      self.kernels[source] = kernel
+
+    scalarBuffer = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * max(len(scalars), 1))
+    if scalars:
+      bufferArray(scalarBuffer, numpy.float32, len(scalars))[:] = scalars
+    wordCount = (array.size + voxelsPerWord - 1) // voxelsPerWord
+    output = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * max(wordCount, 1))
+    kernel.bindScalars(scalarBuffer)
+    kernel.bindOutput(output)
+    for index, inputArray in enumerate(inputs):
+      kernel.bindInput(index, self.upload(inputArray))
+    kernel.run(array.size)
+
+    # the array becomes an input for later expressions, its graph is no longer needed
+    array.buffer = output
+    array.volumeNode = array.referenceVolume()
+    array.operation, array.operands, array.template = None, (), None
@@ -0,0 +1,138 @@
+import cppyy
+import logging
+import numpy
+import time
+
+from VudoLib.Vudo import bufferArray
+
+class Primitives(object):
+  """numpy front end to the data parallel primitives of vudoPrimitives.h.
+
+  The *Array methods copy uint32 arrays into host visible buffers, run the
+  primitive on the device and return the result.  To use a primitive as
+  one stage of a larger submission instead, make the vudo:: object and
+  record it with the buffers the other stages share:
+
+    primitives = Primitives(vudo)
+    sort = primitives.radixSort(capacity)
+    commandSequence.begin()
+    ... sort.record(commandSequence, keys, values, count) ...
+    commandSequence.submitAndWait()
+  """
+
+  def __init__(self, vudo):
+    cppyy.include("vudoPrimitives.h")
+    self.vudo = vudo
+    self.deviceQueue = vudo.getDeviceQueue()
+
+  def exclusiveScan(self, capacity, algorithm="lookback"):
+    """A vudo::ExclusiveScan, algorithm is "lookback" (one pass) or "reduce" (reduce then scan)"""
+    scan = cppyy.gbl.vudo.ExclusiveScan(self.deviceQueue, capacity, self.vudo.libraryShaderPath("scan"))
+    algorithms = {"lookback": cppyy.gbl.vudo.DecoupledLookback, "reduce": cppyy.gbl.vudo.ReduceThenScan}
+    scan.setAlgorithm(algorithms[algorithm])
+    return scan
+
+  def streamCompaction(self, capacity):
+    return cppyy.gbl.vudo.StreamCompaction(self.deviceQueue, capacity,
+                                           self.vudo.libraryShaderPath("compact"),
+                                           self.vudo.libraryShaderPath("scan"))
+
+  def radixSort(self, capacity):
+    return cppyy.gbl.vudo.RadixSort(self.deviceQueue, capacity,
+                                    self.vudo.libraryShaderPath("radixSort"),
+                                    self.vudo.libraryShaderPath("scan"))
+
+  def buffer(self, array=None, count=None):
+    """A host visible buffer of count uint32 values, or holding a copy of array"""
+    count = array.size if array is not None else count
+    computeBuffer = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * max(count, 1))
+    if array is not None:
+      bufferArray(computeBuffer, numpy.uint32, count)[:] = numpy.asarray(array, dtype=numpy.uint32).reshape(-1)
+    return computeBuffer
+
+  def scanArray(self, array, algorithm="lookback"):
+    """Exclusive prefix sum of a uint32 array (wrapping at 2^32)"""
+    values = self.buffer(array)
+    self.exclusiveScan(array.size, algorithm).run(values, array.size)
+    return bufferArray(values, numpy.uint32, array.size).copy()
+
+  def compactArray(self, values=None, flags=None):
+    """The values with nonzero flags (or the nonzero values without flags), in order.
+    Without values, the indices of the nonzero flags.
+    """
+    count = (values if values is not None else flags).size
+    valuesBuffer = self.buffer(values) if values is not None else None
+    flagsBuffer = self.buffer(flags) if flags is not None else None
+    output = self.buffer(count=count)
+    kept = self.streamCompaction(count).run(valuesBuffer, flagsBuffer, count, output)
+    return bufferArray(output, numpy.uint32, kept).copy()
+
+  def sortArray(self, keys, values=None, keyBits=32):
+    """Stably sorted uint32 keys, and the values in the same order when given"""
+    keysBuffer = self.buffer(keys)
+    valuesBuffer = self.buffer(values) if values is not None else None
+    self.radixSort(keys.size).run(keysBuffer, valuesBuffer, keys.size, keyBits)
+    sortedKeys = bufferArray(keysBuffer, numpy.uint32, keys.size).copy()
+    if values is None:
+      return sortedKeys
+    return sortedKeys, bufferArray(valuesBuffer, numpy.uint32, keys.size).copy()
+
+  def benchmark(self, sizes=(1<<20, 1<<24, 1<<27, 1<<30), repeat=3):
+    """Best of repeat throughputs, in elements per second, of each primitive on
+    device local buffers.  Inputs are staged outside the timing.  Sizes whose
+    buffers exceed the device's maxStorageBufferRange (2^27 bytes guaranteed),
+    or that the device (or host) has no memory for, are logged and left out.
+    """
+    results = {"scan (lookback)": {}, "scan (reduce)": {}, "compaction": {}, "key/value sort": {}}
+    random = numpy.random.default_rng(37)
+    properties = cppyy.gbl.VkPhysicalDeviceProperties()
+    cppyy.gbl.vkGetPhysicalDeviceProperties(self.deviceQueue.getPhysicalDevice(), properties)
+    maxStorageBufferRange = int(properties.limits.maxStorageBufferRange)
+    for size in sizes:
+      if 4 * size > maxStorageBufferRange:
+        # binding more than the range is invalid usage, which would not raise
+        logging.info(f"primitives benchmark skipped {size} elements: {4 * size} bytes is more than "
+                     f"maxStorageBufferRange {maxStorageBufferRange}")
+        continue
+      try:
+        deviceLocal = cppyy.gbl.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        keys = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * size, deviceLocal)
+        values = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * size, deviceLocal)
+        output = cppyy.gbl.vudo.ComputeBuffer(self.deviceQueue, 4 * size, deviceLocal)
+        staging = self.buffer(count=size)
+        commandSequence = cppyy.gbl.vudo.CommandSequence(self.deviceQueue)
+        def stage(fill=None):
+          commandSequence.begin()
+          if fill is None:
+            commandSequence.copyBuffer(staging, keys)
+            commandSequence.copyBuffer(staging, values)
+          else:
+            commandSequence.fillBuffer(keys, fill)
+          commandSequence.barrier()
+          commandSequence.submitAndWait()
+        def best(run, before):
+          seconds = []
+          for _ in range(repeat + 1): # the first run creates the descriptor sets
+            before()
+            startTime = time.perf_counter()
+            run()
+            seconds.append(time.perf_counter() - startTime)
+          return size / min(seconds[1:])
+
+        for name, algorithm in (("scan (lookback)", "lookback"), ("scan (reduce)", "reduce")):
+          scan = self.exclusiveScan(size, algorithm)
+          results[name][size] = best(lambda: scan.run(keys, size), lambda: stage(1))
+          del scan
+
+        bufferArray(staging, numpy.uint32, size)[:] = random.integers(0, 2, size, dtype=numpy.uint32)
+        compaction = self.streamCompaction(size)
+        results["compaction"][size] = best(lambda: compaction.run(values, keys, size, output), stage)
+        del compaction
+
+        bufferArray(staging, numpy.uint32, size)[:] = random.integers(0, 1<<32, size, dtype=numpy.uint32)
+        sort = self.radixSort(size)
+        results["key/value sort"][size] = best(lambda: sort.run(keys, values, size), stage)
+        del sort
+      except Exception as error:
+        logging.info(f"primitives benchmark skipped {size} elements: {error}")
+    return results
@@ -0,0 +1,81 @@
+import cppyy
+import numpy
+import qt
+import slicer
+
+from VudoLib.Vudo import bufferArray
+
+class ProgressiveVolume(object):
+  """Fill a volume node coarse-to-fine from a generator compute shader.
+
+  The shader renders one vec4 per voxel (only .x is shown) and takes
+  vudo::ProgressivePushConstants, see Mandelbrot.comp.glsl.  After each
+  pass the lattice it completed is published as a volume with
+  correspondingly larger spacing, so a preview appears after the first
+  1/512th of the work and the node is refined in place until the full
+  resolution pass is done.
+
+    progressive = ProgressiveVolume(vudo, "Mandelbrot", (512,512,512))
+    progressive.start()
+    ...
+    progressive.cancel()
+  """
+
+  def __init__(self, vudo, shaderName, dimensions, volumeNode=None, name="VudoVolume",
+               shaderPath="", coarsestStride=8, workgroupSize=8, onFinished=None):
+    cppyy.include("vudoProgressive.h")
+    self.vudo = vudo
+    self.dimensions = dimensions
+    self.volumeNode = volumeNode
+    self.name = name
+    self.onFinished = onFinished
+    self.spacing = volumeNode.GetSpacing() if volumeNode else (1.,1.,1.)
+
+    deviceQueue = vudo.getDeviceQueue()
+    width, height, depth = dimensions
+    self.buffer = cppyy.gbl.vudo.ComputeBuffer(deviceQueue, 16 * width * height * depth)
+    shaderModule = cppyy.gbl.vudo.createShaderModule(deviceQueue.getDevice(), shaderName, shaderPath)
+    pushConstantSize = cppyy.sizeof(cppyy.gbl.vudo.ProgressivePushConstants)
+    # binding 1 is the brick list of a bricked dispatch, which a progressive one never reads
+    self.pipeline = cppyy.gbl.vudo.ComputePipeline(deviceQueue, shaderModule, 2, pushConstantSize)
+    self.pipeline.bindBuffer(0, self.buffer)
+    self.pipeline.bindBuffer(1, self.buffer)
+    self.dispatch = cppyy.gbl.vudo.ProgressiveDispatch(deviceQueue, self.pipeline,
+                                                      width, height, depth, workgroupSize, coarsestStride)
+    self.timer = qt.QTimer()
+    self.timer.setInterval(10)
+    self.timer.connect("timeout()", self.poll)
+
+  def start(self):
+    self.dispatch.submitNextPass()
+    self.timer.start()
+
+  def cancel(self):
+    self.dispatch.cancel()
+
+  def poll(self):
+    if not self.dispatch.isPassComplete():
+      return
+    stride = self.dispatch.getCompletedStride()
+    # the next pass only writes voxels off this lattice, so it can run while we publish
+    self.dispatch.submitNextPass()
+    self.publish(stride)
+    if self.dispatch.isFinished():
+      self.timer.stop()
+      self.vudo.drainDiagnostics(self.vudo.getDeviceQueue())
+      if self.onFinished:
+        self.onFinished(self.volumeNode)
+
+  def array(self, stride=1):
+    """The rendered values on the lattice of the given stride, as a (k,j,i) view"""
+    width, height, depth = self.dimensions
+    voxels = bufferArray(self.buffer, numpy.float32, 4*width*height*depth)
+    return voxels.reshape((depth, height, width, 4))[::stride,::stride,::stride,0]
+
+  def publish(self, stride):
+    volumeArray = numpy.ascontiguousarray(self.array(stride))
+    if self.volumeNode is None:
+      self.volumeNode = slicer.util.addVolumeFromArray(volumeArray, name=self.name)
+    else:
+      slicer.util.updateVolumeFromArray(self.volumeNode, volumeArray)
+    self.volumeNode.SetSpacing([spacing * stride for spacing in self.spacing])
@@ -0,0 +1,102 @@
+import collections
+import hashlib
+import numpy
+
+class ResultCache(object):
+  """Least recently used cache of filter results under a byte budget.
+
+  Keys are tuples that identify a run completely: the kernel (name and
+  SPIR-V hash, Vudo.shaderDigest), its specialization and push constant
+  values, and a key for each input's content (volumeKey or arrayKey).
+  Values are numpy arrays, stored read-only and returned as they are, or
+  device resident vudo::ComputeBuffers; either way their bytes count
+  against the budget and the least recently used results are evicted
+  first.  A result bigger than the whole budget is not kept.
+
+    key = ("threshold", vudo.shaderDigest("threshold"), threshold, cache.volumeKey(inputVolume))
+    output = cache.get(key)
+    if output is None:
+      output = cache.put(key, compute())
+  """
+
+  def __init__(self, byteBudget=512 * 1024 * 1024):
+    self.byteBudget = byteBudget
+    self.entries = collections.OrderedDict() # key: (value, bytes)
+    self.byteCount = 0
+    self.hits = 0
+    self.misses = 0
+    self.evictions = 0
+
+  def __len__(self):
+    return len(self.entries)
+
+  def __contains__(self, key):
+    return key in self.entries
+
+  @staticmethod
+  def valueBytes(value):
+    if isinstance(value, numpy.ndarray):
+      return value.nbytes
+    return int(value.getSize()) # a ComputeBuffer
+
+  def get(self, key):
+    """The cached value of key, or None"""
+    entry = self.entries.get(key)
+    if entry is None:
+      self.misses += 1
+      return None
+    self.entries.move_to_end(key)
+    self.hits += 1
+    return entry[0]
+
+  def put(self, key, value):
+    """Cache value under key and return it; numpy arrays become read-only"""
+    if isinstance(value, numpy.ndarray):
+      value.flags.writeable = False
+    valueBytes = self.valueBytes(value)
+    self.discard(key)
+    if valueBytes > self.byteBudget:
+      return value
+    self.entries[key] = (value, valueBytes)
+    self.byteCount += valueBytes
+    self.evict(self.byteBudget)
+    return value
+
+  def discard(self, key):
+    entry = self.entries.pop(key, None)
+    if entry is not None:
+      self.byteCount -= entry[1]
+
+  def evict(self, byteBudget):
+    """Drop least recently used values until the cache holds at most byteBudget bytes"""
+    while self.byteCount > byteBudget and self.entries:
+      key, (value, valueBytes) = self.entries.popitem(last=False)
+      self.byteCount -= valueBytes
+      self.evictions += 1
+
+  def setByteBudget(self, byteBudget):
+    self.byteBudget = byteBudget
+    self.evict(byteBudget)
+
+  def clear(self):
+    self.evict(0)
+
+  def report(self):
+    return (f"{len(self.entries)} results, {self.byteCount / 2**20:.1f} of {self.byteBudget / 2**20:.0f} MiB, "
+            f"{self.hits} hits, {self.misses} misses, {self.evictions} evictions")
+
+  @staticmethod
+  def volumeKey(volumeNode):
+    """Content key of a volume node from MRML modified times: microseconds, no voxel is read.
+    arrayFromVolumeModified and every filter writing the node advance them."""
+    imageData = volumeNode.GetImageData()
+    scalars = imageData.GetPointData().GetScalars()
+    return ("volume", volumeNode.GetID(), imageData.GetMTime(), scalars.GetMTime() if scalars else 0,
+            imageData.GetDimensions())
+
+  @staticmethod
+  def arrayKey(array):
+    """Content key of a numpy array: its shape, dtype and a BLAKE2 digest of its bytes"""
+    array = numpy.ascontiguousarray(array)
+    digest = hashlib.blake2b(memoryview(array).cast("B"), digest_size=16).hexdigest()
+    return ("array", array.shape, array.dtype.str, digest)
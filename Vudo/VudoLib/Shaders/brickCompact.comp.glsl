@@ -0,0 +1,69 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Stream compaction of the occupancy map into a list of active bricks,
+then (a second dispatch with finalize set, one workgroup) the
+VkDispatchIndirectCommand for the consumer.  A row of groupCountX holds
+as many whole bricks of groupsPerBrick workgroups as maxGroupCountX
+allows and groupCountY counts the rows; the bricks past the end of the
+last row are set to NO_BRICK, for the consumer to skip.  The arguments
+must be cleared to {0, 1, 1, 0} beforehand, and activeBricks must have
+room for brickCount + min(brickCount, maxGroupCountX) entries.
+*/
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+const uint NO_BRICK = 0xffffffffu;
+
+layout(std430, binding = 0) readonly buffer Occupancy {
+  uint occupancy[];
+};
+
+layout(std430, binding = 1) writeonly buffer ActiveBricks {
+  uint activeBricks[];
+};
+
+layout(std430, binding = 2) buffer IndirectArguments {
+  uint groupCountX;
+  uint groupCountY;
+  uint groupCountZ;
+  uint activeBrickCount;
+};
+
+layout(push_constant) uniform Parameters {
+  uint brickCount;
+  uint groupsPerBrick;
+  uint maxGroupCountX;
+  uint finalize;
+} parameters;
+
+void finalizeArguments() {
+  uint active = activeBrickCount;
+  uint bricksPerRow = max(parameters.maxGroupCountX / parameters.groupsPerBrick, 1);
+  uint rows = (active + bricksPerRow - 1) / bricksPerRow;
+  for (uint slot = active + gl_LocalInvocationIndex; slot < rows * bricksPerRow; slot += WORKGROUP_SIZE) {
+    activeBricks[slot] = NO_BRICK;
+  }
+  if(gl_LocalInvocationIndex == 0) {
+    groupCountX = min(active, bricksPerRow) * parameters.groupsPerBrick;
+    groupCountY = max(rows, 1);
+  }
+}
+
+void main() {
+
+  if(parameters.finalize != 0) {
+    finalizeArguments();
+    return;
+  }
+
+  uint brick = gl_GlobalInvocationID.x;
+  if(brick >= parameters.brickCount || occupancy[brick] == 0) {
+    return;
+  }
+
+  uint slot = atomicAdd(activeBrickCount, 1);
+  activeBricks[slot] = brick;
+}
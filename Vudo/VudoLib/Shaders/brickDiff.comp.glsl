@@ -0,0 +1,52 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Marks the bricks whose voxels changed since the last snapshot.  One
+invocation per 32 bit word of the volume (voxelsPerWord voxels): if
+the word differs from the snapshot, the bricks of its voxels are marked
+dirty and the snapshot takes the new word, so the next comparison is
+against this upload.
+*/
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer Current {
+  uint current[];
+};
+
+layout(std430, binding = 1) buffer Snapshot {
+  uint snapshot[];
+};
+
+layout(std430, binding = 2) buffer Dirty {
+  uint dirty[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  uint brickSize;
+  uint wordCount;
+  uint voxelsPerWord;
+} parameters;
+
+void main() {
+
+  uint word = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * WORKGROUP_SIZE + gl_GlobalInvocationID.x;
+  if(word >= parameters.wordCount || current[word] == snapshot[word]) {
+    return;
+  }
+  snapshot[word] = current[word];
+
+  uvec3 brickGrid = (parameters.dimensions + parameters.brickSize - 1) / parameters.brickSize;
+  uint voxelCount = parameters.dimensions.x * parameters.dimensions.y * parameters.dimensions.z;
+  for (uint voxel = word * parameters.voxelsPerWord;
+       voxel < min((word + 1) * parameters.voxelsPerWord, voxelCount); voxel++) {
+    uint x = voxel % parameters.dimensions.x;
+    uint y = (voxel / parameters.dimensions.x) % parameters.dimensions.y;
+    uint z = voxel / (parameters.dimensions.x * parameters.dimensions.y);
+    uvec3 brick = uvec3(x, y, z) / parameters.brickSize;
+    dirty[(brick.z * brickGrid.y + brick.y) * brickGrid.x + brick.x] = 1;
+  }
+}
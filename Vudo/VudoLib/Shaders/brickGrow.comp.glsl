@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Grows the dirty bricks by brickRadius bricks along each axis: a brick
+must be recomputed when a stencil centered in it reaches a dirty brick.
+One invocation per brick, reading its neighbourhood of dirty flags.
+*/
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer Dirty {
+  uint dirty[];
+};
+
+layout(std430, binding = 1) writeonly buffer Grown {
+  uint grown[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 brickGrid;
+  uint brickCount;
+  uvec3 brickRadius;
+} parameters;
+
+void main() {
+
+  uint brick = gl_GlobalInvocationID.x;
+  if(brick >= parameters.brickCount) {
+    return;
+  }
+  uvec3 grid = parameters.brickGrid;
+  ivec3 center = ivec3(brick % grid.x, (brick / grid.x) % grid.y, brick / (grid.x * grid.y));
+  ivec3 first = max(center - ivec3(parameters.brickRadius), ivec3(0));
+  ivec3 last = min(center + ivec3(parameters.brickRadius), ivec3(grid) - 1);
+
+  uint affected = 0;
+  for (int z = first.z; z <= last.z && affected == 0; z++) {
+    for (int y = first.y; y <= last.y && affected == 0; y++) {
+      for (int x = first.x; x <= last.x && affected == 0; x++) {
+        affected = dirty[(z * grid.y + y) * grid.x + x];
+      }
+    }
+  }
+  grown[brick] = affected == 0 ? 0 : 1;
+}
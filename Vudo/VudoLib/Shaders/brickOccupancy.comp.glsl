@@ -0,0 +1,67 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+One workgroup per brick: marks the brick occupied if it overlaps the
+region of interest and (when valueStride is not 0) any voxel in the
+overlap is above background.  values holds valueStride floats per voxel
+and only the first one is tested, so both scalar volumes and the vec4
+output of the experiments can be scanned.
+*/
+
+#define WORKGROUP_SIZE 8
+layout (local_size_x = WORKGROUP_SIZE, local_size_y = WORKGROUP_SIZE, local_size_z = WORKGROUP_SIZE ) in;
+
+layout(std430, binding = 0) readonly buffer Values {
+  float values[];
+};
+
+layout(std430, binding = 1) writeonly buffer Occupancy {
+  uint occupancy[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  uint brickSize;
+  uvec3 roiMin;
+  uint valueStride;
+  uvec3 roiMax;
+  float background;
+} parameters;
+
+shared uint brickOccupied;
+
+void main() {
+
+  if(gl_LocalInvocationIndex == 0) {
+    brickOccupied = 0;
+  }
+  barrier();
+
+  uvec3 brickOrigin = gl_WorkGroupID * parameters.brickSize;
+  uvec3 first = max(brickOrigin, parameters.roiMin);
+  uvec3 last = min(brickOrigin + parameters.brickSize, min(parameters.roiMax, parameters.dimensions));
+
+  bool occupied = false;
+  if(all(lessThan(first, last))) {
+    occupied = parameters.valueStride == 0;
+    for (uint z = first.z + gl_LocalInvocationID.z; z < last.z && !occupied; z += WORKGROUP_SIZE) {
+      for (uint y = first.y + gl_LocalInvocationID.y; y < last.y && !occupied; y += WORKGROUP_SIZE) {
+        for (uint x = first.x + gl_LocalInvocationID.x; x < last.x && !occupied; x += WORKGROUP_SIZE) {
+          uint voxel = (z * parameters.dimensions.y + y) * parameters.dimensions.x + x;
+          occupied = values[voxel * parameters.valueStride] > parameters.background;
+        }
+      }
+    }
+  }
+  if(occupied) {
+    atomicOr(brickOccupied, 1);
+  }
+  barrier();
+
+  if(gl_LocalInvocationIndex == 0) {
+    uint brick = (gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y) * gl_NumWorkGroups.x
+                  + gl_WorkGroupID.x;
+    occupancy[brick] = brickOccupied;
+  }
+}
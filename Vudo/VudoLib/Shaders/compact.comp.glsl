@@ -0,0 +1,60 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Stream compaction, around an exclusive scan of the kept flags:
+
+  MARK     offsets[i] = 1 for the elements to keep, else 0
+  (scan of offsets)
+  SCATTER  output[offsets[i]] = values[i] (or i) for the kept elements
+
+An element is kept when its flag is nonzero, or its value when there
+are no flags.  Without values the indices of the kept elements are
+written, which is how active cell lists are made.  Order is preserved.
+*/
+
+layout(constant_id = 0) const uint PASS = 0;
+
+#define WORKGROUP_SIZE 256
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+const uint MARK = 0;
+const uint SCATTER = 1;
+
+layout(std430, binding = 0) readonly buffer Values {
+  uint values[];
+};
+
+layout(std430, binding = 1) readonly buffer Flags {
+  uint flags[];
+};
+
+layout(std430, binding = 2) buffer Offsets {
+  uint offsets[];
+};
+
+layout(std430, binding = 3) writeonly buffer Output {
+  uint outputValues[];
+};
+
+layout(push_constant) uniform Parameters {
+  uint count;
+  uint hasValues;
+  uint hasFlags;
+} parameters;
+
+bool kept(uint index) {
+  return (parameters.hasFlags != 0 ? flags[index] : values[index]) != 0;
+}
+
+void main() {
+  uint index = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * WORKGROUP_SIZE + gl_GlobalInvocationID.x;
+  if(index >= parameters.count) {
+    return;
+  }
+  if(PASS == MARK) {
+    offsets[index] = kept(index) ? 1u : 0u;
+  } else if(kept(index)) {
+    outputValues[offsets[index]] = parameters.hasValues != 0 ? values[index] : index;
+  }
+}
@@ -0,0 +1,160 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Connected component labelling by union-find in storage buffers.
+
+parent holds one voxel index per voxel.  Trees are only ever linked from
+the larger root to the smaller one (atomicMin), so parent[i] <= i and a
+root is the first voxel of its component in memory order.  Finds halve
+the path they walk, which keeps the trees shallow while merging.
+
+Neighbouring voxels are connected when they hold the same nonzero input
+value, so every label of a label map is split into its own islands.
+The passes (specialization constant 0) run in order:
+
+  INIT     parent = self for foreground, NONE for background
+  MERGE    unite each voxel with its lower index neighbours
+  FLATTEN  point every voxel at its root and count the voxels of each root
+  NUMBER   give the roots consecutive labels from 1 and record their counts
+  LABEL    copy the root label to the rest of the component
+
+counts[0] ends up as the number of components and counts[label] as the
+voxel count of that label (for labels up to countCapacity).
+*/
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+layout(constant_id = 0) const uint PASS = 0;
+layout(constant_id = 1) const uint CONNECTIVITY = 26;
+layout(constant_id = 2) const uint INPUT_TYPE = 0; // vudo::ScalarType, integer types only
+
+const uint INIT = 0;
+const uint MERGE = 1;
+const uint FLATTEN = 2;
+const uint NUMBER = 3;
+const uint LABEL = 4;
+
+const uint NONE = 0xffffffffu;
+
+layout(std430, binding = 0) readonly buffer Input {
+  uint inputWords[];
+};
+
+layout(std430, binding = 1) coherent buffer Parent {
+  uint parent[];
+};
+
+layout(std430, binding = 2) buffer Labels {
+  uint labels[];
+};
+
+layout(std430, binding = 3) buffer Counts {
+  uint counts[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  uint voxelCount;
+  uint countCapacity;
+} parameters;
+
+// the half of the 26 neighbourhood with lower indices, ordered so 6, 18 and 26 connectivity are prefixes
+const ivec3 neighbours[13] = ivec3[](
+  ivec3(-1, 0, 0), ivec3( 0,-1, 0), ivec3( 0, 0,-1),
+  ivec3(-1,-1, 0), ivec3( 1,-1, 0), ivec3(-1, 0,-1), ivec3( 1, 0,-1), ivec3( 0,-1,-1), ivec3( 0, 1,-1),
+  ivec3(-1,-1,-1), ivec3( 1,-1,-1), ivec3(-1, 1,-1), ivec3( 1, 1,-1));
+
+uint inputValue(uint voxel) {
+  uint bits = INPUT_TYPE <= 1 ? 8 : INPUT_TYPE <= 3 ? 16 : 32;
+  uint perWord = 32 / bits;
+  uint word = inputWords[voxel / perWord];
+  return bits == 32 ? word : bitfieldExtract(word, int((voxel % perWord) * bits), int(bits));
+}
+
+uint find(uint voxel) {
+  uint next = parent[voxel];
+  while(next != voxel) {
+    uint grandparent = parent[next];
+    if(grandparent != next) {
+      parent[voxel] = grandparent;
+    }
+    voxel = next;
+    next = grandparent;
+  }
+  return voxel;
+}
+
+void unite(uint a, uint b) {
+  while(true) {
+    a = find(a);
+    b = find(b);
+    if(a == b) {
+      return;
+    }
+    if(a < b) {
+      uint swap = a;
+      a = b;
+      b = swap;
+    }
+    // link the larger root under the smaller, unless someone linked it first
+    uint previous = atomicMin(parent[a], b);
+    if(previous == a) {
+      return;
+    }
+    a = previous;
+  }
+}
+
+void main() {
+
+  uint voxel = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * WORKGROUP_SIZE + gl_GlobalInvocationID.x;
+  if(voxel >= parameters.voxelCount) {
+    return;
+  }
+
+  if(PASS == INIT) {
+    parent[voxel] = inputValue(voxel) != 0 ? voxel : NONE;
+    labels[voxel] = 0;
+    return;
+  }
+
+  if(parent[voxel] == NONE) {
+    return;
+  }
+
+  if(PASS == MERGE) {
+    uvec3 size = parameters.dimensions;
+    ivec3 position = ivec3(voxel % size.x, (voxel / size.x) % size.y, voxel / (size.x * size.y));
+    uint value = inputValue(voxel);
+    uint neighbourCount = CONNECTIVITY == 6 ? 3 : CONNECTIVITY == 18 ? 9 : 13;
+    for (uint index = 0; index < neighbourCount; index++) {
+      ivec3 neighbour = position + neighbours[index];
+      if(any(lessThan(neighbour, ivec3(0))) || any(greaterThanEqual(neighbour, ivec3(size)))) {
+        continue;
+      }
+      uint neighbourVoxel = (uint(neighbour.z) * size.y + uint(neighbour.y)) * size.x + uint(neighbour.x);
+      if(inputValue(neighbourVoxel) == value) {
+        unite(voxel, neighbourVoxel);
+      }
+    }
+  } else if(PASS == FLATTEN) {
+    uint root = find(voxel);
+    parent[voxel] = root;
+    atomicAdd(labels[root], 1);
+  } else if(PASS == NUMBER) {
+    if(parent[voxel] == voxel) {
+      uint label = atomicAdd(counts[0], 1) + 1;
+      if(label <= parameters.countCapacity) {
+        counts[label] = labels[voxel];
+      }
+      labels[voxel] = label;
+    }
+  } else if(PASS == LABEL) {
+    uint root = parent[voxel];
+    if(root != voxel) {
+      labels[voxel] = labels[root];
+    }
+  }
+}
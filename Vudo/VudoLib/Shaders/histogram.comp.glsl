@@ -0,0 +1,93 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Histogram of a volume read in its native type.
+
+A kernel template: it is compiled once per voxel type and option flag
+combination listed in variants.txt, with VOXEL_TYPE (the GLSL type of a
+stored voxel) and VOXEL_BITS defined, and vudo::KernelVariants picks the
+compiled variant by VTK scalar type.  Without the defines it compiles as
+the float32 variant.
+
+Options:
+  MASKED  count only the voxels whose segment word (packSegments) has a
+          bit of segmentMask set
+
+Values outside [minimum, maximum] are not counted and maximum falls in
+the last bin, as with numpy.histogram.  Each workgroup counts into
+shared memory and adds its nonzero bins to the output once.
+*/
+
+#ifndef VOXEL_TYPE
+#define VOXEL_TYPE float
+#define VOXEL_BITS 32
+#endif
+
+#if VOXEL_BITS == 16
+#extension GL_EXT_shader_16bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int16 : require
+#elif VOXEL_BITS == 8
+#extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int8 : require
+#endif
+
+#define WORKGROUP_SIZE 256
+#define MAX_BINS 256
+
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer Input {
+  VOXEL_TYPE values[];
+};
+
+layout(std430, binding = 1) buffer Bins {
+  uint bins[];
+};
+
+#ifdef MASKED
+layout(std430, binding = 2) readonly buffer Segments {
+  uint segments[];
+};
+#endif
+
+layout(push_constant) uniform Parameters {
+  uint voxelCount;
+  uint binCount;
+  float minimum;
+  float maximum;
+  uint segmentMask;
+} parameters;
+
+shared uint localBins[MAX_BINS];
+
+void main()
+{
+  for (uint bin = gl_LocalInvocationID.x; bin < parameters.binCount; bin += WORKGROUP_SIZE) {
+    localBins[bin] = 0;
+  }
+  barrier();
+
+  float scale = float(parameters.binCount) / (parameters.maximum - parameters.minimum);
+  uint stride = gl_NumWorkGroups.x * WORKGROUP_SIZE;
+  for (uint voxel = gl_GlobalInvocationID.x; voxel < parameters.voxelCount; voxel += stride) {
+#ifdef MASKED
+    if ((segments[voxel] & parameters.segmentMask) == 0) {
+      continue;
+    }
+#endif
+    float value = float(values[voxel]);
+    if (isnan(value) || value < parameters.minimum || value > parameters.maximum) {
+      continue;
+    }
+    uint bin = min(uint((value - parameters.minimum) * scale), parameters.binCount - 1);
+    atomicAdd(localBins[bin], 1);
+  }
+  barrier();
+
+  for (uint bin = gl_LocalInvocationID.x; bin < parameters.binCount; bin += WORKGROUP_SIZE) {
+    if (localBins[bin] != 0) {
+      atomicAdd(bins[bin], localBins[bin]);
+    }
+  }
+}
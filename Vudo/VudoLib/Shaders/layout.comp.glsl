@@ -0,0 +1,46 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+/*
+Swizzle a linear volume of 32 bit voxels into LAYOUT (DIRECTION 0,
+linear in binding 0, layout out in binding 1) or unswizzle it back
+(DIRECTION 1, layout in binding 0, linear out in binding 1).  One
+invocation per voxel; the padding of the layout is left alone.
+*/
+
+#include "layout.glsl"
+
+layout(constant_id = 0) const uint LAYOUT = 1;
+layout(constant_id = 1) const uint DIRECTION = 0;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 4) in;
+
+const uint TO_LAYOUT = 0;
+const uint TO_LINEAR = 1;
+
+layout(std430, binding = 0) readonly buffer Input {
+  uint inputWords[];
+};
+
+layout(std430, binding = 1) writeonly buffer Output {
+  uint outputWords[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+} parameters;
+
+void main() {
+  uvec3 voxel = gl_GlobalInvocationID;
+  if(any(greaterThanEqual(voxel, parameters.dimensions))) {
+    return;
+  }
+  uint linear = layoutIndex(LINEAR_LAYOUT, voxel, parameters.dimensions);
+  uint swizzled = layoutIndex(LAYOUT, voxel, parameters.dimensions);
+  if(DIRECTION == TO_LAYOUT) {
+    outputWords[swizzled] = inputWords[linear];
+  } else {
+    outputWords[linear] = inputWords[swizzled];
+  }
+}
@@ -0,0 +1,54 @@
+/*
+Voxel addressing for the device volume layouts (vudo::VolumeLayout).
+Include with
+
+  #extension GL_GOOGLE_include_directive : require
+  #include "layout.glsl"
+
+  LINEAR   x fastest, then y, then z: a z neighbour is a slice away
+  BRICKED  8x8x8 bricks, each 512 consecutive voxels (x fastest inside),
+           the bricks themselves in x, y, z order
+  MORTON   32x32x32 tiles in x, y, z order, Z-order (bit interleaved)
+           inside each tile, so neighbours on every axis stay close
+
+BRICKED and MORTON pad each axis to a whole number of bricks or tiles,
+see layoutVoxelCount().  The padding voxels are never read.
+*/
+
+const uint LINEAR_LAYOUT = 0;
+const uint BRICKED_LAYOUT = 1;
+const uint MORTON_LAYOUT = 2;
+
+const uint LAYOUT_BRICK_SIZE = 8;
+const uint LAYOUT_TILE_BITS = 5;
+const uint LAYOUT_TILE_SIZE = 1 << LAYOUT_TILE_BITS;
+
+// the low 10 bits of value moved to every third bit
+uint spreadBits(uint value) {
+  value &= 0x3ffu;
+  value = (value | (value << 16)) & 0x030000ffu;
+  value = (value | (value << 8)) & 0x0300f00fu;
+  value = (value | (value << 4)) & 0x030c30c3u;
+  value = (value | (value << 2)) & 0x09249249u;
+  return value;
+}
+
+uint layoutIndex(uint volumeLayout, uvec3 voxel, uvec3 dimensions) {
+  if(volumeLayout == BRICKED_LAYOUT) {
+    uvec3 grid = (dimensions + LAYOUT_BRICK_SIZE - 1) / LAYOUT_BRICK_SIZE;
+    uvec3 brick = voxel / LAYOUT_BRICK_SIZE;
+    uvec3 inside = voxel % LAYOUT_BRICK_SIZE;
+    uint brickIndex = (brick.z * grid.y + brick.y) * grid.x + brick.x;
+    return brickIndex * (LAYOUT_BRICK_SIZE * LAYOUT_BRICK_SIZE * LAYOUT_BRICK_SIZE)
+           + (inside.z * LAYOUT_BRICK_SIZE + inside.y) * LAYOUT_BRICK_SIZE + inside.x;
+  }
+  if(volumeLayout == MORTON_LAYOUT) {
+    uvec3 grid = (dimensions + LAYOUT_TILE_SIZE - 1) / LAYOUT_TILE_SIZE;
+    uvec3 tile = voxel >> LAYOUT_TILE_BITS;
+    uvec3 inside = voxel & (LAYOUT_TILE_SIZE - 1);
+    uint tileIndex = (tile.z * grid.y + tile.y) * grid.x + tile.x;
+    return (tileIndex << (3 * LAYOUT_TILE_BITS))
+           | spreadBits(inside.x) | (spreadBits(inside.y) << 1) | (spreadBits(inside.z) << 2);
+  }
+  return (voxel.z * dimensions.y + voxel.y) * dimensions.x + voxel.x;
+}
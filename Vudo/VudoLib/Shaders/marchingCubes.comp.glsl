@@ -0,0 +1,286 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Marching cubes, one pass per specialization of PASS:
+
+  CLASSIFY   per voxel: the case of the cell whose lowest corner it is,
+             its triangle count, and which of its three +x/+y/+z edges
+             cross the surface.  Each crossing edge belongs to the voxel
+             it starts at, so every surface vertex is made exactly once
+             and shared by the cells around it (welding on the device).
+             activeOffsets gets 1 for voxels with triangles or vertices.
+  (scan of activeOffsets)
+  COMPACT    active voxels into activeVoxels, with their vertex and
+             triangle counts in vertexOffsets and triangleOffsets
+  (scans of vertexOffsets and triangleOffsets)
+  ARGUMENTS  one invocation: the indirect dispatch over active voxels
+  VERTICES   per active voxel: interpolated points and gradient normals
+  TRIANGLES  per active voxel: indices into the welded vertices
+
+Inside is value >= isovalue, or value == isovalue for a labelmap
+(labelMode), where vertices are at edge midpoints.  Normals point out.
+Input voxels are read in their native type like threshold.comp.glsl.
+Outputs past the capacities are dropped; the host compares the totals
+in counts with the capacities and runs again with larger buffers.
+*/
+
+layout(constant_id = 0) const uint PASS = 0;
+layout(constant_id = 1) const uint INPUT_TYPE = 6;
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+const uint CLASSIFY = 0;
+const uint COMPACT = 1;
+const uint ARGUMENTS = 2;
+const uint VERTICES = 3;
+const uint TRIANGLES = 4;
+
+const uint UINT8 = 0;
+const uint INT8 = 1;
+const uint UINT16 = 2;
+const uint INT16 = 3;
+const uint UINT32 = 4;
+const uint INT32 = 5;
+const uint FLOAT32 = 6;
+
+// per case: triangle count then up to five triangles of edge numbers
+const uint CASE_STRIDE = 16;
+
+layout(std430, binding = 0) readonly buffer Input {
+  uint inputWords[];
+};
+
+layout(std430, binding = 1) readonly buffer TriangleTable {
+  uint triangleTable[];
+};
+
+// cube case | owned edges << 8 | triangle count << 11
+layout(std430, binding = 2) buffer Cases {
+  uint cases[];
+};
+
+layout(std430, binding = 3) buffer ActiveOffsets {
+  uint activeOffsets[];
+};
+
+layout(std430, binding = 4) buffer ActiveVoxels {
+  uint activeVoxels[];
+};
+
+layout(std430, binding = 5) buffer VertexOffsets {
+  uint vertexOffsets[];
+};
+
+layout(std430, binding = 6) buffer TriangleOffsets {
+  uint triangleOffsets[];
+};
+
+layout(std430, binding = 7) writeonly buffer Points {
+  float points[];
+};
+
+layout(std430, binding = 8) writeonly buffer Normals {
+  float normals[];
+};
+
+layout(std430, binding = 9) writeonly buffer Indices {
+  uint indices[];
+};
+
+// active, vertex and triangle totals, padding, then a VkDispatchIndirectCommand
+layout(std430, binding = 10) buffer Counts {
+  uint counts[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  float isovalue;
+  uint labelMode;
+  uint activeCapacity;
+  uint vertexCapacity;
+  uint triangleCapacity;
+} parameters;
+
+uint typeBits(uint type) {
+  return type <= INT8 ? 8 : type <= INT16 ? 16 : 32;
+}
+
+float readInput(uint voxel) {
+  uint bits = typeBits(INPUT_TYPE);
+  uint perWord = 32 / bits;
+  uint word = inputWords[voxel / perWord];
+  int offset = int((voxel % perWord) * bits);
+  switch(INPUT_TYPE) {
+    case UINT8:
+    case UINT16:
+      return float(bitfieldExtract(word, offset, int(bits)));
+    case INT8:
+    case INT16:
+      return float(bitfieldExtract(int(word), offset, int(bits)));
+    case UINT32:
+      return float(word);
+    case INT32:
+      return float(int(word));
+    default:
+      return uintBitsToFloat(word);
+  }
+}
+
+uint voxelIndex(ivec3 position) {
+  return (uint(position.z) * parameters.dimensions.y + uint(position.y)) * parameters.dimensions.x + uint(position.x);
+}
+
+ivec3 voxelPosition(uint index) {
+  uvec3 size = parameters.dimensions;
+  return ivec3(index % size.x, (index / size.x) % size.y, index / (size.x * size.y));
+}
+
+float value(ivec3 position) {
+  return readInput(voxelIndex(clamp(position, ivec3(0), ivec3(parameters.dimensions) - 1)));
+}
+
+bool inside(ivec3 position) {
+  float v = value(position);
+  return parameters.labelMode != 0 ? v == parameters.isovalue : v >= parameters.isovalue;
+}
+
+// the scalar field the surface is a level set of
+float field(ivec3 position) {
+  return parameters.labelMode != 0 ? float(inside(position)) : value(position);
+}
+
+vec3 gradient(ivec3 position) {
+  return 0.5 * vec3(field(position + ivec3(1,0,0)) - field(position - ivec3(1,0,0)),
+                    field(position + ivec3(0,1,0)) - field(position - ivec3(0,1,0)),
+                    field(position + ivec3(0,0,1)) - field(position - ivec3(0,0,1)));
+}
+
+ivec3 axisStep(uint axis) {
+  return ivec3(axis == 0, axis == 1, axis == 2);
+}
+
+// lowest corner of a cube edge relative to the cell, see vudo::marchingCubesEdgeStart
+ivec3 edgeStart(uint edge) {
+  uint axis = edge / 4;
+  uint side = edge % 4;
+  return int(side & 1) * axisStep((axis + 1) % 3) + int(side >> 1) * axisStep((axis + 2) % 3);
+}
+
+uint ownedEdges(uint voxelCase) {
+  return (voxelCase >> 8) & 7;
+}
+
+uint triangleCount(uint voxelCase) {
+  return voxelCase >> 11;
+}
+
+void main() {
+  uint index = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * WORKGROUP_SIZE + gl_GlobalInvocationID.x;
+  uint voxelCount = parameters.dimensions.x * parameters.dimensions.y * parameters.dimensions.z;
+  // written by the scan of activeOffsets, read from ARGUMENTS on
+  uint activeCount = PASS >= ARGUMENTS ? min(counts[0], parameters.activeCapacity) : 0;
+
+  if(PASS == CLASSIFY) {
+    if(index >= voxelCount) {
+      return;
+    }
+    ivec3 position = voxelPosition(index);
+    bool center = inside(position);
+    uint owned = 0;
+    for (uint axis = 0; axis < 3; axis++) {
+      ivec3 next = position + axisStep(axis);
+      if(next[axis] < int(parameters.dimensions[axis]) && inside(next) != center) {
+        owned |= 1u << axis;
+      }
+    }
+    uint cube = 0;
+    uint triangles = 0;
+    if(all(lessThan(position + 1, ivec3(parameters.dimensions)))) {
+      for (uint corner = 0; corner < 8; corner++) {
+        ivec3 cornerPosition = position + ivec3(corner & 1, (corner >> 1) & 1, corner >> 2);
+        cube |= uint(corner == 0 ? center : inside(cornerPosition)) << corner;
+      }
+      triangles = triangleTable[cube * CASE_STRIDE];
+    }
+    cases[index] = cube | (owned << 8) | (triangles << 11);
+    activeOffsets[index] = (triangles > 0 || owned != 0) ? 1u : 0u;
+
+  } else if(PASS == COMPACT) {
+    if(index >= voxelCount) {
+      return;
+    }
+    uint voxelCase = cases[index];
+    if(triangleCount(voxelCase) > 0 || ownedEdges(voxelCase) != 0) {
+      uint active = activeOffsets[index];
+      if(active < parameters.activeCapacity) {
+        activeVoxels[active] = index;
+        vertexOffsets[active] = uint(bitCount(ownedEdges(voxelCase)));
+        triangleOffsets[active] = triangleCount(voxelCase);
+      }
+    }
+
+  } else if(PASS == ARGUMENTS) {
+    if(index == 0) {
+      uint groups = (activeCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+      uint groupsX = min(groups, 65535u);
+      counts[4] = groupsX;
+      counts[5] = groupsX > 0 ? (groups + groupsX - 1) / groupsX : 0u;
+      counts[6] = 1;
+    }
+
+  } else if(PASS == VERTICES) {
+    if(index >= activeCount) {
+      return;
+    }
+    uint voxel = activeVoxels[index];
+    ivec3 position = voxelPosition(voxel);
+    uint owned = ownedEdges(cases[voxel]);
+    uint vertex = vertexOffsets[index];
+    for (uint axis = 0; axis < 3; axis++) {
+      if((owned & (1u << axis)) == 0) {
+        continue;
+      }
+      ivec3 next = position + axisStep(axis);
+      float t = 0.5;
+      if(parameters.labelMode == 0) {
+        float here = value(position);
+        t = clamp((parameters.isovalue - here) / (value(next) - here), 0., 1.);
+      }
+      vec3 point = vec3(position) + t * vec3(axisStep(axis));
+      vec3 normal = -mix(gradient(position), gradient(next), t);
+      normal = length(normal) > 0. ? normalize(normal) : vec3(0.);
+      if(vertex < parameters.vertexCapacity) {
+        for (uint component = 0; component < 3; component++) {
+          points[3 * vertex + component] = point[component];
+          normals[3 * vertex + component] = normal[component];
+        }
+      }
+      vertex++;
+    }
+
+  } else if(PASS == TRIANGLES) {
+    if(index >= activeCount) {
+      return;
+    }
+    uint voxel = activeVoxels[index];
+    ivec3 position = voxelPosition(voxel);
+    uint voxelCase = cases[voxel];
+    uint cube = voxelCase & 0xff;
+    uint firstTriangle = triangleOffsets[index];
+    for (uint triangle = 0; triangle < triangleCount(voxelCase); triangle++) {
+      if(firstTriangle + triangle >= parameters.triangleCapacity) {
+        break;
+      }
+      for (uint corner = 0; corner < 3; corner++) {
+        uint edge = triangleTable[cube * CASE_STRIDE + 1 + 3 * triangle + corner];
+        uint axis = edge / 4;
+        uint owner = voxelIndex(position + edgeStart(edge));
+        uint ownerActive = min(activeOffsets[owner], parameters.activeCapacity - 1);
+        uint below = ownedEdges(cases[owner]) & ((1u << axis) - 1);
+        indices[3 * (firstTriangle + triangle) + corner] = vertexOffsets[ownerActive] + uint(bitCount(below));
+      }
+    }
+  }
+}
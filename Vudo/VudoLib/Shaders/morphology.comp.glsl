@@ -0,0 +1,176 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Binary morphology on bit-packed segments.
+
+Each voxel is one uint holding up to 32 binary segments, one per bit, so
+one pass erodes (AND over the structuring element) or dilates (OR) all of
+them at once.  Only the bits in parameters.segmentMask are processed, the
+others are copied from the input.
+
+Like stencil.comp.glsl, each workgroup loads its tile plus a halo of
+RADIUS_X/Y/Z voxels into shared memory and then evaluates the structuring
+element from there.  SHAPE is BALL (an ellipsoid with the given radii) or
+BOX (every offset within the radii; the host splits a box into one pass
+per axis).  Voxels outside the volume clamp to the nearest edge voxel, so
+the volume border neither erodes nor dilates segments.  When the tile and
+halo of a large radius do not fit in shared memory the host sets
+SHARED_TILE to 0 and each invocation reads its neighbourhood from the
+input buffer instead.
+
+With BRICKED the filter is dispatched indirectly over the active bricks
+of a vudo::DirtyBricks (BRICK_SIZE^3 voxels each, a whole number of
+tiles) and each workgroup takes a tile of its brick, so an incremental
+run only recomputes around the edited voxels.  The workgroups are
+counted row by row over gl_WorkGroupID.y, as vudoBricks.h describes, and
+those of the NO_BRICK padding after the last active brick do nothing.
+*/
+
+layout(constant_id = 0) const uint OPERATION = 0;
+layout(constant_id = 1) const uint SHAPE = 0;
+layout(constant_id = 2) const uint RADIUS_X = 1;
+layout(constant_id = 3) const uint RADIUS_Y = 1;
+layout(constant_id = 4) const uint RADIUS_Z = 1;
+layout(constant_id = 5) const uint TILE_X = 8;
+layout(constant_id = 6) const uint TILE_Y = 8;
+layout(constant_id = 7) const uint TILE_Z = 8;
+layout(constant_id = 8) const uint BRICKED = 0;
+layout(constant_id = 9) const uint BRICK_SIZE = 16;
+layout(constant_id = 10) const uint SHARED_TILE = 1;
+
+layout (local_size_x_id = 5, local_size_y_id = 6, local_size_z_id = 7) in;
+
+const uint ERODE = 0;
+const uint DILATE = 1;
+
+const uint BALL = 0;
+const uint BOX = 1;
+
+const uint NO_BRICK = 0xffffffffu;
+
+const uint SHARED_X = TILE_X + 2 * RADIUS_X;
+const uint SHARED_Y = TILE_Y + 2 * RADIUS_Y;
+const uint SHARED_Z = TILE_Z + 2 * RADIUS_Z;
+
+// a single element without SHARED_TILE
+shared uint tile[SHARED_TILE * SHARED_X * SHARED_Y * SHARED_Z + 1 - SHARED_TILE];
+
+layout(std430, binding = 0) readonly buffer Input {
+  uint inputBits[];
+};
+
+layout(std430, binding = 1) writeonly buffer Output {
+  uint outputBits[];
+};
+
+layout(std430, binding = 2) readonly buffer ActiveBricks {
+  uint activeBricks[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  uint segmentMask;
+} parameters;
+
+uint fetch(ivec3 position) {
+  ivec3 size = ivec3(parameters.dimensions);
+  position = clamp(position, ivec3(0), size - 1);
+  return inputBits[(position.z * size.y + position.y) * size.x + position.x];
+}
+
+uint shared3D(ivec3 position) {
+  return tile[(position.z * SHARED_Y + position.y) * SHARED_X + position.x];
+}
+
+// the voxel at offset from the one this invocation computes
+uint neighbour(ivec3 center, uvec3 voxel, ivec3 offset) {
+  return SHARED_TILE != 0 ? shared3D(center + offset) : fetch(ivec3(voxel) + offset);
+}
+
+// squared offset over squared radius, 0 along axes without extent
+float ellipsoidTerm(int offset, uint radius) {
+  return radius == 0 ? 0. : float(offset * offset) / float(radius * radius);
+}
+
+// no further offset can change the masked bits
+bool settled(uint result) {
+  uint masked = result & parameters.segmentMask;
+  return OPERATION == ERODE ? masked == 0u : masked == parameters.segmentMask;
+}
+
+// the tile of this workgroup: its ID, or with BRICKED one of the tiles of an active brick;
+// false for the padding past the last active brick
+bool workgroupTile(out uvec3 workgroup) {
+  if(BRICKED == 0) {
+    workgroup = gl_WorkGroupID;
+    return true;
+  }
+  uvec3 tilesPerBrick = uvec3(BRICK_SIZE) / gl_WorkGroupSize;
+  uint groupsPerBrick = tilesPerBrick.x * tilesPerBrick.y * tilesPerBrick.z;
+  uint index = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  uint brick = activeBricks[index / groupsPerBrick];
+  if(brick == NO_BRICK) {
+    workgroup = uvec3(0);
+    return false;
+  }
+  uint group = index % groupsPerBrick;
+  uvec3 brickGrid = (parameters.dimensions + BRICK_SIZE - 1) / BRICK_SIZE;
+  uvec3 brickCoordinate = uvec3(brick % brickGrid.x, (brick / brickGrid.x) % brickGrid.y,
+                                brick / (brickGrid.x * brickGrid.y));
+  uvec3 groupCoordinate = uvec3(group % tilesPerBrick.x, (group / tilesPerBrick.x) % tilesPerBrick.y,
+                                group / (tilesPerBrick.x * tilesPerBrick.y));
+  workgroup = brickCoordinate * tilesPerBrick + groupCoordinate;
+  return true;
+}
+
+void main() {
+
+  // the whole workgroup agrees, so it can return before the barrier
+  uvec3 workgroup;
+  if(!workgroupTile(workgroup)) {
+    return;
+  }
+
+  // cooperative load of the tile and its halo
+  ivec3 tileOrigin = ivec3(workgroup * gl_WorkGroupSize) - ivec3(RADIUS_X, RADIUS_Y, RADIUS_Z);
+  if(SHARED_TILE != 0) {
+    for (uint index = gl_LocalInvocationIndex; index < SHARED_X * SHARED_Y * SHARED_Z; index += TILE_X * TILE_Y * TILE_Z) {
+      uvec3 offset = uvec3(index % SHARED_X, (index / SHARED_X) % SHARED_Y, index / (SHARED_X * SHARED_Y));
+      tile[index] = fetch(tileOrigin + ivec3(offset));
+    }
+    barrier();
+  }
+
+  uvec3 voxel = workgroup * gl_WorkGroupSize + gl_LocalInvocationID;
+  if(any(greaterThanEqual(voxel, parameters.dimensions))) {
+    return;
+  }
+  ivec3 center = ivec3(gl_LocalInvocationID) + ivec3(RADIUS_X, RADIUS_Y, RADIUS_Z);
+  uint centerBits = neighbour(center, voxel, ivec3(0));
+
+  // erosion starts from all ones and stops once no masked bit is left,
+  // dilation from zero and stops once every masked bit is set
+  uint result = OPERATION == ERODE ? 0xffffffffu : 0u;
+  for (int z = -int(RADIUS_Z); z <= int(RADIUS_Z); z++) {
+    for (int y = -int(RADIUS_Y); y <= int(RADIUS_Y); y++) {
+      for (int x = -int(RADIUS_X); x <= int(RADIUS_X); x++) {
+        if(SHAPE == BALL &&
+           ellipsoidTerm(x, RADIUS_X) + ellipsoidTerm(y, RADIUS_Y) + ellipsoidTerm(z, RADIUS_Z) > 1.) {
+          continue;
+        }
+        uint bits = neighbour(center, voxel, ivec3(x, y, z));
+        result = OPERATION == ERODE ? result & bits : result | bits;
+      }
+      if(settled(result)) {
+        break;
+      }
+    }
+    if(settled(result)) {
+      break;
+    }
+  }
+
+  result = (result & parameters.segmentMask) | (centerBits & ~parameters.segmentMask);
+  outputBits[(voxel.z * parameters.dimensions.y + voxel.y) * parameters.dimensions.x + voxel.x] = result;
+}
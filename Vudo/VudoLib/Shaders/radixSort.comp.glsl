@@ -0,0 +1,138 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+One 4 bit digit pass of a stable least significant digit radix sort of
+uint keys, with optional uint values carried along:
+
+  HISTOGRAM  each block of BLOCK_SIZE keys counts its digits into
+             histograms[digit * blockCount + block]
+  (exclusive scan of histograms: for each digit and block, the number
+   of keys that go before the block's first key of that digit)
+  SCATTER    each key (and value) moves to its scanned block offset plus
+             its rank among the block's keys of the same digit
+
+Each invocation owns ELEMENTS_PER_INVOCATION consecutive keys, so ranking
+them in invocation order keeps the sort stable: the per invocation digit
+counts are scanned in shared memory, digit major, which gives each
+invocation where its first key of every digit goes within the block.
+
+The shared memory grows with WORKGROUP_SIZE (17 uints per invocation), so
+the host picks the largest size up to 256 that fits the device, at least
+RADIX invocations.
+*/
+
+layout(constant_id = 0) const uint PASS = 0;
+layout(constant_id = 1) const uint HAS_VALUES = 1;
+layout(constant_id = 2) const uint WORKGROUP_SIZE = 256;
+
+#define ELEMENTS_PER_INVOCATION 4
+#define BLOCK_SIZE (WORKGROUP_SIZE * ELEMENTS_PER_INVOCATION)
+#define RADIX 16
+layout (local_size_x_id = 2) in;
+
+const uint HISTOGRAM = 0;
+const uint SCATTER = 1;
+
+layout(std430, binding = 0) readonly buffer KeysIn {
+  uint keysIn[];
+};
+
+layout(std430, binding = 1) readonly buffer ValuesIn {
+  uint valuesIn[];
+};
+
+layout(std430, binding = 2) writeonly buffer KeysOut {
+  uint keysOut[];
+};
+
+layout(std430, binding = 3) writeonly buffer ValuesOut {
+  uint valuesOut[];
+};
+
+layout(std430, binding = 4) buffer Histograms {
+  uint histograms[];
+};
+
+layout(push_constant) uniform Parameters {
+  uint count;
+  uint shift;
+  uint blockCount;
+} parameters;
+
+// digitCounts[digit * WORKGROUP_SIZE + invocation]
+shared uint digitCounts[RADIX * WORKGROUP_SIZE];
+shared uint partial[WORKGROUP_SIZE];
+shared uint digitStart[RADIX];
+
+uint digitOf(uint key) {
+  return (key >> parameters.shift) & (RADIX - 1);
+}
+
+void main() {
+  uint block = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  if(block >= parameters.blockCount) {
+    return;
+  }
+  uint invocation = gl_LocalInvocationID.x;
+  uint first = block * BLOCK_SIZE + invocation * ELEMENTS_PER_INVOCATION;
+  uint last = min(first + ELEMENTS_PER_INVOCATION, parameters.count);
+
+  for (uint digit = 0; digit < RADIX; digit++) {
+    digitCounts[digit * WORKGROUP_SIZE + invocation] = 0;
+  }
+  for (uint element = first; element < last; element++) {
+    digitCounts[digitOf(keysIn[element]) * WORKGROUP_SIZE + invocation]++;
+  }
+  barrier();
+
+  if(PASS == HISTOGRAM) {
+    if(invocation < RADIX) {
+      uint sum = 0;
+      for (uint other = 0; other < WORKGROUP_SIZE; other++) {
+        sum += digitCounts[invocation * WORKGROUP_SIZE + other];
+      }
+      histograms[invocation * parameters.blockCount + block] = sum;
+    }
+    return;
+  }
+
+  // exclusive scan of digitCounts: SPAN consecutive entries per invocation,
+  // then the invocation totals Hillis-Steele
+  const uint SPAN = RADIX; // RADIX * WORKGROUP_SIZE entries over WORKGROUP_SIZE invocations
+  uint sum = 0;
+  for (uint entry = invocation * SPAN; entry < (invocation + 1) * SPAN; entry++) {
+    sum += digitCounts[entry];
+  }
+  partial[invocation] = sum;
+  barrier();
+  for (uint offset = 1; offset < WORKGROUP_SIZE; offset *= 2) {
+    uint previous = invocation >= offset ? partial[invocation - offset] : 0;
+    barrier();
+    partial[invocation] += previous;
+    barrier();
+  }
+  uint running = partial[invocation] - sum;
+  for (uint entry = invocation * SPAN; entry < (invocation + 1) * SPAN; entry++) {
+    uint entryCount = digitCounts[entry];
+    digitCounts[entry] = running;
+    running += entryCount;
+  }
+  barrier();
+  if(invocation < RADIX) {
+    digitStart[invocation] = digitCounts[invocation * WORKGROUP_SIZE];
+  }
+  barrier();
+
+  for (uint element = first; element < last; element++) {
+    uint key = keysIn[element];
+    uint digit = digitOf(key);
+    uint slot = digit * WORKGROUP_SIZE + invocation;
+    uint destination = histograms[digit * parameters.blockCount + block] + digitCounts[slot] - digitStart[digit];
+    digitCounts[slot]++;
+    keysOut[destination] = key;
+    if(HAS_VALUES != 0) {
+      valuesOut[destination] = valuesIn[element];
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Front to back ray casting of a device resident volume into an RGBA8 image.
+
+One invocation per pixel marches a perspective ray from the eye through
+the volume (positions in IJK), maps trilinear samples through a 1D
+transfer function table and composites front to back.  Rays stop once
+they are nearly opaque, and when a brick occupancy map is bound
+(brickSize != 0) rays jump over the samples that only read voxels of
+empty bricks, so skipping does not change the image.
+
+The volume holds valueStride floats per voxel and the first is rendered,
+so the vec4 output of the generators can be cast in place.
+*/
+
+#define WORKGROUP_SIZE 8
+layout (local_size_x = WORKGROUP_SIZE, local_size_y = WORKGROUP_SIZE) in;
+
+const float OPAQUE = 0.99;
+
+layout(std430, binding = 0) readonly buffer Volume {
+  float values[];
+};
+
+layout(std430, binding = 1) readonly buffer TransferFunction {
+  vec4 table[];
+};
+
+layout(std430, binding = 2) readonly buffer Occupancy {
+  uint occupancy[];
+};
+
+layout(std430, binding = 3) writeonly buffer Image {
+  uint pixels[];
+};
+
+layout(push_constant) uniform Parameters {
+  vec3 eye;
+  float stepSize;
+  vec3 pixelOrigin; // position of pixel (0,0) on the image plane
+  uint brickSize;
+  vec3 pixelStepX;  // from one pixel to the next in a row
+  float rangeMin;
+  vec3 pixelStepY;  // from one row to the next (rows go top to bottom)
+  float rangeMax;
+  uvec3 dimensions;
+  uint valueStride;
+  uvec2 imageSize;
+  uint tableSize;
+} parameters;
+
+float voxelValue(ivec3 position) {
+  ivec3 size = ivec3(parameters.dimensions);
+  position = clamp(position, ivec3(0), size - 1);
+  return values[((position.z * size.y + position.y) * size.x + position.x) * parameters.valueStride];
+}
+
+float sampleVolume(vec3 point) {
+  ivec3 base = ivec3(floor(point));
+  vec3 fraction = point - vec3(base);
+  float c00 = mix(voxelValue(base + ivec3(0,0,0)), voxelValue(base + ivec3(1,0,0)), fraction.x);
+  float c10 = mix(voxelValue(base + ivec3(0,1,0)), voxelValue(base + ivec3(1,1,0)), fraction.x);
+  float c01 = mix(voxelValue(base + ivec3(0,0,1)), voxelValue(base + ivec3(1,0,1)), fraction.x);
+  float c11 = mix(voxelValue(base + ivec3(0,1,1)), voxelValue(base + ivec3(1,1,1)), fraction.x);
+  return mix(mix(c00, c10, fraction.y), mix(c01, c11, fraction.y), fraction.z);
+}
+
+vec4 transfer(float value) {
+  float position = (value - parameters.rangeMin) / (parameters.rangeMax - parameters.rangeMin);
+  uint entry = uint(clamp(position, 0., 1.) * float(parameters.tableSize - 1) + 0.5);
+  return table[entry];
+}
+
+/*
+A trilinear sample reads the voxels floor(point) and floor(point) + 1, so
+only points whose eight voxels all lie in one brick can be skipped when
+that brick is empty: [b*brickSize, (b+1)*brickSize - 1] on each axis,
+widened to the volume box at its faces.  Points between two bricks read
+both and are always sampled.
+*/
+bool brickEmpty(vec3 point, vec3 direction, out float exitDistance) {
+  ivec3 lastVoxel = ivec3(parameters.dimensions) - 1;
+  uvec3 low = uvec3(clamp(ivec3(floor(point)), ivec3(0), lastVoxel));
+  uvec3 high = uvec3(clamp(ivec3(floor(point)) + 1, ivec3(0), lastVoxel));
+  uvec3 brick = low / parameters.brickSize;
+  if(any(notEqual(high / parameters.brickSize, brick))) {
+    return false;
+  }
+  uvec3 brickGrid = (parameters.dimensions + parameters.brickSize - 1) / parameters.brickSize;
+  if(occupancy[(brick.z * brickGrid.y + brick.y) * brickGrid.x + brick.x] != 0) {
+    return false;
+  }
+  // distance along the ray to the far side of the part of the brick sampled from it alone
+  uvec3 first = brick * parameters.brickSize;
+  uvec3 end = min(first + parameters.brickSize, parameters.dimensions);
+  vec3 brickMin = vec3(first) - mix(vec3(0.), vec3(0.5), equal(first, uvec3(0)));
+  vec3 brickMax = vec3(end) - mix(vec3(1.), vec3(0.5), equal(end, parameters.dimensions));
+  vec3 inverse = 1. / direction;
+  vec3 far = max((brickMin - point) * inverse, (brickMax - point) * inverse);
+  exitDistance = min(min(far.x, far.y), far.z);
+  return true;
+}
+
+void main() {
+
+  uvec2 pixel = gl_GlobalInvocationID.xy;
+  if(any(greaterThanEqual(pixel, parameters.imageSize))) {
+    return;
+  }
+
+  vec3 pixelPosition = parameters.pixelOrigin
+                       + float(pixel.x) * parameters.pixelStepX + float(pixel.y) * parameters.pixelStepY;
+  vec3 direction = normalize(pixelPosition - parameters.eye);
+  direction = mix(direction, vec3(1e-6), equal(direction, vec3(0.)));
+
+  // clip the ray against the volume box
+  vec3 boxMin = vec3(-0.5);
+  vec3 boxMax = vec3(parameters.dimensions) - 0.5;
+  vec3 inverse = 1. / direction;
+  vec3 near = min((boxMin - parameters.eye) * inverse, (boxMax - parameters.eye) * inverse);
+  vec3 far = max((boxMin - parameters.eye) * inverse, (boxMax - parameters.eye) * inverse);
+  float entry = max(max(max(near.x, near.y), near.z), 0.);
+  float exit = min(min(far.x, far.y), far.z);
+
+  vec4 color = vec4(0.);
+  float distance = entry;
+  while(distance < exit && color.a < OPAQUE) {
+    vec3 point = parameters.eye + distance * direction;
+    float exitDistance;
+    if(parameters.brickSize != 0 && brickEmpty(point, direction, exitDistance)) {
+      // whole steps, so the samples after the jump are those of a ray that never skipped
+      distance += max(ceil(exitDistance / parameters.stepSize), 1.) * parameters.stepSize;
+      continue;
+    }
+    vec4 sampleColor = transfer(sampleVolume(point));
+    // table opacities are per unit length
+    float alpha = 1. - pow(1. - sampleColor.a, parameters.stepSize);
+    color.rgb += (1. - color.a) * alpha * sampleColor.rgb;
+    color.a += (1. - color.a) * alpha;
+    distance += parameters.stepSize;
+  }
+
+  pixels[pixel.y * parameters.imageSize.x + pixel.x] = packUnorm4x8(color);
+}
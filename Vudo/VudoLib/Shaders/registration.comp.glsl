@@ -0,0 +1,303 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Registration metrics of many candidate transforms at once:
+
+  ACCUMULATE  workgroup (group, candidate) maps its share of the fixed
+              samples into the moving volume and writes its sums and
+              joint histogram to one row of partials
+  FINISH      workgroup candidate adds up the GROUPS_PER_CANDIDATE rows
+              and writes the cost of the candidate to results
+
+Sums are of intensities minus the middle of their range, to keep the
+moments of the correlation well conditioned in float.  The joint
+histogram (fixed rows, moving columns) is built in shared memory with
+integer atomics on fixed point weights, and folded into float registers
+after every batch of samples so the integers never overflow.  The fixed
+intensity picks a single bin, the moving one spreads over four with a
+cubic B-spline Parzen window, two bins of padding on each side.
+*/
+
+layout(constant_id = 0) const uint PASS = 0;
+layout(constant_id = 1) const uint METRIC = 2;
+layout(constant_id = 2) const uint BINS = 32;
+
+#define WORKGROUP_SIZE 256
+#define GROUPS_PER_CANDIDATE 32
+#define BATCH_ROUNDS 64
+#define MAX_BINS 64
+#define OWNED_BINS (MAX_BINS * MAX_BINS / WORKGROUP_SIZE)
+#define WEIGHT_SCALE 1024.
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+const uint ACCUMULATE = 0;
+const uint FINISH = 1;
+
+const uint MEAN_SQUARES = 0;
+const uint CORRELATION = 1;
+const uint MUTUAL_INFORMATION = 2;
+
+// count, fixed, moving, fixed^2, moving^2, fixed*moving, (fixed-moving)^2
+const uint STATISTICS = 7;
+const uint ROW_SIZE = STATISTICS + BINS * BINS;
+
+layout(std430, binding = 0) readonly buffer Fixed {
+  float fixedValues[];
+};
+
+layout(std430, binding = 1) readonly buffer Moving {
+  float movingValues[];
+};
+
+layout(std430, binding = 2) readonly buffer Candidates {
+  layout(row_major) mat4 candidates[];
+};
+
+layout(std430, binding = 3) buffer Partials {
+  float partials[];
+};
+
+layout(std430, binding = 4) writeonly buffer Results {
+  float results[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 fixedDimensions;
+  uint sampleStride;
+  uvec3 movingDimensions;
+  uint candidateCount;
+  vec2 fixedRange;
+  vec2 movingRange;
+} parameters;
+
+// the joint histogram, as fixed point counts while accumulating and as float bits when finishing;
+// sized by BINS, the host checks the total against maxComputeSharedMemorySize
+shared uint histogram[BINS * BINS];
+shared float reduction[WORKGROUP_SIZE];
+shared float statistics[STATISTICS];
+shared float fixedMarginal[BINS];
+shared float movingMarginal[BINS];
+
+float workgroupSum(float value) {
+  uint invocation = gl_LocalInvocationID.x;
+  reduction[invocation] = value;
+  barrier();
+  for (uint width = WORKGROUP_SIZE / 2; width > 0; width /= 2) {
+    if(invocation < width) {
+      reduction[invocation] += reduction[invocation + width];
+    }
+    barrier();
+  }
+  float sum = reduction[0];
+  barrier();
+  return sum;
+}
+
+float movingValue(ivec3 position) {
+  ivec3 size = ivec3(parameters.movingDimensions);
+  position = clamp(position, ivec3(0), size - 1);
+  return movingValues[(position.z * size.y + position.y) * size.x + position.x];
+}
+
+float interpolateMoving(vec3 point) {
+  ivec3 base = ivec3(floor(point));
+  vec3 fraction = point - vec3(base);
+  float c00 = mix(movingValue(base + ivec3(0,0,0)), movingValue(base + ivec3(1,0,0)), fraction.x);
+  float c10 = mix(movingValue(base + ivec3(0,1,0)), movingValue(base + ivec3(1,1,0)), fraction.x);
+  float c01 = mix(movingValue(base + ivec3(0,0,1)), movingValue(base + ivec3(1,0,1)), fraction.x);
+  float c11 = mix(movingValue(base + ivec3(0,1,1)), movingValue(base + ivec3(1,1,1)), fraction.x);
+  return mix(mix(c00, c10, fraction.y), mix(c01, c11, fraction.y), fraction.z);
+}
+
+// continuous bin position of value in range, from 2 to BINS - 3
+float binPosition(float value, vec2 range) {
+  float unit = clamp((value - range.x) / (range.y - range.x), 0., 1.);
+  return 2. + unit * float(BINS - 5);
+}
+
+float cubicBSpline(float x) {
+  x = abs(x);
+  if(x < 1.) {
+    return (4. - 6. * x * x + 3. * x * x * x) / 6.;
+  }
+  if(x < 2.) {
+    float t = 2. - x;
+    return t * t * t / 6.;
+  }
+  return 0.;
+}
+
+void accumulate() {
+  uint invocation = gl_LocalInvocationID.x;
+  uint group = gl_WorkGroupID.x;
+  uint candidate = gl_WorkGroupID.y;
+  mat4 fixedToMoving = candidates[candidate];
+  uvec3 sampleDimensions = (parameters.fixedDimensions + parameters.sampleStride - 1) / parameters.sampleStride;
+  uint sampleCount = sampleDimensions.x * sampleDimensions.y * sampleDimensions.z;
+  vec3 lastMoving = vec3(parameters.movingDimensions) - 1.;
+  float fixedShift = 0.5 * (parameters.fixedRange.x + parameters.fixedRange.y);
+  float movingShift = 0.5 * (parameters.movingRange.x + parameters.movingRange.y);
+
+  float sums[STATISTICS];
+  for (uint statistic = 0; statistic < STATISTICS; statistic++) {
+    sums[statistic] = 0.;
+  }
+  float owned[OWNED_BINS];
+  for (uint slot = 0; slot < OWNED_BINS; slot++) {
+    owned[slot] = 0.;
+  }
+  if(METRIC == MUTUAL_INFORMATION) {
+    for (uint slot = invocation; slot < BINS * BINS; slot += WORKGROUP_SIZE) {
+      histogram[slot] = 0;
+    }
+    barrier();
+  }
+
+  // batches are the same for every invocation, so the barriers are uniform
+  const uint stride = GROUPS_PER_CANDIDATE * WORKGROUP_SIZE;
+  for (uint batch = 0; batch < sampleCount; batch += BATCH_ROUNDS * stride) {
+    for (uint round = 0; round < BATCH_ROUNDS; round++) {
+      uint sampleIndex = batch + round * stride + group * WORKGROUP_SIZE + invocation;
+      if(sampleIndex >= sampleCount) {
+        break;
+      }
+      uvec3 sampleVoxel = uvec3(sampleIndex % sampleDimensions.x,
+                                (sampleIndex / sampleDimensions.x) % sampleDimensions.y,
+                                sampleIndex / (sampleDimensions.x * sampleDimensions.y));
+      uvec3 voxel = sampleVoxel * parameters.sampleStride;
+      vec3 point = (fixedToMoving * vec4(vec3(voxel), 1.)).xyz;
+      if(any(lessThan(point, vec3(-0.5))) || any(greaterThan(point, lastMoving + 0.5))) {
+        continue;
+      }
+      uvec3 size = parameters.fixedDimensions;
+      float fixedValue = fixedValues[(voxel.z * size.y + voxel.y) * size.x + voxel.x];
+      float movingValue = interpolateMoving(point);
+
+      float f = fixedValue - fixedShift;
+      float m = movingValue - movingShift;
+      sums[0] += 1.;
+      sums[1] += f;
+      sums[2] += m;
+      sums[3] += f * f;
+      sums[4] += m * m;
+      sums[5] += f * m;
+      sums[6] += (fixedValue - movingValue) * (fixedValue - movingValue);
+
+      if(METRIC == MUTUAL_INFORMATION) {
+        uint fixedBin = uint(binPosition(fixedValue, parameters.fixedRange) + 0.5);
+        float movingPosition = binPosition(movingValue, parameters.movingRange);
+        int movingBin = int(floor(movingPosition));
+        for (int bin = movingBin - 1; bin <= movingBin + 2; bin++) {
+          float weight = cubicBSpline(float(bin) - movingPosition);
+          atomicAdd(histogram[fixedBin * BINS + uint(bin)], uint(weight * WEIGHT_SCALE + 0.5));
+        }
+      }
+    }
+    if(METRIC == MUTUAL_INFORMATION) {
+      barrier();
+      for (uint slot = invocation, ownedSlot = 0; slot < BINS * BINS; slot += WORKGROUP_SIZE, ownedSlot++) {
+        owned[ownedSlot] += float(histogram[slot]) / WEIGHT_SCALE;
+        histogram[slot] = 0;
+      }
+      barrier();
+    }
+  }
+
+  uint row = (candidate * GROUPS_PER_CANDIDATE + group) * ROW_SIZE;
+  for (uint statistic = 0; statistic < STATISTICS; statistic++) {
+    float sum = workgroupSum(sums[statistic]);
+    if(invocation == 0) {
+      partials[row + statistic] = sum;
+    }
+  }
+  if(METRIC == MUTUAL_INFORMATION) {
+    for (uint slot = invocation, ownedSlot = 0; slot < BINS * BINS; slot += WORKGROUP_SIZE, ownedSlot++) {
+      partials[row + STATISTICS + slot] = owned[ownedSlot];
+    }
+  }
+}
+
+void finish() {
+  uint invocation = gl_LocalInvocationID.x;
+  uint candidate = gl_WorkGroupID.x;
+  uint firstRow = candidate * GROUPS_PER_CANDIDATE * ROW_SIZE;
+
+  if(invocation < STATISTICS) {
+    float sum = 0.;
+    for (uint group = 0; group < GROUPS_PER_CANDIDATE; group++) {
+      sum += partials[firstRow + group * ROW_SIZE + invocation];
+    }
+    statistics[invocation] = sum;
+  }
+  barrier();
+  float count = statistics[0];
+
+  if(METRIC == MEAN_SQUARES) {
+    if(invocation == 0) {
+      results[candidate] = count > 0. ? statistics[6] / count : uintBitsToFloat(0x7f800000u);
+    }
+    return;
+  }
+
+  if(METRIC == CORRELATION) {
+    if(invocation == 0) {
+      float covariance = statistics[5] - statistics[1] * statistics[2] / count;
+      float fixedVariance = statistics[3] - statistics[1] * statistics[1] / count;
+      float movingVariance = statistics[4] - statistics[2] * statistics[2] / count;
+      float denominator = sqrt(max(fixedVariance, 0.) * max(movingVariance, 0.));
+      results[candidate] = denominator > 0. ? -covariance / denominator : 0.;
+    }
+    return;
+  }
+
+  for (uint slot = invocation; slot < BINS * BINS; slot += WORKGROUP_SIZE) {
+    float sum = 0.;
+    for (uint group = 0; group < GROUPS_PER_CANDIDATE; group++) {
+      sum += partials[firstRow + group * ROW_SIZE + STATISTICS + slot];
+    }
+    histogram[slot] = floatBitsToUint(sum);
+  }
+  barrier();
+  if(invocation < BINS) {
+    float sum = 0.;
+    for (uint column = 0; column < BINS; column++) {
+      sum += uintBitsToFloat(histogram[invocation * BINS + column]);
+    }
+    fixedMarginal[invocation] = sum;
+  } else if(invocation < 2 * BINS) {
+    uint column = invocation - BINS;
+    float sum = 0.;
+    for (uint row = 0; row < BINS; row++) {
+      sum += uintBitsToFloat(histogram[row * BINS + column]);
+    }
+    movingMarginal[column] = sum;
+  }
+  barrier();
+
+  // sum of p(f,m) log(p(f,m) / (p(f) p(m))) with p = joint / total
+  float total = 0.;
+  for (uint bin = 0; bin < BINS; bin++) {
+    total += fixedMarginal[bin];
+  }
+  float information = 0.;
+  for (uint slot = invocation; slot < BINS * BINS; slot += WORKGROUP_SIZE) {
+    float joint = uintBitsToFloat(histogram[slot]);
+    float marginals = fixedMarginal[slot / BINS] * movingMarginal[slot % BINS];
+    if(joint > 0. && marginals > 0.) {
+      information += joint / total * log(joint * total / marginals);
+    }
+  }
+  information = workgroupSum(information);
+  if(invocation == 0) {
+    results[candidate] = total > 0. ? -information : 0.;
+  }
+}
+
+void main() {
+  if(PASS == ACCUMULATE) {
+    accumulate();
+  } else {
+    finish();
+  }
+}
@@ -0,0 +1,127 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Resample a float volume through an affine transform.
+
+Every output voxel (i,j,k) is mapped by outputToInput (an IJK to IJK
+matrix) into the input and interpolated there.  Points outside the input
+get backgroundValue.  The output of one dispatch is a slab starting at
+outputOffset in the output buffer, so several slabs (e.g. the slices of
+all slice views) can be written by one submission.  Its 16x16 tiles are
+dispatched linearly, counted row by row over gl_WorkGroupID.y (see
+ComputePipeline::recordLinear), slice by slice, so the depth of a slab is
+not bound by maxComputeWorkGroupCount[2].
+
+INTERPOLATION (specialization constant 0) is NEAREST, LINEAR or
+WINDOWED_SINC (Lanczos, 3 lobes, with clamped neighbours at the edges).
+*/
+
+#define WORKGROUP_SIZE 16
+layout (local_size_x = WORKGROUP_SIZE, local_size_y = WORKGROUP_SIZE, local_size_z = 1) in;
+
+layout(constant_id = 0) const uint INTERPOLATION = 1;
+
+const uint NEAREST = 0;
+const uint LINEAR = 1;
+const uint WINDOWED_SINC = 2;
+
+const int SINC_LOBES = 3;
+const float PI = 3.14159265358979;
+
+layout(std430, binding = 0) readonly buffer Input {
+  float inputValues[];
+};
+
+layout(std430, binding = 1) writeonly buffer Output {
+  float outputValues[];
+};
+
+layout(push_constant) uniform Parameters {
+  layout(row_major) mat4 outputToInput;
+  uvec3 inputDimensions;
+  float backgroundValue;
+  uvec3 outputDimensions;
+  uint outputOffset;
+} parameters;
+
+float inputValue(ivec3 position) {
+  ivec3 size = ivec3(parameters.inputDimensions);
+  position = clamp(position, ivec3(0), size - 1);
+  return inputValues[(position.z * size.y + position.y) * size.x + position.x];
+}
+
+float lanczos(float x) {
+  if(abs(x) < 1e-5) {
+    return 1.;
+  }
+  if(abs(x) >= SINC_LOBES) {
+    return 0.;
+  }
+  float piX = PI * x;
+  return SINC_LOBES * sin(piX) * sin(piX / SINC_LOBES) / (piX * piX);
+}
+
+float interpolate(vec3 point) {
+  if(INTERPOLATION == NEAREST) {
+    return inputValue(ivec3(floor(point + 0.5)));
+  }
+
+  ivec3 base = ivec3(floor(point));
+  vec3 fraction = point - vec3(base);
+  if(INTERPOLATION == LINEAR) {
+    float c00 = mix(inputValue(base + ivec3(0,0,0)), inputValue(base + ivec3(1,0,0)), fraction.x);
+    float c10 = mix(inputValue(base + ivec3(0,1,0)), inputValue(base + ivec3(1,1,0)), fraction.x);
+    float c01 = mix(inputValue(base + ivec3(0,0,1)), inputValue(base + ivec3(1,0,1)), fraction.x);
+    float c11 = mix(inputValue(base + ivec3(0,1,1)), inputValue(base + ivec3(1,1,1)), fraction.x);
+    return mix(mix(c00, c10, fraction.y), mix(c01, c11, fraction.y), fraction.z);
+  }
+
+  float weightsX[2 * SINC_LOBES];
+  float weightsY[2 * SINC_LOBES];
+  float weightsZ[2 * SINC_LOBES];
+  for (int tap = 0; tap < 2 * SINC_LOBES; tap++) {
+    float offset = float(tap - SINC_LOBES + 1);
+    weightsX[tap] = lanczos(offset - fraction.x);
+    weightsY[tap] = lanczos(offset - fraction.y);
+    weightsZ[tap] = lanczos(offset - fraction.z);
+  }
+  float sum = 0.;
+  float weightSum = 0.;
+  for (int z = 0; z < 2 * SINC_LOBES; z++) {
+    for (int y = 0; y < 2 * SINC_LOBES; y++) {
+      for (int x = 0; x < 2 * SINC_LOBES; x++) {
+        float weight = weightsX[x] * weightsY[y] * weightsZ[z];
+        sum += weight * inputValue(base + ivec3(x, y, z) - SINC_LOBES + 1);
+        weightSum += weight;
+      }
+    }
+  }
+  return sum / weightSum;
+}
+
+// the output voxel of this invocation, from its linear workgroup index
+uvec3 outputVoxel() {
+  uvec2 tiles = (parameters.outputDimensions.xy + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+  uint workgroup = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  uint tile = workgroup % (tiles.x * tiles.y);
+  return uvec3(uvec2(tile % tiles.x, tile / tiles.x) * WORKGROUP_SIZE + gl_LocalInvocationID.xy,
+               workgroup / (tiles.x * tiles.y));
+}
+
+void main() {
+
+  uvec3 voxel = outputVoxel();
+  if(any(greaterThanEqual(voxel, parameters.outputDimensions))) {
+    return;
+  }
+
+  vec3 point = (parameters.outputToInput * vec4(vec3(voxel), 1.)).xyz;
+  vec3 last = vec3(parameters.inputDimensions) - 1.;
+  // half a voxel of tolerance so that grid aligned outputs keep their edges
+  bool inside = all(greaterThanEqual(point, vec3(-0.5))) && all(lessThanEqual(point, last + 0.5));
+
+  uint index = parameters.outputOffset
+               + (voxel.z * parameters.outputDimensions.y + voxel.y) * parameters.outputDimensions.x + voxel.x;
+  outputValues[index] = inside ? interpolate(point) : parameters.backgroundValue;
+}
@@ -0,0 +1,151 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Exclusive prefix sum of uints in blocks of BLOCK_SIZE.
+
+SCAN_BLOCKS scans each block in place and writes its total to
+blockSums[block]; ADD_BLOCKS adds the (by then scanned) blockSums to
+every element of each block.  vudo::ExclusiveScan chains the two over
+as many levels as needed.
+
+LOOKBACK does it all in one pass with decoupled look-back: blockSums
+then holds a partition counter followed by {flag, aggregate, inclusive
+prefix} for each block.  Workgroups take their block from the counter,
+so every block they wait for has been claimed by a running workgroup.
+A block publishes its aggregate, then walks back over its predecessors,
+adding aggregates until it finds a published inclusive prefix, and
+publishes its own inclusive prefix.
+
+Each invocation scans ELEMENTS_PER_INVOCATION consecutive values in
+registers and the per-invocation totals are scanned in shared memory
+(Hillis-Steele, log2(WORKGROUP_SIZE) steps).  Workgroups are launched
+with ComputePipeline::recordLinear, so the block index folds y into x.
+*/
+
+layout(constant_id = 0) const uint PASS = 0;
+
+#define WORKGROUP_SIZE 256
+#define ELEMENTS_PER_INVOCATION 4
+#define BLOCK_SIZE (WORKGROUP_SIZE * ELEMENTS_PER_INVOCATION)
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+const uint SCAN_BLOCKS = 0;
+const uint ADD_BLOCKS = 1;
+const uint LOOKBACK = 2;
+
+// look-back flags
+const uint NOT_READY = 0;
+const uint AGGREGATE = 1;
+const uint PREFIX = 2;
+
+layout(std430, binding = 0) buffer Values {
+  uint values[];
+};
+
+layout(std430, binding = 1) coherent buffer BlockSums {
+  uint blockSums[];
+};
+
+layout(push_constant) uniform Parameters {
+  uint count;
+} parameters;
+
+shared uint partial[WORKGROUP_SIZE];
+shared uint sharedBlock;
+shared uint blockPrefix;
+
+// partition state of LOOKBACK
+uint flagIndex(uint block) {
+  return 1 + 3 * block;
+}
+
+void publish(uint block, uint flag, uint value) {
+  blockSums[flagIndex(block) + flag] = value;
+  memoryBarrierBuffer();
+  atomicExchange(blockSums[flagIndex(block)], flag);
+}
+
+// exclusive prefix of block, from the blocks before it
+uint lookBack(uint block) {
+  uint prefix = 0;
+  while (block > 0) {
+    block--;
+    uint flag;
+    do {
+      flag = atomicOr(blockSums[flagIndex(block)], 0);
+    } while (flag == NOT_READY);
+    memoryBarrierBuffer();
+    prefix += blockSums[flagIndex(block) + flag];
+    if(flag == PREFIX) {
+      break;
+    }
+  }
+  return prefix;
+}
+
+void main() {
+  uint block = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  if(PASS == LOOKBACK) {
+    if(gl_LocalInvocationID.x == 0) {
+      sharedBlock = atomicAdd(blockSums[0], 1);
+    }
+    barrier();
+    block = sharedBlock;
+  }
+  if(block * BLOCK_SIZE >= parameters.count) {
+    return;
+  }
+  uint first = block * BLOCK_SIZE + gl_LocalInvocationID.x * ELEMENTS_PER_INVOCATION;
+
+  if(PASS == ADD_BLOCKS) {
+    uint blockOffset = blockSums[block];
+    for (uint element = first; element < first + ELEMENTS_PER_INVOCATION && element < parameters.count; element++) {
+      values[element] += blockOffset;
+    }
+    return;
+  }
+
+  uint local[ELEMENTS_PER_INVOCATION];
+  uint sum = 0;
+  for (uint index = 0; index < ELEMENTS_PER_INVOCATION; index++) {
+    uint element = first + index;
+    local[index] = sum;
+    sum += element < parameters.count ? values[element] : 0;
+  }
+
+  partial[gl_LocalInvocationID.x] = sum;
+  barrier();
+  for (uint offset = 1; offset < WORKGROUP_SIZE; offset *= 2) {
+    uint previous = gl_LocalInvocationID.x >= offset ? partial[gl_LocalInvocationID.x - offset] : 0;
+    barrier();
+    partial[gl_LocalInvocationID.x] += previous;
+    barrier();
+  }
+  uint invocationOffset = partial[gl_LocalInvocationID.x] - sum;
+
+  if(PASS == LOOKBACK) {
+    if(gl_LocalInvocationID.x == 0) {
+      uint aggregate = partial[WORKGROUP_SIZE - 1];
+      uint prefix = 0;
+      if(block > 0) {
+        publish(block, AGGREGATE, aggregate);
+        prefix = lookBack(block);
+      }
+      publish(block, PREFIX, prefix + aggregate);
+      blockPrefix = prefix;
+    }
+    barrier();
+    invocationOffset += blockPrefix;
+  }
+
+  for (uint index = 0; index < ELEMENTS_PER_INVOCATION; index++) {
+    uint element = first + index;
+    if(element < parameters.count) {
+      values[element] = invocationOffset + local[index];
+    }
+  }
+  if(PASS == SCAN_BLOCKS && gl_LocalInvocationID.x == WORKGROUP_SIZE - 1) {
+    blockSums[block] = partial[gl_LocalInvocationID.x];
+  }
+}
@@ -0,0 +1,151 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+/*
+Tiled 3D stencils on float volumes.
+
+Each workgroup computes one TILE_X*TILE_Y*TILE_Z tile of the output.  It
+first loads the tile plus its halo into shared memory, each voxel read
+from the storage buffer once, and then every invocation evaluates its
+stencil from shared memory.  When the tile and halo of a large radius do
+not fit in shared memory the host sets SHARED_TILE to 0 and each
+invocation reads its neighbourhood from the input buffer instead.
+
+OPERATION picks the stencil:
+  GAUSSIAN, BOX   one separable pass along AXIS with the given RADIUS,
+                  so the halo only extends along that axis
+  GRADIENT_MAGNITUDE  central differences, a halo of one on every axis
+
+Voxels outside the volume follow BOUNDARY: CLAMP to the nearest edge voxel,
+MIRROR about the edge voxel, or CONSTANT (parameters.constantValue).
+Input and output are stored in LAYOUT (layout.glsl).
+Everything but the volume geometry is a specialization constant, so
+each variant is compiled with fixed loops and a fixed shared tile.
+*/
+
+#include "layout.glsl"
+
+layout(constant_id = 0) const uint OPERATION = 0;
+layout(constant_id = 1) const uint AXIS = 0;
+layout(constant_id = 2) const uint RADIUS = 1;
+layout(constant_id = 3) const uint TILE_X = 8;
+layout(constant_id = 4) const uint TILE_Y = 8;
+layout(constant_id = 5) const uint TILE_Z = 8;
+layout(constant_id = 6) const uint BOUNDARY = 0;
+layout(constant_id = 7) const uint LAYOUT = 0;
+layout(constant_id = 8) const uint SHARED_TILE = 1;
+
+layout (local_size_x_id = 3, local_size_y_id = 4, local_size_z_id = 5) in;
+
+const uint GAUSSIAN = 0;
+const uint BOX = 1;
+const uint GRADIENT_MAGNITUDE = 2;
+
+const uint CLAMP = 0;
+const uint MIRROR = 1;
+const uint CONSTANT = 2;
+
+const bool SEPARABLE = OPERATION != GRADIENT_MAGNITUDE;
+const uint HALO_X = SEPARABLE ? (AXIS == 0 ? RADIUS : 0) : 1;
+const uint HALO_Y = SEPARABLE ? (AXIS == 1 ? RADIUS : 0) : 1;
+const uint HALO_Z = SEPARABLE ? (AXIS == 2 ? RADIUS : 0) : 1;
+const uint SHARED_X = TILE_X + 2 * HALO_X;
+const uint SHARED_Y = TILE_Y + 2 * HALO_Y;
+const uint SHARED_Z = TILE_Z + 2 * HALO_Z;
+
+// a single element without SHARED_TILE
+shared float tile[SHARED_TILE * SHARED_X * SHARED_Y * SHARED_Z + 1 - SHARED_TILE];
+
+layout(std430, binding = 0) readonly buffer Input {
+  float inputValues[];
+};
+
+layout(std430, binding = 1) writeonly buffer Output {
+  float outputValues[];
+};
+
+layout(push_constant) uniform Parameters {
+  uvec3 dimensions;
+  float sigma;
+  vec3 spacing;
+  float constantValue;
+} parameters;
+
+// reflect about the edge voxels without repeating them: -1 -> 1, n -> n-2
+int mirrorIndex(int index, int size) {
+  if(size == 1) {
+    return 0;
+  }
+  int period = 2 * (size - 1);
+  index = abs(index) % period;
+  return index < size ? index : period - index;
+}
+
+float fetch(ivec3 position) {
+  ivec3 size = ivec3(parameters.dimensions);
+  if(any(lessThan(position, ivec3(0))) || any(greaterThanEqual(position, size))) {
+    if(BOUNDARY == CONSTANT) {
+      return parameters.constantValue;
+    } else if(BOUNDARY == MIRROR) {
+      position = ivec3(mirrorIndex(position.x, size.x),
+                       mirrorIndex(position.y, size.y),
+                       mirrorIndex(position.z, size.z));
+    } else {
+      position = clamp(position, ivec3(0), size - 1);
+    }
+  }
+  return inputValues[layoutIndex(LAYOUT, uvec3(position), parameters.dimensions)];
+}
+
+float shared3D(ivec3 position) {
+  return tile[(position.z * SHARED_Y + position.y) * SHARED_X + position.x];
+}
+
+// the voxel at offset from the one this invocation computes
+float neighbour(ivec3 center, uvec3 voxel, ivec3 offset) {
+  return SHARED_TILE != 0 ? shared3D(center + offset) : float(fetch(ivec3(voxel) + offset));
+}
+
+void main() {
+
+  // cooperative load of the tile and its halo
+  ivec3 tileOrigin = ivec3(gl_WorkGroupID * gl_WorkGroupSize) - ivec3(HALO_X, HALO_Y, HALO_Z);
+  if(SHARED_TILE != 0) {
+    for (uint index = gl_LocalInvocationIndex; index < SHARED_X * SHARED_Y * SHARED_Z; index += TILE_X * TILE_Y * TILE_Z) {
+      uvec3 offset = uvec3(index % SHARED_X, (index / SHARED_X) % SHARED_Y, index / (SHARED_X * SHARED_Y));
+      tile[index] = fetch(tileOrigin + ivec3(offset));
+    }
+    barrier();
+  }
+
+  uvec3 voxel = gl_GlobalInvocationID;
+  if(any(greaterThanEqual(voxel, parameters.dimensions))) {
+    return;
+  }
+  ivec3 center = ivec3(gl_LocalInvocationID) + ivec3(HALO_X, HALO_Y, HALO_Z);
+
+  float result;
+  if(SEPARABLE) {
+    ivec3 axisStep = ivec3(AXIS == 0, AXIS == 1, AXIS == 2);
+    float sum = 0.;
+    float weightSum = 0.;
+    for (int offset = -int(RADIUS); offset <= int(RADIUS); offset++) {
+      float weight = 1.;
+      if(OPERATION == GAUSSIAN && RADIUS > 0) {
+        weight = exp(-float(offset * offset) / (2. * parameters.sigma * parameters.sigma));
+      }
+      sum += weight * neighbour(center, voxel, offset * axisStep);
+      weightSum += weight;
+    }
+    result = sum / weightSum;
+  } else {
+    vec3 gradient = vec3(
+      neighbour(center, voxel, ivec3(1,0,0)) - neighbour(center, voxel, ivec3(-1,0,0)),
+      neighbour(center, voxel, ivec3(0,1,0)) - neighbour(center, voxel, ivec3(0,-1,0)),
+      neighbour(center, voxel, ivec3(0,0,1)) - neighbour(center, voxel, ivec3(0,0,-1)));
+    result = length(gradient / (2. * parameters.spacing));
+  }
+
+  outputValues[layoutIndex(LAYOUT, voxel, parameters.dimensions)] = result;
+}
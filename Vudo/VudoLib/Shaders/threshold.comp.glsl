@@ -0,0 +1,111 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/*
+Threshold, rescale and cast in one pass.
+
+Voxels at or above threshold become value * scale + shift, the others
+become outsideValue (given in output units).  Integer outputs are
+rounded (half to even) and clamped to their range.  Input and output
+stay in their native types (vudo::ScalarType, specialization constants
+0 and 1) and are addressed as packed 32 bit words, so each invocation
+writes one whole output word and no two invocations share one.
+*/
+
+#define WORKGROUP_SIZE 64
+layout (local_size_x = WORKGROUP_SIZE) in;
+
+layout(constant_id = 0) const uint INPUT_TYPE = 6;
+layout(constant_id = 1) const uint OUTPUT_TYPE = 6;
+
+const uint UINT8 = 0;
+const uint INT8 = 1;
+const uint UINT16 = 2;
+const uint INT16 = 3;
+const uint UINT32 = 4;
+const uint INT32 = 5;
+const uint FLOAT32 = 6;
+
+layout(std430, binding = 0) readonly buffer Input {
+  uint inputWords[];
+};
+
+layout(std430, binding = 1) writeonly buffer Output {
+  uint outputWords[];
+};
+
+layout(push_constant) uniform Parameters {
+  float threshold;
+  float outsideValue;
+  float scale;
+  float shift;
+  uint voxelCount;
+} parameters;
+
+uint typeBits(uint type) {
+  return type <= INT8 ? 8 : type <= INT16 ? 16 : 32;
+}
+
+float readInput(uint voxel) {
+  uint bits = typeBits(INPUT_TYPE);
+  uint perWord = 32 / bits;
+  uint word = inputWords[voxel / perWord];
+  int offset = int((voxel % perWord) * bits);
+  switch(INPUT_TYPE) {
+    case UINT8:
+    case UINT16:
+      return float(bitfieldExtract(word, offset, int(bits)));
+    case INT8:
+    case INT16:
+      return float(bitfieldExtract(int(word), offset, int(bits)));
+    case UINT32:
+      return float(word);
+    case INT32:
+      return float(int(word));
+    default:
+      return uintBitsToFloat(word);
+  }
+}
+
+uint outputBits(float value) {
+  switch(OUTPUT_TYPE) {
+    case UINT8:
+      return uint(clamp(roundEven(value), 0., 255.));
+    case INT8:
+      return uint(int(clamp(roundEven(value), -128., 127.))) & 0xffu;
+    case UINT16:
+      return uint(clamp(roundEven(value), 0., 65535.));
+    case INT16:
+      return uint(int(clamp(roundEven(value), -32768., 32767.))) & 0xffffu;
+    case UINT32:
+      return uint(clamp(roundEven(value), 0., 4294967040.));
+    case INT32:
+      return uint(int(clamp(roundEven(value), -2147483648., 2147483520.)));
+    default:
+      return floatBitsToUint(value);
+  }
+}
+
+void main() {
+
+  uint word = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * WORKGROUP_SIZE + gl_GlobalInvocationID.x;
+  uint bits = typeBits(OUTPUT_TYPE);
+  uint perWord = 32 / bits;
+  uint firstVoxel = word * perWord;
+  if(firstVoxel >= parameters.voxelCount) {
+    return;
+  }
+
+  uint packed = 0;
+  for (uint index = 0; index < perWord; index++) {
+    uint voxel = firstVoxel + index;
+    if(voxel >= parameters.voxelCount) {
+      break;
+    }
+    float value = readInput(voxel);
+    value = value >= parameters.threshold ? value * parameters.scale + parameters.shift
+                                          : parameters.outsideValue;
+    packed |= outputBits(value) << (index * bits);
+  }
+  outputWords[word] = packed;
+}
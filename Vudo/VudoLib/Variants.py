@@ -0,0 +1,94 @@
+import cppyy
+import itertools
+import os
+
+# variant type name: VTK scalar type id (vtkType.h), GLSL type, bits
+_variantTypes = {
+  "uint8": (3, "uint8_t", 8),
+  "int16": (4, "int16_t", 16),
+  "uint16": (5, "uint16_t", 16),
+  "float32": (10, "float", 32),
+}
+
+def readVariants(path):
+  """The kernel templates of a variants.txt, as {kernel: (scalar type names, option flags)}"""
+  kernels = {}
+  with open(path) as variantsFile:
+    for line in variantsFile:
+      fields = line.split()
+      if len(fields) < 2 or fields[0].startswith("#"):
+        continue
+      types = fields[1].split(",")
+      for typeName in types:
+        if typeName not in _variantTypes:
+          raise ValueError(f"{path}: {fields[0]} has unknown scalar type {typeName}")
+      flags = fields[2].split(",") if len(fields) > 2 else []
+      kernels[fields[0]] = (types, flags)
+  return kernels
+
+class Variants(object):
+  """Generates the variants of the kernel templates in VudoLib/Shaders/variants.txt.
+
+  A template is one .comp.glsl written against VOXEL_TYPE / VOXEL_BITS and
+  optional flags.  kernelVariants(kernel) returns its vudo::KernelVariants
+  dispatch table with every variant either embedded at build time or
+  compiled now, once, through the session's SPIR-V cache and registered.
+  Afterwards picking the variant for a volume is a lookup by VTK scalar
+  type and option bits:
+
+    variants = Variants(vudo)
+    histograms = variants.kernelVariants("histogram")
+    histogram = cppyy.gbl.vudo.VolumeHistogram(deviceQueue, histograms,
+                  imageData.GetScalarType(), voxelCount, 256)
+  """
+
+  def __init__(self, vudo):
+    cppyy.include("vudoVariants.h")
+    self.vudo = vudo
+    self.kernels = readVariants(os.path.join(vudo.vudoLibDir, "Shaders", "variants.txt"))
+    self.tables = {}
+
+  @staticmethod
+  def vtkScalarType(typeName):
+    return _variantTypes[typeName][0]
+
+  def scalarTypes(self, kernel):
+    """The VTK scalar types kernel has variants for"""
+    return [self.vtkScalarType(typeName) for typeName in self.kernels[kernel][0]]
+
+  def optionBits(self, kernel, *flags):
+    """The option bits of the named flags of kernel"""
+    kernelFlags = self.kernels[kernel][1]
+    return sum(1 << kernelFlags.index(flag) for flag in flags)
+
+  def kernelVariants(self, kernel):
+    """The vudo::KernelVariants of kernel, generating the variants that were not embedded"""
+    if kernel in self.tables:
+      return self.tables[kernel]
+    if kernel not in self.kernels:
+      raise ValueError(f"{kernel} is not a kernel template of variants.txt")
+    types, flags = self.kernels[kernel]
+    optionNames = cppyy.gbl.std.vector["std::string"]()
+    for flag in flags:
+      optionNames.push_back(flag)
+    table = cppyy.gbl.vudo.KernelVariants(kernel, optionNames)
+    for typeName in types:
+      vtkScalarType, glslType, bits = _variantTypes[typeName]
+      for options in range(1 << len(flags)):
+        name = str(table.getName(vtkScalarType, options))
+        if self.vudo.hasEmbeddedShader(name):
+          continue
+        defines = {"VOXEL_TYPE": glslType, "VOXEL_BITS": bits}
+        for index, flag in enumerate(flags):
+          if options & (1 << index):
+            defines[flag] = 1
+        table.registerVariant(vtkScalarType, options, self.vudo.libraryShaderPath(name, kernel, defines))
+    self.tables[kernel] = table
+    return table
+
+  def variantNames(self, kernel):
+    """The names of every variant of kernel, in the order they are generated"""
+    table = self.kernelVariants(kernel)
+    flagCount = len(self.kernels[kernel][1])
+    return [str(table.getName(vtkScalarType, options))
+            for vtkScalarType, options in itertools.product(self.scalarTypes(kernel), range(1 << flagCount))]
@@ -1,8 +1,99 @@
 import cppyy
+import hashlib
+import logging
+import numpy
 import os
 import subprocess
+import tempfile
 import time
 
+def _environmentFlag(name):
+  return os.environ.get(name, "0").lower() in ("1", "on", "true", "yes")
+
+def drainDiagnostics(deviceQueue, logger=None):
+  """Move the messages queued by the vudo::DeviceQueue debug messenger into python logging.
+  Returns the number of messages drained.
+  """
+  logger = logger or logging.getLogger("vudo")
+  message = cppyy.gbl.vudo.DiagnosticMessage()
+  count = 0
+  while deviceQueue.diagnostics.pop(message):
+    if message.severity >= 0x1000: # VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
+      level = logging.ERROR
+    elif message.severity >= 0x100: # WARNING
+      level = logging.WARNING
+    elif message.severity >= 0x10: # INFO
+      level = logging.INFO
+    else:
+      level = logging.DEBUG
+    logger.log(level, "%s: %s", message.messageIdName, message.message)
+    count += 1
+  dropped = deviceQueue.diagnostics.droppedCount()
+  if dropped:
+    logger.warning("%d vulkan diagnostic messages were dropped", dropped)
+  return count
+
+_scalarTypes = {
+  numpy.dtype(numpy.uint8): "UInt8",
+  numpy.dtype(numpy.int8): "Int8",
+  numpy.dtype(numpy.uint16): "UInt16",
+  numpy.dtype(numpy.int16): "Int16",
+  numpy.dtype(numpy.uint32): "UInt32",
+  numpy.dtype(numpy.int32): "Int32",
+  numpy.dtype(numpy.float32): "Float32",
+}
+
+def scalarType(dtype):
+  """The vudo::ScalarType for a numpy dtype"""
+  dtype = numpy.dtype(dtype)
+  if dtype not in _scalarTypes:
+    raise ValueError(f"{dtype} volumes are not supported on the GPU")
+  return getattr(cppyy.gbl.vudo, _scalarTypes[dtype])
+
+def scalarDType(scalarType):
+  """The numpy dtype of a vudo::ScalarType"""
+  for dtype, name in _scalarTypes.items():
+    if int(getattr(cppyy.gbl.vudo, name)) == int(scalarType):
+      return dtype
+  raise ValueError(f"vudo scalar type {int(scalarType)} has no numpy dtype")
+
+def bufferArray(computeBuffer, dtype=numpy.float32, count=-1):
+  """A numpy view of the mapped memory of a host visible vudo::ComputeBuffer"""
+  view = computeBuffer.map()
+  view.reshape((computeBuffer.getSize(),))
+  return numpy.frombuffer(view, dtype=dtype, count=count)
+
+def alignedEmpty(shape, dtype=numpy.float32, alignment=4096):
+  """An uninitialized C-contiguous array whose data starts on an alignment boundary and whose
+  allocation runs to the next boundary past its end, so a vudo::HostMemoryBuffer can import it.
+  """
+  dtype = numpy.dtype(dtype)
+  nbytes = int(numpy.prod(shape)) * dtype.itemsize
+  paddedBytes = (nbytes + alignment - 1) // alignment * alignment
+  raw = numpy.empty(paddedBytes + alignment, dtype=numpy.uint8)
+  start = -raw.ctypes.data % alignment
+  return raw[start:start+nbytes].view(dtype).reshape(shape)
+
+def hostArray(array):
+  """The numpy view of a numpy array or vtkDataArray, sharing its memory"""
+  if hasattr(array, "GetVoidPointer"):
+    import vtk.util.numpy_support
+    return vtk.util.numpy_support.vtk_to_numpy(array)
+  return numpy.asarray(array)
+
+def packSegments(masks):
+  """Bit-pack up to 32 same-shape binary masks into one uint32 per voxel, mask i in bit i"""
+  if len(masks) > 32:
+    raise ValueError("at most 32 segments fit in one uint32 per voxel")
+  packed = numpy.zeros(masks[0].shape, dtype=numpy.uint32)
+  for bit, mask in enumerate(masks):
+    packed |= (numpy.asarray(mask) != 0).astype(numpy.uint32) << numpy.uint32(bit)
+  return packed
+
+def unpackSegment(packed, bit):
+  """The uint8 mask of segment bit of a packSegments array"""
+  return ((packed >> numpy.uint32(bit)) & 1).astype(numpy.uint8)
+
 class Vudo(object):
 
   def __init__(self):
@@ -23,15 +114,148 @@ class Vudo(object):
       self.vulkanSDKIncludeDir = self.vulkanSDKDir + "/include"
       self.vulkanSDKLibDir = self.vulkanSDKDir + "/lib"
 
+    self.vudoLibDir = os.path.dirname(os.path.abspath(__file__))
+
     cppyy.add_include_path(self.vulkanSDKIncludeDir)
+    cppyy.add_include_path(self.vudoLibDir)
     cppyy.add_library_path(self.vulkanSDKLibDir)
     cppyy.load_library(self.vulkanSharedLibrary)
+    cppyy.include("vudo.h")
+    cppyy.include("vudoSPIRV.h")
+    cppyy.include("vudoHostMemory.h")
+    self.deviceQueue = None
+
+  def getDeviceQueue(self, options=None):
+    """The vudo::DeviceQueue shared by the algorithms run through this instance,
+    created on first use with options (default deviceQueueOptions()).
+    """
+    if self.deviceQueue is None:
+      self.deviceQueue = cppyy.gbl.vudo.DeviceQueue(options or self.deviceQueueOptions())
+    return self.deviceQueue
+
+  def deviceQueueOptions(self, validation=None, gpuAssistedValidation=None, debugMessenger=None):
+    """Options for creating a vudo::DeviceQueue.
+    Anything not passed is read from the VUDO_VALIDATION, VUDO_GPU_ASSISTED_VALIDATION
+    and VUDO_DEBUG_MESSENGER environment variables, so the default is no validation.
+    """
+    if validation is None:
+      validation = _environmentFlag("VUDO_VALIDATION")
+    if gpuAssistedValidation is None:
+      gpuAssistedValidation = _environmentFlag("VUDO_GPU_ASSISTED_VALIDATION")
+    if debugMessenger is None:
+      debugMessenger = _environmentFlag("VUDO_DEBUG_MESSENGER") or validation or gpuAssistedValidation
+    options = cppyy.gbl.vudo.DeviceQueueOptions()
+    options.enableValidation = validation
+    options.enableGPUAssistedValidation = gpuAssistedValidation
+    options.enableDebugMessenger = debugMessenger
+    return options
+
+  def drainDiagnostics(self, deviceQueue, logger=None):
+    return drainDiagnostics(deviceQueue, logger)
+
+  def hostMemoryBuffer(self, array, allowImport=True):
+    """A vudo::HostMemoryBuffer holding the bytes of a numpy array or vtkDataArray.
+    Aligned contiguous memory (see alignedEmpty) is imported when the device allows it and
+    then read in place by the GPU, so the array must stay alive while the buffer is used;
+    anything else is copied to device memory and can be released right away.
+    """
+    array = hostArray(array)
+    if not array.flags.c_contiguous:
+      array = numpy.ascontiguousarray(array)
+      allowImport = False # the contiguous copy is a temporary
+    pointer = cppyy.ll.cast["void*"](array.ctypes.data)
+    return cppyy.gbl.vudo.HostMemoryBuffer(self.getDeviceQueue(), pointer, array.nbytes, allowImport)
+
+  def memoryReport(self):
+    """One dict per memory heap of the device, in bytes: its size, the budget and usage (the
+    driver's with VK_EXT_memory_budget, otherwise 3/4 of the heap and what vudo allocated),
+    and what the vudo buffers have allocated now and at most since resetPeakAllocatedBytes().
+    """
+    deviceQueue = self.getDeviceQueue()
+    report = []
+    for heap in range(deviceQueue.getMemoryHeapCount()):
+      report.append({
+        "heap": heap,
+        "deviceLocal": bool(deviceQueue.isDeviceLocalHeap(heap)),
+        "size": int(deviceQueue.getHeapSize(heap)),
+        "budget": int(deviceQueue.getHeapBudget(heap)),
+        "usage": int(deviceQueue.getHeapUsage(heap)),
+        "allocated": int(deviceQueue.getAllocatedBytes(heap)),
+        "peak": int(deviceQueue.getPeakAllocatedBytes(heap)),
+      })
+    return report
 
-  def compileGLSL(self, shaderSourcePath, shaderSPIRVPath):
-    compileCommand = self.glslCompilerPath + " -V " + shaderSourcePath + " -o " + shaderSPIRVPath
-    completedProcess = subprocess.run(compileCommand.split())
+  def chunkLength(self, count, bytesPerElement, memoryProperties=None, reserve=0, fraction=0.5):
+    """How many of count elements of bytesPerElement bytes to process at a time so that they,
+    and reserve other bytes, take at most fraction of the headroom left in the memory budget.
+    memoryProperties defaults to host visible and coherent, like the ComputeBuffer default.
+    Returns count when everything fits, and at least 1.
+    """
+    if memoryProperties is None:
+      memoryProperties = cppyy.gbl.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | cppyy.gbl.VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    headroom = int(self.getDeviceQueue().getMemoryHeadroom(memoryProperties)) * fraction - reserve
+    return int(max(1, min(count, headroom // bytesPerElement)))
+
+  def compileGLSL(self, shaderSourcePath, shaderSPIRVPath, defines=None):
+    """Compile to SPIR-V, defines is a dict of preprocessor macros (e.g. for a kernel template variant)"""
+    compileCommand = [self.glslCompilerPath, "-S", "comp", "-V"]
+    for name, value in (defines or {}).items():
+      compileCommand.append(f"-D{name}={value}")
+    compileCommand += [shaderSourcePath, "-o", shaderSPIRVPath]
+    completedProcess = subprocess.run(compileCommand)
     return completedProcess.returncode == 0
 
+  def hasEmbeddedShader(self, name):
+    """True if the shader was compiled to SPIR-V and embedded at build time"""
+    return bool(cppyy.gbl.vudo.hasEmbeddedShader(name))
+
+  def libraryShaderPath(self, name, source=None, defines=None):
+    """SPIR-V path to pass for one of the VudoLib/Shaders, or "" to use the embedded code.
+    Without embedded shaders the GLSL is compiled once per session into a temporary directory.
+    A kernel template variant is compiled from source (the template name) with defines and
+    cached under its own name.
+    """
+    if self.hasEmbeddedShader(name):
+      return ""
+    if not hasattr(self, "shaderCacheDir"):
+      self.shaderCacheDir = tempfile.mkdtemp(prefix="vudo")
+    shaderSPIRVPath = os.path.join(self.shaderCacheDir, name + ".spv")
+    if not os.path.exists(shaderSPIRVPath):
+      shaderSourcePath = os.path.join(self.vudoLibDir, "Shaders", (source or name) + ".comp.glsl")
+      if not self.compileGLSL(shaderSourcePath, shaderSPIRVPath, defines):
+        raise RuntimeError("Could not compile " + shaderSourcePath)
+    return shaderSPIRVPath
+
+  def shaderDigest(self, name):
+    """64 bit hash of the SPIR-V of one of the VudoLib/Shaders (embedded or compiled), for cache keys"""
+    if not hasattr(self, "shaderDigests"):
+      self.shaderDigests = {}
+    if name not in self.shaderDigests:
+      code = cppyy.gbl.vudo.ShaderCode()
+      path = self.libraryShaderPath(name)
+      if path:
+        code.mapFile(path)
+      else:
+        code.loadEmbedded(name)
+      self.shaderDigests[name] = int(cppyy.gbl.vudo.hashWords(code.getWords(), code.getWordCount()))
+    return self.shaderDigests[name]
+
+  def generatedShaderPath(self, name, source):
+    """SPIR-V path of GLSL source generated at run time (e.g. a fused VudoArray expression).
+    Each distinct source is written and compiled once per session, named after name and its hash.
+    """
+    if not hasattr(self, "shaderCacheDir"):
+      self.shaderCacheDir = tempfile.mkdtemp(prefix="vudo")
+    digest = hashlib.sha1(source.encode()).hexdigest()[:16]
+    shaderSPIRVPath = os.path.join(self.shaderCacheDir, f"{name}_{digest}.spv")
+    if not os.path.exists(shaderSPIRVPath):
+      shaderSourcePath = os.path.join(self.shaderCacheDir, f"{name}_{digest}.comp.glsl")
+      with open(shaderSourcePath, "w") as sourceFile:
+        sourceFile.write(source)
+      if not self.compileGLSL(shaderSourcePath, shaderSPIRVPath):
+        raise RuntimeError("Could not compile " + shaderSourcePath)
+    return shaderSPIRVPath
+
   def compileAndImportCPP(self, cppSourcePath):
     cppSource = open(cppSourcePath).read()
     namepaceTag = "cppyy_"+str(time.time()).replace(".", "_")
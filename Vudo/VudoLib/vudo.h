@@ -0,0 +1,1478 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Common runtime shared by the experiments and the Vudo module.
+ * This header is included through cppyy, so everything lives
+ * in the header and in the vudo namespace.
+ */
+
+#ifndef __vudo_h
+#define __vudo_h
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdexcept>
+
+namespace vudo {
+
+// Used for validating return values of Vulkan API calls.
+// TODO: what to use instead of the assert - need to bail out
+// of methods, not overall app.  Probably best to keep an
+// error state in the Vudo class.
+#ifndef vkcheck
+#define vkcheck(f)                     \
+{                                              \
+    VkResult res = (f);                        \
+    if (res != VK_SUCCESS)                     \
+    {                                          \
+        fprintf(stderr, \
+          "Fatal : VkResult is %d in %s at line %d\n", res,  __FILE__, __LINE__); \
+        assert(res == VK_SUCCESS);             \
+    }                                          \
+}
+#endif
+
+/*
+Options chosen when the DeviceQueue is created.
+
+The defaults are the shipped configuration: no layers, no messenger,
+so there is no validation overhead on dispatches.
+*/
+struct DeviceQueueOptions {
+    bool enableValidation = false; // khronos (or legacy lunarg) validation layer
+    bool enableGPUAssistedValidation = false; // shader instrumentation, implies enableValidation
+    bool enableDebugMessenger = false; // VK_EXT_debug_utils messages into the diagnostics ring
+    bool enableTransferQueue = true; // a second queue from a transfer only family, when there is one
+    bool enableTimelineSemaphores = true; // Vulkan 1.2 or VK_KHR_timeline_semaphore, when available
+    bool enableExternalMemoryHost = true; // VK_EXT_external_memory_host on 1.1 devices, for zero copy uploads
+    bool enableMemoryBudget = true; // VK_EXT_memory_budget on 1.1 devices, for the heap budgets
+    bool enableReducedPrecision = true; // 8/16-bit storage, float16 and int8/int16 arithmetic, when supported
+};
+
+/*
+One message from the debug messenger, copied into fixed size storage
+so that the callback never allocates.
+*/
+struct DiagnosticMessage {
+    uint64_t sequence;
+    uint32_t severity; // VkDebugUtilsMessageSeverityFlagBitsEXT
+    uint32_t type; // VkDebugUtilsMessageTypeFlagsEXT
+    int32_t messageIdNumber;
+    char messageIdName[64];
+    char message[448];
+};
+
+/*
+Bounded lock-free ring of diagnostic messages.
+
+Validation layers call the messenger from whatever thread made the
+Vulkan call, so push() is safe for many producers.  pop() is meant
+for a single consumer, typically python draining into logging.
+When the ring is full new messages are dropped and counted.
+*/
+class DiagnosticRing {
+    public:
+        static const uint32_t capacity = 1024;
+
+        DiagnosticRing() {
+            for (uint32_t index = 0; index < capacity; ++index) {
+                this->slots[index].sequence.store(index, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(uint32_t severity, uint32_t type, int32_t messageIdNumber,
+                  const char *messageIdName, const char *message) {
+            uint64_t position = this->writeIndex.load(std::memory_order_relaxed);
+            Slot *slot;
+            for (;;) {
+                slot = &(this->slots[position % capacity]);
+                uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+                int64_t difference = (int64_t)sequence - (int64_t)position;
+                if (difference == 0) {
+                    if (this->writeIndex.compare_exchange_weak(position, position + 1,
+                                                               std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    this->dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                } else {
+                    position = this->writeIndex.load(std::memory_order_relaxed);
+                }
+            }
+            DiagnosticMessage &entry = slot->message;
+            entry.sequence = position;
+            entry.severity = severity;
+            entry.type = type;
+            entry.messageIdNumber = messageIdNumber;
+            copyString(entry.messageIdName, sizeof(entry.messageIdName), messageIdName);
+            copyString(entry.message, sizeof(entry.message), message);
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(DiagnosticMessage &message) {
+            Slot &slot = this->slots[this->readIndex % capacity];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence != this->readIndex + 1) {
+                return false; // empty, or the producer is still writing
+            }
+            message = slot.message;
+            slot.sequence.store(this->readIndex + capacity, std::memory_order_release);
+            this->readIndex++;
+            return true;
+        }
+
+        uint64_t droppedCount() {return this->dropped.load(std::memory_order_relaxed);};
+
+    protected:
+        struct Slot {
+            std::atomic<uint64_t> sequence;
+            DiagnosticMessage message;
+        };
+
+        static void copyString(char *destination, size_t size, const char *source) {
+            if (source == nullptr) {
+                destination[0] = '\0';
+                return;
+            }
+            strncpy(destination, source, size - 1);
+            destination[size - 1] = '\0';
+        }
+
+        Slot slots[capacity];
+        std::atomic<uint64_t> writeIndex{0};
+        std::atomic<uint64_t> dropped{0};
+        uint64_t readIndex = 0;
+};
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL debugUtilsMessengerCallback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT      messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT             messageTypes,
+    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+    void*                                       pUserData) {
+
+    DiagnosticRing *diagnostics = static_cast<DiagnosticRing *>(pUserData);
+    diagnostics->push(messageSeverity, messageTypes,
+                      pCallbackData->messageIdNumber,
+                      pCallbackData->pMessageIdName,
+                      pCallbackData->pMessage);
+
+    return VK_FALSE;
+}
+
+class DeviceQueue {
+    protected:
+
+        DeviceQueueOptions options;
+
+        VkInstance instance = VK_NULL_HANDLE;
+
+        VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+
+        std::vector<const char *> enabledLayers;
+        std::vector<const char *> enabledExtensions;
+
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkDevice device = VK_NULL_HANDLE;
+        VkQueue queue = VK_NULL_HANDLE; // a queue supporting compute operations
+        uint32_t queueFamilyIndex = 0;
+        VkQueue transferQueue = VK_NULL_HANDLE; // the compute queue unless there is a dedicated one
+        uint32_t transferQueueFamilyIndex = 0;
+
+        uint32_t apiVersion = VK_API_VERSION_1_0; // of the instance
+        bool timelineSemaphores = false;
+        PFN_vkVoidFunction waitSemaphoresFunction = nullptr;
+        PFN_vkVoidFunction getSemaphoreCounterValueFunction = nullptr;
+        VkDeviceSize hostPointerAlignment = 0; // stays 0 unless host allocations can be imported
+        PFN_vkVoidFunction getMemoryHostPointerPropertiesFunction = nullptr;
+
+        // bytes of device memory allocated by ComputeBuffers, per heap
+        VkPhysicalDeviceMemoryProperties memoryProperties = {};
+        bool memoryBudget = false;
+        PFN_vkVoidFunction getPhysicalDeviceMemoryProperties2Function = nullptr;
+        std::atomic<VkDeviceSize> allocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+        std::atomic<VkDeviceSize> peakAllocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+
+        // reduced precision features enabled on the device
+        bool storageBuffer16Bit = false;
+        bool storageBuffer8Bit = false;
+        bool shaderFloat16 = false;
+        bool shaderInt8 = false;
+        bool shaderInt16 = false;
+
+    public:
+        DiagnosticRing diagnostics;
+
+        DeviceQueue(const DeviceQueueOptions &options = DeviceQueueOptions()) {
+            this->options = options;
+            if (this->options.enableGPUAssistedValidation) {
+                this->options.enableValidation = true;
+            }
+            findValidationLayer();
+            loadExtensions();
+            createInstance();
+            findDeviceQueue();
+        }
+
+        ~DeviceQueue() {
+            cleanup();
+        }
+
+    VkInstance getInstance() {return this->instance;};
+    VkPhysicalDevice getPhysicalDevice() {return this->physicalDevice;};
+    VkDevice getDevice() {return this->device;};
+    VkQueue getQueue() {return this->queue;};
+    uint32_t getQueueFamilyIndex() {return this->queueFamilyIndex;};
+    VkQueue getTransferQueue() {return this->transferQueue;};
+    uint32_t getTransferQueueFamilyIndex() {return this->transferQueueFamilyIndex;};
+    bool hasDedicatedTransferQueue() {return this->transferQueueFamilyIndex != this->queueFamilyIndex;};
+    uint32_t getAPIVersion() {return this->apiVersion;};
+    bool hasTimelineSemaphores() {return this->timelineSemaphores;};
+    bool hasExternalMemoryHost() {return this->hostPointerAlignment != 0;};
+    VkDeviceSize getHostPointerAlignment() {return this->hostPointerAlignment;};
+    bool hasMemoryBudget() {return this->memoryBudget;};
+    uint32_t getMemoryHeapCount() {return this->memoryProperties.memoryHeapCount;};
+    VkDeviceSize getHeapSize(uint32_t heap) {return this->memoryProperties.memoryHeaps[heap].size;};
+    bool isDeviceLocalHeap(uint32_t heap) {
+        return (this->memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    };
+    uint32_t getMemoryTypeHeapIndex(uint32_t memoryType) {return this->memoryProperties.memoryTypes[memoryType].heapIndex;};
+    VkDeviceSize getAllocatedBytes(uint32_t heap) {return this->allocatedBytes[heap];};
+    VkDeviceSize getPeakAllocatedBytes(uint32_t heap) {return this->peakAllocatedBytes[heap];};
+    bool hasStorageBuffer16Bit() {return this->storageBuffer16Bit;};
+    bool hasStorageBuffer8Bit() {return this->storageBuffer8Bit;};
+    bool hasShaderFloat16() {return this->shaderFloat16;};
+    bool hasShaderInt8() {return this->shaderInt8;};
+    bool hasShaderInt16() {return this->shaderInt16;};
+    // everything the reduced precision kernels use
+    bool hasReducedPrecision() {
+        return this->storageBuffer16Bit && this->storageBuffer8Bit &&
+               this->shaderFloat16 && this->shaderInt8 && this->shaderInt16;
+    };
+    const DeviceQueueOptions &getOptions() {return this->options;};
+    bool validationEnabled() {return !this->enabledLayers.empty();};
+
+    void findValidationLayer();
+    bool hasInstanceExtension(const char *extensionName);
+    void loadExtensions();
+    void createInstance();
+    uint32_t getComputeQueueFamilyIndex();
+    uint32_t getTransferQueueFamilyIndex(uint32_t computeQueueFamilyIndex);
+    bool hasDeviceExtension(const char *extensionName);
+    void findDeviceQueue();
+    VkSemaphore createTimelineSemaphore(uint64_t initialValue = 0);
+    uint64_t getSemaphoreValue(VkSemaphore semaphore);
+    // false on timeout
+    bool waitSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout = UINT64_MAX);
+    // memory types that can import the host allocation at pointer, 0 when none can
+    uint32_t getHostPointerMemoryTypeBits(const void *pointer);
+    // the heap of memory with properties, -1 when there is none
+    uint32_t getMemoryHeapIndex(VkMemoryPropertyFlags properties);
+    void queryHeapBudget(uint32_t heap, VkDeviceSize *budget, VkDeviceSize *usage);
+    VkDeviceSize getHeapBudget(uint32_t heap);
+    VkDeviceSize getHeapUsage(uint32_t heap);
+    // bytes that can still be allocated within the budget
+    VkDeviceSize getHeapHeadroom(uint32_t heap);
+    VkDeviceSize getMemoryHeadroom(VkMemoryPropertyFlags properties);
+    void trackAllocation(uint32_t heap, VkDeviceSize size);
+    void trackRelease(uint32_t heap, VkDeviceSize size);
+    void resetPeakAllocatedBytes();
+    uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+    void cleanup();
+};
+
+inline void DeviceQueue::findValidationLayer() {
+    /*
+    Validation is opt-in.  When asked for, prefer the khronos layer and
+    fall back to the older lunarg meta layer.  A missing layer is reported
+    through the diagnostics ring instead of failing context creation.
+    */
+    if (!this->options.enableValidation) {
+        return;
+    }
+
+    uint32_t layerCount;
+    vkEnumerateInstanceLayerProperties(&layerCount, NULL);
+    std::vector<VkLayerProperties> layerProperties(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layerProperties.data());
+
+    const char *candidates[] = {
+        "VK_LAYER_KHRONOS_validation",
+        "VK_LAYER_LUNARG_standard_validation",
+    };
+    for (const char *candidate : candidates) {
+        for (VkLayerProperties prop : layerProperties) {
+            if (strcmp(candidate, prop.layerName) == 0) {
+                this->enabledLayers.push_back(candidate);
+                return;
+            }
+        }
+    }
+
+    this->diagnostics.push(VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT,
+                           VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT, 0, "vudo",
+                           "No validation layer available, continuing without validation");
+    this->options.enableValidation = false;
+    this->options.enableGPUAssistedValidation = false;
+}
+
+inline bool DeviceQueue::hasInstanceExtension(const char *extensionName) {
+    uint32_t extensionCount;
+    vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, NULL);
+    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+    vkEnumerateInstanceExtensionProperties(NULL, &extensionCount, extensionProperties.data());
+
+    for (VkExtensionProperties prop : extensionProperties) {
+        if (strcmp(extensionName, prop.extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void DeviceQueue::loadExtensions() {
+    /*
+    VK_EXT_debug_utils carries the validation messages (and anything else
+    the loader or driver wants to say) to debugUtilsMessengerCallback.
+    */
+    if (this->options.enableDebugMessenger) {
+        if (hasInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME)) {
+            this->enabledExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        } else {
+            this->options.enableDebugMessenger = false;
+        }
+    }
+    /*
+    VK_EXT_validation_features is exposed by the validation layer itself,
+    so it is not listed by the loader - enable it along with the layer.
+    */
+    if (this->options.enableGPUAssistedValidation) {
+        this->enabledExtensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+    }
+}
+
+inline void DeviceQueue::createInstance() {
+    /*
+    fill applicationInfo - this is actually not that important
+    The only real important field is apiVersion
+    */
+    VkApplicationInfo applicationInfo = {};
+    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    applicationInfo.pApplicationName = "Vudo";
+    applicationInfo.applicationVersion = 0;
+    applicationInfo.pEngineName = "vudo";
+    applicationInfo.engineVersion = 0;
+    /*
+    Ask for 1.2 (timeline semaphores in core) when the loader knows it.
+    A 1.0 loader has no vkEnumerateInstanceVersion and refuses any
+    apiVersion other than 1.0.
+    */
+    typedef VkResult (VKAPI_PTR *EnumerateInstanceVersion)(uint32_t *);
+    auto enumerateInstanceVersion = (EnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+    uint32_t loaderVersion = VK_API_VERSION_1_0;
+    if (enumerateInstanceVersion != nullptr && enumerateInstanceVersion(&loaderVersion) == VK_SUCCESS) {
+        this->apiVersion = std::min(loaderVersion, uint32_t(VK_MAKE_VERSION(1, 2, 0)));
+    }
+    applicationInfo.apiVersion = this->apiVersion;
+
+    VkInstanceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.flags = 0;
+    createInfo.pApplicationInfo = &applicationInfo;
+
+    // pass desired layers and extensions to vulkan
+    createInfo.enabledLayerCount = enabledLayers.size();
+    createInfo.ppEnabledLayerNames = enabledLayers.data();
+    createInfo.enabledExtensionCount = enabledExtensions.size();
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
+
+    /*
+    Chaining the messenger info into the instance create info also
+    reports problems in vkCreateInstance and vkDestroyInstance.
+    */
+    VkDebugUtilsMessengerCreateInfoEXT messengerInfo = {};
+    messengerInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    messengerInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+                                    VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+                                    VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+                                    VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    messengerInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                                VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                                VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    messengerInfo.pfnUserCallback = &debugUtilsMessengerCallback;
+    messengerInfo.pUserData = &(this->diagnostics);
+
+    VkValidationFeatureEnableEXT gpuAssisted[] = {
+        VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT,
+        VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT,
+    };
+    VkValidationFeaturesEXT validationFeatures = {};
+    validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+    validationFeatures.enabledValidationFeatureCount = 2;
+    validationFeatures.pEnabledValidationFeatures = gpuAssisted;
+
+    const void **next = &(createInfo.pNext);
+    if (this->options.enableDebugMessenger) {
+        *next = &messengerInfo;
+        next = &(messengerInfo.pNext);
+    }
+    if (this->options.enableGPUAssistedValidation) {
+        *next = &validationFeatures;
+    }
+
+    /* create the instance.  */
+    vkcheck(vkCreateInstance(
+        &createInfo,
+        NULL,
+        &instance));
+
+    /*
+    Register the messenger for the lifetime of the instance.
+    */
+    if (this->options.enableDebugMessenger) {
+        messengerInfo.pNext = nullptr;
+
+        // We have to explicitly load this function.
+        auto vkCreateDebugUtilsMessengerEXT = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+        if (vkCreateDebugUtilsMessengerEXT == nullptr) {
+            throw std::runtime_error("Could not load vkCreateDebugUtilsMessengerEXT");
+        }
+
+        vkcheck(vkCreateDebugUtilsMessengerEXT(instance, &messengerInfo, NULL, &debugMessenger));
+    }
+}
+
+// Returns the index of a queue family that supports compute operations.
+inline uint32_t DeviceQueue::getComputeQueueFamilyIndex() {
+    uint32_t queueFamilyCount;
+
+    vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &queueFamilyCount, NULL);
+
+    // Retrieve all queue families.
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    // Now find a family that supports compute.
+    uint32_t queueFamilyIndex = 0;
+    for (; queueFamilyIndex < queueFamilies.size(); ++queueFamilyIndex) {
+        VkQueueFamilyProperties props = queueFamilies[queueFamilyIndex];
+
+        if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+            // found a queue with compute
+            break;
+        }
+    }
+
+    if (queueFamilyIndex == queueFamilies.size()) {
+        throw std::runtime_error("could not find a queue family that supports operations");
+    }
+
+    return queueFamilyIndex;
+}
+
+// Returns a family with transfers but neither compute nor graphics (a DMA engine), else the compute family.
+inline uint32_t DeviceQueue::getTransferQueueFamilyIndex(uint32_t computeQueueFamilyIndex) {
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &queueFamilyCount, NULL);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    for (uint32_t queueFamilyIndex = 0; queueFamilyIndex < queueFamilies.size(); ++queueFamilyIndex) {
+        VkQueueFamilyProperties props = queueFamilies[queueFamilyIndex];
+        if (props.queueCount > 0 && (props.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(props.queueFlags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) {
+            return queueFamilyIndex;
+        }
+    }
+    return computeQueueFamilyIndex;
+}
+
+inline bool DeviceQueue::hasDeviceExtension(const char *extensionName) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(this->physicalDevice, NULL, &extensionCount, NULL);
+    std::vector<VkExtensionProperties> extensionProperties(extensionCount);
+    vkEnumerateDeviceExtensionProperties(this->physicalDevice, NULL, &extensionCount, extensionProperties.data());
+
+    for (VkExtensionProperties prop : extensionProperties) {
+        if (strcmp(extensionName, prop.extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void DeviceQueue::findDeviceQueue() {
+
+    // list all physical devices on the system
+    uint32_t deviceCount;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
+    if (deviceCount == 0) {
+        throw std::runtime_error("could not find a device with vulkan support");
+    }
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+    // choose a device that can be used for our purposes
+    for (VkPhysicalDevice device : devices) {
+        if (true) { // TODO: no feature checks, so just accept
+            this->physicalDevice = device;
+            break;
+        }
+    }
+
+    // create the logical device in this function
+    // - when creating the device, we also specify what queues it has:
+    //   one compute queue, and one transfer queue if there is a dedicated family
+    this->queueFamilyIndex = getComputeQueueFamilyIndex(); // find queue family with compute capability
+    this->transferQueueFamilyIndex = this->queueFamilyIndex;
+    if (this->options.enableTransferQueue) {
+        this->transferQueueFamilyIndex = getTransferQueueFamilyIndex(this->queueFamilyIndex);
+    }
+    float queuePriorities = 1.0;  // one queue per family, so this is not that imporant.
+    VkDeviceQueueCreateInfo queueCreateInfos[2] = {};
+    for (uint32_t family = 0; family < 2; ++family) {
+        queueCreateInfos[family].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfos[family].queueCount = 1;
+        queueCreateInfos[family].pQueuePriorities = &queuePriorities;
+    }
+    queueCreateInfos[0].queueFamilyIndex = this->queueFamilyIndex;
+    queueCreateInfos[1].queueFamilyIndex = this->transferQueueFamilyIndex;
+
+    // create the logical device
+    // - specify any desired device features
+    VkDeviceCreateInfo deviceCreateInfo = {};
+
+    VkPhysicalDeviceFeatures deviceFeatures = {};
+    std::vector<const char *> deviceExtensions;
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.enabledLayerCount = enabledLayers.size();  // for older implementations
+    deviceCreateInfo.ppEnabledLayerNames = enabledLayers.data();
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos; // we also specify the queues
+    deviceCreateInfo.queueCreateInfoCount = hasDedicatedTransferQueue() ? 2 : 1;
+    deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+
+    /*
+    Timeline semaphores are core in 1.2 (when both the instance and the
+    device are 1.2) and an extension before.  Either way the feature is
+    mandatory wherever they exist, so it is enabled without a query.
+    */
+    bool coreTimelineSemaphores = false;
+#ifdef VK_KHR_timeline_semaphore
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+    if (this->options.enableTimelineSemaphores) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(this->physicalDevice, &properties);
+        coreTimelineSemaphores = std::min(properties.apiVersion, this->apiVersion) >= VK_MAKE_VERSION(1, 2, 0);
+        if (coreTimelineSemaphores || hasDeviceExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+            if (!coreTimelineSemaphores) {
+                deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            }
+            timelineSemaphoreFeatures.pNext = (void *)deviceCreateInfo.pNext;
+            deviceCreateInfo.pNext = &timelineSemaphoreFeatures;
+            this->timelineSemaphores = true;
+        }
+    }
+#endif
+
+    /*
+    Importing host allocations needs external memory, core in 1.1, and
+    the import alignment comes from the 1.1 properties query.
+    */
+#ifdef VK_EXT_external_memory_host
+    if (this->options.enableExternalMemoryHost) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(this->physicalDevice, &properties);
+        auto getPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(
+            this->instance, "vkGetPhysicalDeviceProperties2");
+        if (std::min(properties.apiVersion, this->apiVersion) >= VK_MAKE_VERSION(1, 1, 0) &&
+            getPhysicalDeviceProperties2 != nullptr &&
+            hasDeviceExtension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+            VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+            hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2 properties2 = {};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &hostProperties;
+            getPhysicalDeviceProperties2(this->physicalDevice, &properties2);
+            deviceExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+            this->hostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+        }
+    }
+#endif
+
+    /*
+    Reduced precision storage and arithmetic.  16-bit storage is core in
+    1.1, 8-bit storage and float16/int8 arithmetic are core in 1.2 and
+    extensions before.  Whatever the device supports of what the kernels
+    use is enabled, the rest stays off.
+    */
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(this->physicalDevice, &supportedFeatures);
+#if defined(VK_KHR_8bit_storage) && defined(VK_KHR_shader_float16_int8)
+    VkPhysicalDevice16BitStorageFeatures storage16BitFeatures = {};
+    storage16BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+    VkPhysicalDevice8BitStorageFeaturesKHR storage8BitFeatures = {};
+    storage8BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES_KHR;
+    VkPhysicalDeviceShaderFloat16Int8FeaturesKHR float16Int8Features = {};
+    float16Int8Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR;
+    auto getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+        this->instance, "vkGetPhysicalDeviceFeatures2");
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(this->physicalDevice, &deviceProperties);
+    uint32_t deviceVersion = std::min(deviceProperties.apiVersion, this->apiVersion);
+    if (this->options.enableReducedPrecision && deviceVersion >= VK_MAKE_VERSION(1, 1, 0) &&
+        getPhysicalDeviceFeatures2 != nullptr) {
+        bool core12 = deviceVersion >= VK_MAKE_VERSION(1, 2, 0);
+        bool storage8BitExtension = core12 || hasDeviceExtension(VK_KHR_8BIT_STORAGE_EXTENSION_NAME);
+        bool float16Int8Extension = core12 || hasDeviceExtension(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+        // only chain the structures the device knows about into the query
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &storage16BitFeatures;
+        if (storage8BitExtension) {
+            storage8BitFeatures.pNext = features2.pNext;
+            features2.pNext = &storage8BitFeatures;
+        }
+        if (float16Int8Extension) {
+            float16Int8Features.pNext = features2.pNext;
+            features2.pNext = &float16Int8Features;
+        }
+        getPhysicalDeviceFeatures2(this->physicalDevice, &features2);
+
+        this->storageBuffer16Bit = storage16BitFeatures.storageBuffer16BitAccess == VK_TRUE;
+        this->storageBuffer8Bit = storage8BitExtension && storage8BitFeatures.storageBuffer8BitAccess == VK_TRUE;
+        this->shaderFloat16 = float16Int8Extension && float16Int8Features.shaderFloat16 == VK_TRUE;
+        this->shaderInt8 = float16Int8Extension && float16Int8Features.shaderInt8 == VK_TRUE;
+        this->shaderInt16 = supportedFeatures.shaderInt16 == VK_TRUE;
+        deviceFeatures.shaderInt16 = supportedFeatures.shaderInt16;
+
+        storage16BitFeatures = {};
+        storage16BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_16BIT_STORAGE_FEATURES;
+        storage16BitFeatures.storageBuffer16BitAccess = this->storageBuffer16Bit;
+        if (this->storageBuffer16Bit) {
+            storage16BitFeatures.pNext = (void *)deviceCreateInfo.pNext;
+            deviceCreateInfo.pNext = &storage16BitFeatures;
+        }
+        storage8BitFeatures = {};
+        storage8BitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_8BIT_STORAGE_FEATURES_KHR;
+        storage8BitFeatures.storageBuffer8BitAccess = this->storageBuffer8Bit;
+        if (this->storageBuffer8Bit) {
+            if (!core12) {
+                deviceExtensions.push_back(VK_KHR_8BIT_STORAGE_EXTENSION_NAME);
+            }
+            storage8BitFeatures.pNext = (void *)deviceCreateInfo.pNext;
+            deviceCreateInfo.pNext = &storage8BitFeatures;
+        }
+        float16Int8Features = {};
+        float16Int8Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES_KHR;
+        float16Int8Features.shaderFloat16 = this->shaderFloat16;
+        float16Int8Features.shaderInt8 = this->shaderInt8;
+        if (this->shaderFloat16 || this->shaderInt8) {
+            if (!core12) {
+                deviceExtensions.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+            }
+            float16Int8Features.pNext = (void *)deviceCreateInfo.pNext;
+            deviceCreateInfo.pNext = &float16Int8Features;
+        }
+    }
+#endif
+
+    // the budget query goes through the 1.1 memory properties query
+    vkGetPhysicalDeviceMemoryProperties(this->physicalDevice, &(this->memoryProperties));
+#ifdef VK_EXT_memory_budget
+    if (this->options.enableMemoryBudget) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(this->physicalDevice, &properties);
+        PFN_vkVoidFunction getPhysicalDeviceMemoryProperties2 = vkGetInstanceProcAddr(
+            this->instance, "vkGetPhysicalDeviceMemoryProperties2");
+        if (std::min(properties.apiVersion, this->apiVersion) >= VK_MAKE_VERSION(1, 1, 0) &&
+            getPhysicalDeviceMemoryProperties2 != nullptr &&
+            hasDeviceExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+            deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            this->getPhysicalDeviceMemoryProperties2Function = getPhysicalDeviceMemoryProperties2;
+            this->memoryBudget = true;
+        }
+    }
+#endif
+    deviceCreateInfo.enabledExtensionCount = deviceExtensions.size();
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    vkcheck(vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &(this->device)));
+
+    // Get a handle to the only member of each queue family.
+    vkGetDeviceQueue(device, this->queueFamilyIndex, 0, &(this->queue));
+    vkGetDeviceQueue(device, this->transferQueueFamilyIndex, 0, &(this->transferQueue));
+
+    if (this->timelineSemaphores) {
+        this->waitSemaphoresFunction = vkGetDeviceProcAddr(device,
+            coreTimelineSemaphores ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR");
+        this->getSemaphoreCounterValueFunction = vkGetDeviceProcAddr(device,
+            coreTimelineSemaphores ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR");
+        this->timelineSemaphores = this->waitSemaphoresFunction != nullptr &&
+                                   this->getSemaphoreCounterValueFunction != nullptr;
+    }
+
+    if (this->hostPointerAlignment != 0) {
+        this->getMemoryHostPointerPropertiesFunction = vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+        if (this->getMemoryHostPointerPropertiesFunction == nullptr) {
+            this->hostPointerAlignment = 0;
+        }
+    }
+}
+
+#ifdef VK_KHR_timeline_semaphore
+inline VkSemaphore DeviceQueue::createTimelineSemaphore(uint64_t initialValue) {
+    if (!this->timelineSemaphores) {
+        throw std::runtime_error("timeline semaphores are not available");
+    }
+    VkSemaphoreTypeCreateInfoKHR semaphoreTypeCreateInfo = {};
+    semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    semaphoreTypeCreateInfo.initialValue = initialValue;
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+    VkSemaphore semaphore;
+    vkcheck(vkCreateSemaphore(this->device, &semaphoreCreateInfo, NULL, &semaphore));
+    return semaphore;
+}
+
+inline uint64_t DeviceQueue::getSemaphoreValue(VkSemaphore semaphore) {
+    uint64_t value = 0;
+    vkcheck(((PFN_vkGetSemaphoreCounterValueKHR)this->getSemaphoreCounterValueFunction)(this->device, semaphore, &value));
+    return value;
+}
+
+inline bool DeviceQueue::waitSemaphore(VkSemaphore semaphore, uint64_t value, uint64_t timeout) {
+    VkSemaphoreWaitInfoKHR waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &semaphore;
+    waitInfo.pValues = &value;
+    VkResult result = ((PFN_vkWaitSemaphoresKHR)this->waitSemaphoresFunction)(this->device, &waitInfo, timeout);
+    if (result == VK_TIMEOUT) {
+        return false;
+    }
+    vkcheck(result);
+    return true;
+}
+#else
+inline VkSemaphore DeviceQueue::createTimelineSemaphore(uint64_t) {
+    throw std::runtime_error("built without timeline semaphore support");
+}
+
+inline uint64_t DeviceQueue::getSemaphoreValue(VkSemaphore) {
+    throw std::runtime_error("built without timeline semaphore support");
+}
+
+inline bool DeviceQueue::waitSemaphore(VkSemaphore, uint64_t, uint64_t) {
+    throw std::runtime_error("built without timeline semaphore support");
+}
+#endif
+
+#ifdef VK_EXT_external_memory_host
+inline uint32_t DeviceQueue::getHostPointerMemoryTypeBits(const void *pointer) {
+    if (this->hostPointerAlignment == 0 || uintptr_t(pointer) % this->hostPointerAlignment != 0) {
+        return 0;
+    }
+    VkMemoryHostPointerPropertiesEXT pointerProperties = {};
+    pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+    VkResult result = ((PFN_vkGetMemoryHostPointerPropertiesEXT)this->getMemoryHostPointerPropertiesFunction)(
+        this->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, pointer, &pointerProperties);
+    return result == VK_SUCCESS ? pointerProperties.memoryTypeBits : 0;
+}
+#else
+inline uint32_t DeviceQueue::getHostPointerMemoryTypeBits(const void *) {
+    return 0;
+}
+#endif
+
+inline uint32_t DeviceQueue::getMemoryHeapIndex(VkMemoryPropertyFlags properties) {
+    uint32_t memoryType = findMemoryType(~0u, properties);
+    return memoryType == uint32_t(-1) ? memoryType : getMemoryTypeHeapIndex(memoryType);
+}
+
+/*
+With VK_EXT_memory_budget the budget and usage are the driver's, for the
+whole process and with other processes taken into account.  Without it
+the budget is three quarters of the heap, leaving the rest to the driver
+and everyone else, and the usage is what the ComputeBuffers allocated.
+*/
+inline void DeviceQueue::queryHeapBudget(uint32_t heap, VkDeviceSize *budget, VkDeviceSize *usage) {
+    *budget = getHeapSize(heap) / 4 * 3;
+    *usage = this->allocatedBytes[heap];
+#ifdef VK_EXT_memory_budget
+    if (this->memoryBudget) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+        memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memoryProperties2.pNext = &budgetProperties;
+        ((PFN_vkGetPhysicalDeviceMemoryProperties2KHR)this->getPhysicalDeviceMemoryProperties2Function)(
+            this->physicalDevice, &memoryProperties2);
+        *budget = budgetProperties.heapBudget[heap];
+        // the driver's figure can lag behind the latest allocations
+        *usage = std::max(*usage, budgetProperties.heapUsage[heap]);
+    }
+#endif
+}
+
+inline VkDeviceSize DeviceQueue::getHeapBudget(uint32_t heap) {
+    VkDeviceSize budget, usage;
+    queryHeapBudget(heap, &budget, &usage);
+    return budget;
+}
+
+inline VkDeviceSize DeviceQueue::getHeapUsage(uint32_t heap) {
+    VkDeviceSize budget, usage;
+    queryHeapBudget(heap, &budget, &usage);
+    return usage;
+}
+
+inline VkDeviceSize DeviceQueue::getHeapHeadroom(uint32_t heap) {
+    VkDeviceSize budget, usage;
+    queryHeapBudget(heap, &budget, &usage);
+    return budget > usage ? budget - usage : 0;
+}
+
+inline VkDeviceSize DeviceQueue::getMemoryHeadroom(VkMemoryPropertyFlags properties) {
+    uint32_t heap = getMemoryHeapIndex(properties);
+    return heap == uint32_t(-1) ? 0 : getHeapHeadroom(heap);
+}
+
+inline void DeviceQueue::trackAllocation(uint32_t heap, VkDeviceSize size) {
+    VkDeviceSize allocated = this->allocatedBytes[heap].fetch_add(size) + size;
+    VkDeviceSize peak = this->peakAllocatedBytes[heap];
+    while (allocated > peak && !this->peakAllocatedBytes[heap].compare_exchange_weak(peak, allocated)) {
+    }
+}
+
+inline void DeviceQueue::trackRelease(uint32_t heap, VkDeviceSize size) {
+    this->allocatedBytes[heap].fetch_sub(size);
+}
+
+inline void DeviceQueue::resetPeakAllocatedBytes() {
+    for (uint32_t heap = 0; heap < VK_MAX_MEMORY_HEAPS; ++heap) {
+        this->peakAllocatedBytes[heap] = VkDeviceSize(this->allocatedBytes[heap]);
+    }
+}
+
+// find memory type with desired properties.
+inline uint32_t DeviceQueue::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+
+    vkGetPhysicalDeviceMemoryProperties(this->physicalDevice, &memoryProperties);
+    for (uint32_t memoryType = 0; memoryType < memoryProperties.memoryTypeCount; ++memoryType) {
+        if ((memoryTypeBits & (1 << memoryType)) &&
+            ((memoryProperties.memoryTypes[memoryType].propertyFlags & properties) == properties))
+            return memoryType;
+    }
+    return -1;
+}
+
+inline void DeviceQueue::cleanup() {
+    if (this->device != VK_NULL_HANDLE) {
+        vkDestroyDevice(this->device, NULL);
+        this->device = VK_NULL_HANDLE;
+    }
+    if (this->debugMessenger != VK_NULL_HANDLE) {
+        auto vkDestroyDebugUtilsMessengerEXT = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+        if (vkDestroyDebugUtilsMessengerEXT != nullptr) {
+            vkDestroyDebugUtilsMessengerEXT(this->instance, this->debugMessenger, NULL);
+        }
+        this->debugMessenger = VK_NULL_HANDLE;
+    }
+    if (this->instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(this->instance, NULL);
+        this->instance = VK_NULL_HANDLE;
+    }
+}
+
+inline uint32_t groupCount(uint32_t size, uint32_t workgroupSize) {
+    return (size + workgroupSize - 1) / workgroupSize;
+}
+
+/*
+Voxel types of volumes passed to and from the shaders, in their native
+width.  Shaders without 8/16 bit storage read them as packed 32 bit words.
+*/
+enum ScalarType : uint32_t {
+    UInt8 = 0,
+    Int8 = 1,
+    UInt16 = 2,
+    Int16 = 3,
+    UInt32 = 4,
+    Int32 = 5,
+    Float32 = 6,
+    Float16 = 7 // storage of the reduced precision kernels only
+};
+
+inline uint32_t scalarTypeSize(ScalarType scalarType) {
+    return scalarType <= Int8 ? 1 : (scalarType <= Int16 || scalarType == Float16) ? 2 : 4;
+}
+
+/*
+Thrown when an allocation would exceed the heap's budget or the driver
+runs out of memory, so callers can retry with smaller pieces.
+*/
+class OutOfMemoryError : public std::runtime_error {
+    public:
+        OutOfMemoryError(const std::string &message) : std::runtime_error(message) {}
+};
+
+/*
+A storage buffer and the memory that backs it.
+
+By default the memory is host visible and coherent, like the buffers in
+the experiments, so it can be mapped and read without staging.  Pass
+VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT for buffers that stay on the GPU.
+Allocations are counted against the heap in the DeviceQueue and throw
+OutOfMemoryError rather than exceed its budget.
+*/
+class ComputeBuffer {
+    protected:
+        DeviceQueue *deviceQueue;
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkMemoryPropertyFlags memoryProperties = 0;
+        void *mappedMemory = nullptr;
+        uint32_t heapIndex = 0;
+        VkDeviceSize allocationSize = 0; // counted in the DeviceQueue, 0 for imported memory
+
+    public:
+        ComputeBuffer(DeviceQueue *deviceQueue, VkDeviceSize size,
+                      VkMemoryPropertyFlags memoryProperties =
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      VkBufferUsageFlags usage =
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
+            this->deviceQueue = deviceQueue;
+            this->size = size;
+            this->memoryProperties = memoryProperties;
+            allocate(usage);
+        }
+
+        ComputeBuffer(const ComputeBuffer &) = delete;
+        ComputeBuffer &operator=(const ComputeBuffer &) = delete;
+
+        virtual ~ComputeBuffer() {
+            release();
+        }
+
+    protected:
+        // for subclasses that create the buffer and memory themselves
+        explicit ComputeBuffer(DeviceQueue *deviceQueue) {
+            this->deviceQueue = deviceQueue;
+        }
+
+    public:
+    VkBuffer getBuffer() {return this->buffer;};
+    VkDeviceMemory getMemory() {return this->memory;};
+    VkDeviceSize getSize() {return this->size;};
+    VkDeviceSize getAllocationSize() {return this->allocationSize;};
+    bool isHostVisible() {return (this->memoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;};
+
+    // create the buffer and bind memory of memoryProperties to it; map() keeps host visible memory mapped until unmap()
+    void allocate(VkBufferUsageFlags usage);
+    void *map();
+    void unmap();
+    void release();
+};
+
+inline void ComputeBuffer::allocate(VkBufferUsageFlags usage) {
+    VkDevice device = this->deviceQueue->getDevice();
+
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = this->size;
+    bufferCreateInfo.usage = usage;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    vkcheck(vkCreateBuffer(device, &bufferCreateInfo, NULL, &(this->buffer)));
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, this->buffer, &memoryRequirements);
+
+    uint32_t memoryType = this->deviceQueue->findMemoryType(
+        memoryRequirements.memoryTypeBits, this->memoryProperties);
+    if (memoryType == uint32_t(-1)) {
+        vkDestroyBuffer(device, this->buffer, NULL);
+        this->buffer = VK_NULL_HANDLE;
+        throw std::runtime_error("could not find a memory type for the buffer");
+    }
+
+    uint32_t heapIndex = this->deviceQueue->getMemoryTypeHeapIndex(memoryType);
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    if (memoryRequirements.size <= this->deviceQueue->getHeapHeadroom(heapIndex)) {
+        VkMemoryAllocateInfo allocateInfo = {};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocateInfo.allocationSize = memoryRequirements.size;
+        allocateInfo.memoryTypeIndex = memoryType;
+        result = vkAllocateMemory(device, &allocateInfo, NULL, &(this->memory));
+    }
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+        this->memory = VK_NULL_HANDLE;
+        vkDestroyBuffer(device, this->buffer, NULL);
+        this->buffer = VK_NULL_HANDLE;
+        throw OutOfMemoryError("no room for " + std::to_string(memoryRequirements.size) +
+                               " bytes in memory heap " + std::to_string(heapIndex));
+    }
+    vkcheck(result);
+    this->heapIndex = heapIndex;
+    this->allocationSize = memoryRequirements.size;
+    this->deviceQueue->trackAllocation(heapIndex, this->allocationSize);
+    vkcheck(vkBindBufferMemory(device, this->buffer, this->memory, 0));
+}
+
+inline void *ComputeBuffer::map() {
+    if (this->mappedMemory == nullptr) {
+        if (!isHostVisible()) {
+            throw std::runtime_error("buffer memory is not host visible");
+        }
+        vkcheck(vkMapMemory(this->deviceQueue->getDevice(), this->memory, 0, this->size, 0, &(this->mappedMemory)));
+    }
+    return this->mappedMemory;
+}
+
+inline void ComputeBuffer::unmap() {
+    if (this->mappedMemory != nullptr) {
+        vkUnmapMemory(this->deviceQueue->getDevice(), this->memory);
+        this->mappedMemory = nullptr;
+    }
+}
+
+inline void ComputeBuffer::release() {
+    VkDevice device = this->deviceQueue->getDevice();
+    unmap();
+    if (this->buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, this->buffer, NULL);
+        this->buffer = VK_NULL_HANDLE;
+    }
+    if (this->memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, this->memory, NULL);
+        this->memory = VK_NULL_HANDLE;
+    }
+    if (this->allocationSize != 0) {
+        this->deviceQueue->trackRelease(this->heapIndex, this->allocationSize);
+        this->allocationSize = 0;
+    }
+}
+
+/*
+A compute shader with its pipeline, layouts and descriptor sets.
+
+Binding i of set 0 is the i-th storage buffer.  Push constants (if any)
+start at offset 0, and specialization constant i is set to
+specialization[i].  One descriptor set is allocated up front; more can
+be allocated (up to maxDescriptorSets) to run the same pipeline over
+different buffers in one command buffer.
+*/
+class ComputePipeline {
+    protected:
+        DeviceQueue *deviceQueue;
+
+        uint32_t bufferCount;
+        uint32_t pushConstantSize;
+
+        VkShaderModule shaderModule = VK_NULL_HANDLE;
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    public:
+        ComputePipeline(DeviceQueue *deviceQueue, VkShaderModule shaderModule,
+                        uint32_t bufferCount, uint32_t pushConstantSize = 0,
+                        const std::vector<uint32_t> &specialization = std::vector<uint32_t>(),
+                        uint32_t maxDescriptorSets = 1) {
+            this->deviceQueue = deviceQueue;
+            this->shaderModule = shaderModule;
+            this->bufferCount = bufferCount;
+            this->pushConstantSize = pushConstantSize;
+            createDescriptorSetLayout();
+            createPipeline(specialization);
+            createDescriptorPool(maxDescriptorSets);
+            this->descriptorSet = allocateDescriptorSet();
+        }
+
+        ComputePipeline(const ComputePipeline &) = delete;
+        ComputePipeline &operator=(const ComputePipeline &) = delete;
+
+        virtual ~ComputePipeline() {
+            VkDevice device = this->deviceQueue->getDevice();
+            vkDestroyDescriptorPool(device, this->descriptorPool, NULL);
+            vkDestroyPipeline(device, this->pipeline, NULL);
+            vkDestroyPipelineLayout(device, this->pipelineLayout, NULL);
+            vkDestroyDescriptorSetLayout(device, this->descriptorSetLayout, NULL);
+            vkDestroyShaderModule(device, this->shaderModule, NULL);
+        }
+
+    VkPipeline getPipeline() {return this->pipeline;};
+    VkPipelineLayout getPipelineLayout() {return this->pipelineLayout;};
+    VkDescriptorSet getDescriptorSet() {return this->descriptorSet;};
+    uint32_t getBufferCount() {return this->bufferCount;};
+    uint32_t getPushConstantSize() {return this->pushConstantSize;};
+
+    void createDescriptorSetLayout();
+    void createPipeline(const std::vector<uint32_t> &specialization);
+    void createDescriptorPool(uint32_t maxDescriptorSets);
+    VkDescriptorSet allocateDescriptorSet();
+    void bindBuffer(VkDescriptorSet descriptorSet, uint32_t binding, ComputeBuffer *buffer,
+                    VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+    void bindBuffer(uint32_t binding, ComputeBuffer *buffer) {
+        bindBuffer(this->descriptorSet, binding, buffer);
+    };
+    void bind(VkCommandBuffer commandBuffer, const void *pushConstants = nullptr,
+              VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+    void record(VkCommandBuffer commandBuffer,
+                uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                const void *pushConstants = nullptr, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+    void recordIndirect(VkCommandBuffer commandBuffer, ComputeBuffer *arguments, VkDeviceSize offset = 0,
+                        const void *pushConstants = nullptr, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+    void recordLinear(VkCommandBuffer commandBuffer, uint64_t invocationCount, uint32_t workgroupSize,
+                      const void *pushConstants = nullptr, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+};
+
+inline void ComputePipeline::createDescriptorSetLayout() {
+    /* layout(std430, binding = i) buffer ... in the compute shader */
+    std::vector<VkDescriptorSetLayoutBinding> bindings(this->bufferCount);
+    for (uint32_t binding = 0; binding < this->bufferCount; ++binding) {
+        bindings[binding] = {};
+        bindings[binding].binding = binding;
+        bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding].descriptorCount = 1;
+        bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = this->bufferCount;
+    descriptorSetLayoutCreateInfo.pBindings = bindings.data();
+    vkcheck(vkCreateDescriptorSetLayout(this->deviceQueue->getDevice(),
+        &descriptorSetLayoutCreateInfo, NULL, &(this->descriptorSetLayout)));
+}
+
+inline void ComputePipeline::createPipeline(const std::vector<uint32_t> &specialization) {
+    VkDevice device = this->deviceQueue->getDevice();
+
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = this->pushConstantSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &(this->descriptorSetLayout);
+    pipelineLayoutCreateInfo.pushConstantRangeCount = this->pushConstantSize > 0 ? 1 : 0;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    vkcheck(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &(this->pipelineLayout)));
+
+    std::vector<VkSpecializationMapEntry> mapEntries(specialization.size());
+    for (uint32_t constant = 0; constant < specialization.size(); ++constant) {
+        mapEntries[constant].constantID = constant;
+        mapEntries[constant].offset = constant * sizeof(uint32_t);
+        mapEntries[constant].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = (uint32_t)mapEntries.size();
+    specializationInfo.pMapEntries = mapEntries.data();
+    specializationInfo.dataSize = specialization.size() * sizeof(uint32_t);
+    specializationInfo.pData = specialization.data();
+
+    VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
+    shaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStageCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    shaderStageCreateInfo.module = this->shaderModule;
+    shaderStageCreateInfo.pName = "main";
+    shaderStageCreateInfo.pSpecializationInfo = specialization.empty() ? nullptr : &specializationInfo;
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage = shaderStageCreateInfo;
+    pipelineCreateInfo.layout = this->pipelineLayout;
+    vkcheck(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &(this->pipeline)));
+}
+
+inline void ComputePipeline::createDescriptorPool(uint32_t maxDescriptorSets) {
+    VkDescriptorPoolSize descriptorPoolSize = {};
+    descriptorPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorPoolSize.descriptorCount = maxDescriptorSets * (this->bufferCount > 0 ? this->bufferCount : 1);
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = maxDescriptorSets;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &descriptorPoolSize;
+    vkcheck(vkCreateDescriptorPool(this->deviceQueue->getDevice(),
+        &descriptorPoolCreateInfo, NULL, &(this->descriptorPool)));
+}
+
+inline VkDescriptorSet ComputePipeline::allocateDescriptorSet() {
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = this->descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &(this->descriptorSetLayout);
+
+    VkDescriptorSet descriptorSet;
+    vkcheck(vkAllocateDescriptorSets(this->deviceQueue->getDevice(), &descriptorSetAllocateInfo, &descriptorSet));
+    return descriptorSet;
+}
+
+inline void ComputePipeline::bindBuffer(VkDescriptorSet descriptorSet, uint32_t binding,
+                                        ComputeBuffer *buffer, VkDeviceSize offset, VkDeviceSize range) {
+    VkDescriptorBufferInfo descriptorBufferInfo = {};
+    descriptorBufferInfo.buffer = buffer->getBuffer();
+    descriptorBufferInfo.offset = offset;
+    descriptorBufferInfo.range = range;
+
+    VkWriteDescriptorSet writeDescriptorSet = {};
+    writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeDescriptorSet.dstSet = descriptorSet;
+    writeDescriptorSet.dstBinding = binding;
+    writeDescriptorSet.descriptorCount = 1;
+    writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writeDescriptorSet.pBufferInfo = &descriptorBufferInfo;
+    vkUpdateDescriptorSets(this->deviceQueue->getDevice(), 1, &writeDescriptorSet, 0, NULL);
+}
+
+inline void ComputePipeline::bind(VkCommandBuffer commandBuffer, const void *pushConstants,
+                                  VkDescriptorSet descriptorSet) {
+    if (descriptorSet == VK_NULL_HANDLE) {
+        descriptorSet = this->descriptorSet;
+    }
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            this->pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+    if (pushConstants != nullptr && this->pushConstantSize > 0) {
+        vkCmdPushConstants(commandBuffer, this->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, this->pushConstantSize, pushConstants);
+    }
+}
+
+inline void ComputePipeline::record(VkCommandBuffer commandBuffer,
+                                    uint32_t groupCountX, uint32_t groupCountY, uint32_t groupCountZ,
+                                    const void *pushConstants, VkDescriptorSet descriptorSet) {
+    bind(commandBuffer, pushConstants, descriptorSet);
+    vkCmdDispatch(commandBuffer, groupCountX, groupCountY, groupCountZ);
+}
+
+/*
+The group counts are read on the GPU from a VkDispatchIndirectCommand
+at offset in arguments (created with VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT),
+so they can be produced by an earlier shader in the same submission.
+*/
+inline void ComputePipeline::recordIndirect(VkCommandBuffer commandBuffer, ComputeBuffer *arguments,
+                                            VkDeviceSize offset, const void *pushConstants,
+                                            VkDescriptorSet descriptorSet) {
+    bind(commandBuffer, pushConstants, descriptorSet);
+    vkCmdDispatchIndirect(commandBuffer, arguments->getBuffer(), offset);
+}
+
+/*
+A one dimensional dispatch of at least invocationCount invocations.
+Large counts are folded into y, since only 65535 groups per dimension
+are guaranteed, so the shader computes its index as
+
+  gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x
+*/
+inline void ComputePipeline::recordLinear(VkCommandBuffer commandBuffer, uint64_t invocationCount,
+                                          uint32_t workgroupSize, const void *pushConstants,
+                                          VkDescriptorSet descriptorSet) {
+    const uint64_t maxGroupCount = 65535;
+    uint64_t groups = (invocationCount + workgroupSize - 1) / workgroupSize;
+    uint64_t groupCountX = groups < maxGroupCount ? (groups > 0 ? groups : 1) : maxGroupCount;
+    uint64_t groupCountY = (groups + groupCountX - 1) / groupCountX;
+    record(commandBuffer, (uint32_t)groupCountX, (uint32_t)(groupCountY > 0 ? groupCountY : 1), 1,
+           pushConstants, descriptorSet);
+}
+
+/*
+A command pool, one primary command buffer and a fence.
+
+begin() starts recording (resetting whatever was recorded before),
+submit() hands the commands to the queue, and completion can either
+be polled with isComplete() or waited for with wait().
+*/
+class CommandSequence {
+    protected:
+        DeviceQueue *deviceQueue;
+
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        bool recording = false;
+        bool submitted = false;
+
+    public:
+        CommandSequence(DeviceQueue *deviceQueue) {
+            this->deviceQueue = deviceQueue;
+            VkDevice device = deviceQueue->getDevice();
+
+            VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+            commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            commandPoolCreateInfo.queueFamilyIndex = deviceQueue->getQueueFamilyIndex();
+            vkcheck(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, &(this->commandPool)));
+
+            VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+            commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            commandBufferAllocateInfo.commandPool = this->commandPool;
+            commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+            vkcheck(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &(this->commandBuffer)));
+
+            VkFenceCreateInfo fenceCreateInfo = {};
+            fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceCreateInfo.flags = 0;
+            vkcheck(vkCreateFence(device, &fenceCreateInfo, NULL, &(this->fence)));
+        }
+
+        CommandSequence(const CommandSequence &) = delete;
+        CommandSequence &operator=(const CommandSequence &) = delete;
+
+        virtual ~CommandSequence() {
+            VkDevice device = this->deviceQueue->getDevice();
+            if (this->submitted) {
+                wait();
+            }
+            vkDestroyFence(device, this->fence, NULL);
+            vkDestroyCommandPool(device, this->commandPool, NULL);
+        }
+
+    VkCommandBuffer getCommandBuffer() {return this->commandBuffer;};
+    VkFence getFence() {return this->fence;};
+
+    VkCommandBuffer begin();
+    void barrier();
+    void copyBuffer(ComputeBuffer *source, ComputeBuffer *destination, VkDeviceSize size = VK_WHOLE_SIZE,
+                    VkDeviceSize sourceOffset = 0, VkDeviceSize destinationOffset = 0);
+    void fillBuffer(ComputeBuffer *buffer, uint32_t value, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+    void end();
+    void submit();
+    bool isComplete();
+    void wait(uint64_t timeout = UINT64_MAX);
+    void submitAndWait() {
+        submit();
+        wait();
+    };
+};
+
+inline VkCommandBuffer CommandSequence::begin() {
+    if (this->submitted) {
+        wait();
+    }
+    vkcheck(vkResetCommandPool(this->deviceQueue->getDevice(), this->commandPool, 0));
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkcheck(vkBeginCommandBuffer(this->commandBuffer, &beginInfo));
+    this->recording = true;
+    return this->commandBuffer;
+}
+
+/*
+Make everything written so far (by shaders or transfers) visible to
+everything recorded afterwards, including indirect dispatch arguments
+and host reads after the fence.
+*/
+inline void CommandSequence::barrier() {
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT |
+                                  VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+                                  VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(this->commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT |
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &memoryBarrier, 0, NULL, 0, NULL);
+}
+
+inline void CommandSequence::copyBuffer(ComputeBuffer *source, ComputeBuffer *destination, VkDeviceSize size,
+                                        VkDeviceSize sourceOffset, VkDeviceSize destinationOffset) {
+    VkBufferCopy region = {};
+    region.srcOffset = sourceOffset;
+    region.dstOffset = destinationOffset;
+    region.size = size == VK_WHOLE_SIZE ? source->getSize() - sourceOffset : size;
+    vkCmdCopyBuffer(this->commandBuffer, source->getBuffer(), destination->getBuffer(), 1, &region);
+}
+
+inline void CommandSequence::fillBuffer(ComputeBuffer *buffer, uint32_t value, VkDeviceSize offset, VkDeviceSize size) {
+    vkCmdFillBuffer(this->commandBuffer, buffer->getBuffer(), offset, size, value);
+}
+
+inline void CommandSequence::end() {
+    if (this->recording) {
+        vkcheck(vkEndCommandBuffer(this->commandBuffer));
+        this->recording = false;
+    }
+}
+
+inline void CommandSequence::submit() {
+    end();
+    vkcheck(vkResetFences(this->deviceQueue->getDevice(), 1, &(this->fence)));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &(this->commandBuffer);
+    vkcheck(vkQueueSubmit(this->deviceQueue->getQueue(), 1, &submitInfo, this->fence));
+    this->submitted = true;
+}
+
+inline bool CommandSequence::isComplete() {
+    if (!this->submitted) {
+        return true;
+    }
+    if (vkGetFenceStatus(this->deviceQueue->getDevice(), this->fence) == VK_SUCCESS) {
+        this->submitted = false;
+        return true;
+    }
+    return false;
+}
+
+inline void CommandSequence::wait(uint64_t timeout) {
+    if (this->submitted) {
+        vkcheck(vkWaitForFences(this->deviceQueue->getDevice(), 1, &(this->fence), VK_TRUE, timeout));
+        this->submitted = false;
+    }
+}
+
+/*
+Base for algorithms built from pipelines, buffers and command sequences
+on a shared DeviceQueue.
+*/
+class ComputeAlgorithm {
+    protected:
+        DeviceQueue *deviceQueue;
+
+    public:
+        ComputeAlgorithm(DeviceQueue *deviceQueue) {
+            this->deviceQueue = deviceQueue;
+        }
+
+        virtual ~ComputeAlgorithm() {
+        }
+
+    DeviceQueue *getDeviceQueue() {return this->deviceQueue;};
+};
+
+} // end of namespace vudo
+
+#endif
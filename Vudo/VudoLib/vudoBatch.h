@@ -0,0 +1,192 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Batched execution: many small volumes (the frames of a 4D sequence,
+ * the series of a study) through the same kernel with one command
+ * buffer, one submission and one fence.
+ */
+
+#ifndef __vudoBatch_h
+#define __vudoBatch_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoThreshold.h"
+
+#include <algorithm>
+
+namespace vudo {
+
+/*
+One buffer (and one memory allocation) carved into ranges for many
+volumes.  Ranges start at multiples of the device's storage buffer
+offset alignment so each can be bound on its own.
+*/
+class BufferArena {
+    protected:
+        ComputeBuffer buffer;
+        VkDeviceSize alignment;
+        VkDeviceSize used = 0;
+
+    public:
+        BufferArena(DeviceQueue *deviceQueue, VkDeviceSize capacity,
+                    VkMemoryPropertyFlags memoryProperties =
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+            : buffer(deviceQueue, capacity > 0 ? capacity : 4, memoryProperties) {
+            this->alignment = deviceAlignment(deviceQueue);
+        }
+
+    static VkDeviceSize deviceAlignment(DeviceQueue *deviceQueue) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(deviceQueue->getPhysicalDevice(), &properties);
+        return std::max(properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize(4));
+    };
+
+    ComputeBuffer *getBuffer() {return &(this->buffer);};
+    VkDeviceSize getAlignment() {return this->alignment;};
+    VkDeviceSize getUsed() {return this->used;};
+    static VkDeviceSize alignedSize(VkDeviceSize size, VkDeviceSize alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    };
+
+    /* Returns the byte offset of a new range of size bytes */
+    VkDeviceSize allocate(VkDeviceSize size) {
+        VkDeviceSize offset = alignedSize(this->used, this->alignment);
+        if (offset + size > this->buffer.getSize()) {
+            throw std::runtime_error("buffer arena exhausted");
+        }
+        this->used = offset + size;
+        return offset;
+    };
+    void reset() {this->used = 0;};
+};
+
+/*
+ThresholdFilter over a batch of volumes of one input and one output
+type.  addVolume() carves each volume's input and output from the two
+arenas and gives it its own descriptor set, then run() records every
+dispatch into one command buffer.  The dispatches are independent, so
+there is no barrier between them, only one before the fence.
+
+Write each input at getInputOffset(volume) bytes into getInput() and
+read its output at getOutputOffset(volume) bytes into getOutput().
+*/
+class ThresholdBatch : public ComputeAlgorithm {
+    protected:
+        ScalarType inputType;
+        ScalarType outputType;
+        uint32_t maxVolumes;
+        ThresholdPushConstants parameters;
+
+        BufferArena input;
+        BufferArena output;
+        ComputePipeline pipeline;
+        CommandSequence commandSequence;
+
+        struct Volume {
+            uint32_t voxelCount;
+            VkDeviceSize inputOffset;
+            VkDeviceSize outputOffset;
+            VkDescriptorSet descriptorSet;
+        };
+        std::vector<Volume> volumes;
+        // descriptor sets come from the pipeline's pool once, and are rebound by later batches
+        std::vector<VkDescriptorSet> descriptorSets;
+
+    public:
+        // voxelCapacity is the total number of voxels over all volumes of a batch
+        ThresholdBatch(DeviceQueue *deviceQueue, ScalarType inputType, ScalarType outputType,
+                       uint32_t maxVolumes, VkDeviceSize voxelCapacity, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, arenaBytes(deviceQueue, inputType, maxVolumes, voxelCapacity)),
+              output(deviceQueue, arenaBytes(deviceQueue, outputType, maxVolumes, voxelCapacity)),
+              pipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "threshold", shaderPath),
+                       2, sizeof(ThresholdPushConstants), {inputType, outputType}, maxVolumes),
+              commandSequence(deviceQueue) {
+            this->inputType = inputType;
+            this->outputType = outputType;
+            this->maxVolumes = maxVolumes;
+            this->parameters.threshold = 0.f;
+            this->parameters.outsideValue = 0.f;
+            this->parameters.scale = 1.f;
+            this->parameters.shift = 0.f;
+            this->parameters.voxelCount = 0;
+        }
+
+        virtual ~ThresholdBatch() {
+            this->commandSequence.wait();
+        }
+
+    // room for voxelCapacity voxels in maxVolumes aligned ranges of whole words
+    static VkDeviceSize arenaBytes(DeviceQueue *deviceQueue, ScalarType scalarType,
+                                   uint32_t maxVolumes, VkDeviceSize voxelCapacity) {
+        return VkDeviceSize(scalarTypeSize(scalarType)) * voxelCapacity
+               + VkDeviceSize(maxVolumes) * (BufferArena::deviceAlignment(deviceQueue) + 4);
+    };
+
+    ScalarType getInputType() {return this->inputType;};
+    ScalarType getOutputType() {return this->outputType;};
+    uint32_t getMaxVolumes() {return this->maxVolumes;};
+    uint32_t getVolumeCount() {return (uint32_t)this->volumes.size();};
+    ComputeBuffer *getInput() {return this->input.getBuffer();};
+    ComputeBuffer *getOutput() {return this->output.getBuffer();};
+    VkDeviceSize getInputOffset(uint32_t volume) {return this->volumes.at(volume).inputOffset;};
+    VkDeviceSize getOutputOffset(uint32_t volume) {return this->volumes.at(volume).outputOffset;};
+
+    void setThreshold(float threshold) {this->parameters.threshold = threshold;};
+    void setOutsideValue(float outsideValue) {this->parameters.outsideValue = outsideValue;};
+    void setRescale(float scale, float shift) {
+        this->parameters.scale = scale;
+        this->parameters.shift = shift;
+    };
+
+    uint32_t addVolume(uint32_t voxelCount);
+    // forget the volumes, keeping the arenas and descriptor sets for the next batch
+    void clearVolumes() {
+        this->volumes.clear();
+        this->input.reset();
+        this->output.reset();
+    };
+    void run();
+};
+
+/* Returns the index of the volume in the batch */
+inline uint32_t ThresholdBatch::addVolume(uint32_t voxelCount) {
+    uint32_t index = (uint32_t)this->volumes.size();
+    if (index >= this->maxVolumes) {
+        throw std::runtime_error("threshold batch is full");
+    }
+    Volume volume;
+    volume.voxelCount = voxelCount;
+    VkDeviceSize inputBytes = ThresholdFilter::wordBytes(this->inputType, voxelCount);
+    VkDeviceSize outputBytes = ThresholdFilter::wordBytes(this->outputType, voxelCount);
+    volume.inputOffset = this->input.allocate(inputBytes);
+    volume.outputOffset = this->output.allocate(outputBytes);
+    if (index >= this->descriptorSets.size()) {
+        this->descriptorSets.push_back(index == 0 ? this->pipeline.getDescriptorSet()
+                                                  : this->pipeline.allocateDescriptorSet());
+    }
+    volume.descriptorSet = this->descriptorSets[index];
+    this->pipeline.bindBuffer(volume.descriptorSet, 0, this->input.getBuffer(), volume.inputOffset, inputBytes);
+    this->pipeline.bindBuffer(volume.descriptorSet, 1, this->output.getBuffer(), volume.outputOffset, outputBytes);
+    this->volumes.push_back(volume);
+    return index;
+}
+
+inline void ThresholdBatch::run() {
+    uint32_t outputPerWord = 4 / scalarTypeSize(this->outputType);
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    for (Volume &volume : this->volumes) {
+        ThresholdPushConstants parameters = this->parameters;
+        parameters.voxelCount = volume.voxelCount;
+        this->pipeline.recordLinear(commandBuffer, groupCount(volume.voxelCount, outputPerWord), 64,
+                                    &parameters, volume.descriptorSet);
+    }
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
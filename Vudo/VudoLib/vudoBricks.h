@@ -0,0 +1,231 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Brick maps for sparse and region of interest dispatch.
+ *
+ * The volume is divided into bricks (16^3 voxels by default).  A first
+ * shader marks the bricks that overlap the region of interest and, for
+ * a filter, contain anything above background; a second one compacts
+ * them into a list and writes the VkDispatchIndirectCommand for the
+ * consumer.  Empty bricks then cost nothing: no workgroups are launched
+ * for them and the host never has to read the map back.
+ *
+ * The workgroups of the indirect dispatch are laid out in rows of whole
+ * bricks, as many as maxComputeWorkGroupCount[0] allows, so a consumer
+ * shader launched with BrickMap::dispatch() finds its voxel with
+ *
+ *   uint groupsPerBrick = (BRICK_SIZE / WORKGROUP_SIZE)^3;
+ *   uint workgroup = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+ *   uint brick = activeBricks[workgroup / groupsPerBrick];
+ *   if (brick == NO_BRICK) return; // 0xffffffff, past the end of the last row
+ *   uint group = workgroup % groupsPerBrick;
+ *   uvec3 voxel = brickCoordinate(brick) * BRICK_SIZE
+ *                 + groupCoordinate(group) * WORKGROUP_SIZE
+ *                 + gl_LocalInvocationID;
+ *
+ * with activeBricks bound from getActiveBricks(), see Mandelbrot.comp.glsl.
+ */
+
+#ifndef __vudoBricks_h
+#define __vudoBricks_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+#include <algorithm>
+
+namespace vudo {
+
+/* push constants of brickOccupancy.comp.glsl (std430 packs each uvec3 with the uint after it) */
+struct BrickOccupancyPushConstants {
+    uint32_t dimensions[3];
+    uint32_t brickSize;
+    uint32_t roiMin[3];
+    uint32_t valueStride;
+    uint32_t roiMax[3];
+    float background;
+};
+
+/* push constants of brickCompact.comp.glsl */
+struct BrickCompactPushConstants {
+    uint32_t brickCount;
+    uint32_t groupsPerBrick;
+    uint32_t maxGroupCountX;
+    uint32_t finalize;
+};
+
+inline uint32_t maxWorkGroupCountX(DeviceQueue *deviceQueue) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(deviceQueue->getPhysicalDevice(), &properties);
+    return properties.limits.maxComputeWorkGroupCount[0];
+}
+
+/* entries of an active brick list, including the NO_BRICK padding of its last row */
+inline uint32_t activeBrickCapacity(DeviceQueue *deviceQueue, uint32_t brickCount) {
+    return brickCount + std::min(brickCount, maxWorkGroupCountX(deviceQueue));
+}
+
+/*
+Compact the occupied bricks of occupancy into activeBricks and write the
+indirect dispatch of groupsPerBrick workgroups per active brick, with
+compactPipeline (brickCompact.comp.glsl) bound to occupancy, activeBricks
+and indirectArguments.
+*/
+inline void recordBrickCompaction(DeviceQueue *deviceQueue, CommandSequence *commandSequence,
+                                  ComputePipeline *compactPipeline, ComputeBuffer *indirectArguments,
+                                  uint32_t brickCount, uint32_t groupsPerBrick) {
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    BrickCompactPushConstants compactConstants;
+    compactConstants.brickCount = brickCount;
+    compactConstants.groupsPerBrick = groupsPerBrick;
+    compactConstants.maxGroupCountX = maxWorkGroupCountX(deviceQueue);
+    compactConstants.finalize = 0;
+
+    // {groupCountX, groupCountY, groupCountZ, activeBrickCount} = {0, 1, 1, 0}
+    commandSequence->fillBuffer(indirectArguments, 0, 0, sizeof(uint32_t));
+    commandSequence->fillBuffer(indirectArguments, 1, sizeof(uint32_t), 2 * sizeof(uint32_t));
+    commandSequence->fillBuffer(indirectArguments, 0, 3 * sizeof(uint32_t), sizeof(uint32_t));
+    commandSequence->barrier();
+    compactPipeline->record(commandBuffer, groupCount(brickCount, 64), 1, 1, &compactConstants);
+    commandSequence->barrier();
+    compactConstants.finalize = 1;
+    compactPipeline->record(commandBuffer, 1, 1, 1, &compactConstants);
+    commandSequence->barrier();
+}
+
+class BrickMap : public ComputeAlgorithm {
+    protected:
+        uint32_t dimensions[3];
+        uint32_t brickSize;
+        uint32_t brickGrid[3];
+        uint32_t roiMin[3] = {0, 0, 0};
+        uint32_t roiMax[3];
+        float background = 0.f;
+
+        ComputeBuffer occupancy;
+        ComputeBuffer activeBricks;
+        ComputeBuffer indirectArguments; // VkDispatchIndirectCommand followed by the active brick count
+        ComputePipeline occupancyPipeline;
+        ComputePipeline compactPipeline;
+
+    public:
+        BrickMap(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                 uint32_t brickSize = 16,
+                 const std::string &occupancyShaderPath = "", const std::string &compactShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              occupancy(deviceQueue, sizeof(uint32_t) * brickCount(width, height, depth, brickSize)),
+              activeBricks(deviceQueue, sizeof(uint32_t) *
+                           activeBrickCapacity(deviceQueue, brickCount(width, height, depth, brickSize))),
+              indirectArguments(deviceQueue, sizeof(VkDispatchIndirectCommand) + sizeof(uint32_t),
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+              occupancyPipeline(deviceQueue,
+                  createShaderModule(deviceQueue->getDevice(), "brickOccupancy", occupancyShaderPath),
+                  2, sizeof(BrickOccupancyPushConstants)),
+              compactPipeline(deviceQueue,
+                  createShaderModule(deviceQueue->getDevice(), "brickCompact", compactShaderPath),
+                  3, sizeof(BrickCompactPushConstants)) {
+            this->dimensions[0] = width;
+            this->dimensions[1] = height;
+            this->dimensions[2] = depth;
+            this->brickSize = brickSize;
+            for (int axis = 0; axis < 3; ++axis) {
+                this->brickGrid[axis] = groupCount(this->dimensions[axis], brickSize);
+                this->roiMax[axis] = this->dimensions[axis];
+            }
+            this->compactPipeline.bindBuffer(0, &(this->occupancy));
+            this->compactPipeline.bindBuffer(1, &(this->activeBricks));
+            this->compactPipeline.bindBuffer(2, &(this->indirectArguments));
+            this->occupancyPipeline.bindBuffer(1, &(this->occupancy));
+        }
+
+    static uint32_t brickCount(uint32_t width, uint32_t height, uint32_t depth, uint32_t brickSize) {
+        return groupCount(width, brickSize) * groupCount(height, brickSize) * groupCount(depth, brickSize);
+    };
+
+    uint32_t getBrickSize() {return this->brickSize;};
+    uint32_t getBrickGrid(int axis) {return this->brickGrid[axis];};
+    uint32_t getBrickCount() {return this->brickGrid[0] * this->brickGrid[1] * this->brickGrid[2];};
+    ComputeBuffer *getOccupancy() {return &(this->occupancy);};
+    ComputeBuffer *getActiveBricks() {return &(this->activeBricks);};
+    ComputeBuffer *getIndirectArguments() {return &(this->indirectArguments);};
+
+    // half open voxel box [min, max), clipped to the volume
+    void setROI(uint32_t minX, uint32_t minY, uint32_t minZ, uint32_t maxX, uint32_t maxY, uint32_t maxZ) {
+        uint32_t minimum[3] = {minX, minY, minZ};
+        uint32_t maximum[3] = {maxX, maxY, maxZ};
+        for (int axis = 0; axis < 3; ++axis) {
+            this->roiMin[axis] = std::min(minimum[axis], this->dimensions[axis]);
+            this->roiMax[axis] = std::min(maximum[axis], this->dimensions[axis]);
+        }
+    };
+    void clearROI() {
+        setROI(0, 0, 0, this->dimensions[0], this->dimensions[1], this->dimensions[2]);
+    };
+    // voxels at or below background do not make a brick occupied
+    void setBackground(float background) {this->background = background;};
+
+    void record(CommandSequence *commandSequence, uint32_t workgroupSize,
+                ComputeBuffer *values = nullptr, uint32_t valueStride = 1);
+    void dispatch(CommandSequence *commandSequence, ComputePipeline *pipeline,
+                  const void *pushConstants = nullptr, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+
+    uint32_t getActiveBrickCount();
+    double getSkippedFraction();
+};
+
+/*
+Record the occupancy and compaction passes into a sequence that has been
+begun.  Without values only the region of interest is considered (for
+generators).  workgroupSize is the consumer's (cubic) workgroup size,
+which must divide the brick size.
+*/
+inline void BrickMap::record(CommandSequence *commandSequence, uint32_t workgroupSize,
+                             ComputeBuffer *values, uint32_t valueStride) {
+    if (workgroupSize == 0 || this->brickSize % workgroupSize != 0) {
+        throw std::runtime_error("brick size must be a multiple of the workgroup size");
+    }
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+
+    BrickOccupancyPushConstants occupancyConstants;
+    for (int axis = 0; axis < 3; ++axis) {
+        occupancyConstants.dimensions[axis] = this->dimensions[axis];
+        occupancyConstants.roiMin[axis] = this->roiMin[axis];
+        occupancyConstants.roiMax[axis] = this->roiMax[axis];
+    }
+    occupancyConstants.brickSize = this->brickSize;
+    occupancyConstants.valueStride = values ? valueStride : 0;
+    occupancyConstants.background = this->background;
+    // the shader does not read values without a stride, but the binding must be valid
+    this->occupancyPipeline.bindBuffer(0, values ? values : &(this->occupancy));
+
+    uint32_t groupsPerAxis = this->brickSize / workgroupSize;
+    this->occupancyPipeline.record(commandBuffer,
+        this->brickGrid[0], this->brickGrid[1], this->brickGrid[2], &occupancyConstants);
+    commandSequence->barrier();
+    recordBrickCompaction(this->deviceQueue, commandSequence, &(this->compactPipeline), &(this->indirectArguments),
+                          getBrickCount(), groupsPerAxis * groupsPerAxis * groupsPerAxis);
+}
+
+/* Launch pipeline over the active bricks of the last record() */
+inline void BrickMap::dispatch(CommandSequence *commandSequence, ComputePipeline *pipeline,
+                               const void *pushConstants, VkDescriptorSet descriptorSet) {
+    pipeline->recordIndirect(commandSequence->getCommandBuffer(), &(this->indirectArguments), 0,
+                             pushConstants, descriptorSet);
+}
+
+/* Valid once the sequence that recorded the map has completed */
+inline uint32_t BrickMap::getActiveBrickCount() {
+    const uint32_t *arguments = static_cast<const uint32_t *>(this->indirectArguments.map());
+    return arguments[3];
+}
+
+inline double BrickMap::getSkippedFraction() {
+    return 1.0 - double(getActiveBrickCount()) / double(getBrickCount());
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Connected component labelling of label maps, for island removal and
+ * component statistics on large segmentations.
+ */
+
+#ifndef __vudoConnectedComponents_h
+#define __vudoConnectedComponents_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* push constants of connectedComponents.comp.glsl */
+struct ConnectedComponentsPushConstants {
+    uint32_t dimensions[3];
+    uint32_t voxelCount;
+    uint32_t countCapacity;
+};
+
+/*
+Fill getInput() with the label map in its native (integer) type and
+run().  getLabels() then holds a uint32_t component label per voxel (0 for
+background), ready to be handed to a volume node, and getCounts() the
+number of components followed by the voxel count of each label.
+
+Voxels are connected when they are neighbours (6, 18 or 26 connectivity)
+with the same nonzero value.  Component labels are consecutive from 1 but
+their order is not deterministic.
+*/
+class ConnectedComponents : public ComputeAlgorithm {
+    protected:
+        ScalarType inputType;
+        uint32_t connectivity;
+        ConnectedComponentsPushConstants parameters;
+
+        ComputeBuffer input;
+        ComputeBuffer parent;
+        ComputeBuffer labels;
+        ComputeBuffer counts;
+        CommandSequence commandSequence;
+        std::vector<ComputePipeline *> passes;
+
+    public:
+        // maxComponents bounds the counts that are kept, not the number of components
+        ConnectedComponents(DeviceQueue *deviceQueue, ScalarType inputType,
+                            uint32_t width, uint32_t height, uint32_t depth,
+                            uint32_t connectivity = 26, uint32_t maxComponents = 65536,
+                            const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, (VkDeviceSize(scalarTypeSize(inputType)) * width * height * depth + 3) & ~VkDeviceSize(3)),
+              parent(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              labels(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth),
+              counts(deviceQueue, sizeof(uint32_t) * (VkDeviceSize(maxComponents) + 1)),
+              commandSequence(deviceQueue) {
+            if (inputType == Float32) {
+                throw std::runtime_error("connected components need an integer label map");
+            }
+            if (connectivity != 6 && connectivity != 18 && connectivity != 26) {
+                throw std::runtime_error("connectivity must be 6, 18 or 26");
+            }
+            this->inputType = inputType;
+            this->connectivity = connectivity;
+            this->parameters.dimensions[0] = width;
+            this->parameters.dimensions[1] = height;
+            this->parameters.dimensions[2] = depth;
+            this->parameters.voxelCount = width * height * depth;
+            this->parameters.countCapacity = maxComponents;
+
+            for (uint32_t pass = 0; pass < 5; ++pass) {
+                std::vector<uint32_t> specialization = {pass, connectivity, inputType};
+                ComputePipeline *pipeline = new ComputePipeline(deviceQueue,
+                    createShaderModule(deviceQueue->getDevice(), "connectedComponents", shaderPath),
+                    4, sizeof(ConnectedComponentsPushConstants), specialization);
+                pipeline->bindBuffer(0, &(this->input));
+                pipeline->bindBuffer(1, &(this->parent));
+                pipeline->bindBuffer(2, &(this->labels));
+                pipeline->bindBuffer(3, &(this->counts));
+                this->passes.push_back(pipeline);
+            }
+        }
+
+        virtual ~ConnectedComponents() {
+            this->commandSequence.wait();
+            for (ComputePipeline *pipeline : this->passes) {
+                delete pipeline;
+            }
+        }
+
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getLabels() {return &(this->labels);};
+    ComputeBuffer *getCounts() {return &(this->counts);};
+    uint32_t getConnectivity() {return this->connectivity;};
+    uint32_t getCountCapacity() {return this->parameters.countCapacity;};
+
+    void run();
+    uint32_t getComponentCount();
+};
+
+/* All five passes in one submission */
+inline void ConnectedComponents::run() {
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->commandSequence.fillBuffer(&(this->counts), 0);
+    for (ComputePipeline *pipeline : this->passes) {
+        pipeline->recordLinear(commandBuffer, this->parameters.voxelCount, 64, &(this->parameters));
+        this->commandSequence.barrier();
+    }
+    this->commandSequence.submitAndWait();
+}
+
+inline uint32_t ConnectedComponents::getComponentCount() {
+    return static_cast<const uint32_t *>(this->counts.map())[0];
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Dirty brick tracking for incremental recomputation after local edits.
+ *
+ * The volume is divided into bricks (16^3 voxels, as in vudoBricks.h).
+ * An upload marks the bricks it changed, either on the host from the
+ * edited extent (e.g. the modified extent of a segment) or on the GPU by
+ * comparing the new voxels with a snapshot of the previous ones.  Before
+ * a filter runs, the dirty bricks are grown by its stencil radius and
+ * compacted into a list, and the filter is dispatched indirectly over
+ * just those bricks, so an edit costs in proportion to its size.
+ *
+ * A consumer shader finds its tile as described in vudoBricks.h, with
+ * groupsPerBrick tiles per brick in rows over gl_WorkGroupID.y and the
+ * NO_BRICK padding skipped, see morphology.comp.glsl.
+ */
+
+#ifndef __vudoDirtyBricks_h
+#define __vudoDirtyBricks_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoBricks.h"
+
+#include <algorithm>
+
+namespace vudo {
+
+/* push constants of brickDiff.comp.glsl */
+struct BrickDiffPushConstants {
+    uint32_t dimensions[3];
+    uint32_t brickSize;
+    uint32_t wordCount;
+    uint32_t voxelsPerWord;
+};
+
+/* push constants of brickGrow.comp.glsl */
+struct BrickGrowPushConstants {
+    uint32_t brickGrid[3];
+    uint32_t brickCount;
+    uint32_t brickRadius[3];
+};
+
+/*
+The dirty flags live in host visible memory so markExtent() can set
+them directly; everything else stays on the device.  Every brick starts
+dirty, since nothing downstream has been computed yet.
+*/
+class DirtyBricks : public ComputeAlgorithm {
+    protected:
+        uint32_t dimensions[3];
+        uint32_t voxelBytes;
+        uint32_t brickSize;
+        uint32_t brickGrid[3];
+
+        ComputeBuffer dirty;
+        ComputeBuffer grown;
+        ComputeBuffer activeBricks;
+        ComputeBuffer indirectArguments; // VkDispatchIndirectCommand followed by the active brick count
+        ComputeBuffer snapshot;
+        ComputePipeline diffPipeline;
+        ComputePipeline growPipeline;
+        ComputePipeline compactPipeline;
+
+    public:
+        DirtyBricks(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                    uint32_t voxelBytes = 4, uint32_t brickSize = 16,
+                    const std::string &diffShaderPath = "", const std::string &growShaderPath = "",
+                    const std::string &compactShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              dirty(deviceQueue, sizeof(uint32_t) * BrickMap::brickCount(width, height, depth, brickSize)),
+              grown(deviceQueue, sizeof(uint32_t) * BrickMap::brickCount(width, height, depth, brickSize),
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              activeBricks(deviceQueue, sizeof(uint32_t) *
+                           activeBrickCapacity(deviceQueue, BrickMap::brickCount(width, height, depth, brickSize)),
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              indirectArguments(deviceQueue, sizeof(VkDispatchIndirectCommand) + sizeof(uint32_t),
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+              snapshot(deviceQueue, snapshotBytes(width, height, depth, voxelBytes), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              diffPipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "brickDiff", diffShaderPath),
+                           3, sizeof(BrickDiffPushConstants)),
+              growPipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "brickGrow", growShaderPath),
+                           2, sizeof(BrickGrowPushConstants)),
+              compactPipeline(deviceQueue,
+                  createShaderModule(deviceQueue->getDevice(), "brickCompact", compactShaderPath),
+                  3, sizeof(BrickCompactPushConstants)) {
+            if (voxelBytes != 1 && voxelBytes != 2 && voxelBytes != 4) {
+                throw std::runtime_error("dirty bricks track 1, 2 or 4 byte voxels");
+            }
+            this->dimensions[0] = width;
+            this->dimensions[1] = height;
+            this->dimensions[2] = depth;
+            this->voxelBytes = voxelBytes;
+            this->brickSize = brickSize;
+            for (int axis = 0; axis < 3; ++axis) {
+                this->brickGrid[axis] = groupCount(this->dimensions[axis], brickSize);
+            }
+            this->diffPipeline.bindBuffer(1, &(this->snapshot));
+            this->diffPipeline.bindBuffer(2, &(this->dirty));
+            this->growPipeline.bindBuffer(0, &(this->dirty));
+            this->growPipeline.bindBuffer(1, &(this->grown));
+            this->compactPipeline.bindBuffer(0, &(this->grown));
+            this->compactPipeline.bindBuffer(1, &(this->activeBricks));
+            this->compactPipeline.bindBuffer(2, &(this->indirectArguments));
+            markAll();
+        }
+
+    static VkDeviceSize snapshotBytes(uint32_t width, uint32_t height, uint32_t depth, uint32_t voxelBytes) {
+        VkDeviceSize bytes = VkDeviceSize(width) * height * depth * voxelBytes;
+        return std::max<VkDeviceSize>((bytes + 3) & ~VkDeviceSize(3), 4);
+    };
+
+    uint32_t getBrickSize() {return this->brickSize;};
+    uint32_t getBrickGrid(int axis) {return this->brickGrid[axis];};
+    uint32_t getBrickCount() {return this->brickGrid[0] * this->brickGrid[1] * this->brickGrid[2];};
+    ComputeBuffer *getDirty() {return &(this->dirty);};
+    ComputeBuffer *getActiveBricks() {return &(this->activeBricks);};
+    ComputeBuffer *getIndirectArguments() {return &(this->indirectArguments);};
+
+    void markAll();
+    void markExtent(uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY, uint32_t minZ, uint32_t maxZ);
+    uint32_t getDirtyBrickCount();
+
+    void recordDiff(CommandSequence *commandSequence, ComputeBuffer *current);
+    void recordGrow(CommandSequence *commandSequence, const uint32_t radius[3], uint32_t groupsPerBrick);
+    void recordClear(CommandSequence *commandSequence);
+    void dispatch(CommandSequence *commandSequence, ComputePipeline *pipeline,
+                  const void *pushConstants = nullptr, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+
+    uint32_t getActiveBrickCount();
+    double getSkippedFraction();
+};
+
+inline void DirtyBricks::markAll() {
+    uint32_t *flags = static_cast<uint32_t *>(this->dirty.map());
+    std::fill(flags, flags + getBrickCount(), 1u);
+}
+
+/* An inclusive voxel extent, as vtkImageData and MRML report them, clipped to the volume */
+inline void DirtyBricks::markExtent(uint32_t minX, uint32_t maxX, uint32_t minY, uint32_t maxY,
+                                    uint32_t minZ, uint32_t maxZ) {
+    uint32_t minimum[3] = {minX, minY, minZ};
+    uint32_t maximum[3] = {maxX, maxY, maxZ};
+    uint32_t first[3], last[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        if (minimum[axis] > maximum[axis] || minimum[axis] >= this->dimensions[axis]) {
+            return;
+        }
+        first[axis] = minimum[axis] / this->brickSize;
+        last[axis] = std::min(maximum[axis], this->dimensions[axis] - 1) / this->brickSize;
+    }
+    uint32_t *flags = static_cast<uint32_t *>(this->dirty.map());
+    for (uint32_t z = first[2]; z <= last[2]; ++z) {
+        for (uint32_t y = first[1]; y <= last[1]; ++y) {
+            for (uint32_t x = first[0]; x <= last[0]; ++x) {
+                flags[(z * this->brickGrid[1] + y) * this->brickGrid[0] + x] = 1;
+            }
+        }
+    }
+}
+
+inline uint32_t DirtyBricks::getDirtyBrickCount() {
+    const uint32_t *flags = static_cast<const uint32_t *>(this->dirty.map());
+    return uint32_t(std::count_if(flags, flags + getBrickCount(), [](uint32_t flag) {return flag != 0;}));
+}
+
+/*
+Mark the bricks where current differs from the snapshot and update the
+snapshot, in a sequence that has been begun.
+*/
+inline void DirtyBricks::recordDiff(CommandSequence *commandSequence, ComputeBuffer *current) {
+    BrickDiffPushConstants parameters;
+    for (int axis = 0; axis < 3; ++axis) {
+        parameters.dimensions[axis] = this->dimensions[axis];
+    }
+    parameters.brickSize = this->brickSize;
+    parameters.voxelsPerWord = 4 / this->voxelBytes;
+    parameters.wordCount = uint32_t(this->snapshot.getSize() / 4);
+    this->diffPipeline.bindBuffer(0, current);
+    this->diffPipeline.recordLinear(commandSequence->getCommandBuffer(), parameters.wordCount, 64, &parameters);
+    commandSequence->barrier();
+}
+
+/*
+Grow the dirty bricks by radius voxels (per axis) and compact them into
+the active brick list, with groupsPerBrick consumer workgroups each.
+*/
+inline void DirtyBricks::recordGrow(CommandSequence *commandSequence, const uint32_t radius[3],
+                                    uint32_t groupsPerBrick) {
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    BrickGrowPushConstants growConstants;
+    for (int axis = 0; axis < 3; ++axis) {
+        growConstants.brickGrid[axis] = this->brickGrid[axis];
+        growConstants.brickRadius[axis] = groupCount(radius[axis], this->brickSize);
+    }
+    growConstants.brickCount = getBrickCount();
+    this->growPipeline.record(commandBuffer, groupCount(growConstants.brickCount, 64), 1, 1, &growConstants);
+    commandSequence->barrier();
+    recordBrickCompaction(this->deviceQueue, commandSequence, &(this->compactPipeline), &(this->indirectArguments),
+                          getBrickCount(), groupsPerBrick);
+}
+
+/* Everything downstream is up to date */
+inline void DirtyBricks::recordClear(CommandSequence *commandSequence) {
+    commandSequence->fillBuffer(&(this->dirty), 0);
+    commandSequence->barrier();
+}
+
+/* Launch pipeline over the active bricks of the last recordGrow() */
+inline void DirtyBricks::dispatch(CommandSequence *commandSequence, ComputePipeline *pipeline,
+                                  const void *pushConstants, VkDescriptorSet descriptorSet) {
+    pipeline->recordIndirect(commandSequence->getCommandBuffer(), &(this->indirectArguments), 0,
+                             pushConstants, descriptorSet);
+}
+
+/* Valid once the sequence that recorded the growth has completed */
+inline uint32_t DirtyBricks::getActiveBrickCount() {
+    const uint32_t *arguments = static_cast<const uint32_t *>(this->indirectArguments.map());
+    return arguments[3];
+}
+
+inline double DirtyBricks::getSkippedFraction() {
+    return 1.0 - double(getActiveBrickCount()) / double(getBrickCount());
+}
+
+} // end of namespace vudo
+
+#endif
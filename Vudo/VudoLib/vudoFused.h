@@ -0,0 +1,80 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Runs the fused elementwise kernels that VudoLib/Arrays.py generates
+ * from VudoArray expressions.
+ */
+
+#ifndef __vudoFused_h
+#define __vudoFused_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* push constants of the generated fused shaders */
+struct FusedPushConstants {
+    uint32_t voxelCount;
+};
+
+/*
+One generated kernel.  Binding 0 holds its scalar operands as floats,
+binding 1 the output and bindings 2 and up the inputs, all read and
+written as 32 bit words.  Each invocation evaluates the voxels of one
+output word (4 uint8, 2 int16 or 1 float), so narrow outputs are packed
+without atomics.
+
+The source only depends on the shape of the expression, never on its
+scalar values, so a kernel is compiled once and rebound to new buffers
+for every evaluation.
+*/
+class FusedKernel : public ComputeAlgorithm {
+    protected:
+        uint32_t inputCount;
+        uint32_t voxelsPerWord;
+        FusedPushConstants parameters;
+
+        ComputePipeline pipeline;
+        CommandSequence commandSequence;
+
+    public:
+        FusedKernel(DeviceQueue *deviceQueue, uint32_t inputCount, uint32_t voxelsPerWord,
+                    const std::string &shaderPath)
+            : ComputeAlgorithm(deviceQueue),
+              pipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "fused", shaderPath),
+                       2 + inputCount, sizeof(FusedPushConstants), {}),
+              commandSequence(deviceQueue) {
+            this->inputCount = inputCount;
+            this->voxelsPerWord = voxelsPerWord;
+            this->parameters.voxelCount = 0;
+        }
+
+    uint32_t getInputCount() {return this->inputCount;};
+    uint32_t getVoxelsPerWord() {return this->voxelsPerWord;};
+
+    void bindScalars(ComputeBuffer *scalars) {this->pipeline.bindBuffer(0, scalars);};
+    void bindOutput(ComputeBuffer *output) {this->pipeline.bindBuffer(1, output);};
+    void bindInput(uint32_t index, ComputeBuffer *input) {
+        if (index >= this->inputCount) {
+            throw std::runtime_error("The fused kernel has only " + std::to_string(this->inputCount) + " inputs");
+        }
+        this->pipeline.bindBuffer(2 + index, input);
+    };
+
+    void run(uint32_t voxelCount);
+};
+
+inline void FusedKernel::run(uint32_t voxelCount) {
+    this->parameters.voxelCount = voxelCount;
+    uint64_t wordCount = (uint64_t(voxelCount) + this->voxelsPerWord - 1) / this->voxelsPerWord;
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->pipeline.recordLinear(commandBuffer, wordCount, 64, &(this->parameters));
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Histogram of a volume in its native type, the first kernel built
+ * from a template by the variant generator (vudoVariants.h).
+ */
+
+#ifndef __vudoHistogram_h
+#define __vudoHistogram_h
+
+#include "vudo.h"
+#include "vudoVariants.h"
+
+namespace vudo {
+
+/* push constants of histogram.comp.glsl */
+struct HistogramPushConstants {
+    uint32_t voxelCount;
+    uint32_t binCount;
+    float minimum;
+    float maximum;
+    uint32_t segmentMask;
+};
+
+/* option flags of histogram.comp.glsl, in variants.txt order */
+enum HistogramOption : uint32_t {
+    HistogramMasked = 1
+};
+
+/*
+Counts the voxels of getInput() into binCount (at most 256) equal bins
+over [minimum, maximum].  The input holds the voxels as stored, with
+the VTK scalar type chosen at construction, and with HistogramMasked
+only voxels whose packed segment word in getSegments() has a bit of the
+segment mask set are counted.  The variant comes from the dispatch
+table; the caller keeps it alive.
+*/
+class VolumeHistogram : public ComputeAlgorithm {
+    protected:
+        int32_t vtkScalarType;
+        uint32_t options;
+        HistogramPushConstants parameters;
+
+        ComputeBuffer input;
+        ComputeBuffer segments;
+        ComputeBuffer bins;
+        ComputePipeline pipeline;
+        CommandSequence commandSequence;
+
+    public:
+        static const uint32_t maximumBinCount = 256;
+
+        VolumeHistogram(DeviceQueue *deviceQueue, KernelVariants *variants, int32_t vtkScalarType,
+                        uint32_t voxelCount, uint32_t binCount, uint32_t options = 0)
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, inputBytes(vtkScalarType, voxelCount)),
+              segments(deviceQueue, (options & HistogramMasked) ? VkDeviceSize(4) * voxelCount : 4),
+              bins(deviceQueue, VkDeviceSize(4) * binCount),
+              pipeline(deviceQueue, variants->createShaderModule(deviceQueue->getDevice(), vtkScalarType, options),
+                       3, sizeof(HistogramPushConstants), {}),
+              commandSequence(deviceQueue) {
+            if (binCount == 0 || binCount > maximumBinCount) {
+                throw std::runtime_error("A histogram has 1 to 256 bins");
+            }
+            this->vtkScalarType = vtkScalarType;
+            this->options = options;
+            this->parameters.voxelCount = voxelCount;
+            this->parameters.binCount = binCount;
+            this->parameters.minimum = 0.f;
+            this->parameters.maximum = 1.f;
+            this->parameters.segmentMask = ~0u;
+            this->pipeline.bindBuffer(0, &(this->input));
+            this->pipeline.bindBuffer(1, &(this->bins));
+            this->pipeline.bindBuffer(2, &(this->segments));
+        }
+
+    // the stored voxels in whole 32 bit words
+    static VkDeviceSize inputBytes(int32_t vtkScalarType, uint32_t voxelCount) {
+        VkDeviceSize voxelBytes = vtkScalarType == VTKUnsignedChar ? 1 : vtkScalarType == VTKFloat ? 4 : 2;
+        return (voxelBytes * voxelCount + 3) & ~VkDeviceSize(3);
+    };
+
+    int32_t getScalarType() {return this->vtkScalarType;};
+    uint32_t getOptions() {return this->options;};
+    uint32_t getVoxelCount() {return this->parameters.voxelCount;};
+    uint32_t getBinCount() {return this->parameters.binCount;};
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getSegments() {return &(this->segments);};
+    ComputeBuffer *getBins() {return &(this->bins);};
+
+    void setRange(float minimum, float maximum) {
+        this->parameters.minimum = minimum;
+        this->parameters.maximum = maximum;
+    };
+    void setSegmentMask(uint32_t segmentMask) {this->parameters.segmentMask = segmentMask;};
+
+    void run();
+};
+
+inline void VolumeHistogram::run() {
+    // a few workgroups per compute unit is plenty, each loops over its share
+    uint32_t workgroups = std::min(groupCount(this->parameters.voxelCount, 256), 1024u);
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->commandSequence.fillBuffer(&(this->bins), 0);
+    this->commandSequence.barrier();
+    this->pipeline.record(commandBuffer, std::max(workgroups, 1u), 1, 1, &(this->parameters));
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Uploads from host memory: numpy and vtkDataArray memory imported as
+ * device memory with VK_EXT_external_memory_host, or copied through a
+ * staging buffer where that is not possible.
+ */
+
+#ifndef __vudoHostMemory_h
+#define __vudoHostMemory_h
+
+#include "vudo.h"
+
+#include <algorithm>
+
+namespace vudo {
+
+/*
+A storage buffer with the size bytes of host memory at data.
+
+When the device has VK_EXT_external_memory_host and data is aligned to
+the device's getHostPointerAlignment(), the host allocation itself
+becomes the memory of the buffer: shaders read it in place and nothing
+is copied.  The host memory must then outlive the buffer.  The import
+covers size rounded up to the alignment, so page aligned arrays whose
+last page is mapped are importable.
+
+Otherwise the bytes go into device local memory through a host visible
+staging buffer of at most stagingBytes, in two halves so that copying
+one chunk on the host overlaps transferring the previous one.  The host
+memory can be released as soon as the constructor returns.
+
+Either way the buffer is an input: writes by shaders reach the host
+memory only when isImported().
+*/
+class HostMemoryBuffer : public ComputeBuffer {
+    protected:
+        bool imported = false;
+
+    public:
+        HostMemoryBuffer(DeviceQueue *deviceQueue, void *data, VkDeviceSize size,
+                         bool allowImport = true, VkDeviceSize stagingBytes = 64 << 20)
+            : ComputeBuffer(deviceQueue) {
+            this->size = size > 0 ? size : 4;
+            if (allowImport && size > 0) {
+                this->imported = import(data);
+            }
+            if (!this->imported) {
+                stage(data, size, stagingBytes);
+            }
+        }
+
+    bool isImported() {return this->imported;};
+
+    static VkBufferUsageFlags usage() {
+        return VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    };
+
+    protected:
+        bool import(void *data);
+        void stage(const void *data, VkDeviceSize size, VkDeviceSize stagingBytes);
+};
+
+/* False, with nothing allocated, when the device will not import data */
+#ifdef VK_EXT_external_memory_host
+inline bool HostMemoryBuffer::import(void *data) {
+    uint32_t pointerMemoryTypeBits = this->deviceQueue->getHostPointerMemoryTypeBits(data);
+    if (pointerMemoryTypeBits == 0) {
+        return false;
+    }
+    VkDevice device = this->deviceQueue->getDevice();
+    VkDeviceSize alignment = this->deviceQueue->getHostPointerAlignment();
+
+    VkExternalMemoryBufferCreateInfo externalCreateInfo = {};
+    externalCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+    externalCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    VkBufferCreateInfo bufferCreateInfo = {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.pNext = &externalCreateInfo;
+    bufferCreateInfo.size = this->size;
+    bufferCreateInfo.usage = usage();
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device, &bufferCreateInfo, NULL, &(this->buffer)) != VK_SUCCESS) {
+        this->buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, this->buffer, &memoryRequirements);
+    uint32_t memoryType = this->deviceQueue->findMemoryType(
+        memoryRequirements.memoryTypeBits & pointerMemoryTypeBits, 0);
+    if (memoryType == uint32_t(-1)) {
+        release();
+        return false;
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo = {};
+    importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = data;
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.pNext = &importInfo;
+    VkDeviceSize importSize = std::max(this->size, memoryRequirements.size);
+    allocateInfo.allocationSize = (importSize + alignment - 1) / alignment * alignment;
+    allocateInfo.memoryTypeIndex = memoryType;
+    if (vkAllocateMemory(device, &allocateInfo, NULL, &(this->memory)) != VK_SUCCESS) {
+        this->memory = VK_NULL_HANDLE;
+        release();
+        return false;
+    }
+    if (vkBindBufferMemory(device, this->buffer, this->memory, 0) != VK_SUCCESS) {
+        release();
+        return false;
+    }
+    return true;
+}
+#else
+inline bool HostMemoryBuffer::import(void *) {
+    return false;
+}
+#endif
+
+inline void HostMemoryBuffer::stage(const void *data, VkDeviceSize size, VkDeviceSize stagingBytes) {
+    this->memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    allocate(usage());
+    if (size == 0) {
+        return;
+    }
+
+    VkDeviceSize chunk = std::min(std::max(stagingBytes / 2, VkDeviceSize(4)), size);
+    ComputeBuffer staging(this->deviceQueue, 2 * chunk,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    CommandSequence first(this->deviceQueue), second(this->deviceQueue);
+    CommandSequence *commandSequences[2] = {&first, &second};
+    char *mapped = (char *)staging.map();
+
+    uint32_t half = 0;
+    for (VkDeviceSize offset = 0; offset < size; offset += chunk, half ^= 1) {
+        VkDeviceSize bytes = std::min(chunk, size - offset);
+        CommandSequence *commandSequence = commandSequences[half];
+        // the transfer out of this half, two chunks ago, has to be done
+        commandSequence->wait();
+        memcpy(mapped + half * chunk, (const char *)data + offset, bytes);
+        commandSequence->begin();
+        commandSequence->copyBuffer(&staging, this, bytes, half * chunk, offset);
+        commandSequence->barrier();
+        commandSequence->submit();
+    }
+    first.wait();
+    second.wait();
+}
+
+} // end of namespace vudo
+
+#endif
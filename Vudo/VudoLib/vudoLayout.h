@@ -0,0 +1,131 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Storage layouts of device volumes: linear, 8^3 bricks, and Morton
+ * order inside 32^3 tiles, with the kernels that convert between the
+ * linear host layout and the others.  Shaders address the layouts
+ * through Shaders/layout.glsl.
+ */
+
+#ifndef __vudoLayout_h
+#define __vudoLayout_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* the constants of layout.glsl */
+enum VolumeLayout : uint32_t {
+    LinearLayout = 0,
+    BrickedLayout = 1,
+    MortonLayout = 2
+};
+
+/* push constants of layout.comp.glsl */
+struct LayoutPushConstants {
+    uint32_t dimensions[3];
+};
+
+/* Voxels stored for a width x height x depth volume, padding included */
+inline VkDeviceSize layoutVoxelCount(VolumeLayout layout, uint32_t width, uint32_t height, uint32_t depth) {
+    uint32_t block = layout == BrickedLayout ? 8 : layout == MortonLayout ? 32 : 1;
+    return VkDeviceSize(groupCount(width, block) * block) * (groupCount(height, block) * block)
+           * (groupCount(depth, block) * block);
+}
+
+/* A buffer of 32 bit voxels in a layout */
+class VolumeBuffer : public ComputeBuffer {
+    protected:
+        VolumeLayout layout;
+        uint32_t dimensions[3];
+
+    public:
+        VolumeBuffer(DeviceQueue *deviceQueue, VolumeLayout layout, uint32_t width, uint32_t height, uint32_t depth,
+                     VkMemoryPropertyFlags memoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+            : ComputeBuffer(deviceQueue, 4 * layoutVoxelCount(layout, width, height, depth), memoryProperties) {
+            this->layout = layout;
+            this->dimensions[0] = width;
+            this->dimensions[1] = height;
+            this->dimensions[2] = depth;
+        }
+
+    VolumeLayout getLayout() {return this->layout;};
+    uint32_t getDimension(uint32_t axis) {return this->dimensions[axis];};
+};
+
+/*
+Records the swizzle of a linear volume into a layout and the unswizzle
+back, one pipeline per layout and direction, built on first use.  The
+buffers are bound when recording, so one converter serves any volumes
+of its dimensions, but a command buffer (until it completes) can hold
+only one swizzle and one unswizzle per layout.
+*/
+class LayoutConverter : public ComputeAlgorithm {
+    protected:
+        LayoutPushConstants parameters;
+        std::string shaderPath;
+        // [layout][direction]
+        ComputePipeline *pipelines[3][2] = {{nullptr, nullptr}, {nullptr, nullptr}, {nullptr, nullptr}};
+
+    public:
+        LayoutConverter(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                        const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue) {
+            this->parameters.dimensions[0] = width;
+            this->parameters.dimensions[1] = height;
+            this->parameters.dimensions[2] = depth;
+            this->shaderPath = shaderPath;
+        }
+
+        virtual ~LayoutConverter() {
+            for (auto &layoutPipelines : this->pipelines) {
+                for (ComputePipeline *pipeline : layoutPipelines) {
+                    delete pipeline;
+                }
+            }
+        }
+
+    // both end with a barrier
+    void recordSwizzle(CommandSequence *commandSequence, ComputeBuffer *linear, ComputeBuffer *swizzled, VolumeLayout layout) {
+        record(commandSequence, linear, swizzled, layout, 0);
+    };
+    void recordUnswizzle(CommandSequence *commandSequence, ComputeBuffer *swizzled, ComputeBuffer *linear, VolumeLayout layout) {
+        record(commandSequence, swizzled, linear, layout, 1);
+    };
+
+    protected:
+        void record(CommandSequence *commandSequence, ComputeBuffer *input, ComputeBuffer *output,
+                    VolumeLayout layout, uint32_t direction);
+};
+
+inline void LayoutConverter::record(CommandSequence *commandSequence, ComputeBuffer *input, ComputeBuffer *output,
+                                    VolumeLayout layout, uint32_t direction) {
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    if (layout == LinearLayout) {
+        VkDeviceSize size = 4 * layoutVoxelCount(LinearLayout, this->parameters.dimensions[0],
+                                                 this->parameters.dimensions[1], this->parameters.dimensions[2]);
+        commandSequence->copyBuffer(input, output, size);
+        commandSequence->barrier();
+        return;
+    }
+    ComputePipeline *&pipeline = this->pipelines[layout][direction];
+    if (pipeline == nullptr) {
+        pipeline = new ComputePipeline(this->deviceQueue,
+            createShaderModule(this->deviceQueue->getDevice(), "layout", this->shaderPath),
+            2, sizeof(LayoutPushConstants), {layout, direction});
+    }
+    pipeline->bindBuffer(0, input);
+    pipeline->bindBuffer(1, output);
+    pipeline->record(commandBuffer,
+                     groupCount(this->parameters.dimensions[0], 8),
+                     groupCount(this->parameters.dimensions[1], 8),
+                     groupCount(this->parameters.dimensions[2], 4),
+                     &(this->parameters));
+    commandSequence->barrier();
+}
+
+} // end of namespace vudo
+
+#endif
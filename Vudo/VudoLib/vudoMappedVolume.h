@@ -0,0 +1,360 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Out-of-core volume source: raw and uncompressed NRRD files larger than
+ * host memory are memory mapped and paged in ahead of their consumer.
+ */
+
+#ifndef __vudoMappedVolume_h
+#define __vudoMappedVolume_h
+
+#include "vudo.h"
+#include "vudoVolumeFile.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+// keep windows.h from defining min and max macros, which break std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vudo {
+
+/* the VolumeFileInfo of a headerless raw file, voxels starting at dataOffset */
+inline VolumeFileInfo rawVolumeInfo(const std::string &path, uint32_t width, uint32_t height, uint32_t depth,
+                                    ScalarType scalarType, uint64_t dataOffset = 0, bool bigEndian = false) {
+    VolumeFileInfo info;
+    info.dimensions[0] = width;
+    info.dimensions[1] = height;
+    info.dimensions[2] = depth;
+    info.scalarType = scalarType;
+    info.dataPath = path;
+    info.dataOffset = dataOffset;
+    info.bigEndian = bigEndian;
+    return info;
+}
+
+/*
+A volume file mapped read only, as a VolumeSource for SlabPipeline and
+for random access to regions (readRegion).
+
+Slices are read front to back, so the mapping is advised sequential and
+a prefetch thread keeps the prefetchBytes after the last read paged in
+(madvise WILLNEED, then touching each page) while the caller uploads
+and computes the slices it has.  Slices before the last read's first
+slice are released (MADV_DONTNEED), so the pages the process holds stay
+about prefetchBytes plus a slab, whatever the size of the file.  On
+Windows the thread touches the pages and released ones are trimmed from
+the working set.
+
+getMaxWindowBytes() is the most the window ever held; getStalledSlices()
+counts slices read before the prefetcher reached them, i.e. where the
+disk could not keep up.
+*/
+class MappedVolume : public VolumeSource {
+    protected:
+        VolumeFileInfo info;
+        uint8_t *mapping = nullptr; // page aligned
+        uint64_t mappingSize = 0;
+        const uint8_t *voxels = nullptr; // first voxel, inside mapping
+        uint64_t pageSize = 4096;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE fileMapping = NULL;
+#endif
+
+        uint32_t windowSlices;
+        std::thread prefetcher;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        uint32_t prefetchCursor = 0; // next slice to page in
+        uint32_t prefetchEnd = 0; // end of the window
+        uint32_t releasedEnd = 0; // slices before it are released
+
+        // statistics
+        uint64_t prefetchedBytes = 0;
+        uint64_t releasedBytes = 0;
+        uint64_t maxWindowBytes = 0;
+        uint32_t stalledSlices = 0;
+        double copySeconds = 0.;
+
+    public:
+        // a NRRD or NIfTI file with uncompressed data, see VolumeFileReader
+        MappedVolume(const std::string &path, uint64_t prefetchBytes = 256ull << 20)
+            : MappedVolume(VolumeFileReader(path).getInfo(), prefetchBytes) {
+        }
+
+        // any file described by info, e.g. rawVolumeInfo()
+        MappedVolume(const VolumeFileInfo &info, uint64_t prefetchBytes = 256ull << 20) {
+            this->info = info;
+            uint64_t sliceBytes = info.getSliceBytes();
+            if (sliceBytes == 0 || info.dimensions[2] == 0) {
+                throw std::runtime_error("mapping an empty volume: " + info.dataPath);
+            }
+            this->windowSlices = uint32_t(std::max<uint64_t>(1, std::min<uint64_t>(prefetchBytes / sliceBytes,
+                                                                                    info.dimensions[2])));
+            map();
+            this->prefetchEnd = this->windowSlices; // the first slices are read before anything else
+            this->prefetcher = std::thread(&MappedVolume::prefetch, this);
+        }
+
+        virtual ~MappedVolume() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            this->wake.notify_all();
+            if (this->prefetcher.joinable()) {
+                this->prefetcher.join();
+            }
+            unmap();
+        }
+
+    const VolumeFileInfo &getInfo() override {return this->info;};
+    uint32_t getWindowSlices() {return this->windowSlices;};
+
+    void readSlices(uint32_t firstSlice, uint32_t sliceCount, void *voxels) override;
+    // the voxels of a box of size voxels from origin (i, j, k), packed x fastest
+    void readRegion(const uint32_t origin[3], const uint32_t size[3], void *voxels);
+
+    // the statistics are updated by the prefetch thread and readSlices(), under mutex
+    uint64_t getPrefetchedBytes() {std::lock_guard<std::mutex> lock(this->mutex); return this->prefetchedBytes;};
+    uint64_t getReleasedBytes() {std::lock_guard<std::mutex> lock(this->mutex); return this->releasedBytes;};
+    uint64_t getMaxWindowBytes() {std::lock_guard<std::mutex> lock(this->mutex); return this->maxWindowBytes;};
+    uint32_t getStalledSlices() {std::lock_guard<std::mutex> lock(this->mutex); return this->stalledSlices;};
+    // time spent copying out of the mapping, including the page faults of stalled slices
+    double getCopySeconds() {std::lock_guard<std::mutex> lock(this->mutex); return this->copySeconds;};
+
+    protected:
+        void map();
+        void unmap();
+        void prefetch();
+        // the whole pages of slices [first, end), rounded outward or inward
+        void slicePages(uint32_t first, uint32_t end, bool outward, uint8_t *&begin, uint64_t &length);
+        void advise(uint32_t first, uint32_t end, bool willNeed);
+        void copyOut(const uint8_t *source, void *destination, uint64_t bytes);
+};
+
+inline void MappedVolume::map() {
+    uint64_t volumeBytes = this->info.getVolumeBytes();
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    this->pageSize = systemInfo.dwPageSize;
+    uint64_t granularity = systemInfo.dwAllocationGranularity;
+#else
+    this->pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+    uint64_t granularity = this->pageSize;
+#endif
+    uint64_t mappingOffset = this->info.dataOffset - this->info.dataOffset % granularity;
+    this->mappingSize = this->info.dataOffset - mappingOffset + volumeBytes;
+#ifdef _WIN32
+    this->file = CreateFileA(this->info.dataPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (this->file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not find or open file: " + this->info.dataPath);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(this->file, &fileSize)) {
+        unmap();
+        throw std::runtime_error("Could not get the size of file: " + this->info.dataPath);
+    }
+    if (uint64_t(fileSize.QuadPart) < this->info.dataOffset + volumeBytes) {
+        unmap();
+        throw std::runtime_error("file is shorter than its volume: " + this->info.dataPath);
+    }
+    this->fileMapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (this->fileMapping != NULL) {
+        this->mapping = static_cast<uint8_t *>(MapViewOfFile(this->fileMapping, FILE_MAP_READ,
+                                                             DWORD(mappingOffset >> 32), DWORD(mappingOffset),
+                                                             SIZE_T(this->mappingSize)));
+    }
+    if (this->mapping == nullptr) {
+        unmap();
+        throw std::runtime_error("Could not map file: " + this->info.dataPath);
+    }
+#else
+    int descriptor = open(this->info.dataPath.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("Could not find or open file: " + this->info.dataPath);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || uint64_t(status.st_size) < this->info.dataOffset + volumeBytes) {
+        close(descriptor);
+        throw std::runtime_error("file is shorter than its volume: " + this->info.dataPath);
+    }
+    void *address = mmap(nullptr, this->mappingSize, PROT_READ, MAP_PRIVATE, descriptor, (off_t)mappingOffset);
+    close(descriptor); // the mapping keeps the file alive
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Could not map file: " + this->info.dataPath);
+    }
+    this->mapping = static_cast<uint8_t *>(address);
+    madvise(address, this->mappingSize, MADV_SEQUENTIAL);
+#endif
+    this->voxels = this->mapping + (this->info.dataOffset - mappingOffset);
+}
+
+inline void MappedVolume::unmap() {
+#ifdef _WIN32
+    if (this->mapping != nullptr) {
+        UnmapViewOfFile(this->mapping);
+    }
+    if (this->fileMapping != NULL) {
+        CloseHandle(this->fileMapping);
+        this->fileMapping = NULL;
+    }
+    if (this->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (this->mapping != nullptr) {
+        munmap(this->mapping, this->mappingSize);
+    }
+#endif
+    this->mapping = nullptr;
+    this->voxels = nullptr;
+    this->mappingSize = 0;
+}
+
+inline void MappedVolume::slicePages(uint32_t first, uint32_t end, bool outward, uint8_t *&begin, uint64_t &length) {
+    uint64_t sliceBytes = this->info.getSliceBytes();
+    uint64_t start = uint64_t(this->voxels - this->mapping) + sliceBytes * first;
+    uint64_t stop = uint64_t(this->voxels - this->mapping) + sliceBytes * end;
+    if (outward) {
+        start -= start % this->pageSize;
+        stop = std::min(this->mappingSize, (stop + this->pageSize - 1) / this->pageSize * this->pageSize);
+    } else {
+        start = (start + this->pageSize - 1) / this->pageSize * this->pageSize;
+        stop -= stop % this->pageSize;
+    }
+    begin = this->mapping + start;
+    length = stop > start ? stop - start : 0;
+}
+
+/* page in (willNeed) or give back the pages of slices [first, end) */
+inline void MappedVolume::advise(uint32_t first, uint32_t end, bool willNeed) {
+    uint8_t *begin;
+    uint64_t length;
+    slicePages(first, end, willNeed, begin, length);
+    if (length == 0) {
+        return;
+    }
+    if (willNeed) {
+#ifndef _WIN32
+        madvise(begin, length, MADV_WILLNEED);
+#endif
+        // the advice only starts the reads, touching waits for them here rather than in the consumer
+        volatile uint8_t sink = 0;
+        for (uint64_t offset = 0; offset < length; offset += this->pageSize) {
+            sink ^= begin[offset];
+        }
+        (void)sink;
+    } else {
+#ifdef _WIN32
+        VirtualUnlock(begin, SIZE_T(length));
+#else
+        madvise(begin, length, MADV_DONTNEED);
+#endif
+    }
+}
+
+/* the prefetch thread: page in the window a slice at a time, following the consumer */
+inline void MappedVolume::prefetch() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wake.wait(lock, [this]() {return this->stopping || this->prefetchCursor < this->prefetchEnd;});
+        if (this->stopping) {
+            return;
+        }
+        uint32_t slice = this->prefetchCursor++;
+        lock.unlock();
+        advise(slice, slice + 1, true);
+        lock.lock();
+        this->prefetchedBytes += this->info.getSliceBytes();
+    }
+}
+
+inline void MappedVolume::copyOut(const uint8_t *source, void *destination, uint64_t bytes) {
+    memcpy(destination, source, bytes);
+    uint32_t voxelBytes = scalarTypeSize(this->info.scalarType);
+    if (voxelBytes > 1 && this->info.bigEndian != hostIsBigEndian()) {
+        swapBytes(destination, voxelBytes, bytes / voxelBytes);
+    }
+}
+
+inline void MappedVolume::readSlices(uint32_t firstSlice, uint32_t sliceCount, void *voxels) {
+    uint32_t depth = this->info.dimensions[2];
+    if (uint64_t(firstSlice) + sliceCount > depth) {
+        throw std::runtime_error("reading past the last slice of " + this->info.dataPath);
+    }
+    uint64_t sliceBytes = this->info.getSliceBytes();
+    uint32_t readEnd = firstSlice + sliceCount;
+    uint32_t releaseFrom, releaseTo;
+    {
+        // move the window past this read, and give back what is before it
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->prefetchCursor < readEnd) {
+            this->stalledSlices += readEnd - std::max(firstSlice, this->prefetchCursor);
+        }
+        if (this->prefetchCursor < readEnd || this->prefetchCursor > this->prefetchEnd) {
+            this->prefetchCursor = readEnd;
+        }
+        this->prefetchEnd = std::min(depth, readEnd + this->windowSlices);
+        releaseFrom = this->releasedEnd;
+        releaseTo = std::max(this->releasedEnd, firstSlice);
+        this->releasedEnd = releaseTo;
+        this->releasedBytes += sliceBytes * (releaseTo - releaseFrom);
+        this->maxWindowBytes = std::max(this->maxWindowBytes,
+                                        sliceBytes * (this->prefetchEnd - std::min(firstSlice, this->releasedEnd)));
+    }
+    this->wake.notify_one();
+    if (releaseTo > releaseFrom) {
+        advise(releaseFrom, releaseTo, false);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    copyOut(this->voxels + sliceBytes * firstSlice, voxels, sliceBytes * sliceCount);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->copySeconds += seconds;
+}
+
+inline void MappedVolume::readRegion(const uint32_t origin[3], const uint32_t size[3], void *voxels) {
+    for (int axis = 0; axis < 3; ++axis) {
+        if (uint64_t(origin[axis]) + size[axis] > this->info.dimensions[axis]) {
+            throw std::runtime_error("region is outside the volume of " + this->info.dataPath);
+        }
+    }
+    uint64_t voxelBytes = scalarTypeSize(this->info.scalarType);
+    uint64_t rowBytes = voxelBytes * size[0];
+    uint8_t *destination = static_cast<uint8_t *>(voxels);
+    for (uint32_t k = 0; k < size[2]; ++k) {
+        for (uint32_t j = 0; j < size[1]; ++j) {
+            uint64_t voxel = (uint64_t(origin[2] + k) * this->info.dimensions[1] + origin[1] + j)
+                             * this->info.dimensions[0] + origin[0];
+            copyOut(this->voxels + voxelBytes * voxel, destination, rowBytes);
+            destination += rowBytes;
+        }
+    }
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Marching cubes surfaces of volumes and labelmaps.
+ *
+ * Classification, compaction of the active cells, vertex welding and
+ * triangle emission all run on the device (marchingCubes.comp.glsl with
+ * ExclusiveScan in between); only the final points, normals and
+ * triangle indices are read back, ready for a vtkPolyData.
+ */
+
+#ifndef __vudoMarchingCubes_h
+#define __vudoMarchingCubes_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoScan.h"
+
+#include <algorithm>
+
+namespace vudo {
+
+/* push constants of marchingCubes.comp.glsl (std430 packs the uvec3 with the float after it) */
+struct MarchingCubesPushConstants {
+    uint32_t dimensions[3];
+    float isovalue;
+    uint32_t labelMode;
+    uint32_t activeCapacity;
+    uint32_t vertexCapacity;
+    uint32_t triangleCapacity;
+};
+
+/*
+Cube corner c is at (c & 1, (c >> 1) & 1, c >> 2).  Edge e runs along
+axis e / 4 from the corner returned here, the other two bits of which
+are e % 4 (axis + 1 first).  The shader's edgeStart() matches.
+*/
+inline uint32_t marchingCubesEdgeStart(uint32_t edge) {
+    uint32_t axis = edge / 4;
+    uint32_t side = edge % 4;
+    return ((side & 1) << ((axis + 1) % 3)) | ((side >> 1) << ((axis + 2) % 3));
+}
+
+/* The edge between two corners differing in one bit */
+inline uint32_t marchingCubesEdge(uint32_t cornerA, uint32_t cornerB) {
+    uint32_t axis = (cornerA ^ cornerB) == 1 ? 0 : (cornerA ^ cornerB) == 2 ? 1 : 2;
+    uint32_t start = std::min(cornerA, cornerB);
+    return 4 * axis + ((start >> ((axis + 1) % 3)) & 1) + 2 * ((start >> ((axis + 2) % 3)) & 1);
+}
+
+inline bool marchingCubesEdgesShareFace(uint32_t edgeA, uint32_t edgeB) {
+    uint32_t startA = marchingCubesEdgeStart(edgeA);
+    uint32_t startB = marchingCubesEdgeStart(edgeB);
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        if (axis != edgeA / 4 && axis != edgeB / 4 && ((startA >> axis) & 1) == ((startB >> axis) & 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+The triangle table, 16 entries per case (bit c set when corner c is
+inside): the triangle count, then up to five triangles of edge numbers.
+
+Rather than a transcribed table it is built from the faces.  On each face
+the crossings are joined so that the inside corners are separated, which
+depends on the face alone, so neighbouring cells always agree and the
+surface is closed.  Oriented around the inside region, the face segments
+chain into polygons, which are triangulated without a diagonal lying on
+a cube face (a neighbour could have the same one) and wound so that the
+normals point out.
+*/
+inline std::vector<uint32_t> marchingCubesTriangleTable() {
+    std::vector<uint32_t> table(256 * 16, 0);
+    for (uint32_t cube = 0; cube < 256; ++cube) {
+        auto isInside = [cube](uint32_t corner) {return ((cube >> corner) & 1) != 0;};
+
+        // next[a] = b for the segment from crossing a to crossing b
+        int next[12];
+        std::fill(next, next + 12, -1);
+        for (uint32_t axis = 0; axis < 3; ++axis) {
+            uint32_t u = (axis + 1) % 3;
+            uint32_t v = (axis + 2) % 3;
+            for (uint32_t side = 0; side < 2; ++side) {
+                // corners counterclockwise seen from outside the cube
+                const uint32_t square[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+                uint32_t corners[4];
+                for (int i = 0; i < 4; ++i) {
+                    const uint32_t *uv = square[side == 1 ? i : 3 - i];
+                    corners[i] = (side << axis) | (uv[0] << u) | (uv[1] << v);
+                }
+                auto corner = [&corners](int i) {return corners[(i + 4) % 4];};
+                auto entering = [&](int i) {return !isInside(corner(i)) && isInside(corner(i + 1));};
+                // from where the boundary leaves the inside back to where it entered
+                for (int i = 0; i < 4; ++i) {
+                    if (isInside(corner(i)) && !isInside(corner(i + 1))) {
+                        int j = i - 1;
+                        while (!entering(j)) {
+                            --j;
+                        }
+                        next[marchingCubesEdge(corner(i), corner(i + 1))] = marchingCubesEdge(corner(j), corner(j + 1));
+                    }
+                }
+            }
+        }
+
+        uint32_t *entry = &table[16 * cube];
+        bool visited[12] = {};
+        for (int edge = 0; edge < 12; ++edge) {
+            if (next[edge] < 0 || visited[edge]) {
+                continue;
+            }
+            std::vector<uint32_t> polygon;
+            for (int crossing = edge; !visited[crossing]; crossing = next[crossing]) {
+                visited[crossing] = true;
+                polygon.push_back(crossing);
+            }
+            // clip ears, preferring those whose new diagonal is not on a face
+            while (polygon.size() >= 3) {
+                size_t count = polygon.size();
+                size_t ear = 0;
+                for (size_t i = 0; i < count && count > 3; ++i) {
+                    if (!marchingCubesEdgesShareFace(polygon[(i + count - 1) % count], polygon[(i + 1) % count])) {
+                        ear = i;
+                        break;
+                    }
+                }
+                uint32_t *triangle = entry + 1 + 3 * entry[0];
+                triangle[0] = polygon[(ear + count - 1) % count];
+                triangle[1] = polygon[(ear + 1) % count];
+                triangle[2] = polygon[ear];
+                entry[0]++;
+                polygon.erase(polygon.begin() + ear);
+                if (count == 3) {
+                    break;
+                }
+            }
+        }
+    }
+    return table;
+}
+
+/*
+Fill getInput() with the volume in its native type, choose setIsovalue()
+or setLabel(), and run().  getPoints() then holds getPointCount() IJK
+points, getNormals() their unit normals and getIndices() the three point
+indices of each of getTriangleCount() triangles.
+
+The buffers between the passes are sized for a number of active cells
+(voxels with triangles or vertices); when a surface needs more, the
+buffers grow and the passes run again, so later runs of similar
+surfaces take one submission.
+*/
+class MarchingCubes : public ComputeAlgorithm {
+    protected:
+        enum Pass {Classify = 0, Compact, Arguments, Vertices, Triangles, PassCount};
+
+        ScalarType inputType;
+        uint32_t voxelCount;
+        MarchingCubesPushConstants parameters;
+        std::string scanShaderPath;
+
+        ComputeBuffer input;
+        ComputeBuffer triangleTable;
+        ComputeBuffer cases;
+        ComputeBuffer activeOffsets;
+        ComputeBuffer counts; // active, vertex, triangle totals, padding and a VkDispatchIndirectCommand
+        ExclusiveScan voxelScan;
+        CommandSequence commandSequence;
+        std::vector<ComputePipeline *> passes;
+
+        // sized by the capacities
+        ComputeBuffer *activeVoxels = nullptr;
+        ComputeBuffer *vertexOffsets = nullptr;
+        ComputeBuffer *triangleOffsets = nullptr;
+        ComputeBuffer *points = nullptr;
+        ComputeBuffer *normals = nullptr;
+        ComputeBuffer *indices = nullptr;
+        ExclusiveScan *activeScan = nullptr;
+
+    public:
+        // activeCapacity 0 starts with a sixteenth of the voxels
+        MarchingCubes(DeviceQueue *deviceQueue, ScalarType inputType,
+                      uint32_t width, uint32_t height, uint32_t depth, uint32_t activeCapacity = 0,
+                      const std::string &shaderPath = "", const std::string &scanShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, (VkDeviceSize(scalarTypeSize(inputType)) * width * height * depth + 3) & ~VkDeviceSize(3)),
+              triangleTable(deviceQueue, sizeof(uint32_t) * 256 * 16),
+              cases(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              activeOffsets(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              counts(deviceQueue, 8 * sizeof(uint32_t),
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT),
+              voxelScan(deviceQueue, width * height * depth, scanShaderPath),
+              commandSequence(deviceQueue) {
+            this->inputType = inputType;
+            this->voxelCount = width * height * depth;
+            this->scanShaderPath = scanShaderPath;
+            this->parameters.dimensions[0] = width;
+            this->parameters.dimensions[1] = height;
+            this->parameters.dimensions[2] = depth;
+            this->parameters.isovalue = 0.5f;
+            this->parameters.labelMode = 0;
+
+            std::vector<uint32_t> table = marchingCubesTriangleTable();
+            memcpy(this->triangleTable.map(), table.data(), sizeof(uint32_t) * table.size());
+
+            for (uint32_t pass = 0; pass < PassCount; ++pass) {
+                std::vector<uint32_t> specialization = {pass, inputType};
+                ComputePipeline *pipeline = new ComputePipeline(deviceQueue,
+                    createShaderModule(deviceQueue->getDevice(), "marchingCubes", shaderPath),
+                    11, sizeof(MarchingCubesPushConstants), specialization);
+                pipeline->bindBuffer(0, &(this->input));
+                pipeline->bindBuffer(1, &(this->triangleTable));
+                pipeline->bindBuffer(2, &(this->cases));
+                pipeline->bindBuffer(3, &(this->activeOffsets));
+                pipeline->bindBuffer(10, &(this->counts));
+                this->passes.push_back(pipeline);
+            }
+            if (activeCapacity == 0) {
+                activeCapacity = std::max(this->voxelCount / 16, 4096u);
+            }
+            allocate(activeCapacity, activeCapacity, 2 * activeCapacity);
+        }
+
+        virtual ~MarchingCubes() {
+            this->commandSequence.wait();
+            for (ComputePipeline *pipeline : this->passes) {
+                delete pipeline;
+            }
+            release();
+        }
+
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getPoints() {return this->points;};
+    ComputeBuffer *getNormals() {return this->normals;};
+    ComputeBuffer *getIndices() {return this->indices;};
+
+    // the surface between voxels below and at or above isovalue
+    void setIsovalue(float isovalue) {
+        this->parameters.isovalue = isovalue;
+        this->parameters.labelMode = 0;
+    };
+    // the boundary of the voxels equal to label
+    void setLabel(uint32_t label) {
+        this->parameters.isovalue = (float)label;
+        this->parameters.labelMode = 1;
+    };
+
+    uint32_t getActiveCount() {return static_cast<const uint32_t *>(this->counts.map())[0];};
+    uint32_t getPointCount() {return static_cast<const uint32_t *>(this->counts.map())[1];};
+    uint32_t getTriangleCount() {return static_cast<const uint32_t *>(this->counts.map())[2];};
+    uint32_t getActiveCapacity() {return this->parameters.activeCapacity;};
+
+    void run();
+
+    protected:
+        void allocate(uint32_t activeCapacity, uint32_t vertexCapacity, uint32_t triangleCapacity);
+        void release();
+        void record();
+};
+
+inline void MarchingCubes::release() {
+    delete this->activeScan;
+    for (ComputeBuffer *buffer : {this->activeVoxels, this->vertexOffsets, this->triangleOffsets,
+                                  this->points, this->normals, this->indices}) {
+        delete buffer;
+    }
+}
+
+inline void MarchingCubes::allocate(uint32_t activeCapacity, uint32_t vertexCapacity, uint32_t triangleCapacity) {
+    DeviceQueue *deviceQueue = this->deviceQueue;
+    this->commandSequence.wait();
+    release();
+    this->parameters.activeCapacity = activeCapacity;
+    this->parameters.vertexCapacity = vertexCapacity;
+    this->parameters.triangleCapacity = triangleCapacity;
+    this->activeVoxels = new ComputeBuffer(deviceQueue, sizeof(uint32_t) * VkDeviceSize(activeCapacity),
+                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    this->vertexOffsets = new ComputeBuffer(deviceQueue, sizeof(uint32_t) * VkDeviceSize(activeCapacity),
+                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    this->triangleOffsets = new ComputeBuffer(deviceQueue, sizeof(uint32_t) * VkDeviceSize(activeCapacity),
+                                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    this->points = new ComputeBuffer(deviceQueue, 3 * sizeof(float) * VkDeviceSize(vertexCapacity));
+    this->normals = new ComputeBuffer(deviceQueue, 3 * sizeof(float) * VkDeviceSize(vertexCapacity));
+    this->indices = new ComputeBuffer(deviceQueue, 3 * sizeof(uint32_t) * VkDeviceSize(triangleCapacity));
+    this->activeScan = new ExclusiveScan(deviceQueue, activeCapacity, this->scanShaderPath);
+    for (ComputePipeline *pipeline : this->passes) {
+        pipeline->bindBuffer(4, this->activeVoxels);
+        pipeline->bindBuffer(5, this->vertexOffsets);
+        pipeline->bindBuffer(6, this->triangleOffsets);
+        pipeline->bindBuffer(7, this->points);
+        pipeline->bindBuffer(8, this->normals);
+        pipeline->bindBuffer(9, this->indices);
+    }
+}
+
+inline void MarchingCubes::record() {
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->passes[Classify]->recordLinear(commandBuffer, this->voxelCount, 64, &(this->parameters));
+    this->commandSequence.barrier();
+    this->voxelScan.record(&(this->commandSequence), &(this->activeOffsets), this->voxelCount, &(this->counts), 0);
+
+    // the counts past the active cells must scan as zero
+    this->commandSequence.fillBuffer(this->vertexOffsets, 0);
+    this->commandSequence.fillBuffer(this->triangleOffsets, 0);
+    this->commandSequence.barrier();
+    this->passes[Compact]->recordLinear(commandBuffer, this->voxelCount, 64, &(this->parameters));
+    this->commandSequence.barrier();
+    uint32_t activeCapacity = this->parameters.activeCapacity;
+    this->activeScan->record(&(this->commandSequence), this->vertexOffsets, activeCapacity,
+                             &(this->counts), sizeof(uint32_t));
+    this->activeScan->record(&(this->commandSequence), this->triangleOffsets, activeCapacity,
+                             &(this->counts), 2 * sizeof(uint32_t));
+
+    this->passes[Arguments]->record(commandBuffer, 1, 1, 1, &(this->parameters));
+    this->commandSequence.barrier();
+    this->passes[Vertices]->recordIndirect(commandBuffer, &(this->counts), 4 * sizeof(uint32_t), &(this->parameters));
+    this->passes[Triangles]->recordIndirect(commandBuffer, &(this->counts), 4 * sizeof(uint32_t), &(this->parameters));
+    this->commandSequence.barrier();
+}
+
+inline void MarchingCubes::run() {
+    while (true) {
+        record();
+        this->commandSequence.submitAndWait();
+        uint32_t active = getActiveCount();
+        uint32_t vertices = getPointCount();
+        uint32_t triangles = getTriangleCount();
+        if (active <= this->parameters.activeCapacity &&
+            vertices <= this->parameters.vertexCapacity &&
+            triangles <= this->parameters.triangleCapacity) {
+            return;
+        }
+        // totals past an active overflow undercount, so grow everything with some headroom
+        auto grow = [](uint32_t needed, uint32_t capacity) {
+            return needed <= capacity ? capacity : needed + needed / 8;
+        };
+        uint32_t activeCapacity = grow(active, this->parameters.activeCapacity);
+        allocate(activeCapacity,
+                 std::max(grow(vertices, this->parameters.vertexCapacity), activeCapacity),
+                 std::max(grow(triangles, this->parameters.triangleCapacity), 2 * activeCapacity));
+    }
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Erode, dilate, open and close for up to 32 binary segments at once.
+ *
+ * Segments are bit-packed, one uint32_t per voxel with a bit per segment,
+ * which is 8x less memory than a byte labelmap per segment and one pass
+ * for all of them instead of one per segment.
+ */
+
+#ifndef __vudoMorphology_h
+#define __vudoMorphology_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoDirtyBricks.h"
+
+#include <map>
+
+namespace vudo {
+
+enum MorphologyOperation : uint32_t {
+    ErodeOperation = 0,
+    DilateOperation = 1
+};
+
+enum StructuringElement : uint32_t {
+    BallElement = 0,
+    BoxElement = 1
+};
+
+/* push constants of morphology.comp.glsl */
+struct MorphologyPushConstants {
+    uint32_t dimensions[3];
+    uint32_t segmentMask;
+};
+
+/*
+Fill getInput() with the packed segments, run an operation and read
+getOutput().  Radii are in voxels per axis, so anisotropic spacing is
+handled by the caller converting a margin in mm.  The passes of an
+operation (three per axis-split box, two for open and close) go in one
+submission, ping-ponging between the output and a scratch buffer.
+
+With setDirtyBricks(), a run that repeats the previous one (same passes,
+element, mask and tile) only recomputes the bricks within the total
+radius of the edited ones: the bricks changed since then are marked by
+comparing the input with a snapshot on the GPU, or by the caller with
+markExtent().  This needs every intermediate result to still be in its
+buffer from the previous run, so it applies to operations of at most
+two passes (any ball, a box along one or two axes); others run in full.
+*/
+class MorphologyFilter : public ComputeAlgorithm {
+    protected:
+        enum Route {InputToOutput = 0, InputToScratch, OutputToScratch, ScratchToOutput, RouteCount};
+
+        struct Variant {
+            ComputePipeline *pipeline;
+            VkDescriptorSet descriptorSets[RouteCount];
+        };
+
+        uint32_t tileSize[3] = {8, 8, 8};
+        StructuringElement element = BallElement;
+        MorphologyPushConstants parameters;
+        std::string shaderPath;
+
+        ComputeBuffer input;
+        ComputeBuffer output;
+        ComputeBuffer scratch;
+        CommandSequence commandSequence;
+
+        // keyed by {operation, element, radius x, y, z, tile x, y, z, bricked, brick size, shared tile}
+        std::map<std::vector<uint32_t>, Variant> variants;
+
+        DirtyBricks *dirtyBricks = nullptr;
+        bool diffInput = true;
+        bool incremental = false;
+        std::vector<uint32_t> lastRun;
+
+    public:
+        MorphologyFilter(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                         const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth),
+              output(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth),
+              scratch(deviceQueue, sizeof(uint32_t) * VkDeviceSize(width) * height * depth,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              commandSequence(deviceQueue) {
+            this->parameters.dimensions[0] = width;
+            this->parameters.dimensions[1] = height;
+            this->parameters.dimensions[2] = depth;
+            this->parameters.segmentMask = 0xffffffffu;
+            this->shaderPath = shaderPath;
+        }
+
+        virtual ~MorphologyFilter() {
+            this->commandSequence.wait();
+            for (auto &entry : this->variants) {
+                delete entry.second.pipeline;
+            }
+        }
+
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getOutput() {return &(this->output);};
+
+    void setStructuringElement(StructuringElement element) {this->element = element;};
+    // only the segments (bits) in segmentMask change, the others are copied through
+    void setSegmentMask(uint32_t segmentMask) {this->parameters.segmentMask = segmentMask;};
+    void setTileSize(uint32_t x, uint32_t y, uint32_t z) {
+        this->tileSize[0] = x;
+        this->tileSize[1] = y;
+        this->tileSize[2] = z;
+    };
+
+    void erode(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ);
+    void dilate(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ);
+    // erode then dilate: removes parts thinner than the element
+    void open(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ);
+    // dilate then erode: fills gaps and holes smaller than the element
+    void close(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ);
+
+    // the tile and halo of a pass, above maxComputeSharedMemorySize it runs from global memory
+    uint64_t getSharedMemorySize(const uint32_t radius[3]);
+
+    /*
+    Track edits with dirtyBricks (4 byte voxels of this volume, owned by the
+    caller), or nullptr to always run in full.  With diffInput every run
+    compares the input with its snapshot, otherwise only the bricks the
+    caller marks count as edited.
+    */
+    void setDirtyBricks(DirtyBricks *dirtyBricks, bool diffInput = true);
+    DirtyBricks *getDirtyBricks() {return this->dirtyBricks;};
+    void setDiffInput(bool diffInput) {this->diffInput = diffInput;};
+    // whether the last run only recomputed the active bricks of the tracker
+    bool wasIncremental() {return this->incremental;};
+
+    protected:
+        struct Pass {
+            MorphologyOperation operation;
+            uint32_t radius[3];
+        };
+
+        Variant &getVariant(MorphologyOperation operation, StructuringElement element, const uint32_t radius[3],
+                            bool bricked = false);
+        void appendPasses(std::vector<Pass> &passes, MorphologyOperation operation, const uint32_t radius[3]);
+        void run(const std::vector<Pass> &passes);
+};
+
+inline uint64_t MorphologyFilter::getSharedMemorySize(const uint32_t radius[3]) {
+    uint64_t size = sizeof(uint32_t);
+    for (int axis = 0; axis < 3; ++axis) {
+        size *= this->tileSize[axis] + 2 * radius[axis];
+    }
+    return size;
+}
+
+inline MorphologyFilter::Variant &MorphologyFilter::getVariant(MorphologyOperation operation,
+                                                               StructuringElement element,
+                                                               const uint32_t radius[3], bool bricked) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(this->deviceQueue->getPhysicalDevice(), &properties);
+    // a large radius whose tile and halo do not fit reads its neighbourhood from the input buffer
+    bool sharedTile = getSharedMemorySize(radius) <= properties.limits.maxComputeSharedMemorySize;
+    uint32_t brickSize = this->dirtyBricks ? this->dirtyBricks->getBrickSize() : 16;
+    std::vector<uint32_t> specialization = {operation, element, radius[0], radius[1], radius[2],
+                                            this->tileSize[0], this->tileSize[1], this->tileSize[2],
+                                            bricked ? 1u : 0u, brickSize, sharedTile ? 1u : 0u};
+    auto found = this->variants.find(specialization);
+    if (found != this->variants.end()) {
+        return found->second;
+    }
+
+    if (this->tileSize[0] * this->tileSize[1] * this->tileSize[2] > properties.limits.maxComputeWorkGroupInvocations) {
+        throw std::runtime_error("morphology tile has more voxels than a workgroup has invocations");
+    }
+
+    // one descriptor set per route, so a pass can be repeated between any two buffers
+    Variant variant;
+    variant.pipeline = new ComputePipeline(this->deviceQueue,
+        createShaderModule(this->deviceQueue->getDevice(), "morphology", this->shaderPath),
+        3, sizeof(MorphologyPushConstants), specialization, RouteCount);
+    ComputeBuffer *routes[RouteCount][2] = {
+        {&(this->input), &(this->output)},
+        {&(this->input), &(this->scratch)},
+        {&(this->output), &(this->scratch)},
+        {&(this->scratch), &(this->output)}};
+    for (int route = 0; route < RouteCount; ++route) {
+        variant.descriptorSets[route] = route == 0 ? variant.pipeline->getDescriptorSet()
+                                                   : variant.pipeline->allocateDescriptorSet();
+        variant.pipeline->bindBuffer(variant.descriptorSets[route], 0, routes[route][0]);
+        variant.pipeline->bindBuffer(variant.descriptorSets[route], 1, routes[route][1]);
+        // full dispatches do not read the active brick list, but the binding must be valid
+        variant.pipeline->bindBuffer(variant.descriptorSets[route], 2,
+                                     bricked ? this->dirtyBricks->getActiveBricks() : &(this->input));
+    }
+    this->variants[specialization] = variant;
+    return this->variants[specialization];
+}
+
+inline void MorphologyFilter::setDirtyBricks(DirtyBricks *dirtyBricks, bool diffInput) {
+    this->dirtyBricks = dirtyBricks;
+    this->diffInput = diffInput;
+    this->lastRun.clear();
+    // bricked variants are bound to the active brick list of the previous tracker
+    for (auto entry = this->variants.begin(); entry != this->variants.end();) {
+        if (entry->first[8] == 0) {
+            ++entry;
+            continue;
+        }
+        delete entry->second.pipeline;
+        entry = this->variants.erase(entry);
+    }
+}
+
+/* A ball is one pass, a box one pass per axis with a nonzero radius */
+inline void MorphologyFilter::appendPasses(std::vector<Pass> &passes, MorphologyOperation operation,
+                                           const uint32_t radius[3]) {
+    if (this->element == BallElement) {
+        passes.push_back({operation, {radius[0], radius[1], radius[2]}});
+        return;
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        if (radius[axis] > 0) {
+            Pass pass = {operation, {0, 0, 0}};
+            pass.radius[axis] = radius[axis];
+            passes.push_back(pass);
+        }
+    }
+}
+
+/*
+Pass i reads buffer i and writes buffer i+1, the first reading the input
+and the last writing the output.  The buffers in between alternate so that
+the one before the output is always the scratch buffer.
+*/
+inline void MorphologyFilter::run(const std::vector<Pass> &passes) {
+    this->incremental = false;
+    if (passes.empty()) {
+        this->commandSequence.begin();
+        this->commandSequence.copyBuffer(&(this->input), &(this->output));
+        this->commandSequence.submitAndWait();
+        this->lastRun.clear();
+        return;
+    }
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    size_t passCount = passes.size();
+
+    std::vector<uint32_t> runKey = {this->element, this->parameters.segmentMask,
+                                    this->tileSize[0], this->tileSize[1], this->tileSize[2]};
+    uint32_t totalRadius[3] = {0, 0, 0};
+    for (const Pass &pass : passes) {
+        runKey.insert(runKey.end(), {pass.operation, pass.radius[0], pass.radius[1], pass.radius[2]});
+        for (int axis = 0; axis < 3; ++axis) {
+            totalRadius[axis] += pass.radius[axis];
+        }
+    }
+    if (this->dirtyBricks) {
+        uint32_t brickSize = this->dirtyBricks->getBrickSize();
+        bool tilesFit = true;
+        uint32_t groupsPerBrick = 1;
+        for (int axis = 0; axis < 3; ++axis) {
+            tilesFit = tilesFit && brickSize % this->tileSize[axis] == 0;
+            groupsPerBrick *= brickSize / this->tileSize[axis];
+        }
+        this->incremental = tilesFit && passCount <= 2 && runKey == this->lastRun;
+        if (this->diffInput) {
+            this->dirtyBricks->recordDiff(&(this->commandSequence), &(this->input));
+        }
+        if (this->incremental) {
+            // the passes together reach as far as the sum of their radii
+            this->dirtyBricks->recordGrow(&(this->commandSequence), totalRadius, groupsPerBrick);
+        }
+    }
+
+    for (size_t pass = 0; pass < passCount; ++pass) {
+        bool fromInput = pass == 0;
+        bool toOutput = (passCount - pass) % 2 == 1;
+        Route route = fromInput ? (toOutput ? InputToOutput : InputToScratch)
+                                : (toOutput ? ScratchToOutput : OutputToScratch);
+        // a box is split into axis passes, so the element of each pass is a box again
+        Variant &variant = getVariant(passes[pass].operation, this->element, passes[pass].radius,
+                                      this->incremental);
+        if (this->incremental) {
+            this->dirtyBricks->dispatch(&(this->commandSequence), variant.pipeline, &(this->parameters),
+                                        variant.descriptorSets[route]);
+        } else {
+            variant.pipeline->record(commandBuffer,
+                                     groupCount(this->parameters.dimensions[0], this->tileSize[0]),
+                                     groupCount(this->parameters.dimensions[1], this->tileSize[1]),
+                                     groupCount(this->parameters.dimensions[2], this->tileSize[2]),
+                                     &(this->parameters), variant.descriptorSets[route]);
+        }
+        this->commandSequence.barrier();
+    }
+    if (this->dirtyBricks) {
+        this->dirtyBricks->recordClear(&(this->commandSequence));
+    }
+    this->commandSequence.submitAndWait();
+    this->lastRun = this->dirtyBricks ? runKey : std::vector<uint32_t>();
+}
+
+inline void MorphologyFilter::erode(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+    uint32_t radius[3] = {radiusX, radiusY, radiusZ};
+    std::vector<Pass> passes;
+    appendPasses(passes, ErodeOperation, radius);
+    run(passes);
+}
+
+inline void MorphologyFilter::dilate(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+    uint32_t radius[3] = {radiusX, radiusY, radiusZ};
+    std::vector<Pass> passes;
+    appendPasses(passes, DilateOperation, radius);
+    run(passes);
+}
+
+inline void MorphologyFilter::open(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+    uint32_t radius[3] = {radiusX, radiusY, radiusZ};
+    std::vector<Pass> passes;
+    appendPasses(passes, ErodeOperation, radius);
+    appendPasses(passes, DilateOperation, radius);
+    run(passes);
+}
+
+inline void MorphologyFilter::close(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+    uint32_t radius[3] = {radiusX, radiusY, radiusZ};
+    std::vector<Pass> passes;
+    appendPasses(passes, DilateOperation, radius);
+    appendPasses(passes, ErodeOperation, radius);
+    run(passes);
+}
+
+} // end of namespace vudo
+
+#endif
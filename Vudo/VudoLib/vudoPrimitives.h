@@ -0,0 +1,306 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Data parallel primitives over device buffers: prefix sum
+ * (ExclusiveScan, vudoScan.h), stream compaction and radix sort.
+ *
+ * Each has a record() that adds its passes to a command sequence the
+ * caller has begun, so it can be one stage of a larger submission, and
+ * a run() that submits just that and waits.
+ */
+
+#ifndef __vudoPrimitives_h
+#define __vudoPrimitives_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoScan.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+namespace vudo {
+
+/* push constants of compact.comp.glsl */
+struct CompactPushConstants {
+    uint32_t count;
+    uint32_t hasValues;
+    uint32_t hasFlags;
+};
+
+/* push constants of radixSort.comp.glsl */
+struct RadixSortPushConstants {
+    uint32_t count;
+    uint32_t shift;
+    uint32_t blockCount;
+};
+
+/*
+Writes the kept elements of up to capacity uint32_t values, in order, to
+output and their number to total.  An element is kept when its flag is
+nonzero, or when it is nonzero if flags is null; with null values the
+indices of the kept elements are written instead.
+*/
+class StreamCompaction : public ComputeAlgorithm {
+    protected:
+        static const uint32_t maxBindings = 8;
+        uint32_t capacity;
+
+        ComputeBuffer offsets;
+        ComputeBuffer total; // host visible, for run()
+        ExclusiveScan scan;
+        ComputePipeline mark;
+        ComputePipeline scatter;
+        CommandSequence commandSequence;
+
+        // keyed by {values, flags, output}
+        std::map<std::tuple<ComputeBuffer *, ComputeBuffer *, ComputeBuffer *>,
+                 std::pair<VkDescriptorSet, VkDescriptorSet>> descriptorSets;
+
+    public:
+        StreamCompaction(DeviceQueue *deviceQueue, uint32_t capacity,
+                         const std::string &shaderPath = "", const std::string &scanShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              offsets(deviceQueue, sizeof(uint32_t) * VkDeviceSize(capacity > 0 ? capacity : 1),
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              total(deviceQueue, sizeof(uint32_t)),
+              scan(deviceQueue, capacity, scanShaderPath),
+              mark(deviceQueue, createShaderModule(deviceQueue->getDevice(), "compact", shaderPath),
+                   4, sizeof(CompactPushConstants), {0}, maxBindings),
+              scatter(deviceQueue, createShaderModule(deviceQueue->getDevice(), "compact", shaderPath),
+                      4, sizeof(CompactPushConstants), {1}, maxBindings),
+              commandSequence(deviceQueue) {
+            this->capacity = capacity;
+        }
+
+        virtual ~StreamCompaction() {
+            this->commandSequence.wait();
+        }
+
+    uint32_t getCapacity() {return this->capacity;};
+    ExclusiveScan *getScan() {return &(this->scan);};
+
+    void record(CommandSequence *commandSequence, ComputeBuffer *values, ComputeBuffer *flags,
+                uint32_t count, ComputeBuffer *output, ComputeBuffer *total, VkDeviceSize totalOffset = 0);
+    // returns the number of kept elements
+    uint32_t run(ComputeBuffer *values, ComputeBuffer *flags, uint32_t count, ComputeBuffer *output);
+};
+
+/* Ends with a barrier */
+inline void StreamCompaction::record(CommandSequence *commandSequence, ComputeBuffer *values, ComputeBuffer *flags,
+                                     uint32_t count, ComputeBuffer *output, ComputeBuffer *total,
+                                     VkDeviceSize totalOffset) {
+    if (values == nullptr && flags == nullptr) {
+        throw std::runtime_error("compaction needs values, flags or both");
+    }
+    auto key = std::make_tuple(values, flags, output);
+    auto found = this->descriptorSets.find(key);
+    if (found == this->descriptorSets.end()) {
+        if (this->descriptorSets.size() >= maxBindings) {
+            throw std::runtime_error("compaction used with too many different buffers");
+        }
+        bool first = this->descriptorSets.empty();
+        std::pair<VkDescriptorSet, VkDescriptorSet> sets(
+            first ? this->mark.getDescriptorSet() : this->mark.allocateDescriptorSet(),
+            first ? this->scatter.getDescriptorSet() : this->scatter.allocateDescriptorSet());
+        // a missing buffer is never read, the offsets stand in for it
+        ComputeBuffer *buffers[4] = {values ? values : &(this->offsets), flags ? flags : &(this->offsets),
+                                     &(this->offsets), output};
+        for (uint32_t binding = 0; binding < 4; ++binding) {
+            this->mark.bindBuffer(sets.first, binding, buffers[binding]);
+            this->scatter.bindBuffer(sets.second, binding, buffers[binding]);
+        }
+        found = this->descriptorSets.insert(std::make_pair(key, sets)).first;
+    }
+
+    CompactPushConstants parameters = {count, values != nullptr, flags != nullptr};
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    this->mark.recordLinear(commandBuffer, count, 256, &parameters, found->second.first);
+    commandSequence->barrier();
+    this->scan.record(commandSequence, &(this->offsets), count, total, totalOffset);
+    this->scatter.recordLinear(commandBuffer, count, 256, &parameters, found->second.second);
+    commandSequence->barrier();
+}
+
+inline uint32_t StreamCompaction::run(ComputeBuffer *values, ComputeBuffer *flags, uint32_t count,
+                                      ComputeBuffer *output) {
+    this->commandSequence.begin();
+    record(&(this->commandSequence), values, flags, count, output, &(this->total));
+    this->commandSequence.submitAndWait();
+    return static_cast<const uint32_t *>(this->total.map())[0];
+}
+
+/*
+Stable least significant digit radix sort of up to capacity uint32_t keys,
+in place, with optional uint32_t values (e.g. indices) moved along.
+Four bits per pass; sorting only the low keyBits bits saves passes when
+the keys are known to be small.  Each workgroup ranks a block of four keys
+per invocation in shared memory, so the workgroup is as large as the
+device's maxComputeSharedMemorySize allows, up to 256 invocations.
+*/
+class RadixSort : public ComputeAlgorithm {
+    protected:
+        static const uint32_t maxBindings = 8;
+        static const uint32_t radix = 16;
+        static const uint32_t elementsPerInvocation = 4;
+        uint32_t capacity;
+        uint32_t workgroupSize;
+        uint32_t blockSize;
+
+        ComputeBuffer keysScratch;
+        ComputeBuffer valuesScratch;
+        ComputeBuffer histograms;
+        ExclusiveScan scan;
+        // histogram and scatter, with and without values
+        ComputePipeline *pipelines[2][2];
+        CommandSequence commandSequence;
+
+        // keyed by {keys, values}, a set per direction
+        std::map<std::pair<ComputeBuffer *, ComputeBuffer *>,
+                 std::pair<VkDescriptorSet, VkDescriptorSet>> descriptorSets[2][2];
+
+    public:
+        RadixSort(DeviceQueue *deviceQueue, uint32_t capacity,
+                  const std::string &shaderPath = "", const std::string &scanShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              workgroupSize(chooseWorkgroupSize(deviceQueue)),
+              blockSize(elementsPerInvocation * workgroupSize),
+              keysScratch(deviceQueue, sizeof(uint32_t) * VkDeviceSize(capacity > 0 ? capacity : 1),
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              valuesScratch(deviceQueue, sizeof(uint32_t) * VkDeviceSize(capacity > 0 ? capacity : 1),
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              histograms(deviceQueue, sizeof(uint32_t) * radix * VkDeviceSize(groupCount(capacity, blockSize) + 1),
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              scan(deviceQueue, radix * groupCount(capacity, blockSize), scanShaderPath),
+              commandSequence(deviceQueue) {
+            this->capacity = capacity;
+            for (uint32_t pass = 0; pass < 2; ++pass) {
+                for (uint32_t hasValues = 0; hasValues < 2; ++hasValues) {
+                    std::vector<uint32_t> specialization = {pass, hasValues, this->workgroupSize};
+                    this->pipelines[pass][hasValues] = new ComputePipeline(deviceQueue,
+                        createShaderModule(deviceQueue->getDevice(), "radixSort", shaderPath),
+                        5, sizeof(RadixSortPushConstants), specialization, 2 * maxBindings);
+                }
+            }
+        }
+
+        virtual ~RadixSort() {
+            this->commandSequence.wait();
+            for (auto &passPipelines : this->pipelines) {
+                for (ComputePipeline *pipeline : passPipelines) {
+                    delete pipeline;
+                }
+            }
+        }
+
+    uint32_t getCapacity() {return this->capacity;};
+    uint32_t getWorkgroupSize() {return this->workgroupSize;};
+
+    // shared memory of radixSort.comp.glsl: digit counts, partial sums and digit starts
+    static uint64_t getSharedMemorySize(uint32_t workgroupSize) {
+        return sizeof(uint32_t) * (uint64_t(radix) * workgroupSize + workgroupSize + radix);
+    };
+    static uint32_t chooseWorkgroupSize(DeviceQueue *deviceQueue);
+
+    void record(CommandSequence *commandSequence, ComputeBuffer *keys, ComputeBuffer *values,
+                uint32_t count, uint32_t keyBits = 32);
+    void run(ComputeBuffer *keys, ComputeBuffer *values, uint32_t count, uint32_t keyBits = 32);
+
+    protected:
+        // descriptor set reading {keys, values} (toScratch) or the scratch buffers
+        VkDescriptorSet getDescriptorSet(uint32_t pass, ComputeBuffer *keys, ComputeBuffer *values, bool toScratch);
+};
+
+/* The largest power of two up to 256 whose shared memory fits, at least one invocation per digit */
+inline uint32_t RadixSort::chooseWorkgroupSize(DeviceQueue *deviceQueue) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(deviceQueue->getPhysicalDevice(), &properties);
+    uint32_t workgroupSize = 256;
+    while (workgroupSize > radix &&
+           (getSharedMemorySize(workgroupSize) > properties.limits.maxComputeSharedMemorySize ||
+            workgroupSize > properties.limits.maxComputeWorkGroupInvocations)) {
+        workgroupSize /= 2;
+    }
+    if (getSharedMemorySize(workgroupSize) > properties.limits.maxComputeSharedMemorySize) {
+        throw std::runtime_error("radix sort does not fit in shared memory");
+    }
+    return workgroupSize;
+}
+
+inline VkDescriptorSet RadixSort::getDescriptorSet(uint32_t pass, ComputeBuffer *keys, ComputeBuffer *values,
+                                                   bool toScratch) {
+    bool hasValues = values != nullptr;
+    ComputePipeline *pipeline = this->pipelines[pass][hasValues];
+    auto &sets = this->descriptorSets[pass][hasValues];
+    auto key = std::make_pair(keys, values);
+    auto found = sets.find(key);
+    if (found == sets.end()) {
+        if (sets.size() >= maxBindings) {
+            throw std::runtime_error("radix sort used with too many different buffers");
+        }
+        std::pair<VkDescriptorSet, VkDescriptorSet> directions(
+            sets.empty() ? pipeline->getDescriptorSet() : pipeline->allocateDescriptorSet(),
+            pipeline->allocateDescriptorSet());
+        // values are bound to the keys when there are none, the shader never touches them
+        ComputeBuffer *valuesOrKeys = hasValues ? values : keys;
+        ComputeBuffer *scratchValues = hasValues ? &(this->valuesScratch) : &(this->keysScratch);
+        pipeline->bindBuffer(directions.first, 0, keys);
+        pipeline->bindBuffer(directions.first, 1, valuesOrKeys);
+        pipeline->bindBuffer(directions.first, 2, &(this->keysScratch));
+        pipeline->bindBuffer(directions.first, 3, scratchValues);
+        pipeline->bindBuffer(directions.second, 0, &(this->keysScratch));
+        pipeline->bindBuffer(directions.second, 1, scratchValues);
+        pipeline->bindBuffer(directions.second, 2, keys);
+        pipeline->bindBuffer(directions.second, 3, valuesOrKeys);
+        for (VkDescriptorSet descriptorSet : {directions.first, directions.second}) {
+            pipeline->bindBuffer(descriptorSet, 4, &(this->histograms));
+        }
+        found = sets.insert(std::make_pair(key, directions)).first;
+    }
+    return toScratch ? found->second.first : found->second.second;
+}
+
+/* Ends with a barrier, with the sorted keys and values back in keys and values */
+inline void RadixSort::record(CommandSequence *commandSequence, ComputeBuffer *keys, ComputeBuffer *values,
+                              uint32_t count, uint32_t keyBits) {
+    if (count > this->capacity) {
+        throw std::runtime_error("radix sort count exceeds its capacity");
+    }
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    RadixSortPushConstants parameters = {count, 0, groupCount(count, this->blockSize)};
+    uint32_t passes = groupCount(std::min(keyBits, 32u), 4);
+    for (uint32_t pass = 0; pass < passes; ++pass) {
+        parameters.shift = 4 * pass;
+        bool toScratch = pass % 2 == 0;
+        VkDeviceSize invocations = VkDeviceSize(parameters.blockCount) * this->workgroupSize;
+        this->pipelines[0][values != nullptr]->recordLinear(commandBuffer, invocations, this->workgroupSize,
+                                                            &parameters, getDescriptorSet(0, keys, values, toScratch));
+        commandSequence->barrier();
+        this->scan.record(commandSequence, &(this->histograms), radix * parameters.blockCount);
+        this->pipelines[1][values != nullptr]->recordLinear(commandBuffer, invocations, this->workgroupSize,
+                                                            &parameters, getDescriptorSet(1, keys, values, toScratch));
+        commandSequence->barrier();
+    }
+    if (passes % 2 == 1) {
+        VkDeviceSize size = sizeof(uint32_t) * VkDeviceSize(count);
+        if (size > 0) {
+            commandSequence->copyBuffer(&(this->keysScratch), keys, size);
+            if (values != nullptr) {
+                commandSequence->copyBuffer(&(this->valuesScratch), values, size);
+            }
+            commandSequence->barrier();
+        }
+    }
+}
+
+inline void RadixSort::run(ComputeBuffer *keys, ComputeBuffer *values, uint32_t count, uint32_t keyBits) {
+    this->commandSequence.begin();
+    record(&(this->commandSequence), keys, values, count, keyBits);
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Coarse-to-fine progressive dispatch.
+ *
+ * A generator is run as a series of passes over ever finer lattices,
+ * e.g. every 8th voxel, then every 4th, 2nd and finally every voxel.
+ * Each pass only renders the voxels that coarser passes have not,
+ * so the total work is the same as one full dispatch, but a usable
+ * low resolution result is ready after the first (1/512th) pass.
+ *
+ * The shader must start its push constants with ProgressivePushConstants
+ * and render the voxel at gl_GlobalInvocationID * stride, returning early
+ * when every coordinate is a multiple of skipStride (see Mandelbrot.comp.glsl).
+ */
+
+#ifndef __vudoProgressive_h
+#define __vudoProgressive_h
+
+#include "vudo.h"
+
+namespace vudo {
+
+struct ProgressivePushConstants {
+    uint32_t stride;
+    uint32_t skipStride;
+};
+
+/*
+Submits one pass at a time without blocking, so the caller can poll
+isPassComplete(), publish the lattice of the completed pass and then
+submit the next one - or cancel() in between passes.
+
+Later passes never write voxels on the lattice of an earlier pass, so the
+next pass can be submitted before the previous result has been read back.
+*/
+class ProgressiveDispatch {
+    protected:
+        ComputePipeline *pipeline;
+        CommandSequence commandSequence;
+
+        uint32_t dimensions[3];
+        uint32_t workgroupSize;
+        std::vector<uint32_t> strides; // coarsest first, ending in 1
+
+        uint32_t submittedPasses = 0;
+        uint32_t completedPasses = 0;
+        bool cancelled = false;
+
+    public:
+        ProgressiveDispatch(DeviceQueue *deviceQueue, ComputePipeline *pipeline,
+                            uint32_t width, uint32_t height, uint32_t depth,
+                            uint32_t workgroupSize = 8, uint32_t coarsestStride = 8)
+            : commandSequence(deviceQueue) {
+            this->pipeline = pipeline;
+            this->dimensions[0] = width;
+            this->dimensions[1] = height;
+            this->dimensions[2] = depth;
+            this->workgroupSize = workgroupSize;
+            for (uint32_t stride = coarsestStride; stride > 1; stride /= 2) {
+                this->strides.push_back(stride);
+            }
+            this->strides.push_back(1);
+        }
+
+    uint32_t getPassCount() {return (uint32_t)this->strides.size();};
+    uint32_t getStride(uint32_t pass) {return this->strides[pass];};
+    uint32_t getCompletedPasses() {return this->completedPasses;};
+    bool isCancelled() {return this->cancelled;};
+    bool isFinished() {return this->cancelled || this->completedPasses == this->strides.size();};
+
+    // stride of the finest completed pass, 0 before the first one completes
+    uint32_t getCompletedStride() {
+        return this->completedPasses == 0 ? 0 : this->strides[this->completedPasses - 1];
+    };
+
+    bool submitNextPass();
+    bool isPassComplete();
+    void waitForPass();
+    void cancel();
+    void runToCompletion();
+};
+
+inline bool ProgressiveDispatch::submitNextPass() {
+    if (this->cancelled || this->submittedPasses == this->strides.size()) {
+        return false;
+    }
+    if (this->submittedPasses > this->completedPasses) {
+        waitForPass();
+    }
+    uint32_t pass = this->submittedPasses;
+    ProgressivePushConstants pushConstants;
+    pushConstants.stride = this->strides[pass];
+    pushConstants.skipStride = pass == 0 ? 0 : this->strides[pass - 1];
+
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->pipeline->record(commandBuffer,
+        groupCount(groupCount(this->dimensions[0], pushConstants.stride), this->workgroupSize),
+        groupCount(groupCount(this->dimensions[1], pushConstants.stride), this->workgroupSize),
+        groupCount(groupCount(this->dimensions[2], pushConstants.stride), this->workgroupSize),
+        &pushConstants);
+    this->commandSequence.barrier();
+    this->commandSequence.submit();
+    this->submittedPasses++;
+    return true;
+}
+
+inline bool ProgressiveDispatch::isPassComplete() {
+    if (this->submittedPasses > this->completedPasses && this->commandSequence.isComplete()) {
+        this->completedPasses = this->submittedPasses;
+    }
+    return this->submittedPasses == this->completedPasses;
+}
+
+inline void ProgressiveDispatch::waitForPass() {
+    this->commandSequence.wait();
+    this->completedPasses = this->submittedPasses;
+}
+
+/*
+Nothing more is submitted after a cancel, a pass that is already on the
+GPU still runs to completion (it is short compared to a full dispatch).
+*/
+inline void ProgressiveDispatch::cancel() {
+    this->cancelled = true;
+}
+
+inline void ProgressiveDispatch::runToCompletion() {
+    while (submitNextPass()) {
+        waitForPass();
+    }
+}
+
+} // end of namespace vudo
+
+#endif
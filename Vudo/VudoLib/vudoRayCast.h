@@ -0,0 +1,189 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Volume ray casting in a compute shader.
+ *
+ * The volume never leaves the GPU: rays are marched through the buffer a
+ * generator or filter wrote and only the RGBA8 image is read back, 1 MiB
+ * at 512^2 instead of the 2 GiB of a 512^3 vec4 volume.
+ */
+
+#ifndef __vudoRayCast_h
+#define __vudoRayCast_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+#include "vudoBricks.h"
+
+#include <cmath>
+
+namespace vudo {
+
+/* push constants of raycast.comp.glsl */
+struct RayCastPushConstants {
+    float eye[3];
+    float stepSize;
+    float pixelOrigin[3];
+    uint32_t brickSize;
+    float pixelStepX[3];
+    float rangeMin;
+    float pixelStepY[3];
+    float rangeMax;
+    uint32_t dimensions[3];
+    uint32_t valueStride;
+    uint32_t imageSize[2];
+    uint32_t tableSize;
+};
+
+/*
+Renders volume (width x height x depth voxels of valueStride floats,
+the first one rendered) into a host visible image of one packed RGBA8
+uint32_t per pixel, rows from top to bottom.  Camera positions are in
+IJK, i.e. voxel units.
+*/
+class RayCaster : public ComputeAlgorithm {
+    protected:
+        ComputeBuffer *volume;
+        RayCastPushConstants parameters;
+        static const uint32_t maxTableSize = 4096;
+
+        ComputeBuffer transferFunction;
+        ComputeBuffer image;
+        ComputePipeline pipeline;
+        CommandSequence commandSequence;
+
+    public:
+        RayCaster(DeviceQueue *deviceQueue, ComputeBuffer *volume,
+                  uint32_t width, uint32_t height, uint32_t depth, uint32_t valueStride,
+                  uint32_t imageWidth, uint32_t imageHeight, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              transferFunction(deviceQueue, 4 * sizeof(float) * maxTableSize),
+              image(deviceQueue, sizeof(uint32_t) * VkDeviceSize(imageWidth) * imageHeight),
+              pipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "raycast", shaderPath),
+                       4, sizeof(RayCastPushConstants)),
+              commandSequence(deviceQueue) {
+            this->volume = volume;
+            memset(&(this->parameters), 0, sizeof(this->parameters));
+            this->parameters.dimensions[0] = width;
+            this->parameters.dimensions[1] = height;
+            this->parameters.dimensions[2] = depth;
+            this->parameters.valueStride = valueStride;
+            this->parameters.imageSize[0] = imageWidth;
+            this->parameters.imageSize[1] = imageHeight;
+            this->parameters.stepSize = 0.5f;
+            this->parameters.rangeMax = 1.f;
+            this->parameters.tableSize = 1;
+            // an opaque white table until setTransferFunction
+            float *table = static_cast<float *>(this->transferFunction.map());
+            for (int component = 0; component < 4; ++component) {
+                table[component] = 1.f;
+            }
+            this->pipeline.bindBuffer(0, volume);
+            this->pipeline.bindBuffer(1, &(this->transferFunction));
+            this->pipeline.bindBuffer(2, &(this->transferFunction)); // placeholder until setEmptySpaceSkipping
+            this->pipeline.bindBuffer(3, &(this->image));
+            setCamera(0.5f * width, 0.5f * height, -2.f * depth,
+                      0.5f * width, 0.5f * height, 0.5f * depth,
+                      0.f, -1.f, 0.f, 30.f);
+        }
+
+    ComputeBuffer *getImage() {return &(this->image);};
+    uint32_t getImageWidth() {return this->parameters.imageSize[0];};
+    uint32_t getImageHeight() {return this->parameters.imageSize[1];};
+
+    // distance between samples in voxels
+    void setStepSize(float stepSize) {this->parameters.stepSize = stepSize;};
+
+    void setTransferFunction(const float *rgba, uint32_t entries, float rangeMin, float rangeMax);
+    void setCamera(float eyeX, float eyeY, float eyeZ,
+                   float focalX, float focalY, float focalZ,
+                   float upX, float upY, float upZ, float viewAngle);
+    void setEmptySpaceSkipping(BrickMap *brickMap, float background);
+    void disableEmptySpaceSkipping() {this->parameters.brickSize = 0;};
+    void render();
+};
+
+/*
+entries RGBA values (opacity per voxel of distance) spread evenly
+over [rangeMin, rangeMax]; values outside use the end entries.
+*/
+inline void RayCaster::setTransferFunction(const float *rgba, uint32_t entries, float rangeMin, float rangeMax) {
+    if (entries == 0 || entries > maxTableSize) {
+        throw std::runtime_error("transfer function must have 1 to 4096 entries");
+    }
+    this->commandSequence.wait();
+    memcpy(this->transferFunction.map(), rgba, 4 * sizeof(float) * entries);
+    this->parameters.tableSize = entries;
+    this->parameters.rangeMin = rangeMin;
+    this->parameters.rangeMax = rangeMax > rangeMin ? rangeMax : rangeMin + 1.f;
+}
+
+/* A perspective camera looking from eye at focal point, viewAngle in degrees vertically */
+inline void RayCaster::setCamera(float eyeX, float eyeY, float eyeZ,
+                                 float focalX, float focalY, float focalZ,
+                                 float upX, float upY, float upZ, float viewAngle) {
+    float eye[3] = {eyeX, eyeY, eyeZ};
+    float forward[3] = {focalX - eyeX, focalY - eyeY, focalZ - eyeZ};
+    float up[3] = {upX, upY, upZ};
+    auto normalize = [](float *vector) {
+        float length = std::sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+        if (length > 0.f) {
+            for (int axis = 0; axis < 3; ++axis) {
+                vector[axis] /= length;
+            }
+        }
+    };
+    normalize(forward);
+    float right[3] = {forward[1] * up[2] - forward[2] * up[1],
+                      forward[2] * up[0] - forward[0] * up[2],
+                      forward[0] * up[1] - forward[1] * up[0]};
+    normalize(right);
+    float trueUp[3] = {right[1] * forward[2] - right[2] * forward[1],
+                       right[2] * forward[0] - right[0] * forward[2],
+                       right[0] * forward[1] - right[1] * forward[0]};
+
+    // the image plane is one unit in front of the eye
+    float width = (float)this->parameters.imageSize[0];
+    float height = (float)this->parameters.imageSize[1];
+    float pixelSize = 2.f * std::tan(0.5f * viewAngle * 3.14159265f / 180.f) / height;
+    for (int axis = 0; axis < 3; ++axis) {
+        this->parameters.eye[axis] = eye[axis];
+        this->parameters.pixelStepX[axis] = pixelSize * right[axis];
+        this->parameters.pixelStepY[axis] = -pixelSize * trueUp[axis];
+        this->parameters.pixelOrigin[axis] = eye[axis] + forward[axis]
+            - (0.5f * width - 0.5f) * this->parameters.pixelStepX[axis]
+            - (0.5f * height - 0.5f) * this->parameters.pixelStepY[axis];
+    }
+}
+
+/*
+Compute the occupancy of brickMap over the volume (voxels above background
+count) and let rays jump over the empty bricks.  background should be
+where the transfer function becomes transparent.  Call again when the
+volume changes.
+*/
+inline void RayCaster::setEmptySpaceSkipping(BrickMap *brickMap, float background) {
+    brickMap->clearROI();
+    brickMap->setBackground(background);
+    this->commandSequence.begin();
+    brickMap->record(&(this->commandSequence), brickMap->getBrickSize(),
+                     this->volume, this->parameters.valueStride);
+    this->commandSequence.submitAndWait();
+    this->pipeline.bindBuffer(2, brickMap->getOccupancy());
+    this->parameters.brickSize = brickMap->getBrickSize();
+}
+
+inline void RayCaster::render() {
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->pipeline.record(commandBuffer,
+                          groupCount(this->parameters.imageSize[0], 8),
+                          groupCount(this->parameters.imageSize[1], 8), 1,
+                          &(this->parameters));
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Batched similarity metrics for image registration: mean squares,
+ * normalized correlation and Mattes mutual information of a fixed and a
+ * moving volume under many candidate transforms in one submission.
+ */
+
+#ifndef __vudoRegistration_h
+#define __vudoRegistration_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* All are costs: lower is better */
+enum RegistrationMetric : uint32_t {
+    MeanSquaresMetric = 0, // mean of (fixed - moving)^2
+    CorrelationMetric = 1, // -normalized cross correlation
+    MattesMutualInformationMetric = 2 // -mutual information
+};
+
+/* push constants of registration.comp.glsl */
+struct RegistrationPushConstants {
+    uint32_t fixedDimensions[3];
+    uint32_t sampleStride;
+    uint32_t movingDimensions[3];
+    uint32_t candidateCount;
+    float fixedRange[2];
+    float movingRange[2];
+};
+
+/*
+Fill getFixed() and getMoving() with the float volumes, getCandidates()
+with one row major fixed IJK to moving IJK matrix (16 floats) per
+candidate transform, and run(candidateCount).  getResults() then holds
+one cost per candidate; nothing else comes back from the device.
+
+The fixed voxels, every sampleStride along each axis, are the samples;
+those that map outside the moving volume are left out.  Mutual
+information bins the intensity ranges given to setFixedRange() and
+setMovingRange() into a histogramBins square joint histogram, with a
+cubic B-spline Parzen window on the moving side as in Mattes et al.
+*/
+class RegistrationMetrics : public ComputeAlgorithm {
+    protected:
+        static const uint32_t groupsPerCandidate = 32;
+        static const uint32_t statisticCount = 7;
+        static const uint32_t maxBins = 64;
+        uint32_t maxCandidates;
+        uint32_t histogramBins;
+        RegistrationMetric metric = MattesMutualInformationMetric;
+        RegistrationPushConstants parameters;
+        std::string shaderPath;
+
+        ComputeBuffer fixed;
+        ComputeBuffer moving;
+        ComputeBuffer candidates;
+        ComputeBuffer partials;
+        ComputeBuffer results;
+        CommandSequence commandSequence;
+        // accumulate and finish, per metric
+        ComputePipeline *pipelines[3][2] = {{nullptr, nullptr}, {nullptr, nullptr}, {nullptr, nullptr}};
+
+    public:
+        RegistrationMetrics(DeviceQueue *deviceQueue,
+                            uint32_t fixedWidth, uint32_t fixedHeight, uint32_t fixedDepth,
+                            uint32_t movingWidth, uint32_t movingHeight, uint32_t movingDepth,
+                            uint32_t maxCandidates, uint32_t histogramBins = 32, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              fixed(deviceQueue, sizeof(float) * VkDeviceSize(fixedWidth) * fixedHeight * fixedDepth),
+              moving(deviceQueue, sizeof(float) * VkDeviceSize(movingWidth) * movingHeight * movingDepth),
+              candidates(deviceQueue, 16 * sizeof(float) * VkDeviceSize(maxCandidates)),
+              partials(deviceQueue, sizeof(float) * VkDeviceSize(maxCandidates) * groupsPerCandidate
+                                    * (statisticCount + histogramBins * histogramBins),
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              results(deviceQueue, sizeof(float) * VkDeviceSize(maxCandidates)),
+              commandSequence(deviceQueue) {
+            if (histogramBins < 8 || histogramBins > maxBins) {
+                throw std::runtime_error("histogram bins must be from 8 to 64");
+            }
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(deviceQueue->getPhysicalDevice(), &properties);
+            if (getSharedMemorySize(histogramBins) > properties.limits.maxComputeSharedMemorySize) {
+                throw std::runtime_error("the joint histogram does not fit in shared memory, use fewer histogram bins");
+            }
+            if (maxCandidates > 65535) {
+                throw std::runtime_error("at most 65535 registration candidates per run");
+            }
+            this->maxCandidates = maxCandidates;
+            this->histogramBins = histogramBins;
+            this->shaderPath = shaderPath;
+            this->parameters.fixedDimensions[0] = fixedWidth;
+            this->parameters.fixedDimensions[1] = fixedHeight;
+            this->parameters.fixedDimensions[2] = fixedDepth;
+            this->parameters.movingDimensions[0] = movingWidth;
+            this->parameters.movingDimensions[1] = movingHeight;
+            this->parameters.movingDimensions[2] = movingDepth;
+            this->parameters.sampleStride = 1;
+            this->parameters.candidateCount = 0;
+            setFixedRange(0.f, 1.f);
+            setMovingRange(0.f, 1.f);
+        }
+
+        virtual ~RegistrationMetrics() {
+            this->commandSequence.wait();
+            for (auto &metricPipelines : this->pipelines) {
+                for (ComputePipeline *pipeline : metricPipelines) {
+                    delete pipeline;
+                }
+            }
+        }
+
+    ComputeBuffer *getFixed() {return &(this->fixed);};
+    ComputeBuffer *getMoving() {return &(this->moving);};
+    ComputeBuffer *getCandidates() {return &(this->candidates);};
+    ComputeBuffer *getResults() {return &(this->results);};
+    uint32_t getMaxCandidates() {return this->maxCandidates;};
+    uint32_t getHistogramBins() {return this->histogramBins;};
+    // shared memory of registration.comp.glsl: joint histogram, reduction, statistics and marginals
+    static uint64_t getSharedMemorySize(uint32_t histogramBins) {
+        return sizeof(uint32_t) * (uint64_t(histogramBins) * histogramBins + 256 + statisticCount + 2 * histogramBins);
+    };
+
+    void setMetric(RegistrationMetric metric) {this->metric = metric;};
+    RegistrationMetric getMetric() {return this->metric;};
+    void setSampleStride(uint32_t sampleStride) {this->parameters.sampleStride = sampleStride > 0 ? sampleStride : 1;};
+    // intensities outside the ranges fall into the first or last bins
+    void setFixedRange(float minimum, float maximum) {
+        this->parameters.fixedRange[0] = minimum;
+        this->parameters.fixedRange[1] = maximum > minimum ? maximum : minimum + 1.f;
+    };
+    void setMovingRange(float minimum, float maximum) {
+        this->parameters.movingRange[0] = minimum;
+        this->parameters.movingRange[1] = maximum > minimum ? maximum : minimum + 1.f;
+    };
+
+    void record(CommandSequence *commandSequence, uint32_t candidateCount);
+    void run(uint32_t candidateCount);
+
+    protected:
+        ComputePipeline *getPipeline(uint32_t pass);
+};
+
+inline ComputePipeline *RegistrationMetrics::getPipeline(uint32_t pass) {
+    ComputePipeline *&pipeline = this->pipelines[this->metric][pass];
+    if (pipeline == nullptr) {
+        std::vector<uint32_t> specialization = {pass, this->metric, this->histogramBins};
+        pipeline = new ComputePipeline(this->deviceQueue,
+            createShaderModule(this->deviceQueue->getDevice(), "registration", this->shaderPath),
+            5, sizeof(RegistrationPushConstants), specialization);
+        pipeline->bindBuffer(0, &(this->fixed));
+        pipeline->bindBuffer(1, &(this->moving));
+        pipeline->bindBuffer(2, &(this->candidates));
+        pipeline->bindBuffer(3, &(this->partials));
+        pipeline->bindBuffer(4, &(this->results));
+    }
+    return pipeline;
+}
+
+/* Each candidate is accumulated by groupsPerCandidate workgroups, then reduced by one. Ends with a barrier. */
+inline void RegistrationMetrics::record(CommandSequence *commandSequence, uint32_t candidateCount) {
+    if (candidateCount > this->maxCandidates) {
+        throw std::runtime_error("more registration candidates than allocated");
+    }
+    if (candidateCount == 0) {
+        return;
+    }
+    this->parameters.candidateCount = candidateCount;
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    getPipeline(0)->record(commandBuffer, groupsPerCandidate, candidateCount, 1, &(this->parameters));
+    commandSequence->barrier();
+    getPipeline(1)->record(commandBuffer, candidateCount, 1, 1, &(this->parameters));
+    commandSequence->barrier();
+}
+
+inline void RegistrationMetrics::run(uint32_t candidateCount) {
+    this->commandSequence.begin();
+    record(&(this->commandSequence), candidateCount);
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Affine reslicing and resampling of volumes.
+ *
+ * The input volume stays resident on the GPU, and any number of output
+ * slabs (whole volumes for harden transform, single slices for the
+ * slice views) are resampled from it in one submission.
+ */
+
+#ifndef __vudoResample_h
+#define __vudoResample_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+enum Interpolation : uint32_t {
+    NearestInterpolation = 0,
+    LinearInterpolation = 1,
+    WindowedSincInterpolation = 2
+};
+
+/* push constants of resample.comp.glsl */
+struct ResamplePushConstants {
+    float outputToInput[16]; // row major, like vtkMatrix4x4
+    uint32_t inputDimensions[3];
+    float backgroundValue;
+    uint32_t outputDimensions[3];
+    uint32_t outputOffset;
+};
+
+/*
+Fill getInput() with the float input volume, addSlab() for each output
+(its IJK to input IJK matrix and dimensions), run(), and read each slab
+from getOutput() at the voxel offset addSlab() returned.  Slabs stay
+queued until clearSlabs(), so a fixed set of slice views can simply be
+run() again after the input changes.
+*/
+class Resampler : public ComputeAlgorithm {
+    protected:
+        uint32_t inputDimensions[3];
+        VkDeviceSize outputCapacity;
+        VkDeviceSize outputUsed = 0;
+        Interpolation interpolation = LinearInterpolation;
+        float backgroundValue = 0.f;
+        std::string shaderPath;
+        std::vector<ResamplePushConstants> slabs;
+
+        ComputeBuffer input;
+        ComputeBuffer output;
+        CommandSequence commandSequence;
+        ComputePipeline *pipelines[3] = {nullptr, nullptr, nullptr};
+
+    public:
+        // outputCapacity is the total number of output voxels over all slabs
+        Resampler(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                  VkDeviceSize outputCapacity, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, sizeof(float) * VkDeviceSize(width) * height * depth),
+              output(deviceQueue, sizeof(float) * outputCapacity),
+              commandSequence(deviceQueue) {
+            this->inputDimensions[0] = width;
+            this->inputDimensions[1] = height;
+            this->inputDimensions[2] = depth;
+            this->outputCapacity = outputCapacity;
+            this->shaderPath = shaderPath;
+        }
+
+        virtual ~Resampler() {
+            this->commandSequence.wait();
+            for (ComputePipeline *pipeline : this->pipelines) {
+                delete pipeline;
+            }
+        }
+
+    ComputeBuffer *getInput() {return &(this->input);};
+    VkDeviceSize getOutputCapacity() {return this->outputCapacity;};
+    ComputeBuffer *getOutput() {return &(this->output);};
+    uint32_t getSlabCount() {return (uint32_t)this->slabs.size();};
+
+    void setInterpolation(Interpolation interpolation) {this->interpolation = interpolation;};
+    // value of output voxels that map outside the input
+    void setBackgroundValue(float backgroundValue) {this->backgroundValue = backgroundValue;};
+
+    VkDeviceSize addSlab(const float outputToInput[16], uint32_t width, uint32_t height, uint32_t depth);
+    void clearSlabs() {
+        this->slabs.clear();
+        this->outputUsed = 0;
+    };
+    void run();
+
+    protected:
+        ComputePipeline *getPipeline();
+};
+
+/* Returns the voxel offset of the slab in the output buffer */
+inline VkDeviceSize Resampler::addSlab(const float outputToInput[16], uint32_t width, uint32_t height, uint32_t depth) {
+    VkDeviceSize voxelCount = VkDeviceSize(width) * height * depth;
+    if (this->outputUsed + voxelCount > this->outputCapacity) {
+        throw std::runtime_error("resampler output capacity exceeded");
+    }
+    // the shader indexes the output with 32 bit voxel offsets
+    if (this->outputUsed + voxelCount > (VkDeviceSize(1) << 32)) {
+        throw std::runtime_error("resampler output is more than 2^32 voxels");
+    }
+    ResamplePushConstants slab;
+    memcpy(slab.outputToInput, outputToInput, sizeof(slab.outputToInput));
+    slab.outputDimensions[0] = width;
+    slab.outputDimensions[1] = height;
+    slab.outputDimensions[2] = depth;
+    slab.outputOffset = (uint32_t)this->outputUsed;
+    this->slabs.push_back(slab);
+    this->outputUsed += voxelCount;
+    return slab.outputOffset;
+}
+
+inline ComputePipeline *Resampler::getPipeline() {
+    if (this->pipelines[this->interpolation] == nullptr) {
+        std::vector<uint32_t> specialization = {this->interpolation};
+        ComputePipeline *pipeline = new ComputePipeline(this->deviceQueue,
+            createShaderModule(this->deviceQueue->getDevice(), "resample", this->shaderPath),
+            2, sizeof(ResamplePushConstants), specialization);
+        pipeline->bindBuffer(0, &(this->input));
+        pipeline->bindBuffer(1, &(this->output));
+        this->pipelines[this->interpolation] = pipeline;
+    }
+    return this->pipelines[this->interpolation];
+}
+
+/* All slabs in one command buffer and one submission */
+inline void Resampler::run() {
+    ComputePipeline *pipeline = getPipeline();
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    for (ResamplePushConstants &slab : this->slabs) {
+        for (int axis = 0; axis < 3; ++axis) {
+            slab.inputDimensions[axis] = this->inputDimensions[axis];
+        }
+        slab.backgroundValue = this->backgroundValue;
+        // the 16x16 tiles of every slice in a linear dispatch, the z axis included
+        uint64_t tiles = uint64_t(groupCount(slab.outputDimensions[0], 16)) * groupCount(slab.outputDimensions[1], 16)
+                         * slab.outputDimensions[2];
+        pipeline->recordLinear(commandBuffer, tiles * 256, 256, &slab);
+    }
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,311 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Getting SPIR-V into shader modules.
+ *
+ * Shaders compiled at build time are embedded as constexpr word arrays
+ * in the generated vudoShaders.h (see CMake/vudoEmbedSPIRV.cmake), so
+ * a cold start needs no shader file I/O.  External .spv files are
+ * memory mapped rather than copied.  Either way the words are checked
+ * before they are handed to vkCreateShaderModule.
+ */
+
+#ifndef __vudoSPIRV_h
+#define __vudoSPIRV_h
+
+#include "vudo.h"
+
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+// keep windows.h from defining min and max macros, which break std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vudo {
+
+struct EmbeddedShader {
+    const char *name;
+    const uint32_t *words;
+    size_t wordCount;
+};
+
+} // end of namespace vudo
+
+#if defined(__has_include)
+#if __has_include("vudoShaders.h")
+#include "vudoShaders.h"
+#define VUDO_HAS_EMBEDDED_SHADERS 1
+#endif
+#endif
+
+namespace vudo {
+
+const uint32_t SPIRVMagic = 0x07230203;
+
+/*
+Cheap structural check of a SPIR-V module: header, version, and that
+the instruction stream walks cleanly to the end and declares a
+GLCompute entry point.  Returns false with a reason in error.
+*/
+inline bool validateSPIRV(const uint32_t *words, size_t wordCount, std::string &error) {
+    if (words == nullptr || wordCount < 5) {
+        error = "SPIR-V is shorter than its header";
+        return false;
+    }
+    if (words[0] != SPIRVMagic) {
+        if (words[0] == 0x03022307) {
+            error = "SPIR-V has the wrong endianness";
+        } else {
+            error = "not SPIR-V (bad magic number)";
+        }
+        return false;
+    }
+    uint32_t version = words[1];
+    uint32_t major = (version >> 16) & 0xff;
+    uint32_t minor = (version >> 8) & 0xff;
+    if ((version & 0xff0000ff) != 0 || major != 1 || minor > 6) {
+        error = "unsupported SPIR-V version";
+        return false;
+    }
+    if (words[3] == 0) {
+        error = "SPIR-V id bound is zero";
+        return false;
+    }
+    if (words[4] != 0) {
+        error = "SPIR-V schema is not zero";
+        return false;
+    }
+
+    const uint32_t OpEntryPoint = 15;
+    const uint32_t ExecutionModelGLCompute = 5;
+    bool foundComputeEntryPoint = false;
+    size_t position = 5;
+    while (position < wordCount) {
+        uint32_t instructionWordCount = words[position] >> 16;
+        uint32_t opcode = words[position] & 0xffff;
+        if (instructionWordCount == 0 || position + instructionWordCount > wordCount) {
+            error = "SPIR-V instruction stream is truncated";
+            return false;
+        }
+        if (opcode == OpEntryPoint && instructionWordCount > 1
+            && words[position + 1] == ExecutionModelGLCompute) {
+            foundComputeEntryPoint = true;
+        }
+        position += instructionWordCount;
+    }
+    if (!foundComputeEntryPoint) {
+        error = "SPIR-V has no GLCompute entry point";
+        return false;
+    }
+    return true;
+}
+
+/*
+A view of SPIR-V words, either pointing at an embedded array or at a
+read-only memory mapping of a .spv file.  The mapping lives as long
+as the ShaderCode.
+*/
+class ShaderCode {
+    protected:
+        const uint32_t *words = nullptr;
+        size_t wordCount = 0;
+        void *mapping = nullptr;
+        size_t mappingSize = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE fileMapping = NULL;
+#endif
+
+    public:
+        ShaderCode() {
+        }
+
+        ShaderCode(const ShaderCode &) = delete;
+        ShaderCode &operator=(const ShaderCode &) = delete;
+
+        ~ShaderCode() {
+            release();
+        }
+
+    const uint32_t *getWords() {return this->words;};
+    size_t getWordCount() {return this->wordCount;};
+    size_t getByteCount() {return this->wordCount * sizeof(uint32_t);};
+
+    bool loadEmbedded(const std::string &name);
+    void mapFile(const std::string &path);
+    void release();
+};
+
+/* 64 bit FNV-1a of SPIR-V words, identifies a compiled shader in cache keys */
+inline uint64_t hashWords(const uint32_t *words, size_t wordCount) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t index = 0; index < wordCount; ++index) {
+        for (int byte = 0; byte < 4; ++byte) {
+            hash ^= (words[index] >> (8 * byte)) & 0xffu;
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+inline bool hasEmbeddedShader(const std::string &name) {
+#ifdef VUDO_HAS_EMBEDDED_SHADERS
+    for (size_t index = 0; index < embeddedShaderCount; ++index) {
+        if (name == embeddedShaderTable[index].name) {
+            return true;
+        }
+    }
+#else
+    (void)name;
+#endif
+    return false;
+}
+
+inline bool ShaderCode::loadEmbedded(const std::string &name) {
+#ifdef VUDO_HAS_EMBEDDED_SHADERS
+    for (size_t index = 0; index < embeddedShaderCount; ++index) {
+        if (name == embeddedShaderTable[index].name) {
+            release();
+            this->words = embeddedShaderTable[index].words;
+            this->wordCount = embeddedShaderTable[index].wordCount;
+            return true;
+        }
+    }
+#else
+    (void)name;
+#endif
+    return false;
+}
+
+inline void ShaderCode::mapFile(const std::string &path) {
+    release();
+#ifdef _WIN32
+    this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (this->file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not find or open file: " + path);
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(this->file, &fileSize)) {
+        release();
+        throw std::runtime_error("Could not get the size of file: " + path);
+    }
+    this->mappingSize = (size_t)fileSize.QuadPart;
+    if (this->mappingSize > 0) {
+        this->fileMapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (this->fileMapping != NULL) {
+            this->mapping = MapViewOfFile(this->fileMapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (this->mapping == nullptr) {
+            release();
+            throw std::runtime_error("Could not map file: " + path);
+        }
+    }
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("Could not find or open file: " + path);
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0) {
+        close(descriptor);
+        throw std::runtime_error("Could not stat file: " + path);
+    }
+    this->mappingSize = (size_t)status.st_size;
+    if (this->mappingSize > 0) {
+        void *address = mmap(nullptr, this->mappingSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address == MAP_FAILED) {
+            close(descriptor);
+            this->mappingSize = 0;
+            throw std::runtime_error("Could not map file: " + path);
+        }
+        this->mapping = address;
+    }
+    close(descriptor); // the mapping keeps the file alive
+#endif
+    if (this->mappingSize % sizeof(uint32_t) != 0) {
+        release();
+        throw std::runtime_error("SPIR-V file size is not a multiple of 4: " + path);
+    }
+    this->words = static_cast<const uint32_t *>(this->mapping);
+    this->wordCount = this->mappingSize / sizeof(uint32_t);
+}
+
+inline void ShaderCode::release() {
+#ifdef _WIN32
+    if (this->mapping != nullptr) {
+        UnmapViewOfFile(this->mapping);
+    }
+    if (this->fileMapping != NULL) {
+        CloseHandle(this->fileMapping);
+        this->fileMapping = NULL;
+    }
+    if (this->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (this->mapping != nullptr) {
+        munmap(this->mapping, this->mappingSize);
+    }
+#endif
+    this->mapping = nullptr;
+    this->mappingSize = 0;
+    this->words = nullptr;
+    this->wordCount = 0;
+}
+
+/*
+Validate and create a shader module.  Invalid code never reaches the
+driver, it is reported with a runtime_error instead.
+*/
+inline VkShaderModule createShaderModule(VkDevice device, const uint32_t *words, size_t wordCount) {
+    std::string error;
+    if (!validateSPIRV(words, wordCount, error)) {
+        throw std::runtime_error("Invalid SPIR-V: " + error);
+    }
+    VkShaderModuleCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.pCode = words;
+    createInfo.codeSize = wordCount * sizeof(uint32_t);
+
+    VkShaderModule shaderModule;
+    vkcheck(vkCreateShaderModule(device, &createInfo, NULL, &shaderModule));
+    return shaderModule;
+}
+
+inline VkShaderModule createShaderModule(VkDevice device, ShaderCode &code) {
+    return createShaderModule(device, code.getWords(), code.getWordCount());
+}
+
+/*
+The mapped file when a path is given (e.g. a freshly compiled shader),
+otherwise the code embedded under name.
+*/
+inline VkShaderModule createShaderModule(VkDevice device, const std::string &name, const std::string &path) {
+    ShaderCode code;
+    if (!path.empty()) {
+        code.mapFile(path);
+    } else if (!code.loadEmbedded(name)) {
+        throw std::runtime_error("No SPIR-V path given and no embedded shader named " + name);
+    }
+    return createShaderModule(device, code);
+}
+
+} // end of namespace vudo
+
+#endif
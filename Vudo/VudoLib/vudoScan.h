@@ -0,0 +1,221 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Exclusive prefix sum (scan) of uint32_t buffers on the device, the
+ * building block for stream compaction and for sizing variable length
+ * outputs such as marching cubes vertices.
+ */
+
+#ifndef __vudoScan_h
+#define __vudoScan_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+#include <map>
+
+namespace vudo {
+
+/* push constants of scan.comp.glsl */
+struct ScanPushConstants {
+    uint32_t count;
+};
+
+enum ScanAlgorithm : uint32_t {
+    ReduceThenScan = 0,
+    DecoupledLookback = 1
+};
+
+/*
+Scans up to capacity values in place: values[i] becomes the sum of
+values[0..i).  Blocks of 1024 values are scanned in shared memory.
+
+With DecoupledLookback (the default) each block gets its offset from the
+blocks before it in the same pass, so the values are read and written
+once.  This relies on running workgroups making progress while others
+wait for them, which GPUs provide in practice; ReduceThenScan does not,
+and instead scans the block totals recursively (three levels cover 2^30
+values) and adds them back.
+
+The total can be copied into any buffer, so a consumer never has to wait
+for the host.  record() can be called for several buffers in one command
+sequence; each call gets its own descriptor sets (up to maxBuffers
+buffers).
+*/
+class ExclusiveScan : public ComputeAlgorithm {
+    protected:
+        static const uint32_t maxBuffers = 8;
+        uint32_t capacity;
+        ScanAlgorithm algorithm = DecoupledLookback;
+        std::vector<ComputeBuffer *> blockSums; // one buffer per level
+        ComputeBuffer partitionState; // counter, then {flag, aggregate, inclusive prefix} per block
+        ComputePipeline scanBlocks;
+        ComputePipeline addBlocks;
+        ComputePipeline lookback;
+        CommandSequence commandSequence;
+
+        // keyed by {values buffer, level}
+        std::map<std::pair<ComputeBuffer *, uint32_t>, VkDescriptorSet> scanSets;
+        std::map<std::pair<ComputeBuffer *, uint32_t>, VkDescriptorSet> addSets;
+        std::map<ComputeBuffer *, VkDescriptorSet> lookbackSets;
+
+    public:
+        // scan.comp.glsl's WORKGROUP_SIZE and WORKGROUP_SIZE * ELEMENTS_PER_INVOCATION
+        static const uint32_t workgroupSize = 256;
+        static const uint32_t blockSize = 1024;
+
+        ExclusiveScan(DeviceQueue *deviceQueue, uint32_t capacity, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              partitionState(deviceQueue, sizeof(uint32_t) * (1 + 3 * VkDeviceSize(groupCount(capacity, blockSize))),
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              scanBlocks(deviceQueue, createShaderModule(deviceQueue->getDevice(), "scan", shaderPath),
+                         2, sizeof(ScanPushConstants), {0}, 4 * maxBuffers),
+              addBlocks(deviceQueue, createShaderModule(deviceQueue->getDevice(), "scan", shaderPath),
+                        2, sizeof(ScanPushConstants), {1}, 4 * maxBuffers),
+              lookback(deviceQueue, createShaderModule(deviceQueue->getDevice(), "scan", shaderPath),
+                       2, sizeof(ScanPushConstants), {2}, maxBuffers),
+              commandSequence(deviceQueue) {
+            this->capacity = capacity;
+            uint32_t count = capacity > 0 ? capacity : 1;
+            do {
+                count = groupCount(count, blockSize);
+                this->blockSums.push_back(new ComputeBuffer(deviceQueue, sizeof(uint32_t) * VkDeviceSize(count),
+                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+            } while (count > 1);
+        }
+
+        virtual ~ExclusiveScan() {
+            this->commandSequence.wait();
+            for (ComputeBuffer *buffer : this->blockSums) {
+                delete buffer;
+            }
+        }
+
+    uint32_t getCapacity() {return this->capacity;};
+    ScanAlgorithm getAlgorithm() {return this->algorithm;};
+    void setAlgorithm(ScanAlgorithm algorithm) {this->algorithm = algorithm;};
+
+    void record(CommandSequence *commandSequence, ComputeBuffer *values, uint32_t count,
+                ComputeBuffer *total = nullptr, VkDeviceSize totalOffset = 0);
+    void run(ComputeBuffer *values, uint32_t count, ComputeBuffer *total = nullptr, VkDeviceSize totalOffset = 0);
+
+    protected:
+        void recordLookback(CommandSequence *commandSequence, ComputeBuffer *values, uint32_t count,
+                            ComputeBuffer *total, VkDeviceSize totalOffset);
+        VkDescriptorSet getDescriptorSet(ComputePipeline *pipeline,
+                                         std::map<std::pair<ComputeBuffer *, uint32_t>, VkDescriptorSet> &sets,
+                                         ComputeBuffer *values, uint32_t level);
+};
+
+inline VkDescriptorSet ExclusiveScan::getDescriptorSet(ComputePipeline *pipeline,
+                                                       std::map<std::pair<ComputeBuffer *, uint32_t>, VkDescriptorSet> &sets,
+                                                       ComputeBuffer *values, uint32_t level) {
+    auto key = std::make_pair(values, level);
+    auto found = sets.find(key);
+    if (found != sets.end()) {
+        return found->second;
+    }
+    if (sets.size() >= 4 * maxBuffers) {
+        throw std::runtime_error("scan used with too many different buffers");
+    }
+    VkDescriptorSet descriptorSet = sets.empty() ? pipeline->getDescriptorSet() : pipeline->allocateDescriptorSet();
+    pipeline->bindBuffer(descriptorSet, 0, level == 0 ? values : this->blockSums[level - 1]);
+    pipeline->bindBuffer(descriptorSet, 1, this->blockSums[level]);
+    sets[key] = descriptorSet;
+    return descriptorSet;
+}
+
+/*
+Record the scan of the first count values into a sequence that has been
+begun, optionally copying the total (a uint32_t) to total at totalOffset.
+Ends with a barrier.
+*/
+inline void ExclusiveScan::record(CommandSequence *commandSequence, ComputeBuffer *values, uint32_t count,
+                                  ComputeBuffer *total, VkDeviceSize totalOffset) {
+    if (count > this->capacity) {
+        throw std::runtime_error("scan count exceeds its capacity");
+    }
+    VkCommandBuffer commandBuffer = commandSequence->getCommandBuffer();
+    if (count == 0) {
+        if (total != nullptr) {
+            commandSequence->fillBuffer(total, 0, totalOffset, sizeof(uint32_t));
+            commandSequence->barrier();
+        }
+        return;
+    }
+
+    if (this->algorithm == DecoupledLookback) {
+        recordLookback(commandSequence, values, count, total, totalOffset);
+        return;
+    }
+
+    // scan up the levels until a single block holds everything
+    std::vector<uint32_t> counts = {count};
+    uint32_t level = 0;
+    while (true) {
+        ScanPushConstants parameters = {counts[level]};
+        uint32_t blocks = groupCount(counts[level], blockSize);
+        this->scanBlocks.recordLinear(commandBuffer, VkDeviceSize(blocks) * workgroupSize, workgroupSize, &parameters,
+                                      getDescriptorSet(&(this->scanBlocks), this->scanSets, values, level));
+        commandSequence->barrier();
+        if (blocks == 1) {
+            break;
+        }
+        counts.push_back(blocks);
+        ++level;
+    }
+    if (total != nullptr) {
+        commandSequence->copyBuffer(this->blockSums[level], total, sizeof(uint32_t), 0, totalOffset);
+        commandSequence->barrier();
+    }
+
+    // and add the scanned block sums back down
+    while (level > 0) {
+        --level;
+        ScanPushConstants parameters = {counts[level]};
+        uint32_t blocks = groupCount(counts[level], blockSize);
+        this->addBlocks.recordLinear(commandBuffer, VkDeviceSize(blocks) * workgroupSize, workgroupSize, &parameters,
+                                     getDescriptorSet(&(this->addBlocks), this->addSets, values, level));
+        commandSequence->barrier();
+    }
+}
+
+inline void ExclusiveScan::recordLookback(CommandSequence *commandSequence, ComputeBuffer *values, uint32_t count,
+                                          ComputeBuffer *total, VkDeviceSize totalOffset) {
+    auto found = this->lookbackSets.find(values);
+    if (found == this->lookbackSets.end()) {
+        if (this->lookbackSets.size() >= maxBuffers) {
+            throw std::runtime_error("scan used with too many different buffers");
+        }
+        VkDescriptorSet descriptorSet = this->lookbackSets.empty() ? this->lookback.getDescriptorSet()
+                                                                   : this->lookback.allocateDescriptorSet();
+        this->lookback.bindBuffer(descriptorSet, 0, values);
+        this->lookback.bindBuffer(descriptorSet, 1, &(this->partitionState));
+        found = this->lookbackSets.insert(std::make_pair(values, descriptorSet)).first;
+    }
+
+    uint32_t blocks = groupCount(count, blockSize);
+    commandSequence->fillBuffer(&(this->partitionState), 0, 0, sizeof(uint32_t) * (1 + 3 * VkDeviceSize(blocks)));
+    commandSequence->barrier();
+    ScanPushConstants parameters = {count};
+    this->lookback.recordLinear(commandSequence->getCommandBuffer(), VkDeviceSize(blocks) * workgroupSize,
+                                workgroupSize, &parameters, found->second);
+    commandSequence->barrier();
+    if (total != nullptr) {
+        // the inclusive prefix of the last block
+        commandSequence->copyBuffer(&(this->partitionState), total, sizeof(uint32_t),
+                                    sizeof(uint32_t) * (3 * VkDeviceSize(blocks)), totalOffset);
+        commandSequence->barrier();
+    }
+}
+
+inline void ExclusiveScan::run(ComputeBuffer *values, uint32_t count, ComputeBuffer *total, VkDeviceSize totalOffset) {
+    this->commandSequence.begin();
+    record(&(this->commandSequence), values, count, total, totalOffset);
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Streaming a volume file through a pipeline of filters a slab of
+ * slices at a time, the engine of the headless VudoCLI.
+ */
+
+#ifndef __vudoSlabPipeline_h
+#define __vudoSlabPipeline_h
+
+#include "vudo.h"
+#include "vudoStencil.h"
+#include "vudoThreshold.h"
+#include "vudoVolumeFile.h"
+
+#include <chrono>
+#include <map>
+
+namespace vudo {
+
+enum SlabStageType : uint32_t {
+    ThresholdStage = 0,
+    GaussianStage = 1,
+    BoxStage = 2,
+    GradientMagnitudeStage = 3
+};
+
+/*
+One filter of a SlabPipeline.  parameters are the threshold's threshold,
+outsideValue, scale and shift, the Gaussian's sigmas or the box radii
+(in voxels).  outputType only applies to a threshold ending the pipeline,
+every other stage produces float32.
+*/
+struct SlabStage {
+    SlabStageType type;
+    float parameters[4];
+    ScalarType outputType;
+};
+
+/*
+Runs its stages over each slab of a volume and writes the result as it
+goes, so the host holds only a slab (in the filters' host visible
+buffers plus one staging copy), never the volume.
+
+The stencil stages reach across slab boundaries, so each slab is read
+with halo slices on both sides: as many as the z radii of all the
+stencils together.  Outside the volume the edge slice is repeated,
+which is what the stencils' clamp boundary would read, and it is
+repeated again between stages, so the result equals filtering the
+whole volume at once.  Only the inner slices of the last stage are
+written.
+
+A threshold first in the pipeline reads the file's type as stored;
+stencils read float32, converted on the host.  Between stages the
+slab is copied device side.  The threshold, stencil and layout shaders
+are the embedded ones unless setShaderPath() gives their SPIR-V files.
+*/
+class SlabPipeline : public ComputeAlgorithm {
+    protected:
+        std::vector<SlabStage> stages;
+        std::map<std::string, std::string> shaderPaths;
+        CommandSequence commandSequence;
+
+        // statistics of the last run
+        uint32_t slabCount = 0;
+        uint64_t bytesRead = 0;
+        uint64_t bytesWritten = 0;
+        double readSeconds = 0.;
+        double computeSeconds = 0.;
+        double writeSeconds = 0.;
+        double totalSeconds = 0.;
+
+    public:
+        SlabPipeline(DeviceQueue *deviceQueue)
+            : ComputeAlgorithm(deviceQueue),
+              commandSequence(deviceQueue) {
+        }
+
+    void setShaderPath(const std::string &name, const std::string &path) {this->shaderPaths[name] = path;};
+    std::string getShaderPath(const std::string &name) {
+        auto found = this->shaderPaths.find(name);
+        return found == this->shaderPaths.end() ? "" : found->second;
+    };
+
+    // voxels at or above threshold become value * scale + shift, the others outsideValue
+    void addThreshold(float threshold, float outsideValue = 0.f, float scale = 1.f, float shift = 0.f,
+                      ScalarType outputType = Float32) {
+        this->stages.push_back({ThresholdStage, {threshold, outsideValue, scale, shift}, outputType});
+    };
+    void addGaussian(float sigmaX, float sigmaY, float sigmaZ) {
+        this->stages.push_back({GaussianStage, {sigmaX, sigmaY, sigmaZ, 0.f}, Float32});
+    };
+    void addBox(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+        this->stages.push_back({BoxStage, {float(radiusX), float(radiusY), float(radiusZ), 0.f}, Float32});
+    };
+    void addGradientMagnitude() {
+        this->stages.push_back({GradientMagnitudeStage, {0.f, 0.f, 0.f, 0.f}, Float32});
+    };
+    void clearStages() {this->stages.clear();};
+    uint32_t getStageCount() {return uint32_t(this->stages.size());};
+
+    // the slices a stage reads beyond each side of the slice it writes
+    static uint32_t stageHalo(const SlabStage &stage) {
+        switch (stage.type) {
+            case GaussianStage: return stage.parameters[2] > 0.f ? (uint32_t)std::ceil(3.f * stage.parameters[2]) : 0;
+            case BoxStage: return uint32_t(stage.parameters[2]);
+            case GradientMagnitudeStage: return 1;
+            default: return 0;
+        }
+    };
+    uint32_t getHalo() {
+        uint32_t halo = 0;
+        for (const SlabStage &stage : this->stages) {
+            halo += stageHalo(stage);
+        }
+        return halo;
+    };
+    ScalarType getOutputType(ScalarType inputType) {
+        if (this->stages.empty()) {
+            return inputType;
+        }
+        const SlabStage &last = this->stages.back();
+        return last.type == ThresholdStage ? last.outputType : Float32;
+    };
+
+    /*
+    Stream every slab of at most slabSlices slices from source (a
+    VolumeFileReader or a MappedVolume) to writer, which must have been
+    created with getOutputType() and the source's dimensions.
+    */
+    void run(VolumeSource *source, VolumeFileWriter *writer, uint32_t slabSlices);
+
+    uint32_t getSlabCount() {return this->slabCount;};
+    uint64_t getBytesRead() {return this->bytesRead;};
+    uint64_t getBytesWritten() {return this->bytesWritten;};
+    double getReadSeconds() {return this->readSeconds;};
+    double getComputeSeconds() {return this->computeSeconds;};
+    double getWriteSeconds() {return this->writeSeconds;};
+    double getTotalSeconds() {return this->totalSeconds;};
+    // input megabytes per second of wall time, reading to writing
+    double getThroughput() {
+        return this->totalSeconds > 0. ? this->bytesRead / this->totalSeconds / 1e6 : 0.;
+    };
+
+    protected:
+        // copy source rows [validFirst, validEnd) to destination, repeating the edge rows outside them
+        void recordEdgeCopy(ComputeBuffer *source, ComputeBuffer *destination, VkDeviceSize rowBytes,
+                            uint32_t rowCount, uint32_t validFirst, uint32_t validEnd);
+};
+
+template <typename T>
+inline void convertSlices(const void *source, float *destination, uint64_t voxelCount) {
+    const T *values = static_cast<const T *>(source);
+    for (uint64_t voxel = 0; voxel < voxelCount; ++voxel) {
+        destination[voxel] = float(values[voxel]);
+    }
+}
+
+/* voxels of a stored type as float32, for the stencils */
+inline void convertToFloat(ScalarType scalarType, const void *source, float *destination, uint64_t voxelCount) {
+    switch (scalarType) {
+        case UInt8: convertSlices<uint8_t>(source, destination, voxelCount); break;
+        case Int8: convertSlices<int8_t>(source, destination, voxelCount); break;
+        case UInt16: convertSlices<uint16_t>(source, destination, voxelCount); break;
+        case Int16: convertSlices<int16_t>(source, destination, voxelCount); break;
+        case UInt32: convertSlices<uint32_t>(source, destination, voxelCount); break;
+        case Int32: convertSlices<int32_t>(source, destination, voxelCount); break;
+        case Float32: memcpy(destination, source, voxelCount * sizeof(float)); break;
+        default: throw std::runtime_error("no float conversion for this scalar type");
+    }
+}
+
+inline void SlabPipeline::recordEdgeCopy(ComputeBuffer *source, ComputeBuffer *destination, VkDeviceSize rowBytes,
+                                         uint32_t rowCount, uint32_t validFirst, uint32_t validEnd) {
+    this->commandSequence.copyBuffer(source, destination, rowBytes * (validEnd - validFirst),
+                                     rowBytes * validFirst, rowBytes * validFirst);
+    for (uint32_t row = 0; row < rowCount; ++row) {
+        if (row < validFirst || row >= validEnd) {
+            uint32_t edge = row < validFirst ? validFirst : validEnd - 1;
+            this->commandSequence.copyBuffer(source, destination, rowBytes, rowBytes * edge, rowBytes * row);
+        }
+    }
+}
+
+inline void SlabPipeline::run(VolumeSource *source, VolumeFileWriter *writer, uint32_t slabSlices) {
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    Clock::time_point runStart = Clock::now();
+    this->slabCount = 0;
+    this->bytesRead = 0;
+    this->bytesWritten = 0;
+    this->readSeconds = this->computeSeconds = this->writeSeconds = 0.;
+
+    const VolumeFileInfo &info = source->getInfo();
+    uint32_t width = info.dimensions[0], height = info.dimensions[1], depth = info.dimensions[2];
+    if (this->stages.empty()) {
+        throw std::runtime_error("the slab pipeline has no stages");
+    }
+    if (writer->getInfo().scalarType != getOutputType(info.scalarType)) {
+        throw std::runtime_error("the output file's scalar type is not the pipeline's output type");
+    }
+    uint32_t halo = getHalo();
+    slabSlices = std::max(1u, std::min(slabSlices, depth));
+    uint32_t rowCount = slabSlices + 2 * halo; // slices in each filter's buffers
+    uint64_t sliceVoxels = uint64_t(width) * height;
+    if (sliceVoxels * rowCount > UINT32_MAX) {
+        throw std::runtime_error("a slab with its halo has more than 2^32 voxels, use fewer slices");
+    }
+    uint32_t voxelCount = uint32_t(sliceVoxels * rowCount);
+
+    // one filter per stage, sized for a whole slab with its halo
+    std::vector<ThresholdFilter *> thresholds(this->stages.size(), nullptr);
+    std::vector<StencilFilter *> stencils(this->stages.size(), nullptr);
+    std::vector<ComputeBuffer *> inputs, outputs;
+    std::vector<ScalarType> inputTypes;
+    for (size_t index = 0; index < this->stages.size(); ++index) {
+        const SlabStage &stage = this->stages[index];
+        bool last = index + 1 == this->stages.size();
+        if (stage.type == ThresholdStage) {
+            ScalarType inputType = index == 0 ? info.scalarType : Float32;
+            ThresholdFilter *threshold = new ThresholdFilter(this->deviceQueue, inputType,
+                                                             last ? stage.outputType : Float32,
+                                                             voxelCount, getShaderPath("threshold"));
+            threshold->setThreshold(stage.parameters[0]);
+            threshold->setOutsideValue(stage.parameters[1]);
+            threshold->setRescale(stage.parameters[2], stage.parameters[3]);
+            thresholds[index] = threshold;
+            inputs.push_back(threshold->getInput());
+            outputs.push_back(threshold->getOutput());
+            inputTypes.push_back(inputType);
+        } else {
+            StencilFilter *stencil = new StencilFilter(this->deviceQueue, width, height, rowCount,
+                                                       getShaderPath("stencil"), Float32, LinearLayout,
+                                                       getShaderPath("layout"));
+            stencil->setSpacing(float(info.spacing[0]), float(info.spacing[1]), float(info.spacing[2]));
+            stencils[index] = stencil;
+            inputs.push_back(stencil->getInput());
+            outputs.push_back(stencil->getOutput());
+            inputTypes.push_back(Float32);
+        }
+    }
+
+    uint64_t fileSliceBytes = info.getSliceBytes();
+    uint64_t bufferSliceBytes = sliceVoxels * scalarTypeSize(inputTypes[0]);
+    std::vector<uint8_t> staging(fileSliceBytes * rowCount);
+    uint8_t *firstInput = static_cast<uint8_t *>(inputs[0]->map());
+
+    try {
+        for (uint32_t slabFirst = 0; slabFirst < depth; slabFirst += slabSlices) {
+            uint32_t slabEnd = std::min(depth, slabFirst + slabSlices);
+            // buffer row r holds volume slice slabFirst - halo + r, rows [validFirst, validEnd) are in the volume
+            int64_t bufferFirst = int64_t(slabFirst) - halo;
+            uint32_t readFirst = uint32_t(std::max<int64_t>(0, bufferFirst));
+            uint32_t readEnd = std::min<uint32_t>(depth, slabEnd + halo);
+            uint32_t validFirst = uint32_t(readFirst - bufferFirst);
+            uint32_t validEnd = uint32_t(readEnd - bufferFirst);
+
+            Clock::time_point start = Clock::now();
+            source->readSlices(readFirst, readEnd - readFirst, staging.data());
+            for (uint32_t row = 0; row < rowCount; ++row) {
+                uint32_t source = std::min(std::max(row, validFirst), validEnd - 1) - validFirst;
+                const uint8_t *slice = staging.data() + fileSliceBytes * source;
+                uint8_t *destination = firstInput + bufferSliceBytes * row;
+                if (inputTypes[0] == info.scalarType) {
+                    memcpy(destination, slice, fileSliceBytes);
+                } else {
+                    convertToFloat(info.scalarType, slice, reinterpret_cast<float *>(destination), sliceVoxels);
+                }
+            }
+            this->bytesRead += fileSliceBytes * (slabEnd - slabFirst);
+            this->readSeconds += seconds(start);
+
+            start = Clock::now();
+            for (size_t index = 0; index < this->stages.size(); ++index) {
+                const SlabStage &stage = this->stages[index];
+                if (index > 0) {
+                    this->commandSequence.begin();
+                    recordEdgeCopy(outputs[index - 1], inputs[index], sliceVoxels * sizeof(float),
+                                   rowCount, validFirst, validEnd);
+                    this->commandSequence.barrier();
+                    this->commandSequence.submitAndWait();
+                }
+                switch (stage.type) {
+                    case ThresholdStage:
+                        thresholds[index]->run();
+                        break;
+                    case GaussianStage:
+                        stencils[index]->gaussian(stage.parameters[0], stage.parameters[1], stage.parameters[2]);
+                        break;
+                    case BoxStage:
+                        stencils[index]->box(uint32_t(stage.parameters[0]), uint32_t(stage.parameters[1]),
+                                             uint32_t(stage.parameters[2]));
+                        break;
+                    case GradientMagnitudeStage:
+                        stencils[index]->gradientMagnitude();
+                        break;
+                }
+            }
+            this->computeSeconds += seconds(start);
+
+            start = Clock::now();
+            const uint8_t *result = static_cast<const uint8_t *>(outputs.back()->map());
+            uint64_t outputSliceBytes = writer->getInfo().getSliceBytes();
+            writer->writeSlices(slabEnd - slabFirst, result + outputSliceBytes * halo);
+            this->bytesWritten += outputSliceBytes * (slabEnd - slabFirst);
+            this->writeSeconds += seconds(start);
+            this->slabCount++;
+        }
+    } catch (...) {
+        for (size_t index = 0; index < this->stages.size(); ++index) {
+            delete thresholds[index];
+            delete stencils[index];
+        }
+        throw;
+    }
+
+    for (size_t index = 0; index < this->stages.size(); ++index) {
+        delete thresholds[index];
+        delete stencils[index];
+    }
+    this->totalSeconds = seconds(runStart);
+}
+
+} // end of namespace vudo
+
+#endif
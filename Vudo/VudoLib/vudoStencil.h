@@ -0,0 +1,287 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Shared memory tiled 3D stencils: separable Gaussian and box
+ * smoothing and central difference gradient magnitude.
+ *
+ * One shader (stencil.comp.glsl) covers the whole family.  The operation,
+ * axis, radius, tile size and boundary mode are specialization constants,
+ * and a pipeline is built for each combination the first time it is used.
+ * stencil16.comp.glsl is the same family on 8 and 16-bit storage.
+ */
+
+#ifndef __vudoStencil_h
+#define __vudoStencil_h
+
+#include "vudo.h"
+#include "vudoLayout.h"
+#include "vudoSPIRV.h"
+
+#include <cmath>
+#include <map>
+
+namespace vudo {
+
+enum StencilOperation : uint32_t {
+    GaussianPass = 0,
+    BoxPass = 1,
+    GradientMagnitude = 2
+};
+
+enum BoundaryMode : uint32_t {
+    ClampBoundary = 0,
+    MirrorBoundary = 1,
+    ConstantBoundary = 2
+};
+
+/* push constants of stencil.comp.glsl (std430 packs each vec3 with the scalar after it) */
+struct StencilPushConstants {
+    uint32_t dimensions[3];
+    float sigma;
+    float spacing[3];
+    float constantValue;
+};
+
+/*
+Filters a float volume held in host visible buffers: fill getInput(),
+run an operation, read getOutput().  Separable operations ping-pong
+through a scratch buffer and all their passes go in one submission.
+
+With an inputType other than Float32 (Float16, Int16 or UInt8, on a
+device that hasReducedPrecision()) the input is read as stored and the
+scratch and output are Float16, through stencil16.comp.glsl; shaderPath
+is then that shader's.
+
+With a storage layout other than LinearLayout (float32 only) the passes
+run on bricked or Morton ordered copies: the input is swizzled into the
+scratch buffer, the passes ping-pong between it and a layout output,
+and the result is unswizzled into getOutput(), all in the same
+submission.  layoutShaderPath is that of layout.comp.glsl.
+*/
+class StencilFilter : public ComputeAlgorithm {
+    protected:
+        uint32_t dimensions[3];
+        ScalarType inputType;
+        VolumeLayout layout;
+        uint32_t tileSize[3] = {8, 8, 8};
+        BoundaryMode boundary = ClampBoundary;
+        StencilPushConstants parameters;
+        std::string shaderPath;
+
+        ComputeBuffer input;
+        ComputeBuffer output;
+        ComputeBuffer scratch;
+        ComputeBuffer layoutOutput; // only used by the bricked and Morton layouts
+        LayoutConverter layoutConverter;
+        CommandSequence commandSequence;
+
+        // keyed by {operation, axis, radius, tile x, y, z, boundary}, the layout (or the pass input type
+        // when reduced) and whether the tile and halo fit in shared memory
+        std::map<std::vector<uint32_t>, ComputePipeline *> pipelines;
+
+    public:
+        StencilFilter(DeviceQueue *deviceQueue, uint32_t width, uint32_t height, uint32_t depth,
+                      const std::string &shaderPath = "", ScalarType inputType = Float32,
+                      VolumeLayout layout = LinearLayout, const std::string &layoutShaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, voxelBytes(inputType, VkDeviceSize(width) * height * depth)),
+              output(deviceQueue, voxelBytes(storageType(inputType), VkDeviceSize(width) * height * depth)),
+              scratch(deviceQueue, voxelBytes(storageType(inputType), layoutVoxelCount(layout, width, height, depth)),
+                      layout == LinearLayout ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                             : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              layoutOutput(deviceQueue, layout == LinearLayout ? 4 : 4 * layoutVoxelCount(layout, width, height, depth),
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+              layoutConverter(deviceQueue, width, height, depth, layoutShaderPath),
+              commandSequence(deviceQueue) {
+            if (inputType != Float32 && inputType != Float16 && inputType != Int16 && inputType != UInt8) {
+                throw std::runtime_error("stencil input must be float32, float16, int16 or uint8");
+            }
+            if (inputType != Float32 && !deviceQueue->hasReducedPrecision()) {
+                throw std::runtime_error("the device has no 8/16-bit storage and float16 arithmetic");
+            }
+            if (inputType != Float32 && layout != LinearLayout) {
+                throw std::runtime_error("bricked and Morton stencils are float32 only");
+            }
+            this->inputType = inputType;
+            this->layout = layout;
+            this->dimensions[0] = width;
+            this->dimensions[1] = height;
+            this->dimensions[2] = depth;
+            this->shaderPath = shaderPath;
+            for (int axis = 0; axis < 3; ++axis) {
+                this->parameters.dimensions[axis] = this->dimensions[axis];
+                this->parameters.spacing[axis] = 1.f;
+            }
+            this->parameters.sigma = 1.f;
+            this->parameters.constantValue = 0.f;
+        }
+
+        virtual ~StencilFilter() {
+            this->commandSequence.wait();
+            for (auto &entry : this->pipelines) {
+                delete entry.second;
+            }
+        }
+
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getOutput() {return &(this->output);};
+    ScalarType getInputType() {return this->inputType;};
+    ScalarType getOutputType() {return storageType(this->inputType);};
+    VolumeLayout getLayout() {return this->layout;};
+
+    // the type of the output and scratch buffers
+    static ScalarType storageType(ScalarType inputType) {return inputType == Float32 ? Float32 : Float16;};
+    // in whole 32 bit words
+    static VkDeviceSize voxelBytes(ScalarType scalarType, VkDeviceSize voxelCount) {
+        return (VkDeviceSize(scalarTypeSize(scalarType)) * voxelCount + 3) & ~VkDeviceSize(3);
+    };
+
+    void setBoundary(BoundaryMode boundary, float constantValue = 0.f) {
+        this->boundary = boundary;
+        this->parameters.constantValue = constantValue;
+    };
+    // workgroup (and output tile) size, e.g. 32x4x2 favours long rows
+    void setTileSize(uint32_t x, uint32_t y, uint32_t z) {
+        this->tileSize[0] = x;
+        this->tileSize[1] = y;
+        this->tileSize[2] = z;
+    };
+    // only the gradient magnitude uses the spacing
+    void setSpacing(float x, float y, float z) {
+        this->parameters.spacing[0] = x;
+        this->parameters.spacing[1] = y;
+        this->parameters.spacing[2] = z;
+    };
+
+    // standard deviations in voxels, the kernel is cut off at 3 sigma
+    void gaussian(float sigmaX, float sigmaY, float sigmaZ);
+    // mean over (2r+1) voxels along each axis
+    void box(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ);
+    void gradientMagnitude();
+
+    ComputePipeline *getPipeline(StencilOperation operation, uint32_t axis, uint32_t radius);
+    uint64_t getSharedMemorySize(StencilOperation operation, uint32_t axis, uint32_t radius);
+
+    protected:
+        void recordPass(StencilOperation operation, uint32_t axis, uint32_t radius, float sigma);
+        void separable(StencilOperation operation, const uint32_t radius[3], const float sigma[3]);
+        // swizzle the input into the layout, and the result back out of it
+        void beginLayout();
+        void endLayout();
+};
+
+inline uint64_t StencilFilter::getSharedMemorySize(StencilOperation operation, uint32_t axis, uint32_t radius) {
+    uint64_t size = scalarTypeSize(getOutputType());
+    for (uint32_t dimension = 0; dimension < 3; ++dimension) {
+        uint32_t halo = operation == GradientMagnitude ? 1 : (dimension == axis ? radius : 0);
+        size *= this->tileSize[dimension] + 2 * halo;
+    }
+    return size;
+}
+
+inline ComputePipeline *StencilFilter::getPipeline(StencilOperation operation, uint32_t axis, uint32_t radius) {
+    std::vector<uint32_t> specialization = {
+        operation, axis, radius, this->tileSize[0], this->tileSize[1], this->tileSize[2], this->boundary};
+    bool reducedPrecision = this->inputType != Float32;
+    if (!reducedPrecision) {
+        specialization.push_back(this->layout);
+    } else {
+        // only the first pass reads the input, the others the float16 scratch and output
+        bool readsInput = operation == GradientMagnitude || axis == 0;
+        specialization.push_back(readsInput ? this->inputType : Float16);
+    }
+    // a tile and halo too big for shared memory are read from the input buffer instead
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(this->deviceQueue->getPhysicalDevice(), &properties);
+    bool sharedTile = getSharedMemorySize(operation, axis, radius) <= properties.limits.maxComputeSharedMemorySize;
+    specialization.push_back(sharedTile ? 1 : 0);
+    auto found = this->pipelines.find(specialization);
+    if (found != this->pipelines.end()) {
+        return found->second;
+    }
+
+    if (this->tileSize[0] * this->tileSize[1] * this->tileSize[2] > properties.limits.maxComputeWorkGroupInvocations) {
+        throw std::runtime_error("stencil tile has more voxels than a workgroup has invocations");
+    }
+
+    ComputePipeline *pipeline = new ComputePipeline(this->deviceQueue,
+        createShaderModule(this->deviceQueue->getDevice(), reducedPrecision ? "stencil16" : "stencil", this->shaderPath),
+        2, sizeof(StencilPushConstants), specialization);
+    // separable passes run input -> output -> scratch -> output, one axis each,
+    // or in a layout scratch -> layout output -> scratch -> layout output
+    if (this->layout != LinearLayout) {
+        bool fromScratch = operation == GradientMagnitude || axis != 1;
+        pipeline->bindBuffer(0, fromScratch ? &(this->scratch) : &(this->layoutOutput));
+        pipeline->bindBuffer(1, fromScratch ? &(this->layoutOutput) : &(this->scratch));
+    } else if (operation == GradientMagnitude || axis == 0) {
+        pipeline->bindBuffer(0, &(this->input));
+        pipeline->bindBuffer(1, &(this->output));
+    } else if (axis == 1) {
+        pipeline->bindBuffer(0, &(this->output));
+        pipeline->bindBuffer(1, &(this->scratch));
+    } else {
+        pipeline->bindBuffer(0, &(this->scratch));
+        pipeline->bindBuffer(1, &(this->output));
+    }
+    this->pipelines[specialization] = pipeline;
+    return pipeline;
+}
+
+inline void StencilFilter::recordPass(StencilOperation operation, uint32_t axis, uint32_t radius, float sigma) {
+    ComputePipeline *pipeline = getPipeline(operation, axis, radius);
+    this->parameters.sigma = sigma;
+    pipeline->record(this->commandSequence.getCommandBuffer(),
+                     groupCount(this->dimensions[0], this->tileSize[0]),
+                     groupCount(this->dimensions[1], this->tileSize[1]),
+                     groupCount(this->dimensions[2], this->tileSize[2]),
+                     &(this->parameters));
+    this->commandSequence.barrier();
+}
+
+inline void StencilFilter::separable(StencilOperation operation, const uint32_t radius[3], const float sigma[3]) {
+    beginLayout();
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        recordPass(operation, axis, radius[axis], sigma[axis]);
+    }
+    endLayout();
+}
+
+inline void StencilFilter::beginLayout() {
+    this->commandSequence.begin();
+    if (this->layout != LinearLayout) {
+        this->layoutConverter.recordSwizzle(&(this->commandSequence), &(this->input), &(this->scratch), this->layout);
+    }
+}
+
+inline void StencilFilter::endLayout() {
+    if (this->layout != LinearLayout) {
+        this->layoutConverter.recordUnswizzle(&(this->commandSequence), &(this->layoutOutput), &(this->output), this->layout);
+    }
+    this->commandSequence.submitAndWait();
+}
+
+inline void StencilFilter::gaussian(float sigmaX, float sigmaY, float sigmaZ) {
+    float sigma[3] = {sigmaX, sigmaY, sigmaZ};
+    uint32_t radius[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        radius[axis] = sigma[axis] > 0.f ? (uint32_t)std::ceil(3.f * sigma[axis]) : 0;
+    }
+    separable(GaussianPass, radius, sigma);
+}
+
+inline void StencilFilter::box(uint32_t radiusX, uint32_t radiusY, uint32_t radiusZ) {
+    uint32_t radius[3] = {radiusX, radiusY, radiusZ};
+    float sigma[3] = {0.f, 0.f, 0.f};
+    separable(BoxPass, radius, sigma);
+}
+
+inline void StencilFilter::gradientMagnitude() {
+    beginLayout();
+    recordPass(GradientMagnitude, 0, 1, 0.f);
+    endLayout();
+}
+
+} // end of namespace vudo
+
+#endif
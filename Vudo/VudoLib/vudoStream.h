@@ -0,0 +1,354 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Streaming the frames of a sequence through a compute pipeline with
+ * upload, compute and download overlapped.
+ */
+
+#ifndef __vudoStream_h
+#define __vudoStream_h
+
+#include "vudo.h"
+
+namespace vudo {
+
+/*
+Frames go through slotCount (default 3) sets of buffers: a host visible
+input and output for each, and device local copies the pipeline reads
+(binding 0) and writes (binding 1).  Each frame is three submissions
+chained by timeline semaphores, so while frame N computes, frame N+1
+uploads and frame N-1 downloads:
+
+  upload    transfer queue  staging input -> input          signals uploaded = N+1
+  compute   compute queue   waits uploaded, dispatches      signals computed = N+1
+  download  transfer queue  waits computed, output -> staging  signals downloaded = N+1
+
+Uploads and downloads share the transfer queue, which runs its
+submissions in order, so the download of frame N is held back until
+submit(N+1) has queued that frame's upload: otherwise upload N+1 would
+sit behind a download that waits for compute N.  wait(), isComplete()
+and finish() submit a held back download themselves.
+
+The transfer queue is a dedicated (DMA) family when the device has one,
+with queue family ownership of the device buffers handed over in both
+directions.  Without timeline semaphores each frame is one submission
+waited for on a fence, which is correct but does not overlap.
+
+For each frame: n = acquire(), fill getInputStaging(n), submit(n, push
+constants), and once wait(n) returns read getOutputStaging(n).  The
+output of frame n must be read before frame n + slotCount is submitted,
+which acquire() alone does not enforce.
+
+The pipeline needs slotCount descriptor sets (maxDescriptorSets).
+*/
+class FrameStream : public ComputeAlgorithm {
+    protected:
+        ComputePipeline *pipeline;
+        uint32_t slotCount;
+        VkDeviceSize inputBytes;
+        VkDeviceSize outputBytes;
+        uint64_t invocationCount;
+        uint32_t workgroupSize;
+        uint64_t submittedFrames = 0;
+        bool downloadHeld = false; // the download of the last submitted frame is recorded but not submitted
+
+        std::vector<ComputeBuffer *> inputStaging;
+        std::vector<ComputeBuffer *> outputStaging;
+        std::vector<ComputeBuffer *> inputs;
+        std::vector<ComputeBuffer *> outputs;
+        std::vector<VkDescriptorSet> descriptorSets;
+
+        bool timeline;
+        VkCommandPool computePool = VK_NULL_HANDLE;
+        VkCommandPool transferPool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> uploadCommands;
+        std::vector<VkCommandBuffer> computeCommands;
+        std::vector<VkCommandBuffer> downloadCommands;
+        VkSemaphore uploaded = VK_NULL_HANDLE;
+        VkSemaphore computed = VK_NULL_HANDLE;
+        VkSemaphore downloaded = VK_NULL_HANDLE;
+        CommandSequence commandSequence; // without timeline semaphores
+
+    public:
+        // invocationCount invocations of workgroupSize per frame, dispatched with recordLinear
+        FrameStream(DeviceQueue *deviceQueue, ComputePipeline *pipeline,
+                    VkDeviceSize inputBytes, VkDeviceSize outputBytes,
+                    uint64_t invocationCount, uint32_t workgroupSize, uint32_t slotCount = 3)
+            : ComputeAlgorithm(deviceQueue),
+              commandSequence(deviceQueue) {
+            this->pipeline = pipeline;
+            this->slotCount = slotCount > 0 ? slotCount : 1;
+            this->inputBytes = inputBytes;
+            this->outputBytes = outputBytes;
+            this->invocationCount = invocationCount;
+            this->workgroupSize = workgroupSize;
+            this->timeline = deviceQueue->hasTimelineSemaphores();
+
+            for (uint32_t slot = 0; slot < this->slotCount; ++slot) {
+                this->inputStaging.push_back(new ComputeBuffer(deviceQueue, inputBytes));
+                this->outputStaging.push_back(new ComputeBuffer(deviceQueue, outputBytes));
+                this->inputs.push_back(new ComputeBuffer(deviceQueue, inputBytes, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+                this->outputs.push_back(new ComputeBuffer(deviceQueue, outputBytes, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+                VkDescriptorSet descriptorSet = slot == 0 ? pipeline->getDescriptorSet()
+                                                          : pipeline->allocateDescriptorSet();
+                pipeline->bindBuffer(descriptorSet, 0, this->inputs[slot]);
+                pipeline->bindBuffer(descriptorSet, 1, this->outputs[slot]);
+                this->descriptorSets.push_back(descriptorSet);
+            }
+            if (this->timeline) {
+                createCommandBuffers();
+                this->uploaded = deviceQueue->createTimelineSemaphore();
+                this->computed = deviceQueue->createTimelineSemaphore();
+                this->downloaded = deviceQueue->createTimelineSemaphore();
+            }
+        }
+
+        virtual ~FrameStream() {
+            finish();
+            VkDevice device = this->deviceQueue->getDevice();
+            for (VkSemaphore semaphore : {this->uploaded, this->computed, this->downloaded}) {
+                if (semaphore != VK_NULL_HANDLE) {
+                    vkDestroySemaphore(device, semaphore, NULL);
+                }
+            }
+            for (VkCommandPool commandPool : {this->computePool, this->transferPool}) {
+                if (commandPool != VK_NULL_HANDLE) {
+                    vkDestroyCommandPool(device, commandPool, NULL);
+                }
+            }
+            for (auto *buffers : {&(this->inputStaging), &(this->outputStaging), &(this->inputs), &(this->outputs)}) {
+                for (ComputeBuffer *buffer : *buffers) {
+                    delete buffer;
+                }
+            }
+        }
+
+    uint32_t getSlotCount() {return this->slotCount;};
+    bool isOverlapped() {return this->timeline;};
+    uint64_t getSubmittedFrames() {return this->submittedFrames;};
+    ComputeBuffer *getInputStaging(uint64_t frame) {return this->inputStaging[frame % this->slotCount];};
+    ComputeBuffer *getOutputStaging(uint64_t frame) {return this->outputStaging[frame % this->slotCount];};
+
+    uint64_t acquire();
+    void submit(uint64_t frame, const void *pushConstants = nullptr);
+    bool isComplete(uint64_t frame);
+    void wait(uint64_t frame);
+    // wait for every submitted frame
+    void finish() {
+        if (this->submittedFrames > 0) {
+            wait(this->submittedFrames - 1);
+        }
+    };
+
+    protected:
+        void createCommandBuffers();
+        void submitHeldDownload();
+        void ownershipBarrier(VkCommandBuffer commandBuffer, ComputeBuffer *buffer, bool release,
+                              uint32_t sourceFamily, uint32_t destinationFamily,
+                              VkAccessFlags accessMask, VkPipelineStageFlags stage);
+        void queueSubmit(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore,
+                         VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore, uint64_t value);
+};
+
+inline void FrameStream::createCommandBuffers() {
+    VkDevice device = this->deviceQueue->getDevice();
+    VkCommandPool *pools[2] = {&(this->computePool), &(this->transferPool)};
+    uint32_t families[2] = {this->deviceQueue->getQueueFamilyIndex(), this->deviceQueue->getTransferQueueFamilyIndex()};
+    for (uint32_t pool = 0; pool < 2; ++pool) {
+        VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        commandPoolCreateInfo.queueFamilyIndex = families[pool];
+        vkcheck(vkCreateCommandPool(device, &commandPoolCreateInfo, NULL, pools[pool]));
+    }
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = this->slotCount;
+    this->uploadCommands.resize(this->slotCount);
+    this->computeCommands.resize(this->slotCount);
+    this->downloadCommands.resize(this->slotCount);
+    commandBufferAllocateInfo.commandPool = this->transferPool;
+    vkcheck(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, this->uploadCommands.data()));
+    vkcheck(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, this->downloadCommands.data()));
+    commandBufferAllocateInfo.commandPool = this->computePool;
+    vkcheck(vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, this->computeCommands.data()));
+}
+
+/*
+Half of a queue family ownership transfer of the whole buffer: the
+release on the source queue makes accessMask writes available, the
+acquire on the destination queue makes them visible to accessMask.
+*/
+inline void FrameStream::ownershipBarrier(VkCommandBuffer commandBuffer, ComputeBuffer *buffer, bool release,
+                                          uint32_t sourceFamily, uint32_t destinationFamily,
+                                          VkAccessFlags accessMask, VkPipelineStageFlags stage) {
+    VkBufferMemoryBarrier bufferBarrier = {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = release ? accessMask : 0;
+    bufferBarrier.dstAccessMask = release ? 0 : accessMask;
+    bufferBarrier.srcQueueFamilyIndex = sourceFamily;
+    bufferBarrier.dstQueueFamilyIndex = destinationFamily;
+    bufferBarrier.buffer = buffer->getBuffer();
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+    VkPipelineStageFlags sourceStage = release ? stage : VkPipelineStageFlags(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    VkPipelineStageFlags destinationStage = release ? VkPipelineStageFlags(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT) : stage;
+    vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, NULL, 1, &bufferBarrier, 0, NULL);
+}
+
+#ifdef VK_KHR_timeline_semaphore
+inline void FrameStream::queueSubmit(VkQueue queue, VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore,
+                                     VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore, uint64_t value) {
+    VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = {};
+    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineSubmitInfo.waitSemaphoreValueCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    timelineSubmitInfo.pWaitSemaphoreValues = &value;
+    timelineSubmitInfo.signalSemaphoreValueCount = 1;
+    timelineSubmitInfo.pSignalSemaphoreValues = &value;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineSubmitInfo;
+    submitInfo.waitSemaphoreCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &waitSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &signalSemaphore;
+    vkcheck(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+}
+#else
+inline void FrameStream::queueSubmit(VkQueue, VkCommandBuffer, VkSemaphore, VkPipelineStageFlags, VkSemaphore, uint64_t) {
+    throw std::runtime_error("built without timeline semaphore support");
+}
+#endif
+
+/* Returns the next frame number, once the slot it uses has been downloaded */
+inline uint64_t FrameStream::acquire() {
+    uint64_t frame = this->submittedFrames;
+    if (frame >= this->slotCount) {
+        wait(frame - this->slotCount);
+    }
+    return frame;
+}
+
+inline void FrameStream::submit(uint64_t frame, const void *pushConstants) {
+    if (frame != this->submittedFrames) {
+        throw std::runtime_error("frames must be submitted in the order they were acquired");
+    }
+    uint32_t slot = frame % this->slotCount;
+
+    if (!this->timeline) {
+        this->commandSequence.begin();
+        this->commandSequence.copyBuffer(this->inputStaging[slot], this->inputs[slot], this->inputBytes);
+        this->commandSequence.barrier();
+        this->pipeline->recordLinear(this->commandSequence.getCommandBuffer(), this->invocationCount,
+                                     this->workgroupSize, pushConstants, this->descriptorSets[slot]);
+        this->commandSequence.barrier();
+        this->commandSequence.copyBuffer(this->outputs[slot], this->outputStaging[slot], this->outputBytes);
+        this->commandSequence.barrier();
+        this->commandSequence.submitAndWait();
+        this->submittedFrames++;
+        return;
+    }
+
+    uint32_t computeFamily = this->deviceQueue->getQueueFamilyIndex();
+    uint32_t transferFamily = this->deviceQueue->getTransferQueueFamilyIndex();
+    bool handOver = computeFamily != transferFamily;
+    uint64_t value = frame + 1;
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkBufferCopy region = {};
+
+    VkCommandBuffer upload = this->uploadCommands[slot];
+    vkcheck(vkResetCommandBuffer(upload, 0));
+    vkcheck(vkBeginCommandBuffer(upload, &beginInfo));
+    region.size = this->inputBytes;
+    vkCmdCopyBuffer(upload, this->inputStaging[slot]->getBuffer(), this->inputs[slot]->getBuffer(), 1, &region);
+    if (handOver) {
+        ownershipBarrier(upload, this->inputs[slot], true, transferFamily, computeFamily,
+                         VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+    vkcheck(vkEndCommandBuffer(upload));
+    queueSubmit(this->deviceQueue->getTransferQueue(), upload, VK_NULL_HANDLE, 0, this->uploaded, value);
+    // the previous frame's download goes after this upload on the transfer queue
+    submitHeldDownload();
+
+    VkCommandBuffer compute = this->computeCommands[slot];
+    vkcheck(vkResetCommandBuffer(compute, 0));
+    vkcheck(vkBeginCommandBuffer(compute, &beginInfo));
+    if (handOver) {
+        ownershipBarrier(compute, this->inputs[slot], false, transferFamily, computeFamily,
+                         VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+    this->pipeline->recordLinear(compute, this->invocationCount, this->workgroupSize,
+                                 pushConstants, this->descriptorSets[slot]);
+    if (handOver) {
+        ownershipBarrier(compute, this->outputs[slot], true, computeFamily, transferFamily,
+                         VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+    vkcheck(vkEndCommandBuffer(compute));
+    queueSubmit(this->deviceQueue->getQueue(), compute, this->uploaded,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, this->computed, value);
+
+    VkCommandBuffer download = this->downloadCommands[slot];
+    vkcheck(vkResetCommandBuffer(download, 0));
+    vkcheck(vkBeginCommandBuffer(download, &beginInfo));
+    if (handOver) {
+        ownershipBarrier(download, this->outputs[slot], false, computeFamily, transferFamily,
+                         VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    }
+    region.size = this->outputBytes;
+    vkCmdCopyBuffer(download, this->outputs[slot]->getBuffer(), this->outputStaging[slot]->getBuffer(), 1, &region);
+    VkMemoryBarrier hostBarrier = {};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(download, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &hostBarrier, 0, NULL, 0, NULL);
+    vkcheck(vkEndCommandBuffer(download));
+    this->downloadHeld = true;
+
+    this->submittedFrames++;
+}
+
+inline void FrameStream::submitHeldDownload() {
+    if (!this->downloadHeld) {
+        return;
+    }
+    uint64_t frame = this->submittedFrames - 1;
+    queueSubmit(this->deviceQueue->getTransferQueue(), this->downloadCommands[frame % this->slotCount],
+                this->computed, VK_PIPELINE_STAGE_TRANSFER_BIT, this->downloaded, frame + 1);
+    this->downloadHeld = false;
+}
+
+inline bool FrameStream::isComplete(uint64_t frame) {
+    if (!this->timeline) {
+        return frame < this->submittedFrames;
+    }
+    if (frame + 1 == this->submittedFrames) {
+        submitHeldDownload();
+    }
+    return this->deviceQueue->getSemaphoreValue(this->downloaded) >= frame + 1;
+}
+
+inline void FrameStream::wait(uint64_t frame) {
+    if (frame >= this->submittedFrames) {
+        throw std::runtime_error("waiting for a frame that was not submitted");
+    }
+    if (this->timeline) {
+        if (frame + 1 == this->submittedFrames) {
+            submitHeldDownload();
+        }
+        this->deviceQueue->waitSemaphore(this->downloaded, frame + 1);
+    }
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Threshold filter with fused rescale and type cast,
+ * the GPU implementation behind VudoLogic.run.
+ */
+
+#ifndef __vudoThreshold_h
+#define __vudoThreshold_h
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* push constants of threshold.comp.glsl */
+struct ThresholdPushConstants {
+    float threshold;
+    float outsideValue;
+    float scale;
+    float shift;
+    uint32_t voxelCount;
+};
+
+/*
+The input and output buffers are host visible and hold the voxels in
+their native types, so the caller copies the volume straight in and
+out of getInput() / getOutput() with no conversion on the CPU.
+*/
+class ThresholdFilter : public ComputeAlgorithm {
+    protected:
+        ScalarType inputType;
+        ScalarType outputType;
+        uint32_t voxelCount;
+        ThresholdPushConstants parameters;
+
+        ComputeBuffer input;
+        ComputeBuffer output;
+        ComputePipeline pipeline;
+        CommandSequence commandSequence;
+
+    public:
+        ThresholdFilter(DeviceQueue *deviceQueue, ScalarType inputType, ScalarType outputType,
+                        uint32_t voxelCount, const std::string &shaderPath = "")
+            : ComputeAlgorithm(deviceQueue),
+              input(deviceQueue, wordBytes(inputType, voxelCount)),
+              output(deviceQueue, wordBytes(outputType, voxelCount)),
+              pipeline(deviceQueue, createShaderModule(deviceQueue->getDevice(), "threshold", shaderPath),
+                       2, sizeof(ThresholdPushConstants), {inputType, outputType}),
+              commandSequence(deviceQueue) {
+            this->inputType = inputType;
+            this->outputType = outputType;
+            this->voxelCount = voxelCount;
+            this->parameters.threshold = 0.f;
+            this->parameters.outsideValue = 0.f;
+            this->parameters.scale = 1.f;
+            this->parameters.shift = 0.f;
+            this->parameters.voxelCount = voxelCount;
+            this->pipeline.bindBuffer(0, &(this->input));
+            this->pipeline.bindBuffer(1, &(this->output));
+        }
+
+    // whole 32 bit words, the shader reads and writes nothing smaller
+    static VkDeviceSize wordBytes(ScalarType scalarType, uint32_t voxelCount) {
+        VkDeviceSize bytes = VkDeviceSize(scalarTypeSize(scalarType)) * voxelCount;
+        return (bytes + 3) & ~VkDeviceSize(3);
+    };
+
+    ScalarType getInputType() {return this->inputType;};
+    ScalarType getOutputType() {return this->outputType;};
+    uint32_t getVoxelCount() {return this->voxelCount;};
+    ComputeBuffer *getInput() {return &(this->input);};
+    ComputeBuffer *getOutput() {return &(this->output);};
+
+    void setThreshold(float threshold) {this->parameters.threshold = threshold;};
+    void setOutsideValue(float outsideValue) {this->parameters.outsideValue = outsideValue;};
+    // voxels that pass the threshold become value * scale + shift
+    void setRescale(float scale, float shift) {
+        this->parameters.scale = scale;
+        this->parameters.shift = shift;
+    };
+
+    void run();
+};
+
+inline void ThresholdFilter::run() {
+    uint32_t outputPerWord = 4 / scalarTypeSize(this->outputType);
+    VkCommandBuffer commandBuffer = this->commandSequence.begin();
+    this->pipeline.recordLinear(commandBuffer, groupCount(this->voxelCount, outputPerWord), 64,
+                                &(this->parameters));
+    this->commandSequence.barrier();
+    this->commandSequence.submitAndWait();
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Dispatch tables of the variants compiled from one kernel template,
+ * keyed by VTK scalar type and option flags.
+ */
+
+#ifndef __vudoVariants_h
+#define __vudoVariants_h
+
+#include <cctype>
+#include <map>
+#include <utility>
+
+#include "vudo.h"
+#include "vudoSPIRV.h"
+
+namespace vudo {
+
+/* The VTK scalar type ids (vtkType.h) that kernel templates are instantiated for */
+enum VTKScalarType : int32_t {
+    VTKUnsignedChar = 3,
+    VTKShort = 4,
+    VTKUnsignedShort = 5,
+    VTKFloat = 10
+};
+
+/* The type name used in Shaders/variants.txt and variant names, nullptr for other types */
+inline const char *variantTypeName(int32_t vtkScalarType) {
+    switch (vtkScalarType) {
+        case VTKUnsignedChar: return "uint8";
+        case VTKShort: return "int16";
+        case VTKUnsignedShort: return "uint16";
+        case VTKFloat: return "float32";
+        default: return nullptr;
+    }
+}
+
+/*
+The variants of one kernel template.  Option flags are bits in the order
+of optionNames, and a variant is named after its kernel, type and set
+flags: histogram_int16_masked is VTKShort with the MASKED bit.
+
+Variants compiled at build time are embedded under that name.  Others
+are compiled once by VudoLib/Variants.py and registered here with their
+SPIR-V path, so picking a variant when a volume arrives is a table
+lookup and never a compile.
+*/
+class KernelVariants {
+    protected:
+        std::string kernel;
+        std::vector<std::string> optionNames;
+        std::map<std::pair<int32_t, uint32_t>, std::string> paths;
+
+    public:
+        KernelVariants(const std::string &kernel, const std::vector<std::string> &optionNames = {}) {
+            this->kernel = kernel;
+            this->optionNames = optionNames;
+        }
+
+    const std::string &getKernel() {return this->kernel;};
+    uint32_t getOptionCount() {return uint32_t(this->optionNames.size());};
+    size_t getRegisteredCount() {return this->paths.size();};
+
+    // the option bit of a flag name, 0 if the template has no such flag
+    uint32_t getOptionBit(const std::string &optionName) {
+        for (size_t index = 0; index < this->optionNames.size(); ++index) {
+            if (this->optionNames[index] == optionName) {
+                return 1u << index;
+            }
+        }
+        return 0;
+    };
+
+    std::string getName(int32_t vtkScalarType, uint32_t options);
+    void registerVariant(int32_t vtkScalarType, uint32_t options, const std::string &path);
+    bool hasVariant(int32_t vtkScalarType, uint32_t options);
+    VkShaderModule createShaderModule(VkDevice device, int32_t vtkScalarType, uint32_t options);
+
+    // 8 and 16 bit variants read their voxels through 8/16-bit storage buffers
+    static bool isSupported(DeviceQueue *deviceQueue, int32_t vtkScalarType) {
+        if (vtkScalarType == VTKFloat) {
+            return true;
+        }
+        if (vtkScalarType == VTKUnsignedChar) {
+            return deviceQueue->hasStorageBuffer8Bit() && deviceQueue->hasShaderInt8();
+        }
+        if (vtkScalarType == VTKShort || vtkScalarType == VTKUnsignedShort) {
+            return deviceQueue->hasStorageBuffer16Bit() && deviceQueue->hasShaderInt16();
+        }
+        return false;
+    };
+};
+
+inline std::string KernelVariants::getName(int32_t vtkScalarType, uint32_t options) {
+    const char *typeName = variantTypeName(vtkScalarType);
+    if (!typeName) {
+        throw std::runtime_error(this->kernel + " has no variants for VTK scalar type " +
+                                 std::to_string(vtkScalarType));
+    }
+    std::string name = this->kernel + "_" + typeName;
+    for (size_t index = 0; index < this->optionNames.size(); ++index) {
+        if (options & (1u << index)) {
+            std::string flag = this->optionNames[index];
+            for (char &character : flag) {
+                character = char(std::tolower(static_cast<unsigned char>(character)));
+            }
+            name += "_" + flag;
+        }
+    }
+    return name;
+}
+
+inline void KernelVariants::registerVariant(int32_t vtkScalarType, uint32_t options, const std::string &path) {
+    this->paths[std::make_pair(vtkScalarType, options)] = path;
+}
+
+inline bool KernelVariants::hasVariant(int32_t vtkScalarType, uint32_t options) {
+    if (this->paths.count(std::make_pair(vtkScalarType, options))) {
+        return true;
+    }
+    return variantTypeName(vtkScalarType) && hasEmbeddedShader(this->getName(vtkScalarType, options));
+}
+
+inline VkShaderModule KernelVariants::createShaderModule(VkDevice device, int32_t vtkScalarType, uint32_t options) {
+    std::string name = this->getName(vtkScalarType, options);
+    auto entry = this->paths.find(std::make_pair(vtkScalarType, options));
+    if (entry != this->paths.end()) {
+        return vudo::createShaderModule(device, name, entry->second);
+    }
+    if (!hasEmbeddedShader(name)) {
+        throw std::runtime_error("The variant " + name + " was neither embedded nor generated");
+    }
+    return vudo::createShaderModule(device, name, "");
+}
+
+} // end of namespace vudo
+
+#endif
@@ -0,0 +1,621 @@
+/*
+ * Vudo
+ * Do things using Vulkan.
+ *
+ * Streaming NRRD and NIfTI-1 volume files a slab of slices at a time,
+ * so volumes can be processed without ever being whole in host memory.
+ */
+
+#ifndef __vudoVolumeFile_h
+#define __vudoVolumeFile_h
+
+#include "vudo.h"
+
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace vudo {
+
+/*
+What is needed to stream a volume's voxels and to write its geometry
+back out.  The geometry is in LPS like Slicer's: directions[axis] is
+the unit vector of the i, j or k axis, so a voxel's position is
+origin + sum(index[axis] * spacing[axis] * directions[axis]).
+*/
+struct VolumeFileInfo {
+    uint32_t dimensions[3] = {0, 0, 0};
+    ScalarType scalarType = Float32;
+    double spacing[3] = {1., 1., 1.};
+    double origin[3] = {0., 0., 0.};
+    double directions[3][3] = {{1., 0., 0.}, {0., 1., 0.}, {0., 0., 1.}};
+    bool bigEndian = false;
+    std::string dataPath; // the file holding the voxels, the header file unless detached
+    uint64_t dataOffset = 0; // byte offset of the first voxel in dataPath
+
+    uint64_t getSliceBytes() const {
+        return uint64_t(scalarTypeSize(this->scalarType)) * this->dimensions[0] * this->dimensions[1];
+    };
+    uint64_t getVolumeBytes() const {return getSliceBytes() * this->dimensions[2];};
+};
+
+enum VolumeFileFormat : uint32_t {
+    NRRDFormat = 0,
+    NIfTIFormat = 1
+};
+
+inline bool hostIsBigEndian() {
+    uint16_t probe = 1;
+    return *reinterpret_cast<uint8_t *>(&probe) == 0;
+}
+
+inline void swapBytes(void *voxels, uint32_t voxelBytes, uint64_t voxelCount) {
+    uint8_t *bytes = static_cast<uint8_t *>(voxels);
+    for (uint64_t voxel = 0; voxel < voxelCount; ++voxel, bytes += voxelBytes) {
+        std::reverse(bytes, bytes + voxelBytes);
+    }
+}
+
+/* .nii and .hdr are NIfTI-1, everything else (.nrrd, .nhdr) NRRD */
+inline VolumeFileFormat volumeFileFormat(const std::string &path) {
+    std::string lower = path;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (const char *suffix : {".nii", ".hdr"}) {
+        size_t length = strlen(suffix);
+        if (lower.size() >= length && lower.compare(lower.size() - length, length, suffix) == 0) {
+            return NIfTIFormat;
+        }
+    }
+    if (lower.size() >= 7 && lower.compare(lower.size() - 7, 7, ".nii.gz") == 0) {
+        throw std::runtime_error("compressed NIfTI can not be streamed: " + path);
+    }
+    return NRRDFormat;
+}
+
+// 64 bit file offsets on every platform
+inline int seekFile(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/*
+Where slices come from: a volume file read with stdio, or a memory
+mapped one (vudoMappedVolume.h).  readSlices returns them in host byte
+order.
+*/
+class VolumeSource {
+    public:
+        virtual ~VolumeSource() {}
+
+    virtual const VolumeFileInfo &getInfo() = 0;
+    // read sliceCount slices from firstSlice on into voxels
+    virtual void readSlices(uint32_t firstSlice, uint32_t sliceCount, void *voxels) = 0;
+};
+
+/*
+NIfTI-1 header fields by byte offset (nifti1.h); the 348 byte header is
+followed by 4 extension bytes in .nii files.
+*/
+namespace nifti {
+    const uint32_t HeaderSize = 348;
+    const uint32_t Dim = 40;
+    const uint32_t Datatype = 70;
+    const uint32_t Bitpix = 72;
+    const uint32_t Pixdim = 76;
+    const uint32_t VoxOffset = 108;
+    const uint32_t SclSlope = 112;
+    const uint32_t SclInter = 116;
+    const uint32_t XyztUnits = 123;
+    const uint32_t QformCode = 252;
+    const uint32_t SformCode = 254;
+    const uint32_t Quatern = 256; // b, c, d, then qoffset x, y, z
+    const uint32_t Srow = 280; // srow_x, srow_y, srow_z, 4 floats each
+    const uint32_t Magic = 344;
+
+    // datatype codes
+    inline int16_t datatype(ScalarType scalarType) {
+        const int16_t codes[] = {2, 256, 512, 4, 768, 8, 16};
+        if (scalarType > Float32) {
+            throw std::runtime_error("NIfTI files can not hold this scalar type");
+        }
+        return codes[scalarType];
+    }
+
+    inline ScalarType scalarType(int16_t datatype) {
+        switch (datatype) {
+            case 2: return UInt8;
+            case 256: return Int8;
+            case 4: return Int16;
+            case 512: return UInt16;
+            case 8: return Int32;
+            case 768: return UInt32;
+            case 16: return Float32;
+        }
+        throw std::runtime_error("unsupported NIfTI datatype " + std::to_string(datatype));
+    }
+} // end of namespace nifti
+
+/*
+Reads the header of a NRRD (attached or detached .nhdr) or NIfTI-1
+(.nii, or an .hdr/.img pair) volume, then any run of slices on demand.
+Only uncompressed (raw) data can be streamed; compressed files throw
+and should be converted first, e.g. by saving them from Slicer without
+compression.  Voxels are returned in host byte order.
+*/
+class VolumeFileReader : public VolumeSource {
+    protected:
+        std::string path;
+        VolumeFileFormat format;
+        VolumeFileInfo info;
+        FILE *data = nullptr;
+
+    public:
+        VolumeFileReader(const std::string &path) {
+            this->path = path;
+            this->format = volumeFileFormat(path);
+            if (this->format == NIfTIFormat) {
+                readNIfTIHeader();
+            } else {
+                readNRRDHeader();
+            }
+            this->data = fopen(this->info.dataPath.c_str(), "rb");
+            if (this->data == nullptr) {
+                throw std::runtime_error("Could not open volume data: " + this->info.dataPath);
+            }
+        }
+
+        virtual ~VolumeFileReader() {
+            if (this->data != nullptr) {
+                fclose(this->data);
+            }
+        }
+
+    const VolumeFileInfo &getInfo() override {return this->info;};
+    VolumeFileFormat getFormat() {return this->format;};
+
+    void readSlices(uint32_t firstSlice, uint32_t sliceCount, void *voxels) override;
+
+    protected:
+        void readNRRDHeader();
+        void readNIfTIHeader();
+        void setDirections(const double matrix[3][3], bool ras);
+};
+
+/* columns of matrix are the scaled axis vectors */
+inline void VolumeFileReader::setDirections(const double matrix[3][3], bool ras) {
+    for (int axis = 0; axis < 3; ++axis) {
+        double length = 0.;
+        for (int row = 0; row < 3; ++row) {
+            length += matrix[row][axis] * matrix[row][axis];
+        }
+        length = std::sqrt(length);
+        this->info.spacing[axis] = length > 0. ? length : 1.;
+        for (int row = 0; row < 3; ++row) {
+            double component = length > 0. ? matrix[row][axis] / length : (row == axis ? 1. : 0.);
+            this->info.directions[axis][row] = (ras && row < 2) ? -component : component;
+        }
+    }
+    if (ras) {
+        this->info.origin[0] = -this->info.origin[0];
+        this->info.origin[1] = -this->info.origin[1];
+    }
+}
+
+inline void VolumeFileReader::readNRRDHeader() {
+    std::ifstream header(this->path, std::ios::binary);
+    if (!header) {
+        throw std::runtime_error("Could not find or open file: " + this->path);
+    }
+    std::string line;
+    std::getline(header, line);
+    if (line.compare(0, 4, "NRRD") != 0) {
+        throw std::runtime_error("not a NRRD file: " + this->path);
+    }
+
+    std::string type, encoding = "raw", space, dataFile;
+    std::vector<uint32_t> sizes;
+    std::vector<double> spacings;
+    std::string spaceDirections, spaceOrigin;
+    long long byteSkip = 0;
+    uint32_t lineSkip = 0;
+    while (std::getline(header, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break; // the data follows the blank line
+        }
+        if (line[0] == '#') {
+            continue;
+        }
+        size_t separator = line.find(':');
+        if (separator == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, separator);
+        // key:=value are key/value pairs, not fields
+        if (separator + 1 < line.size() && line[separator + 1] == '=') {
+            continue;
+        }
+        std::string value = line.substr(separator + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        std::istringstream values(value);
+        if (key == "type") {
+            type = value;
+        } else if (key == "sizes") {
+            uint32_t size;
+            while (values >> size) {
+                sizes.push_back(size);
+            }
+        } else if (key == "spacings") {
+            double spacing;
+            while (values >> spacing) {
+                spacings.push_back(spacing);
+            }
+        } else if (key == "encoding") {
+            encoding = value;
+        } else if (key == "endian") {
+            this->info.bigEndian = value == "big";
+        } else if (key == "space") {
+            space = value;
+        } else if (key == "space directions") {
+            spaceDirections = value;
+        } else if (key == "space origin") {
+            spaceOrigin = value;
+        } else if (key == "byte skip") {
+            byteSkip = std::stoll(value);
+        } else if (key == "line skip") {
+            lineSkip = (uint32_t)std::stoul(value);
+        } else if (key == "data file" || key == "datafile") {
+            dataFile = value;
+        }
+    }
+
+    const char *types[][7] = {
+        {"uchar", "unsigned char", "uint8", "uint8_t", nullptr},
+        {"signed char", "int8", "int8_t", nullptr},
+        {"ushort", "unsigned short", "unsigned short int", "uint16", "uint16_t", nullptr},
+        {"short", "short int", "signed short", "signed short int", "int16", "int16_t", nullptr},
+        {"uint", "unsigned int", "uint32", "uint32_t", nullptr},
+        {"int", "signed int", "int32", "int32_t", nullptr},
+        {"float", nullptr},
+    };
+    bool known = false;
+    for (uint32_t scalarType = UInt8; scalarType <= Float32 && !known; ++scalarType) {
+        for (const char **name = types[scalarType]; *name != nullptr; ++name) {
+            if (type == *name) {
+                this->info.scalarType = ScalarType(scalarType);
+                known = true;
+                break;
+            }
+        }
+    }
+    if (!known) {
+        throw std::runtime_error("unsupported NRRD type '" + type + "' in " + this->path);
+    }
+    if (encoding != "raw") {
+        throw std::runtime_error("only raw NRRD encoding can be streamed, " + this->path + " is " + encoding);
+    }
+    if (sizes.size() < 2 || sizes.size() > 3) {
+        throw std::runtime_error("only 2D and 3D scalar NRRD volumes are supported: " + this->path);
+    }
+    for (size_t axis = 0; axis < 3; ++axis) {
+        this->info.dimensions[axis] = axis < sizes.size() ? sizes[axis] : 1;
+    }
+
+    // geometry, as (x,y,z) vectors or spacings
+    double matrix[3][3] = {{1., 0., 0.}, {0., 1., 0.}, {0., 0., 1.}};
+    for (size_t axis = 0; axis < 3; ++axis) {
+        matrix[axis][axis] = axis < spacings.size() && std::isfinite(spacings[axis]) ? spacings[axis] : 1.;
+    }
+    if (!spaceDirections.empty()) {
+        std::string numbers = spaceDirections;
+        for (char &character : numbers) {
+            if (character == '(' || character == ')' || character == ',') {
+                character = ' ';
+            }
+        }
+        std::istringstream vectors(numbers);
+        for (int axis = 0; axis < int(sizes.size()); ++axis) {
+            for (int row = 0; row < 3; ++row) {
+                vectors >> matrix[row][axis];
+            }
+        }
+    }
+    if (!spaceOrigin.empty()) {
+        sscanf(spaceOrigin.c_str(), " (%lf , %lf , %lf)",
+               &this->info.origin[0], &this->info.origin[1], &this->info.origin[2]);
+    }
+    bool ras = space == "right-anterior-superior" || space == "RAS";
+    setDirections(matrix, ras);
+
+    if (dataFile.empty()) {
+        this->info.dataPath = this->path;
+        this->info.dataOffset = (uint64_t)header.tellg();
+    } else {
+        if (dataFile.compare(0, 4, "LIST") == 0 || dataFile.find('%') != std::string::npos) {
+            throw std::runtime_error("multi-file NRRD data is not supported: " + this->path);
+        }
+        size_t slash = this->path.find_last_of("/\\");
+        bool absolute = dataFile[0] == '/' || (dataFile.size() > 1 && dataFile[1] == ':');
+        this->info.dataPath = (absolute || slash == std::string::npos) ? dataFile
+                            : this->path.substr(0, slash + 1) + dataFile;
+        this->info.dataOffset = 0;
+    }
+    if (lineSkip > 0) {
+        std::ifstream dataLines(this->info.dataPath, std::ios::binary);
+        dataLines.seekg((std::streamoff)this->info.dataOffset);
+        for (uint32_t skipped = 0; skipped < lineSkip; ++skipped) {
+            std::getline(dataLines, line);
+        }
+        this->info.dataOffset = (uint64_t)dataLines.tellg();
+    }
+    if (byteSkip == -1) {
+        // the data is at the end of the file
+        std::ifstream dataEnd(this->info.dataPath, std::ios::binary | std::ios::ate);
+        this->info.dataOffset = (uint64_t)dataEnd.tellg() - this->info.getVolumeBytes();
+    } else {
+        this->info.dataOffset += (uint64_t)byteSkip;
+    }
+}
+
+inline void VolumeFileReader::readNIfTIHeader() {
+    std::ifstream header(this->path, std::ios::binary);
+    char bytes[nifti::HeaderSize];
+    if (!header || !header.read(bytes, nifti::HeaderSize)) {
+        throw std::runtime_error("Could not read a NIfTI header from " + this->path);
+    }
+    int32_t headerSize;
+    memcpy(&headerSize, bytes, 4);
+    bool swap = headerSize != int32_t(nifti::HeaderSize);
+    if (swap) {
+        swapBytes(&headerSize, 4, 1);
+        if (headerSize != int32_t(nifti::HeaderSize)) {
+            throw std::runtime_error("not a NIfTI-1 file: " + this->path);
+        }
+    }
+    this->info.bigEndian = hostIsBigEndian() != swap;
+    auto field = [&](uint32_t offset, auto &value) {
+        memcpy(&value, bytes + offset, sizeof(value));
+        if (swap) {
+            swapBytes(&value, sizeof(value), 1);
+        }
+    };
+
+    int16_t dim[8], datatype, qformCode, sformCode;
+    float pixdim[8], voxOffset, slope, intercept, quatern[6], srow[3][4];
+    for (int index = 0; index < 8; ++index) {
+        field(nifti::Dim + 2 * index, dim[index]);
+        field(nifti::Pixdim + 4 * index, pixdim[index]);
+    }
+    field(nifti::Datatype, datatype);
+    field(nifti::VoxOffset, voxOffset);
+    field(nifti::SclSlope, slope);
+    field(nifti::SclInter, intercept);
+    field(nifti::QformCode, qformCode);
+    field(nifti::SformCode, sformCode);
+    for (int index = 0; index < 6; ++index) {
+        field(nifti::Quatern + 4 * index, quatern[index]);
+    }
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            field(nifti::Srow + 16 * row + 4 * column, srow[row][column]);
+        }
+    }
+
+    if (dim[0] < 2 || dim[0] > 4 || (dim[0] == 4 && dim[4] > 1)) {
+        throw std::runtime_error("only 2D and 3D scalar NIfTI volumes are supported: " + this->path);
+    }
+    if ((slope != 0.f && slope != 1.f) || intercept != 0.f) {
+        throw std::runtime_error("scaled NIfTI values (scl_slope, scl_inter) are not supported: " + this->path);
+    }
+    this->info.scalarType = nifti::scalarType(datatype);
+    for (int axis = 0; axis < 3; ++axis) {
+        this->info.dimensions[axis] = axis < dim[0] ? (uint32_t)dim[axis + 1] : 1;
+    }
+
+    // sform, else qform, else just the spacing; both are in RAS
+    double matrix[3][3] = {{1., 0., 0.}, {0., 1., 0.}, {0., 0., 1.}};
+    if (sformCode > 0) {
+        for (int row = 0; row < 3; ++row) {
+            for (int axis = 0; axis < 3; ++axis) {
+                matrix[row][axis] = srow[row][axis];
+            }
+            this->info.origin[row] = srow[row][3];
+        }
+    } else if (qformCode > 0) {
+        double b = quatern[0], c = quatern[1], d = quatern[2];
+        double a = std::sqrt(std::max(0., 1. - (b*b + c*c + d*d)));
+        double rotation[3][3] = {
+            {a*a + b*b - c*c - d*d, 2*b*c - 2*a*d, 2*b*d + 2*a*c},
+            {2*b*c + 2*a*d, a*a + c*c - b*b - d*d, 2*c*d - 2*a*b},
+            {2*b*d - 2*a*c, 2*c*d + 2*a*b, a*a + d*d - c*c - b*b}};
+        double qfac = pixdim[0] < 0.f ? -1. : 1.;
+        for (int row = 0; row < 3; ++row) {
+            for (int axis = 0; axis < 3; ++axis) {
+                matrix[row][axis] = rotation[row][axis] * pixdim[axis + 1] * (axis == 2 ? qfac : 1.);
+            }
+            this->info.origin[row] = quatern[3 + row];
+        }
+    } else {
+        for (int axis = 0; axis < 3; ++axis) {
+            matrix[axis][axis] = pixdim[axis + 1] > 0.f ? pixdim[axis + 1] : 1.;
+        }
+    }
+    setDirections(matrix, true);
+
+    if (memcmp(bytes + nifti::Magic, "n+1", 4) == 0) {
+        this->info.dataPath = this->path;
+        this->info.dataOffset = (uint64_t)voxOffset;
+    } else if (memcmp(bytes + nifti::Magic, "ni1", 4) == 0) {
+        this->info.dataPath = this->path.substr(0, this->path.size() - 4) + ".img";
+        this->info.dataOffset = (uint64_t)voxOffset;
+    } else {
+        throw std::runtime_error("not a NIfTI-1 file: " + this->path);
+    }
+}
+
+inline void VolumeFileReader::readSlices(uint32_t firstSlice, uint32_t sliceCount, void *voxels) {
+    if (uint64_t(firstSlice) + sliceCount > this->info.dimensions[2]) {
+        throw std::runtime_error("reading past the last slice of " + this->path);
+    }
+    uint64_t sliceBytes = this->info.getSliceBytes();
+    uint64_t bytes = sliceBytes * sliceCount;
+    if (seekFile(this->data, this->info.dataOffset + sliceBytes * firstSlice) != 0 ||
+        fread(voxels, 1, bytes, this->data) != bytes) {
+        throw std::runtime_error("Could not read slices from " + this->info.dataPath);
+    }
+    uint32_t voxelBytes = scalarTypeSize(this->info.scalarType);
+    if (voxelBytes > 1 && this->info.bigEndian != hostIsBigEndian()) {
+        swapBytes(voxels, voxelBytes, bytes / voxelBytes);
+    }
+}
+
+/*
+Writes the header of a volume with info's dimensions, type and
+geometry, then takes its slices in order, so a result can be written
+as it is computed.  NRRD output is attached raw data, NIfTI output is
+a single .nii with an sform.  Both are in host byte order.
+*/
+class VolumeFileWriter {
+    protected:
+        std::string path;
+        VolumeFileInfo info;
+        FILE *file = nullptr;
+        uint32_t writtenSlices = 0;
+
+    public:
+        VolumeFileWriter(const std::string &path, const VolumeFileInfo &info) {
+            this->path = path;
+            this->info = info;
+            this->info.bigEndian = hostIsBigEndian();
+            this->file = fopen(path.c_str(), "wb");
+            if (this->file == nullptr) {
+                throw std::runtime_error("Could not open file for writing: " + path);
+            }
+            if (volumeFileFormat(path) == NIfTIFormat) {
+                writeNIfTIHeader();
+            } else {
+                writeNRRDHeader();
+            }
+        }
+
+        virtual ~VolumeFileWriter() {
+            if (this->file != nullptr) {
+                fclose(this->file);
+            }
+        }
+
+    const VolumeFileInfo &getInfo() {return this->info;};
+    uint32_t getWrittenSlices() {return this->writtenSlices;};
+
+    // append sliceCount slices of voxels in host byte order
+    void writeSlices(uint32_t sliceCount, const void *voxels);
+    // flush and close, throwing if the file is incomplete or could not be written
+    void close();
+
+    protected:
+        void writeNRRDHeader();
+        void writeNIfTIHeader();
+};
+
+inline void VolumeFileWriter::writeNRRDHeader() {
+    const char *types[] = {"uint8", "int8", "uint16", "int16", "uint32", "int32", "float"};
+    if (this->info.scalarType > Float32) {
+        throw std::runtime_error("NRRD output can not hold this scalar type");
+    }
+    fprintf(this->file, "NRRD0004\n");
+    fprintf(this->file, "# Complete NRRD file format specification at:\n");
+    fprintf(this->file, "# http://teem.sourceforge.net/nrrd/format.html\n");
+    fprintf(this->file, "type: %s\n", types[this->info.scalarType]);
+    fprintf(this->file, "dimension: 3\n");
+    fprintf(this->file, "space: left-posterior-superior\n");
+    fprintf(this->file, "sizes: %u %u %u\n", this->info.dimensions[0], this->info.dimensions[1], this->info.dimensions[2]);
+    fprintf(this->file, "space directions:");
+    for (int axis = 0; axis < 3; ++axis) {
+        const double *direction = this->info.directions[axis];
+        double spacing = this->info.spacing[axis];
+        fprintf(this->file, " (%.17g,%.17g,%.17g)", direction[0] * spacing, direction[1] * spacing, direction[2] * spacing);
+    }
+    fprintf(this->file, "\nkinds: domain domain domain\n");
+    if (scalarTypeSize(this->info.scalarType) > 1) {
+        fprintf(this->file, "endian: %s\n", this->info.bigEndian ? "big" : "little");
+    }
+    fprintf(this->file, "encoding: raw\n");
+    fprintf(this->file, "space origin: (%.17g,%.17g,%.17g)\n\n", this->info.origin[0], this->info.origin[1], this->info.origin[2]);
+}
+
+inline void VolumeFileWriter::writeNIfTIHeader() {
+    char bytes[nifti::HeaderSize + 4] = {};
+    auto field = [&](uint32_t offset, auto value) {
+        memcpy(bytes + offset, &value, sizeof(value));
+    };
+    field(0, int32_t(nifti::HeaderSize));
+    int16_t dim[8] = {3, int16_t(this->info.dimensions[0]), int16_t(this->info.dimensions[1]),
+                      int16_t(this->info.dimensions[2]), 1, 1, 1, 1};
+    for (int axis = 0; axis < 3; ++axis) {
+        if (this->info.dimensions[axis] > 32767) {
+            throw std::runtime_error("NIfTI-1 dimensions are at most 32767");
+        }
+    }
+    float pixdim[8] = {1.f, float(this->info.spacing[0]), float(this->info.spacing[1]), float(this->info.spacing[2]),
+                       0.f, 0.f, 0.f, 0.f};
+    for (int index = 0; index < 8; ++index) {
+        field(nifti::Dim + 2 * index, dim[index]);
+        field(nifti::Pixdim + 4 * index, pixdim[index]);
+    }
+    field(nifti::Datatype, nifti::datatype(this->info.scalarType));
+    field(nifti::Bitpix, int16_t(8 * scalarTypeSize(this->info.scalarType)));
+    field(nifti::VoxOffset, float(nifti::HeaderSize + 4));
+    field(nifti::SclSlope, 1.f);
+    field(nifti::XyztUnits, uint8_t(2)); // millimeters
+    field(nifti::SformCode, int16_t(1)); // scanner coordinates
+    // LPS to RAS
+    for (int row = 0; row < 3; ++row) {
+        float sign = row < 2 ? -1.f : 1.f;
+        for (int axis = 0; axis < 3; ++axis) {
+            field(nifti::Srow + 16 * row + 4 * axis, sign * float(this->info.directions[axis][row] * this->info.spacing[axis]));
+        }
+        field(nifti::Srow + 16 * row + 12, sign * float(this->info.origin[row]));
+    }
+    memcpy(bytes + nifti::Magic, "n+1", 4);
+    if (fwrite(bytes, 1, sizeof(bytes), this->file) != sizeof(bytes)) {
+        throw std::runtime_error("Could not write the NIfTI header of " + this->path);
+    }
+}
+
+inline void VolumeFileWriter::writeSlices(uint32_t sliceCount, const void *voxels) {
+    if (uint64_t(this->writtenSlices) + sliceCount > this->info.dimensions[2]) {
+        throw std::runtime_error("writing past the last slice of " + this->path);
+    }
+    uint64_t bytes = this->info.getSliceBytes() * sliceCount;
+    if (fwrite(voxels, 1, bytes, this->file) != bytes) {
+        throw std::runtime_error("Could not write slices to " + this->path);
+    }
+    this->writtenSlices += sliceCount;
+}
+
+inline void VolumeFileWriter::close() {
+    if (this->file == nullptr) {
+        return;
+    }
+    int closed = fclose(this->file);
+    this->file = nullptr;
+    if (closed != 0) {
+        throw std::runtime_error("Could not finish writing " + this->path);
+    }
+    if (this->writtenSlices != this->info.dimensions[2]) {
+        throw std::runtime_error(this->path + " was closed after " + std::to_string(this->writtenSlices) +
+                                 " of " + std::to_string(this->info.dimensions[2]) + " slices");
+    }
+}
+
+} // end of namespace vudo
+
+#endif